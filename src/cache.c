@@ -0,0 +1,302 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+
+#define CACHE_MAGIC "SMAABIN1"
+
+typedef struct CacheHeader {
+    char magic[8];
+    uint64_t key;
+    uint32_t format;
+    uint32_t length;
+} CacheHeader;
+
+// Set up by the first SMAA instance, the rest of this file may be used
+// from any thread with a context current
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int cache_initialized = 0;
+static int cache_enabled = 0;
+static uint64_t cache_seed;
+static char cache_dir[4096];
+
+static int cache_hits, cache_misses, cache_rejected;
+static double cache_hit_ms, cache_miss_ms;
+
+static
+uint64_t cache_hash(uint64_t hash, const void *data, size_t length)
+{
+    // FNV-1a
+    const unsigned char *bytes = data;
+    for(size_t i = 0; i < length; i++) {
+	hash ^= bytes[i];
+	hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static
+uint64_t cache_hash_string(uint64_t hash, const char *string)
+{
+    if(!string) {
+	string = "";
+    }
+    // Include the terminator so ("ab", "c") and ("a", "bc") differ
+    return cache_hash(hash, string, strlen(string) + 1);
+}
+
+static
+int cache_mkdir(const char *path)
+{
+    if(mkdir(path, 0755) && errno != EEXIST) {
+	fprintf(stderr, "with_smaa: cannot create %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+    return 1;
+}
+
+static
+int cache_find_dir()
+{
+    const char *xdg = getenv("XDG_CACHE_HOME");
+    const char *home = getenv("HOME");
+
+    if(xdg && xdg[0]) {
+	if(!cache_mkdir(xdg)) {
+	    return 0;
+	}
+	snprintf(cache_dir, sizeof(cache_dir), "%s/with_smaa", xdg);
+    } else if(home && home[0]) {
+	snprintf(cache_dir, sizeof(cache_dir), "%s/.cache", home);
+	if(!cache_mkdir(cache_dir)) {
+	    return 0;
+	}
+	snprintf(cache_dir, sizeof(cache_dir), "%s/.cache/with_smaa", home);
+    } else {
+	return 0;
+    }
+
+    return cache_mkdir(cache_dir);
+}
+
+static
+void cache_path(char *path, size_t size, uint64_t key)
+{
+    snprintf(path, size, "%s/%016llx.bin", cache_dir, (unsigned long long)key);
+}
+
+static
+void cache_setup(const unsigned char *source, unsigned int source_length)
+{
+    const char *env = getenv("WITH_SMAA_CACHE");
+    if(env && !strcmp(env, "0")) {
+	fprintf(stderr, "with_smaa: program cache disabled\n");
+	return;
+    }
+
+    GLint major, minor, formats = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &major);
+    glGetIntegerv(GL_MINOR_VERSION, &minor);
+    if((major == 4 && minor >= 1) || major > 4) {
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+    } else {
+	GLint count;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for(int i = 0; i < count; i++) {
+	    if(!strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), "GL_ARB_get_program_binary")) {
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		break;
+	    }
+	}
+    }
+
+    if(formats <= 0) {
+	fprintf(stderr, "with_smaa: driver has no program binary formats, not caching\n");
+	return;
+    }
+
+    if(!cache_find_dir()) {
+	return;
+    }
+
+    // GL_VERSION contains the driver build for most drivers (e.g. "Mesa
+    // 23.1.2", "NVIDIA 535.86.05"), so an update invalidates the cache.
+    uint64_t seed = 0xcbf29ce484222325ULL;
+    seed = cache_hash_string(seed, (const char*)glGetString(GL_VENDOR));
+    seed = cache_hash_string(seed, (const char*)glGetString(GL_RENDERER));
+    seed = cache_hash_string(seed, (const char*)glGetString(GL_VERSION));
+    seed = cache_hash_string(seed, (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
+    seed = cache_hash(seed, source, source_length);
+    cache_seed = seed;
+
+    cache_enabled = 1;
+    fprintf(stderr, "with_smaa: program cache at %s\n", cache_dir);
+}
+
+internal
+void smaa_cache_init(const unsigned char *source, unsigned int source_length)
+{
+    pthread_mutex_lock(&cache_mutex);
+    if(!cache_initialized) {
+	cache_initialized = 1;
+	cache_setup(source, source_length);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+internal
+uint64_t smaa_cache_key(const char **parts, int count)
+{
+    uint64_t key = cache_seed;
+    for(int i = 0; i < count; i++) {
+	key = cache_hash_string(key, parts[i]);
+    }
+    return key;
+}
+
+internal
+GLuint smaa_cache_load(uint64_t key)
+{
+    if(!cache_enabled) {
+	return 0;
+    }
+
+    double start = smaa_time_ms();
+
+    char path[4200];
+    cache_path(path, sizeof(path), key);
+
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+	return 0;
+    }
+
+    CacheHeader header;
+    void *binary = 0;
+    GLuint program = 0;
+
+    if(fread(&header, sizeof(header), 1, file) != 1
+       || memcmp(header.magic, CACHE_MAGIC, sizeof(header.magic))
+       || header.key != key) {
+	goto rejected;
+    }
+
+    binary = malloc(header.length);
+    if(!binary || fread(binary, 1, header.length, file) != header.length) {
+	goto rejected;
+    }
+
+    program = glCreateProgram();
+    glProgramBinary(program, header.format, binary, header.length);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if(!status) {
+	// Usually a driver update that kept the version string
+	glDeleteProgram(program);
+	program = 0;
+	goto rejected;
+    }
+
+    free(binary);
+    fclose(file);
+
+    double time = smaa_time_ms() - start;
+    pthread_mutex_lock(&cache_mutex);
+    cache_hits++;
+    cache_hit_ms += time;
+    pthread_mutex_unlock(&cache_mutex);
+    fprintf(stderr, "with_smaa: program cache hit %016llx (%.1f ms)\n",
+	    (unsigned long long)key, time);
+    return program;
+
+rejected:
+    free(binary);
+    fclose(file);
+    unlink(path);
+    __atomic_fetch_add(&cache_rejected, 1, __ATOMIC_RELAXED);
+    fprintf(stderr, "with_smaa: program cache entry %016llx rejected\n", (unsigned long long)key);
+    return 0;
+}
+
+internal
+void smaa_cache_prepare(GLuint program)
+{
+    if(cache_enabled) {
+	glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+}
+
+internal
+void smaa_cache_store(uint64_t key, GLuint program, double start)
+{
+    if(!cache_enabled) {
+	return;
+    }
+
+    GLint length = 0;
+    glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+    if(length <= 0) {
+	return;
+    }
+
+    CacheHeader header;
+    memcpy(header.magic, CACHE_MAGIC, sizeof(header.magic));
+    header.key = key;
+    header.length = length;
+
+    void *binary = malloc(length);
+    if(!binary) {
+	return;
+    }
+    GLenum format;
+    glGetProgramBinary(program, length, 0, &format, binary);
+    header.format = format;
+
+    // Write to a temporary file first, so concurrently starting
+    // instances never see a partial entry. Share groups in the same
+    // process may be storing the same program.
+    static unsigned serial;
+    char path[4200], tmp_path[4300];
+    cache_path(path, sizeof(path), key);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%u.tmp", path, (int)getpid(),
+	     __atomic_fetch_add(&serial, 1, __ATOMIC_RELAXED));
+
+    FILE *file = fopen(tmp_path, "wb");
+    if(file) {
+	int ok = fwrite(&header, sizeof(header), 1, file) == 1
+	    && fwrite(binary, 1, length, file) == (size_t)length;
+	ok = !fclose(file) && ok;
+	if(!ok || rename(tmp_path, path)) {
+	    unlink(tmp_path);
+	}
+    }
+    free(binary);
+
+    double time = smaa_time_ms() - start;
+    pthread_mutex_lock(&cache_mutex);
+    cache_misses++;
+    cache_miss_ms += time;
+    pthread_mutex_unlock(&cache_mutex);
+    fprintf(stderr, "with_smaa: program cache miss %016llx (%.1f ms)\n",
+	    (unsigned long long)key, time);
+}
+
+internal
+void smaa_cache_report(void)
+{
+    if(!cache_enabled) {
+	return;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    fprintf(stderr, "with_smaa: program cache: %d hits (%.1f ms), %d misses (%.1f ms), %d rejected\n",
+	    cache_hits, cache_hit_ms, cache_misses, cache_miss_ms, cache_rejected);
+    pthread_mutex_unlock(&cache_mutex);
+}
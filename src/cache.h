@@ -0,0 +1,32 @@
+
+#ifndef WITH_SMAA_CACHE_H
+#define WITH_SMAA_CACHE_H
+
+#include <stdint.h>
+
+#include "smaa.h"
+
+// Persistent cache of linked program binaries, stored as one file per
+// program under $XDG_CACHE_HOME/with_smaa. Keys cover the driver
+// (vendor, renderer, version strings), the SMAA source and everything
+// passed to smaa_cache_key(), i.e. settings and shader mains.
+
+// Call once with a current context before any other smaa_cache_* call.
+// source identifies the SMAA source, e.g. smaa_source_id of smaa_shader.h.
+internal void smaa_cache_init(const unsigned char *source, unsigned int source_length);
+
+internal uint64_t smaa_cache_key(const char **parts, int count);
+
+// Returns a linked program, or 0 if there is no (usable) cached binary.
+internal GLuint smaa_cache_load(uint64_t key);
+
+// To be called on a freshly created program before it is linked.
+internal void smaa_cache_prepare(GLuint program);
+
+// Stores the binary of a successfully linked program. start is the
+// smaa_time_ms() at which building the program began.
+internal void smaa_cache_store(uint64_t key, GLuint program, double start);
+
+internal void smaa_cache_report(void);
+
+#endif
@@ -0,0 +1,368 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "smaa.h"
+
+typedef struct CaptureItem {
+    SMAACaptureFrame frame;
+    // Color, then depth
+    uint8_t *data;
+    size_t color_size;
+    size_t depth_size;
+} CaptureItem;
+
+// The writer and the file, shared by all instances
+static pthread_mutex_t capture_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t capture_cond = PTHREAD_COND_INITIALIZER;
+static int capture_started = 0;
+static int capture_fd = -1;
+static unsigned capture_interval = 1;
+static double capture_start_ms;
+static SMAACaptureHeader capture_header;
+// Where the next frame goes
+static uint64_t capture_end;
+
+// With capture_mutex held. Frames are counted as queued before they are
+// copied, so no more than frame_capacity are ever queued.
+static CaptureItem capture_queue[SMAA_CAPTURE_QUEUE];
+static unsigned capture_head;
+static unsigned capture_tail;
+static unsigned capture_queued;
+static unsigned capture_skipped;
+
+static
+uint64_t capture_align(uint64_t offset)
+{
+    return (offset + SMAA_CAPTURE_ALIGN - 1) & ~(uint64_t)(SMAA_CAPTURE_ALIGN - 1);
+}
+
+static
+int capture_pwrite(const void *data, size_t size, uint64_t offset)
+{
+    const uint8_t *p = data;
+    while(size) {
+	ssize_t r = pwrite(capture_fd, p, size, offset);
+	if(r < 0 && errno == EINTR) {
+	    continue;
+	}
+	if(r <= 0) {
+	    return 0;
+	}
+	p += r;
+	size -= r;
+	offset += r;
+    }
+    return 1;
+}
+
+// Frame, then its index entry, then the count, so readers never see a
+// frame before its data
+static
+int capture_write(CaptureItem *item, uint32_t index)
+{
+    item->frame.color_offset = capture_end;
+    capture_end = capture_align(capture_end + item->color_size);
+    if(item->depth_size) {
+	item->frame.depth_offset = capture_end;
+	capture_end = capture_align(capture_end + item->depth_size);
+    }
+
+    uint64_t entry = capture_header.index_offset + (uint64_t)index * sizeof(SMAACaptureFrame);
+    uint32_t count = index + 1;
+    return capture_pwrite(item->data, item->color_size, item->frame.color_offset)
+	&& (!item->depth_size
+	    || capture_pwrite(item->data + item->color_size, item->depth_size, item->frame.depth_offset))
+	&& capture_pwrite(&item->frame, sizeof(item->frame), entry)
+	&& capture_pwrite(&count, sizeof(count), offsetof(SMAACaptureHeader, frame_count));
+}
+
+static
+void *capture_thread(void *arg)
+{
+    (void)arg;
+
+    for(uint32_t index = 0; index < capture_header.frame_capacity; index++) {
+	pthread_mutex_lock(&capture_mutex);
+	while(capture_head == capture_tail) {
+	    pthread_cond_wait(&capture_cond, &capture_mutex);
+	}
+	CaptureItem item = capture_queue[capture_tail % SMAA_CAPTURE_QUEUE];
+	pthread_mutex_unlock(&capture_mutex);
+
+	int ok = capture_write(&item, index);
+	free(item.data);
+
+	pthread_mutex_lock(&capture_mutex);
+	capture_tail++;
+	unsigned skipped = capture_skipped;
+	pthread_mutex_unlock(&capture_mutex);
+
+	if(!ok) {
+	    fprintf(stderr, "with_smaa: cannot write the capture: %s\n", strerror(errno));
+	    break;
+	}
+	if(index + 1 == capture_header.frame_capacity) {
+	    fprintf(stderr, "with_smaa: captured %u frames, %u skipped\n", index + 1, skipped);
+	}
+    }
+
+    close(capture_fd);
+    capture_fd = -1;
+    return 0;
+}
+
+// Creates the file with an empty index and starts the writer
+static
+int capture_start(const char *path)
+{
+    const char *frames = getenv("WITH_SMAA_CAPTURE_FRAMES");
+    const char *interval = getenv("WITH_SMAA_CAPTURE_INTERVAL");
+    uint32_t capacity = frames && atoi(frames) > 0 ? atoi(frames) : 300;
+    capture_interval = interval && atoi(interval) > 0 ? atoi(interval) : 1;
+
+    capture_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(capture_fd < 0) {
+	fprintf(stderr, "with_smaa: cannot open %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+
+    memset(&capture_header, 0, sizeof(capture_header));
+    memcpy(capture_header.magic, SMAA_CAPTURE_MAGIC, sizeof(capture_header.magic));
+    capture_header.version = SMAA_CAPTURE_VERSION;
+    capture_header.frame_capacity = capacity;
+    capture_header.index_offset = capture_align(sizeof(capture_header));
+    capture_header.time = time(0);
+    snprintf(capture_header.application, sizeof(capture_header.application), "%s",
+	     program_invocation_short_name);
+    const char *renderer = (const char*)glGetString(GL_RENDERER);
+    snprintf(capture_header.renderer, sizeof(capture_header.renderer), "%s", renderer ? renderer : "");
+    capture_end = capture_align(capture_header.index_offset + (uint64_t)capacity * sizeof(SMAACaptureFrame));
+
+    // Zeroes up to the first frame
+    if(!capture_pwrite(&capture_header, sizeof(capture_header), 0) || ftruncate(capture_fd, capture_end)) {
+	fprintf(stderr, "with_smaa: cannot write %s: %s\n", path, strerror(errno));
+	close(capture_fd);
+	capture_fd = -1;
+	return 0;
+    }
+
+    pthread_t thread;
+    pthread_attr_t attributes;
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    int r = pthread_create(&thread, &attributes, capture_thread, 0);
+    pthread_attr_destroy(&attributes);
+    if(r) {
+	fprintf(stderr, "with_smaa: cannot start capture thread: %s\n", strerror(r));
+	close(capture_fd);
+	capture_fd = -1;
+	return 0;
+    }
+
+    capture_start_ms = smaa_time_ms();
+    fprintf(stderr, "with_smaa: capturing %u frames, one in %u, to %s\n", capacity, capture_interval, path);
+    return 1;
+}
+
+internal
+void smaa_capture_init(SMAACapture *capture, int sync)
+{
+    memset(capture, 0, sizeof(*capture));
+
+    const char *path = getenv("WITH_SMAA_CAPTURE");
+    if(!path || !path[0]) {
+	return;
+    }
+    if(!sync) {
+	fprintf(stderr, "with_smaa: no fences, capture disabled\n");
+	return;
+    }
+
+    pthread_mutex_lock(&capture_mutex);
+    if(!capture_started) {
+	capture_started = capture_start(path) ? 1 : -1;
+    }
+    capture->enabled = capture_started > 0;
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+// Hands the frame in the slot's buffer to the writer
+static
+void capture_collect(SMAACaptureSlot *slot)
+{
+    size_t color_size = (size_t)slot->width * slot->height * 4;
+    size_t depth_size = slot->depth ? color_size : 0;
+
+    pthread_mutex_lock(&capture_mutex);
+    int full = capture_queued - capture_tail >= SMAA_CAPTURE_QUEUE
+	|| capture_queued >= capture_header.frame_capacity;
+    capture_skipped += full && capture_queued < capture_header.frame_capacity;
+    capture_queued += !full;
+    pthread_mutex_unlock(&capture_mutex);
+    if(full) {
+	return;
+    }
+
+    // The copy is the price of never keeping a buffer mapped across frames
+    uint8_t *data = malloc(color_size + depth_size);
+    const uint8_t *pixels = 0;
+    if(data) {
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+	pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, color_size + depth_size, GL_MAP_READ_BIT);
+    }
+    if(!pixels) {
+	free(data);
+	pthread_mutex_lock(&capture_mutex);
+	capture_queued--;
+	pthread_mutex_unlock(&capture_mutex);
+	return;
+    }
+    memcpy(data, pixels, color_size + depth_size);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+    CaptureItem item = {
+	.frame = {
+	    .width = slot->width,
+	    .height = slot->height,
+	    .number = slot->number,
+	    .time_ms = slot->time_ms,
+	},
+	.data = data,
+	.color_size = color_size,
+	.depth_size = depth_size,
+    };
+
+    pthread_mutex_lock(&capture_mutex);
+    capture_queue[capture_head % SMAA_CAPTURE_QUEUE] = item;
+    capture_head++;
+    pthread_cond_signal(&capture_cond);
+    pthread_mutex_unlock(&capture_mutex);
+}
+
+static
+void capture_read(SMAACaptureSlot *slot, GLuint fbo, const SMAARect *rect, int depth)
+{
+    GLsizeiptr color_size = (GLsizeiptr)rect->width * rect->height * 4;
+    GLsizeiptr size = depth ? color_size * 2 : color_size;
+
+    if(!slot->buffer) {
+	glGenBuffers(1, &slot->buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->buffer);
+    if(slot->size != size) {
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+	slot->size = size;
+    }
+
+    GLint read_fbo;
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+    glReadPixels(rect->x, rect->y, rect->width, rect->height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    if(depth) {
+	glReadPixels(rect->x, rect->y, rect->width, rect->height, GL_DEPTH_COMPONENT, GL_FLOAT,
+		     (void*)color_size);
+    }
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot->width = rect->width;
+    slot->height = rect->height;
+    slot->depth = depth;
+}
+
+internal
+void smaa_capture_frame(SMAACapture *capture, GLuint fbo, const SMAARect *rect, int depth)
+{
+    if(!capture->enabled) {
+	return;
+    }
+    unsigned frame = capture->frame++;
+
+    // Neither buffers nor pixel storage modes the game left set may
+    // affect the transfers
+    GLint pack_buffer, pack_alignment, pack_row_length, pack_skip_rows, pack_skip_pixels;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &pack_row_length);
+    glGetIntegerv(GL_PACK_SKIP_ROWS, &pack_skip_rows);
+    glGetIntegerv(GL_PACK_SKIP_PIXELS, &pack_skip_pixels);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+
+    // Oldest first, so frames are written in order
+    SMAACaptureSlot *free_slot = 0;
+    for(;;) {
+	SMAACaptureSlot *oldest = 0;
+	for(int i = 0; i < SMAA_CAPTURE_BUFFERS; i++) {
+	    SMAACaptureSlot *slot = &capture->slots[i];
+	    if(slot->fence && (!oldest || slot->number < oldest->number)) {
+		oldest = slot;
+	    }
+	}
+	if(!oldest) {
+	    break;
+	}
+	GLenum status = glClientWaitSync(oldest->fence, 0, 0);
+	if(status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED) {
+	    break;
+	}
+	glDeleteSync(oldest->fence);
+	oldest->fence = 0;
+	capture_collect(oldest);
+    }
+    for(int i = 0; i < SMAA_CAPTURE_BUFFERS && !free_slot; i++) {
+	if(!capture->slots[i].fence) {
+	    free_slot = &capture->slots[i];
+	}
+    }
+
+    pthread_mutex_lock(&capture_mutex);
+    int done = capture_queued >= capture_header.frame_capacity;
+    int wanted = !done && frame % capture_interval == 0;
+    capture_skipped += wanted && !free_slot;
+    pthread_mutex_unlock(&capture_mutex);
+
+    // Nothing left to read or collect
+    if(done && free_slot) {
+	int in_flight = 0;
+	for(int i = 0; i < SMAA_CAPTURE_BUFFERS; i++) {
+	    in_flight |= capture->slots[i].fence != 0;
+	}
+	capture->enabled = in_flight;
+    }
+
+    if(wanted && free_slot && rect->width > 0 && rect->height > 0) {
+	free_slot->number = frame;
+	free_slot->time_ms = smaa_time_ms() - capture_start_ms;
+	capture_read(free_slot, fbo, rect, depth);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+    glPixelStorei(GL_PACK_ROW_LENGTH, pack_row_length);
+    glPixelStorei(GL_PACK_SKIP_ROWS, pack_skip_rows);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, pack_skip_pixels);
+}
+
+internal
+void smaa_capture_destroy(SMAACapture *capture, int current)
+{
+    for(int i = 0; i < SMAA_CAPTURE_BUFFERS; i++) {
+	SMAACaptureSlot *slot = &capture->slots[i];
+	if(current && slot->fence) {
+	    glDeleteSync(slot->fence);
+	}
+	slot->fence = 0;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef WITH_SMAA_CAPTURE_H
+#define WITH_SMAA_CAPTURE_H
+
+// Include smaa.h instead, which needs SMAACapture itself
+
+// Frames of a game as SMAA gets them, for smaa_replay to run SMAA on
+// again later. Enabled by WITH_SMAA_CAPTURE, the file to write.
+// WITH_SMAA_CAPTURE_FRAMES (default 300) frames are captured, one every
+// WITH_SMAA_CAPTURE_INTERVAL (default 1) frames.
+//
+// The frame, and the depth buffer if there is one, is read into one of
+// SMAA_CAPTURE_BUFFERS pixel pack buffers and picked up once its fence
+// is signaled, frames later. If all buffers are still in flight the
+// frame is skipped rather than waited for. A thread writes the frames,
+// frames that would queue up more than SMAA_CAPTURE_QUEUE are skipped
+// too.
+//
+// The file is a header, an index of SMAACaptureFrame for the frames to
+// come and the frames themselves, every part at an offset aligned to
+// SMAA_CAPTURE_ALIGN, so it can be mapped and the frames used in place.
+// frame_count is updated after each frame, so a capture cut short is
+// still valid.
+
+#define SMAA_CAPTURE_MAGIC "SMAACAP\n"
+#define SMAA_CAPTURE_VERSION 1
+#define SMAA_CAPTURE_ALIGN 4096
+
+#define SMAA_CAPTURE_BUFFERS 3
+#define SMAA_CAPTURE_QUEUE 4
+
+typedef struct SMAACaptureHeader {
+    char magic[8];
+    uint32_t version;
+    // Frames written so far, and entries in the index
+    uint32_t frame_count;
+    uint32_t frame_capacity;
+    uint32_t reserved;
+    uint64_t index_offset;
+    // Unix time the capture started at
+    int64_t time;
+    char application[64];
+    char renderer[128];
+} SMAACaptureHeader;
+
+typedef struct SMAACaptureFrame {
+    // RGBA8, bottom row first, as read from the framebuffer
+    uint64_t color_offset;
+    // 32 bit float depth, 0 without depth
+    uint64_t depth_offset;
+    uint32_t width;
+    uint32_t height;
+    // Frame of the game it was captured at
+    uint32_t number;
+    uint32_t reserved;
+    // Since the capture started
+    double time_ms;
+} SMAACaptureFrame;
+
+typedef struct SMAACaptureSlot {
+    GLuint buffer;
+    GLsizeiptr size;
+    GLsync fence;
+    // What is in flight
+    int width;
+    int height;
+    int depth;
+    unsigned number;
+    double time_ms;
+} SMAACaptureSlot;
+
+typedef struct SMAACapture {
+    int enabled;
+    SMAACaptureSlot slots[SMAA_CAPTURE_BUFFERS];
+    // Frames seen, captured or not
+    unsigned frame;
+} SMAACapture;
+
+// Call with a current context, fences are needed
+internal void smaa_capture_init(SMAACapture *capture, int sync);
+
+// Once per frame, before SMAA writes to it: starts reading rect of
+// framebuffer fbo, its depth buffer too with depth set. Picks up the
+// frames read earlier. Keeps the bound buffer and pixel storage modes.
+internal void smaa_capture_frame(SMAACapture *capture, GLuint fbo, const SMAARect *rect, int depth);
+
+// With current set, the context is current and the fences are deleted.
+// The buffers are left to the caller, frames still in flight are lost.
+internal void smaa_capture_destroy(SMAACapture *capture, int current);
+
+#endif
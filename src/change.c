@@ -0,0 +1,375 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smaa.h"
+
+// Of the reduction passes, SMAA_CHANGE_TILE is two of them. The
+// shaders have them spelled out.
+#define CHANGE_BLOCK 8
+
+// The edges of a pixel depend on the pixels up to two away (local
+// contrast adaptation), the searches read a few pixels past their ends
+#define CHANGE_EDGE_REACH 2
+#define CHANGE_SEARCH_MARGIN 8
+
+// All passes draw the SMAA triangle over their whole viewport
+static const char *change_vs =
+    "#version 330\n"
+    "layout(location = 0) in vec2 in_texcoord;\n"
+    "void main() {\n"
+    "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
+    "}";
+
+// FNV-1a over 8x8 of the frame, then over 8x8 of those
+static const char *change_hash_fs =
+    "#version 330\n"
+    "uniform sampler2D in_tex;\n"
+    "uniform ivec2 in_size;\n"
+    "layout(location = 0) out uint out_hash;\n"
+    "void main() {\n"
+    "    ivec2 base = ivec2(gl_FragCoord.xy) * 8;\n"
+    "    ivec2 end = min(base + ivec2(8), in_size);\n"
+    "    uint hash = 2166136261u;\n"
+    "    for(int y = base.y; y < end.y; y++) {\n"
+    "        for(int x = base.x; x < end.x; x++) {\n"
+    "            uvec4 c = uvec4(texelFetch(in_tex, ivec2(x, y), 0) * 255.0f + 0.5f);\n"
+    "            hash = (hash ^ (c.r | (c.g << 8) | (c.b << 16) | (c.a << 24))) * 16777619u;\n"
+    "        }\n"
+    "    }\n"
+    "    out_hash = hash;\n"
+    "}";
+
+static const char *change_tile_fs =
+    "#version 330\n"
+    "uniform usampler2D in_hash;\n"
+    "uniform ivec2 in_size;\n"
+    "layout(location = 0) out uint out_hash;\n"
+    "void main() {\n"
+    "    ivec2 base = ivec2(gl_FragCoord.xy) * 8;\n"
+    "    ivec2 end = min(base + ivec2(8), in_size);\n"
+    "    uint hash = 2166136261u;\n"
+    "    for(int y = base.y; y < end.y; y++) {\n"
+    "        for(int x = base.x; x < end.x; x++) {\n"
+    "            hash = (hash ^ texelFetch(in_hash, ivec2(x, y), 0).r) * 16777619u;\n"
+    "        }\n"
+    "    }\n"
+    "    out_hash = hash;\n"
+    "}";
+
+// The level of a tile is that of the closest changed tile
+static const char *change_compare_fs =
+    "#version 330\n"
+    "uniform usampler2D in_current;\n"
+    "uniform usampler2D in_previous;\n"
+    "uniform ivec2 in_size;\n"
+    "uniform int in_weights_reach;\n"
+    "uniform int in_edges_reach;\n"
+    "layout(location = 0) out uint out_level;\n"
+    "void main() {\n"
+    "    ivec2 tile = ivec2(gl_FragCoord.xy);\n"
+    "    ivec2 first = max(tile - ivec2(in_edges_reach), ivec2(0));\n"
+    "    ivec2 last = min(tile + ivec2(in_edges_reach), in_size - ivec2(1));\n"
+    "    uint level = 0u;\n"
+    "    for(int y = first.y; y <= last.y; y++) {\n"
+    "        for(int x = first.x; x <= last.x; x++) {\n"
+    "            ivec2 other = ivec2(x, y);\n"
+    "            if(texelFetch(in_current, other, 0).r != texelFetch(in_previous, other, 0).r) {\n"
+    "                ivec2 distance = abs(other - tile);\n"
+    "                level = max(level, max(distance.x, distance.y) <= in_weights_reach ? 2u : 1u);\n"
+    "            }\n"
+    "        }\n"
+    "    }\n"
+    "    out_level = level;\n"
+    "}";
+
+static const char *change_mark_fs =
+    "#version 330\n"
+    "uniform usampler2D in_mask;\n"
+    "uniform uint in_level;\n"
+    "layout(location = 0) out vec4 out_color;\n"
+    "void main() {\n"
+    "    if(texelFetch(in_mask, ivec2(gl_FragCoord.xy) / 64, 0).r < in_level) {\n"
+    "        discard;\n"
+    "    }\n"
+    "    out_color = vec4(0.0f);\n"
+    "}";
+
+static
+GLuint change_program(const char *fs)
+{
+    const char *sources[] = { change_vs, fs };
+    GLenum types[] = { GL_VERTEX_SHADER, GL_FRAGMENT_SHADER };
+
+    GLuint program = glCreateProgram();
+    for(int i = 0; i < 2; i++) {
+	GLuint shader = glCreateShader(types[i]);
+	glShaderSource(shader, 1, &sources[i], 0);
+	glCompileShader(shader);
+	glAttachShader(program, shader);
+	glDeleteShader(shader);
+    }
+    glLinkProgram(program);
+
+    GLint status;
+    glGetProgramiv(program, GL_LINK_STATUS, &status);
+    if(!status) {
+	char log[1024];
+	glGetProgramInfoLog(program, sizeof(log), 0, log);
+	fprintf(stderr, "with_smaa: change detection program failed: %s\n", log);
+	glDeleteProgram(program);
+	return 0;
+    }
+    return program;
+}
+
+internal
+void smaa_change_init(SMAAChange *change, int supported)
+{
+    memset(change, 0, sizeof(*change));
+    change->supported = supported;
+}
+
+internal
+void smaa_change_configure(SMAAChange *change, const SMAAConfig *config)
+{
+    // Edges and weights of a frame before may have been dropped
+    change->enabled = change->supported && config->reuse;
+    change->valid = 0;
+}
+
+// Compiled on first use, turns change detection off if that fails
+static
+int change_prepare(SMAAChange *change)
+{
+    if(change->fbo) {
+	return 1;
+    }
+
+    change->hash_program = change_program(change_hash_fs);
+    change->tile_program = change_program(change_tile_fs);
+    change->compare_program = change_program(change_compare_fs);
+    change->mark_program = change_program(change_mark_fs);
+    if(!change->hash_program || !change->tile_program
+       || !change->compare_program || !change->mark_program) {
+	change->supported = change->enabled = 0;
+	return 0;
+    }
+
+    glGenFramebuffers(1, &change->fbo);
+    glGenQueries(SMAA_CHANGE_QUERIES, change->queries);
+    return 1;
+}
+
+static
+void change_texture(GLuint *tex, GLenum format, int width, int height)
+{
+    glDeleteTextures(1, tex);
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_2D, *tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RED_INTEGER,
+		 format == GL_R8UI ? GL_UNSIGNED_BYTE : GL_UNSIGNED_INT, 0);
+}
+
+// The pool is allocated in whole tiles, see SMAA_POOL_GRANULARITY
+static
+void change_resize(SMAAChange *change, int pool_width, int pool_height)
+{
+    int tiles_x = (pool_width + SMAA_CHANGE_TILE - 1) / SMAA_CHANGE_TILE;
+    int tiles_y = (pool_height + SMAA_CHANGE_TILE - 1) / SMAA_CHANGE_TILE;
+
+    change_texture(&change->hash_tex, GL_R32UI, tiles_x * CHANGE_BLOCK, tiles_y * CHANGE_BLOCK);
+    change_texture(&change->tile_tex[0], GL_R32UI, tiles_x, tiles_y);
+    change_texture(&change->tile_tex[1], GL_R32UI, tiles_x, tiles_y);
+    change_texture(&change->mask_tex, GL_R8UI, tiles_x, tiles_y);
+
+    change->pool_width = pool_width;
+    change->pool_height = pool_height;
+    change->valid = 0;
+}
+
+// Renders the bound program into width x height of target
+static
+void change_draw(GLuint target, int width, int height)
+{
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target, 0);
+    glViewport(0, 0, width, height);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+}
+
+// Tiles around a changed one that need new weights: as far as the
+// searches read edges, those edges in turn depend on pixels around
+static
+int change_weights_reach(const SMAAConfig *config)
+{
+    int reach = 2 * config->max_search_steps + CHANGE_SEARCH_MARGIN + CHANGE_EDGE_REACH;
+    if(config->diag_detection) {
+	reach += config->max_search_steps_diag;
+    }
+    return (reach + SMAA_CHANGE_TILE - 1) / SMAA_CHANGE_TILE;
+}
+
+static
+void change_report(SMAAChange *change)
+{
+    fprintf(stderr, "with_smaa: reused edges and weights for %.1f%% of the pixels of the last %u"
+	    " frames, %u of them skipped edge detection and blending weights\n",
+	    change->pixels > 0 ? 100.0 * (1.0 - change->processed / change->pixels) : 0.0,
+	    change->frames, change->skipped);
+    change->frames = change->skipped = 0;
+    change->pixels = change->processed = 0;
+}
+
+static
+void change_account(SMAAChange *change, double pixels, double processed)
+{
+    change->frames++;
+    change->skipped += processed == 0;
+    change->pixels += pixels;
+    change->processed += processed;
+    if(change->frames >= SMAA_CHANGE_REPORT) {
+	change_report(change);
+    }
+}
+
+// Picks up the results of the queries of earlier frames
+static
+void change_collect(SMAAChange *change)
+{
+    for(int i = 0; i < SMAA_CHANGE_QUERIES; i++) {
+	if(!change->query_pixels[i]) {
+	    continue;
+	}
+
+	GLuint available;
+	glGetQueryObjectuiv(change->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+	if(!available) {
+	    continue;
+	}
+
+	GLuint samples;
+	glGetQueryObjectuiv(change->queries[i], GL_QUERY_RESULT, &samples);
+	change_account(change, change->query_pixels[i], samples);
+	change->query_pixels[i] = 0;
+    }
+}
+
+internal
+int smaa_change_detect(SMAAChange *change, GLuint tex, const SMAAChangeKey *key,
+		       const SMAAConfig *config)
+{
+    if(!change->enabled || config->edge_mode == SMAA_EDGE_DEPTH || config->predication
+       || !change_prepare(change)) {
+	change->valid = 0;
+	return 0;
+    }
+
+    if(change->pool_width != key->pool_width || change->pool_height != key->pool_height) {
+	change_resize(change, key->pool_width, key->pool_height);
+    }
+
+    int blocks_x = (key->width + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+    int blocks_y = (key->height + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+    int tiles_x = (blocks_x + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+    int tiles_y = (blocks_y + CHANGE_BLOCK - 1) / CHANGE_BLOCK;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, change->fbo);
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glUseProgram(change->hash_program);
+    glUniform1i(glGetUniformLocation(change->hash_program, "in_tex"), 0);
+    glUniform2i(glGetUniformLocation(change->hash_program, "in_size"), key->width, key->height);
+    change_draw(change->hash_tex, blocks_x, blocks_y);
+
+    // Integer textures stay off unit 0, which may have a sampler bound
+    change->current = !change->current;
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, change->hash_tex);
+    glUseProgram(change->tile_program);
+    glUniform1i(glGetUniformLocation(change->tile_program, "in_hash"), 1);
+    glUniform2i(glGetUniformLocation(change->tile_program, "in_size"), blocks_x, blocks_y);
+    change_draw(change->tile_tex[change->current], tiles_x, tiles_y);
+
+    int partial = change->valid && !memcmp(key, &change->key, sizeof(*key));
+    change->key = *key;
+    change->valid = 1;
+
+    // The query also decides whether the passes run, and queries don't
+    // nest: a slot still in flight, or one of the game's, means the
+    // whole frame is processed
+    GLint active;
+    glGetQueryiv(GL_SAMPLES_PASSED, GL_CURRENT_QUERY, &active);
+    change_collect(change);
+    if(active || change->query_pixels[change->next_query]) {
+	partial = 0;
+    }
+
+    if(partial) {
+	int weights_reach = change_weights_reach(config);
+	glBindTexture(GL_TEXTURE_2D, change->tile_tex[change->current]);
+	glActiveTexture(GL_TEXTURE2);
+	glBindTexture(GL_TEXTURE_2D, change->tile_tex[!change->current]);
+	glUseProgram(change->compare_program);
+	glUniform1i(glGetUniformLocation(change->compare_program, "in_current"), 1);
+	glUniform1i(glGetUniformLocation(change->compare_program, "in_previous"), 2);
+	glUniform2i(glGetUniformLocation(change->compare_program, "in_size"), tiles_x, tiles_y);
+	glUniform1i(glGetUniformLocation(change->compare_program, "in_weights_reach"), weights_reach);
+	// Edges further out only depend on pixels that didn't change, the
+	// kept ones are still right
+	glUniform1i(glGetUniformLocation(change->compare_program, "in_edges_reach"), weights_reach);
+	change_draw(change->mask_tex, tiles_x, tiles_y);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	change->query = change->queries[change->next_query];
+	change->query_pixels[change->next_query] = (double)key->width * key->height;
+	change->next_query = (change->next_query + 1) % SMAA_CHANGE_QUERIES;
+    } else {
+	change_account(change, (double)key->width * key->height, (double)key->width * key->height);
+    }
+
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, tex);
+    glViewport(0, 0, key->width, key->height);
+
+    return partial;
+}
+
+internal
+void smaa_change_mark(SMAAChange *change, int level, GLint ref)
+{
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, change->mask_tex);
+    glUseProgram(change->mark_program);
+    glUniform1i(glGetUniformLocation(change->mark_program, "in_mask"), 1);
+    glUniform1ui(glGetUniformLocation(change->mark_program, "in_level"), level);
+
+    glStencilMask(0xff);
+    glStencilFunc(GL_ALWAYS, ref, 0xff);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+
+    if(level == SMAA_CHANGE_EDGES) {
+	glBeginQuery(GL_SAMPLES_PASSED, change->query);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    if(level == SMAA_CHANGE_EDGES) {
+	glEndQuery(GL_SAMPLES_PASSED);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glActiveTexture(GL_TEXTURE0);
+}
+
+internal
+void smaa_change_destroy(SMAAChange *change, int current)
+{
+    if(current && change->fbo) {
+	glDeleteFramebuffers(1, &change->fbo);
+	glDeleteQueries(SMAA_CHANGE_QUERIES, change->queries);
+    }
+    change->fbo = 0;
+}
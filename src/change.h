@@ -0,0 +1,110 @@
+#ifndef WITH_SMAA_CHANGE_H
+#define WITH_SMAA_CHANGE_H
+
+// Include smaa.h instead, which needs SMAAChange itself
+
+// Menus, loading and pause screens present the same frame over and
+// over. Parts of the frame that did not change keep the edges and
+// blending weights of the last frame, only the rest goes through edge
+// detection and blending weight calculation again.
+//
+// Every frame is hashed per SMAA_CHANGE_TILE square tile on the GPU, in
+// two reduction passes (8x8 pixels, then 8x8 of those), and compared to
+// the hashes of the last frame. Blending weights depend on the edges as
+// far as the searches reach, and those on the pixels around, so tiles
+// that close to a changed one get new edges and weights. Edges further
+// out only depend on pixels that didn't change and are kept as they are.
+// smaa_change_mark() marks both in the stencil buffer.
+// When nothing changed, the occlusion query of the edge mark skips both
+// passes through conditional rendering; nothing is read back for that.
+//
+// The query results are read frames later, for the share of pixels
+// processed again, logged every SMAA_CHANGE_REPORT frames.
+//
+// Depth isn't hashed, so edge detection and predication based on it
+// always process the whole frame.
+
+#define SMAA_CHANGE_TILE 64
+#define SMAA_CHANGE_QUERIES 4
+#define SMAA_CHANGE_REPORT 600
+
+// Levels of the mask, see smaa_change_mark()
+enum {
+    SMAA_CHANGE_SAME,
+    SMAA_CHANGE_EDGES,
+    SMAA_CHANGE_WEIGHTS
+};
+
+// Everything besides the frame the edges and weights depend on. A
+// frame with another key than the last one is processed as a whole.
+typedef struct SMAAChangeKey {
+    // Program cache keys of the edge and blend programs
+    uint64_t edge, blend;
+    // The part of the frame processed, and the size of the targets
+    int x, y, width, height;
+    int pool_width, pool_height;
+    SMAARect exclusions[SMAA_MAX_EXCLUSIONS];
+    int exclusion_count;
+} SMAAChangeKey;
+
+typedef struct SMAAChange {
+    // GL 3.3, and not turned off with reuse
+    int supported;
+    int enabled;
+
+    GLuint hash_program;
+    GLuint tile_program;
+    GLuint compare_program;
+    GLuint mark_program;
+    GLuint fbo;
+
+    // Hashes per 8x8 pixels, and per tile of this and the last frame
+    GLuint hash_tex;
+    GLuint tile_tex[2];
+    int current;
+    // Level per tile, SMAA_CHANGE_*
+    GLuint mask_tex;
+    int pool_width, pool_height;
+
+    // Of the last frame hashed, valid unset if there's none
+    SMAAChangeKey key;
+    int valid;
+
+    GLuint queries[SMAA_CHANGE_QUERIES];
+    // Pixels of the frame a query was made for, 0 if it's not in flight
+    double query_pixels[SMAA_CHANGE_QUERIES];
+    int next_query;
+    // The query of the frame being rendered
+    GLuint query;
+
+    // Since the last report
+    unsigned frames;
+    unsigned skipped;
+    double pixels;
+    double processed;
+} SMAAChange;
+
+// Call with a current context
+internal void smaa_change_init(SMAAChange *change, int supported);
+
+internal void smaa_change_configure(SMAAChange *change, const SMAAConfig *config);
+
+// Once per frame SMAA renders, with the frame in the lower left corner
+// of tex and the SMAA vertex array bound: hashes it. Returns 1 if it is
+// to be processed in part, after marking the parts with
+// smaa_change_mark() and with rendering conditional on change->query.
+// With 0 the whole frame is processed.
+// The edges and weights of every frame hashed must be kept for the next.
+internal int smaa_change_detect(SMAAChange *change, GLuint tex, const SMAAChangeKey *key,
+				const SMAAConfig *config);
+
+// Writes zeros and the stencil value ref to the bound draw framebuffer
+// wherever the mask is at least level, with the SMAA vertex array bound.
+// Marking SMAA_CHANGE_EDGES takes change->query.
+internal void smaa_change_mark(SMAAChange *change, int level, GLint ref);
+
+// With current set, the context is current and the framebuffer and the
+// queries are deleted. The textures and programs are left to the caller.
+internal void smaa_change_destroy(SMAAChange *change, int current);
+
+#endif
@@ -0,0 +1,661 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include "smaa.h"
+
+// Settings are read from, in increasing priority:
+//   $XDG_CONFIG_HOME/with_smaa/default.conf
+//   $XDG_CONFIG_HOME/with_smaa/<executable name>.conf
+//   WITH_SMAA_<KEY> environment variables
+// WITH_SMAA_PROFILE=<file> replaces both files by a single one.
+// The files are watched with inotify and reloaded when they change.
+
+#define CONFIG_MAX_FILES 2
+
+static int config_loaded = 0;
+static unsigned config_generation = 0;
+static SMAAConfig config_current;
+static pthread_mutex_t config_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// What smaa_config_get() returned on this thread, a reload from another
+// one doesn't change it under the caller
+static __thread SMAAConfig config_snapshot;
+
+static char config_dir[4096];
+static char config_files[CONFIG_MAX_FILES][256];
+static int config_file_count = 0;
+static int config_watch_fd = -1;
+
+static const SMAAConfig config_presets[] = {
+    // These mirror SMAA_PRESET_* in SMAA.hlsl
+    [SMAA_QUALITY_LOW] = { SMAA_QUALITY_LOW, SMAA_EDGE_LUMA, 0.15f, 4, 0, 0, 0, 0, 0, SMAA_BACKEND_AUTO, 0 },
+    [SMAA_QUALITY_MEDIUM] = { SMAA_QUALITY_MEDIUM, SMAA_EDGE_LUMA, 0.1f, 8, 0, 0, 0, 0, 0, SMAA_BACKEND_AUTO, 0 },
+    [SMAA_QUALITY_HIGH] = { SMAA_QUALITY_HIGH, SMAA_EDGE_LUMA, 0.1f, 16, 8, 25, 1, 1, 0, SMAA_BACKEND_AUTO, 0 },
+    [SMAA_QUALITY_ULTRA] = { SMAA_QUALITY_ULTRA, SMAA_EDGE_LUMA, 0.05f, 32, 16, 25, 1, 1, 0, SMAA_BACKEND_AUTO, 0 },
+};
+
+static const char *config_quality_names[] = { "low", "medium", "high", "ultra" };
+static const char *config_edge_names[] = { "luma", "color", "depth" };
+static const char *config_backend_names[] = { "auto", "raster", "compute", "cpu" };
+static const char *config_method_names[] = { "smaa", "fxaa" };
+
+static const char *config_keys[] = {
+    "preset",
+    "edge_detection",
+    "threshold",
+    "max_search_steps",
+    "max_search_steps_diag",
+    "corner_rounding",
+    "diag_detection",
+    "corner_detection",
+    "predication",
+    "backend",
+    "budget",
+    "method",
+    "sharpen",
+    "zero_copy",
+    "letterbox",
+    "reuse",
+    "max_queued_frames",
+    "exclude",
+    "exclude_mask",
+};
+
+internal
+const SMAAConfig *smaa_config_preset(int quality)
+{
+    return &config_presets[quality];
+}
+
+internal
+const char *smaa_config_quality_name(int quality)
+{
+    return config_quality_names[quality];
+}
+
+internal
+const char *smaa_config_edge_name(int edge_mode)
+{
+    return config_edge_names[edge_mode];
+}
+
+internal
+const char *smaa_config_method_name(int method)
+{
+    return config_method_names[method];
+}
+
+static
+void config_unset(SMAAConfig *config)
+{
+    config->quality = -1;
+    config->edge_mode = -1;
+    config->threshold = -1;
+    config->max_search_steps = -1;
+    config->max_search_steps_diag = -1;
+    config->corner_rounding = -1;
+    config->diag_detection = -1;
+    config->corner_detection = -1;
+    config->predication = -1;
+    config->backend = -1;
+    config->budget = -1;
+    config->method = -1;
+    config->sharpen = -1;
+    config->zero_copy = -1;
+    config->letterbox = -1;
+    config->reuse = -1;
+    config->max_queued_frames = -1;
+    config->exclusion_count = -1;
+    config->exclude_mask[0] = 0;
+}
+
+// Rows of a binary PGM (P5), top to bottom. Returns 0 on errors.
+static
+uint8_t *config_read_pgm(const char *path, int *width, int *height)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+	fprintf(stderr, "with_smaa: cannot open %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+
+    // Magic, width, height and maximum value, with # comments in between
+    int header[4] = { 0 };
+    int c = fgetc(file);
+    int valid = c == 'P' && fgetc(file) == '5';
+    for(int i = 1; valid && i < 4; i++) {
+	do {
+	    c = fgetc(file);
+	    if(c == '#') {
+		while(c != '\n' && c != EOF) {
+		    c = fgetc(file);
+		}
+	    }
+	} while(isspace(c));
+	if(!isdigit(c)) {
+	    valid = 0;
+	}
+	for(; isdigit(c) && header[i] < 65536; c = fgetc(file)) {
+	    header[i] = header[i] * 10 + (c - '0');
+	}
+    }
+    // A single whitespace character ends the header
+    valid = valid && isspace(c) && header[1] > 0 && header[2] > 0
+	&& header[1] < 65536 && header[2] < 65536 && header[3] > 0 && header[3] < 256;
+
+    uint8_t *pixels = valid ? malloc((size_t)header[1] * header[2]) : 0;
+    if(pixels && fread(pixels, header[1], header[2], file) != (size_t)header[2]) {
+	free(pixels);
+	pixels = 0;
+    }
+    fclose(file);
+
+    if(!pixels) {
+	fprintf(stderr, "with_smaa: %s is not an 8 bit binary PGM image\n", path);
+	return 0;
+    }
+    *width = header[1];
+    *height = header[2];
+    return pixels;
+}
+
+// Appends the bright (> half of white) parts of a PGM image to the
+// exclusions, as rectangles: runs of bright pixels on a row, merged with
+// identical runs on the rows below
+static
+void config_load_mask(const char *path, SMAAConfig *config)
+{
+    int width, height;
+    uint8_t *pixels = config_read_pgm(path, &width, &height);
+    if(!pixels) {
+	return;
+    }
+
+    SMAAExclusion *exclusions = config->exclusions;
+    int first = config->exclusion_count, count = first;
+    // Bottom row of each rectangle, in pixels, and whether it's open
+    int bottom[SMAA_MAX_EXCLUSIONS];
+    int valid = 1;
+
+    for(int y = 0; valid && y < height; y++) {
+	const uint8_t *row = pixels + (size_t)y * width;
+	for(int x = 0; valid && x < width; ) {
+	    if(row[x] < 128) {
+		x++;
+		continue;
+	    }
+	    int start = x;
+	    while(x < width && row[x] >= 128) {
+		x++;
+	    }
+
+	    float left = (float)start / width, run = (float)(x - start) / width;
+	    int i;
+	    for(i = first; i < count; i++) {
+		if(bottom[i] == y - 1 && exclusions[i].left == left && exclusions[i].width == run) {
+		    break;
+		}
+	    }
+	    if(i == count) {
+		if(count == SMAA_MAX_EXCLUSIONS) {
+		    valid = 0;
+		    break;
+		}
+		exclusions[count] = (SMAAExclusion){ left, (float)y / height, run, 0 };
+		count++;
+	    }
+	    exclusions[i].height += 1.0f / height;
+	    bottom[i] = y;
+	}
+    }
+    free(pixels);
+
+    if(!valid) {
+	fprintf(stderr, "with_smaa: %s needs more than %d rectangles, ignored\n",
+		path, SMAA_MAX_EXCLUSIONS);
+	return;
+    }
+    fprintf(stderr, "with_smaa: excluding %d rectangles of %s\n", count - first, path);
+    config->exclusion_count = count;
+}
+
+static
+void config_resolve(const SMAAConfig *set, SMAAConfig *config)
+{
+    *config = config_presets[set->quality >= 0 ? set->quality : SMAA_QUALITY_ULTRA];
+
+    if(set->edge_mode >= 0) config->edge_mode = set->edge_mode;
+    if(set->threshold >= 0) config->threshold = set->threshold;
+    if(set->max_search_steps >= 0) config->max_search_steps = set->max_search_steps;
+    if(set->max_search_steps_diag >= 0) config->max_search_steps_diag = set->max_search_steps_diag;
+    if(set->corner_rounding >= 0) config->corner_rounding = set->corner_rounding;
+    if(set->diag_detection >= 0) config->diag_detection = set->diag_detection;
+    if(set->corner_detection >= 0) config->corner_detection = set->corner_detection;
+    if(set->predication >= 0) config->predication = set->predication;
+    if(set->backend >= 0) config->backend = set->backend;
+    if(set->budget >= 0) config->budget = set->budget;
+    if(set->method >= 0) config->method = set->method;
+    if(set->sharpen >= 0) config->sharpen = set->sharpen;
+    config->zero_copy = set->zero_copy >= 0 ? set->zero_copy : 1;
+    config->letterbox = set->letterbox >= 0 ? set->letterbox : 1;
+    config->reuse = set->reuse >= 0 ? set->reuse : 1;
+    config->max_queued_frames = set->max_queued_frames >= 0 ? set->max_queued_frames : 0;
+
+    if(set->exclusion_count > 0) {
+	memcpy(config->exclusions, set->exclusions, set->exclusion_count * sizeof(SMAAExclusion));
+	config->exclusion_count = set->exclusion_count;
+    }
+    if(set->exclude_mask[0] && strcmp(set->exclude_mask, "none")) {
+	// Relative to the profiles
+	char path[4400];
+	snprintf(path, sizeof(path), "%s%s%s", set->exclude_mask[0] == '/' ? "" : config_dir,
+		 set->exclude_mask[0] == '/' ? "" : "/", set->exclude_mask);
+	config_load_mask(path, config);
+    }
+
+    // Explicitly asking for diagonal search steps turns the search on,
+    // as for corner rounding and corner detection.
+    if(set->max_search_steps_diag > 0 && set->diag_detection < 0) config->diag_detection = 1;
+    if(set->corner_rounding >= 0 && set->corner_detection < 0) config->corner_detection = 1;
+    if(config->diag_detection && !config->max_search_steps_diag) config->max_search_steps_diag = 8;
+}
+
+static
+int config_parse_name(const char *value, const char **names, int count)
+{
+    for(int i = 0; i < count; i++) {
+	if(!strcasecmp(value, names[i])) {
+	    return i;
+	}
+    }
+    return -1;
+}
+
+static
+int config_parse_int(const char *value, int min, int max)
+{
+    char *end;
+    long result = strtol(value, &end, 10);
+    if(end == value || *end || result < min || result > max) {
+	return -1;
+    }
+    return result;
+}
+
+// Games commonly call setlocale(), so strtod() may expect a decimal comma
+static
+float config_parse_float(const char *value, float max)
+{
+    float result = 0, scale = 1;
+    int digits = 0;
+
+    for(; isdigit((unsigned char)*value); value++, digits++) {
+	result = result * 10 + (*value - '0');
+    }
+    if(*value == '.') {
+	for(value++; isdigit((unsigned char)*value); value++, digits++) {
+	    scale /= 10;
+	    result += (*value - '0') * scale;
+	}
+    }
+
+    if(!digits || *value || result > max) {
+	return -1;
+    }
+    return result;
+}
+
+// "left top width height" in fractions of the frame, comma separated,
+// or "none". Returns the number of rectangles, -1 if invalid.
+static
+int config_parse_exclusions(const char *value, SMAAExclusion *exclusions)
+{
+    if(!strcasecmp(value, "none")) {
+	return 0;
+    }
+
+    char list[1024];
+    snprintf(list, sizeof(list), "%s", value);
+
+    int count = 0;
+    for(char *rect = list, *next; rect; rect = next) {
+	next = strchr(rect, ',');
+	if(next) {
+	    *next++ = 0;
+	}
+	if(count == SMAA_MAX_EXCLUSIONS) {
+	    return -1;
+	}
+
+	float values[4];
+	int parsed = 0;
+	for(char *part = rect, *end; *part; part = end) {
+	    while(isspace((unsigned char)*part)) {
+		part++;
+	    }
+	    for(end = part; *end && !isspace((unsigned char)*end); end++) {
+	    }
+	    if(end == part) {
+		break;
+	    }
+	    char separator = *end;
+	    *end = 0;
+	    if(parsed == 4 || (values[parsed++] = config_parse_float(part, 1.0f)) < 0) {
+		return -1;
+	    }
+	    *end = separator;
+	}
+	if(parsed != 4) {
+	    return -1;
+	}
+
+	exclusions[count++] = (SMAAExclusion){ values[0], values[1], values[2], values[3] };
+    }
+    return count;
+}
+
+static
+int config_parse_bool(const char *value)
+{
+    static const char *names[] = { "0", "1", "off", "on", "no", "yes", "false", "true" };
+    int index = config_parse_name(value, names, sizeof(names) / sizeof(names[0]));
+    return index < 0 ? -1 : index % 2;
+}
+
+static
+void config_set(SMAAConfig *set, const char *key, const char *value, const char *origin)
+{
+    int valid = 1;
+
+    if(!strcmp(key, "preset")) {
+	valid = (set->quality = config_parse_name(value, config_quality_names, 4)) >= 0;
+    } else if(!strcmp(key, "edge_detection")) {
+	valid = (set->edge_mode = config_parse_name(value, config_edge_names, 3)) >= 0;
+    } else if(!strcmp(key, "threshold")) {
+	valid = (set->threshold = config_parse_float(value, 0.5f)) >= 0;
+    } else if(!strcmp(key, "max_search_steps")) {
+	valid = (set->max_search_steps = config_parse_int(value, 0, 112)) >= 0;
+    } else if(!strcmp(key, "max_search_steps_diag")) {
+	valid = (set->max_search_steps_diag = config_parse_int(value, 0, 20)) >= 0;
+    } else if(!strcmp(key, "corner_rounding")) {
+	valid = (set->corner_rounding = config_parse_int(value, 0, 100)) >= 0;
+    } else if(!strcmp(key, "diag_detection")) {
+	valid = (set->diag_detection = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "corner_detection")) {
+	valid = (set->corner_detection = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "predication")) {
+	valid = (set->predication = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "backend")) {
+	valid = (set->backend = config_parse_name(value, config_backend_names, 4)) >= 0;
+    } else if(!strcmp(key, "budget")) {
+	valid = (set->budget = config_parse_float(value, 1000.0f)) >= 0;
+    } else if(!strcmp(key, "method")) {
+	valid = (set->method = config_parse_name(value, config_method_names, 2)) >= 0;
+    } else if(!strcmp(key, "sharpen")) {
+	valid = (set->sharpen = config_parse_float(value, 1.0f)) >= 0;
+    } else if(!strcmp(key, "zero_copy")) {
+	valid = (set->zero_copy = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "letterbox")) {
+	valid = (set->letterbox = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "reuse")) {
+	valid = (set->reuse = config_parse_bool(value)) >= 0;
+    } else if(!strcmp(key, "max_queued_frames")) {
+	valid = (set->max_queued_frames = config_parse_int(value, 0, SMAA_LIMITER_MAX_FRAMES)) >= 0;
+    } else if(!strcmp(key, "exclude")) {
+	valid = (set->exclusion_count = config_parse_exclusions(value, set->exclusions)) >= 0;
+    } else if(!strcmp(key, "exclude_mask")) {
+	valid = strlen(value) < sizeof(set->exclude_mask);
+	snprintf(set->exclude_mask, sizeof(set->exclude_mask), "%s", valid ? value : "");
+    } else {
+	fprintf(stderr, "with_smaa: %s: unknown option '%s'\n", origin, key);
+	return;
+    }
+
+    if(!valid) {
+	fprintf(stderr, "with_smaa: %s: invalid value '%s' for %s\n", origin, value, key);
+    }
+}
+
+static
+char *config_trim(char *string)
+{
+    while(isspace((unsigned char)*string)) {
+	string++;
+    }
+    char *end = string + strlen(string);
+    while(end > string && isspace((unsigned char)end[-1])) {
+	*--end = 0;
+    }
+    return string;
+}
+
+static
+void config_load_file(SMAAConfig *set, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(!file) {
+	if(errno != ENOENT) {
+	    fprintf(stderr, "with_smaa: cannot open %s: %s\n", path, strerror(errno));
+	}
+	return;
+    }
+
+    fprintf(stderr, "with_smaa: loading profile %s\n", path);
+
+    char line[1024];
+    while(fgets(line, sizeof(line), file)) {
+	char *comment = strchr(line, '#');
+	if(comment) {
+	    *comment = 0;
+	}
+
+	char *key = config_trim(line);
+	if(!*key) {
+	    continue;
+	}
+
+	char *value = strchr(key, '=');
+	if(!value) {
+	    fprintf(stderr, "with_smaa: %s: expected 'key = value': %s\n", path, key);
+	    continue;
+	}
+	*value++ = 0;
+
+	config_set(set, config_trim(key), config_trim(value), path);
+    }
+
+    fclose(file);
+}
+
+static
+void config_load_env(SMAAConfig *set)
+{
+    for(size_t i = 0; i < sizeof(config_keys) / sizeof(config_keys[0]); i++) {
+	char name[64] = "WITH_SMAA_";
+	size_t length = strlen(name);
+	for(const char *c = config_keys[i]; *c && length < sizeof(name) - 1; c++) {
+	    name[length++] = toupper((unsigned char)*c);
+	}
+	name[length] = 0;
+
+	const char *value = getenv(name);
+	if(value) {
+	    config_set(set, config_keys[i], value, name);
+	}
+    }
+}
+
+static
+void config_find_files()
+{
+    const char *profile = getenv("WITH_SMAA_PROFILE");
+    if(profile && profile[0]) {
+	const char *slash = strrchr(profile, '/');
+	int length = slash ? (int)(slash - profile) : 1;
+	const char *dir = slash ? profile : ".";
+	const char *name = slash ? slash + 1 : profile;
+	if(snprintf(config_dir, sizeof(config_dir), "%.*s", length, dir) >= (int)sizeof(config_dir)
+	   || snprintf(config_files[0], sizeof(config_files[0]), "%s", name)
+	      >= (int)sizeof(config_files[0])) {
+	    fprintf(stderr, "with_smaa: profile path too long, ignoring %s\n", profile);
+	    config_dir[0] = 0;
+	    return;
+	}
+	config_file_count = 1;
+	return;
+    }
+
+    const char *xdg = getenv("XDG_CONFIG_HOME");
+    const char *home = getenv("HOME");
+    int written;
+    if(xdg && xdg[0]) {
+	written = snprintf(config_dir, sizeof(config_dir), "%s/with_smaa", xdg);
+    } else if(home && home[0]) {
+	written = snprintf(config_dir, sizeof(config_dir), "%s/.config/with_smaa", home);
+    } else {
+	return;
+    }
+    if(written >= (int)sizeof(config_dir)) {
+	fprintf(stderr, "with_smaa: configuration directory path too long, no profiles\n");
+	config_dir[0] = 0;
+	return;
+    }
+
+    strcpy(config_files[config_file_count++], "default.conf");
+
+    char exe[4096];
+    ssize_t length = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if(length > 0) {
+	exe[length] = 0;
+	const char *name = strrchr(exe, '/');
+	name = name ? name + 1 : exe;
+	// No such file can exist when the name is too long for it
+	if(snprintf(config_files[config_file_count], sizeof(config_files[0]), "%s.conf", name)
+	   < (int)sizeof(config_files[0])) {
+	    config_file_count++;
+	}
+    }
+}
+
+static
+void config_load()
+{
+    SMAAConfig set;
+    config_unset(&set);
+
+    for(int i = 0; i < config_file_count; i++) {
+	char path[sizeof(config_dir) + sizeof(config_files[0])];
+	if(snprintf(path, sizeof(path), "%s/%s", config_dir, config_files[i])
+	   >= (int)sizeof(path)) {
+	    fprintf(stderr, "with_smaa: path too long, skipping %s\n", config_files[i]);
+	    continue;
+	}
+	config_load_file(&set, path);
+    }
+
+    config_load_env(&set);
+
+    config_resolve(&set, &config_current);
+    config_generation++;
+}
+
+static
+void config_watch()
+{
+    if(!config_file_count) {
+	return;
+    }
+
+    config_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(config_watch_fd < 0) {
+	return;
+    }
+
+    // Watch the directory, editors tend to replace files on saving
+    if(inotify_add_watch(config_watch_fd, config_dir,
+			 IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE) < 0) {
+	fprintf(stderr, "with_smaa: not watching %s for profile changes: %s\n",
+		config_dir, strerror(errno));
+	close(config_watch_fd);
+	config_watch_fd = -1;
+    }
+}
+
+static
+int config_poll()
+{
+    if(config_watch_fd < 0) {
+	return 0;
+    }
+
+    int changed = 0;
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t length;
+
+    while((length = read(config_watch_fd, buffer, sizeof(buffer))) > 0) {
+	for(char *ptr = buffer; ptr < buffer + length; ) {
+	    struct inotify_event *event = (struct inotify_event*)ptr;
+	    for(int i = 0; event->len && i < config_file_count; i++) {
+		if(!strcmp(event->name, config_files[i])) {
+		    changed = 1;
+		}
+	    }
+	    ptr += sizeof(struct inotify_event) + event->len;
+	}
+    }
+
+    return changed;
+}
+
+internal
+const SMAAConfig *smaa_config_get(unsigned *generation)
+{
+    pthread_mutex_lock(&config_mutex);
+    if(!config_loaded) {
+	config_loaded = 1;
+	config_find_files();
+	config_load();
+	config_watch();
+    } else if(config_poll()) {
+	fprintf(stderr, "with_smaa: profile changed, reloading\n");
+	config_load();
+    }
+
+    *generation = config_generation;
+    config_snapshot = config_current;
+    pthread_mutex_unlock(&config_mutex);
+    return &config_snapshot;
+}
+
+internal
+void smaa_config_reload(void)
+{
+    unsigned generation;
+    smaa_config_get(&generation);
+    pthread_mutex_lock(&config_mutex);
+    config_load();
+    pthread_mutex_unlock(&config_mutex);
+}
+
+internal
+int smaa_config_same_shaders(const SMAAConfig *a, const SMAAConfig *b)
+{
+    return a->edge_mode == b->edge_mode
+	&& a->threshold == b->threshold
+	&& a->max_search_steps == b->max_search_steps
+	&& a->max_search_steps_diag == b->max_search_steps_diag
+	&& a->corner_rounding == b->corner_rounding
+	&& a->diag_detection == b->diag_detection
+	&& a->corner_detection == b->corner_detection
+	&& a->predication == b->predication
+	&& a->method == b->method
+	&& a->sharpen == b->sharpen;
+}
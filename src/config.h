@@ -0,0 +1,101 @@
+
+#ifndef WITH_SMAA_CONFIG_H
+#define WITH_SMAA_CONFIG_H
+
+// Include smaa.h instead, which needs SMAAConfig itself
+
+enum {
+    SMAA_QUALITY_LOW,
+    SMAA_QUALITY_MEDIUM,
+    SMAA_QUALITY_HIGH,
+    SMAA_QUALITY_ULTRA
+};
+
+enum {
+    SMAA_EDGE_LUMA,
+    SMAA_EDGE_COLOR,
+    SMAA_EDGE_DEPTH
+};
+
+enum {
+    SMAA_BACKEND_AUTO,
+    SMAA_BACKEND_RASTER,
+    SMAA_BACKEND_COMPUTE,
+    // SMAA on the CPU, see smaa_cpu.h
+    SMAA_BACKEND_CPU
+};
+
+enum {
+    SMAA_METHOD_SMAA,
+    // FXAA in a single pass, see smaa_final_fs()
+    SMAA_METHOD_FXAA
+};
+
+#define SMAA_MAX_EXCLUSIONS 64
+
+// Part of the frame SMAA leaves alone, in fractions of the frame's size
+// from its top left corner
+typedef struct SMAAExclusion {
+    float left, top, width, height;
+} SMAAExclusion;
+
+// Fully resolved settings, i.e. the preset already expanded into the
+// individual SMAA parameters and any custom values applied on top.
+typedef struct SMAAConfig {
+    int quality;
+    int edge_mode;
+
+    float threshold;
+    int max_search_steps;
+    int max_search_steps_diag;
+    int corner_rounding;
+    int diag_detection;
+    int corner_detection;
+    // Luma and color edge detection use depth to predicate thresholds
+    int predication;
+
+    // Only read when SMAA is initialized
+    int backend;
+    // GPU time for SMAA in ms the governor aims for, 0 to disable it
+    float budget;
+    // SMAA, or the cheaper FXAA
+    int method;
+    // Strength of the sharpening fused into the last pass, 0 for none
+    float sharpen;
+    // Anti-alias blits of the final frame to the default framebuffer
+    // in place, see smaa_blit()
+    int zero_copy;
+    // Leave out letterbox and pillarbox bars, see region.h
+    int letterbox;
+    // Keep the edges and weights of unchanged parts, see change.h
+    int reuse;
+    // Frames the GPU may be behind after a swap, 0 for any, see limiter.h
+    int max_queued_frames;
+    // The exclude rectangles followed by those of the exclude_mask image
+    SMAAExclusion exclusions[SMAA_MAX_EXCLUSIONS];
+    int exclusion_count;
+    // PGM image of the parts to exclude, stretched over the frame
+    char exclude_mask[256];
+} SMAAConfig;
+
+// Returns the current configuration. The first call loads it, later
+// calls pick up changes of the profile files. *generation is bumped
+// whenever the configuration changed.
+internal const SMAAConfig *smaa_config_get(unsigned *generation);
+
+// Loads the configuration again, e.g. after changing the environment
+internal void smaa_config_reload(void);
+
+// Whether both configurations result in the same SMAA programs
+internal int smaa_config_same_shaders(const SMAAConfig *a, const SMAAConfig *b);
+
+// Settings of a preset, without any custom values
+internal const SMAAConfig *smaa_config_preset(int quality);
+
+internal const char *smaa_config_quality_name(int quality);
+
+internal const char *smaa_config_edge_name(int edge_mode);
+
+internal const char *smaa_config_method_name(int method);
+
+#endif
@@ -0,0 +1,282 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "smaa.h"
+
+// Must be a power of two
+#define EXPORTER_RING 1024
+// Samples kept per summary, later ones in the same interval are dropped
+#define EXPORTER_MAX_SAMPLES 8192
+#define EXPORTER_DRAIN_MS 100
+
+typedef struct ExporterRecord {
+    float ms[SMAA_PASS_COUNT];
+} ExporterRecord;
+
+static const char *exporter_pass_names[SMAA_PASS_COUNT] = { "copy", "edge", "blend", "neighbor" };
+
+// Written by render threads with exporter_push_mutex held, contexts
+// swapping on several threads all report here
+static ExporterRecord exporter_ring[EXPORTER_RING];
+static unsigned exporter_head;
+static pthread_mutex_t exporter_push_mutex = PTHREAD_MUTEX_INITIALIZER;
+// Written by the exporter thread only
+static unsigned exporter_tail;
+// Frames not measured because the ring or all query slots were full
+static unsigned exporter_dropped;
+
+static char exporter_target[4096];
+static double exporter_interval = 1000;
+static int exporter_fd = -1;
+static int exporter_socket = 0;
+// Started by the first instance measuring
+static pthread_mutex_t exporter_start_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int exporter_started = 0;
+
+// Monotonic, the GL path's smaa_time_ms() isn't linked into the layer
+static
+double exporter_time_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static
+int exporter_pop(ExporterRecord *record)
+{
+    unsigned tail = exporter_tail;
+    unsigned head = __atomic_load_n(&exporter_head, __ATOMIC_ACQUIRE);
+    if(tail == head) {
+	return 0;
+    }
+
+    *record = exporter_ring[tail & (EXPORTER_RING - 1)];
+    __atomic_store_n(&exporter_tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static
+int exporter_open()
+{
+    if(exporter_fd >= 0) {
+	return 1;
+    }
+
+    if(!strncmp(exporter_target, "unix:", 5)) {
+	struct sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	// Checked by exporter_valid_target()
+	if(snprintf(address.sun_path, sizeof(address.sun_path), "%s", exporter_target + 5)
+	   >= (int)sizeof(address.sun_path)) {
+	    return 0;
+	}
+
+	exporter_fd = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if(exporter_fd < 0) {
+	    return 0;
+	}
+	fcntl(exporter_fd, F_SETFL, O_NONBLOCK);
+	fcntl(exporter_fd, F_SETFD, FD_CLOEXEC);
+
+	// Nobody listening (yet) is normal, try again next time
+	if(connect(exporter_fd, (struct sockaddr*)&address, sizeof(address))) {
+	    close(exporter_fd);
+	    exporter_fd = -1;
+	    return 0;
+	}
+	exporter_socket = 1;
+    } else {
+	exporter_fd = open(exporter_target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+	if(exporter_fd < 0) {
+	    fprintf(stderr, "with_smaa: cannot open %s: %s\n", exporter_target, strerror(errno));
+	    return 0;
+	}
+	fcntl(exporter_fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    return 1;
+}
+
+static
+void exporter_write(const char *line, size_t length)
+{
+    if(!exporter_open()) {
+	return;
+    }
+
+    if(write(exporter_fd, line, length) < 0 && exporter_socket && errno != EAGAIN) {
+	// Listener went away, reconnect for the next summary
+	close(exporter_fd);
+	exporter_fd = -1;
+    }
+}
+
+static
+int exporter_compare(const void *a, const void *b)
+{
+    float x = *(const float*)a, y = *(const float*)b;
+    return (x > y) - (x < y);
+}
+
+static
+float exporter_percentile(const float *sorted, int count, int percent)
+{
+    int index = (count * percent + 99) / 100 - 1;
+    return sorted[index < 0 ? 0 : index];
+}
+
+static
+void exporter_summarize(float samples[][EXPORTER_MAX_SAMPLES], int count, unsigned dropped)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    // One JSON object per line
+    char line[1024];
+    int length = snprintf(line, sizeof(line), "{\"time\":%lld.%03d,\"frames\":%d,\"dropped\":%u",
+			  (long long)ts.tv_sec, (int)(ts.tv_nsec / 1000000), count, dropped);
+
+    for(int pass = 0; pass <= SMAA_PASS_COUNT; pass++) {
+	float *values = samples[pass];
+	qsort(values, count, sizeof(float), exporter_compare);
+	length += snprintf(line + length, sizeof(line) - length,
+			   ",\"%s\":{\"p50\":%.3f,\"p95\":%.3f,\"p99\":%.3f}",
+			   pass < SMAA_PASS_COUNT ? exporter_pass_names[pass] : "total",
+			   exporter_percentile(values, count, 50),
+			   exporter_percentile(values, count, 95),
+			   exporter_percentile(values, count, 99));
+    }
+    length += snprintf(line + length, sizeof(line) - length, "}\n");
+
+    exporter_write(line, length);
+}
+
+static
+void *exporter_thread(void *arg)
+{
+    (void)arg;
+
+    // Per pass and the total, in ms
+    static float samples[SMAA_PASS_COUNT + 1][EXPORTER_MAX_SAMPLES];
+    int count = 0;
+    unsigned dropped = 0;
+    double last = exporter_time_ms();
+
+    for(;;) {
+	struct timespec delay = { 0, EXPORTER_DRAIN_MS * 1000000L };
+	nanosleep(&delay, 0);
+
+	ExporterRecord record;
+	while(exporter_pop(&record)) {
+	    if(count == EXPORTER_MAX_SAMPLES) {
+		dropped++;
+		continue;
+	    }
+	    float total = 0;
+	    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+		samples[pass][count] = record.ms[pass];
+		total += record.ms[pass];
+	    }
+	    samples[SMAA_PASS_COUNT][count] = total;
+	    count++;
+	}
+
+	double now = exporter_time_ms();
+	if(now - last < exporter_interval) {
+	    continue;
+	}
+	last = now;
+
+	dropped += __atomic_exchange_n(&exporter_dropped, 0, __ATOMIC_RELAXED);
+	if(count) {
+	    exporter_summarize(samples, count, dropped);
+	}
+	count = 0;
+	dropped = 0;
+    }
+
+    return 0;
+}
+
+// A truncated path would be another file or socket
+static
+int exporter_valid_target(const char *target)
+{
+    struct sockaddr_un address;
+    if(!strncmp(target, "unix:", 5) && strlen(target + 5) >= sizeof(address.sun_path)) {
+	fprintf(stderr, "with_smaa: telemetry socket path longer than %zu bytes, telemetry disabled\n",
+		sizeof(address.sun_path) - 1);
+	return 0;
+    }
+    if(strlen(target) >= sizeof(exporter_target)) {
+	fprintf(stderr, "with_smaa: telemetry path too long, telemetry disabled\n");
+	return 0;
+    }
+    return 1;
+}
+
+internal
+int smaa_exporter_start(void)
+{
+    const char *target = getenv("WITH_SMAA_TELEMETRY");
+    if(!target || !target[0] || !exporter_valid_target(target)) {
+	return 0;
+    }
+
+    pthread_mutex_lock(&exporter_start_mutex);
+    if(!exporter_started) {
+	const char *interval = getenv("WITH_SMAA_TELEMETRY_INTERVAL");
+	if(interval && atof(interval) > 0) {
+	    exporter_interval = atof(interval) * 1000;
+	}
+	snprintf(exporter_target, sizeof(exporter_target), "%s", target);
+
+	// Everything but the exporter thread's initial stack is static
+	pthread_t thread;
+	pthread_attr_t attributes;
+	pthread_attr_init(&attributes);
+	pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+	int r = pthread_create(&thread, &attributes, exporter_thread, 0);
+	pthread_attr_destroy(&attributes);
+	if(r) {
+	    fprintf(stderr, "with_smaa: cannot start telemetry thread: %s\n", strerror(r));
+	} else {
+	    exporter_started = 1;
+	    fprintf(stderr, "with_smaa: telemetry to %s every %.1f s\n", target, exporter_interval / 1000);
+	}
+    }
+    int started = exporter_started;
+    pthread_mutex_unlock(&exporter_start_mutex);
+    return started;
+}
+
+internal
+void smaa_exporter_push(const float *ms)
+{
+    pthread_mutex_lock(&exporter_push_mutex);
+    unsigned head = exporter_head;
+    unsigned tail = __atomic_load_n(&exporter_tail, __ATOMIC_ACQUIRE);
+    if(head - tail >= EXPORTER_RING) {
+	__atomic_fetch_add(&exporter_dropped, 1, __ATOMIC_RELAXED);
+    } else {
+	memcpy(exporter_ring[head & (EXPORTER_RING - 1)].ms, ms, sizeof(exporter_ring[0].ms));
+	__atomic_store_n(&exporter_head, head + 1, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&exporter_push_mutex);
+}
+
+internal
+void smaa_exporter_drop(void)
+{
+    __atomic_fetch_add(&exporter_dropped, 1, __ATOMIC_RELAXED);
+}
@@ -0,0 +1,35 @@
+#ifndef WITH_SMAA_EXPORTER_H
+#define WITH_SMAA_EXPORTER_H
+
+// Include smaa.h instead, which needs SMAA_PASS_COUNT itself
+
+// Exporter of the per-pass GPU timings, shared by the GL path (see
+// telemetry.h) and the Vulkan layer (see smaa_vk.h). Render threads push
+// the timings of a frame into a single producer/single consumer ring. An
+// exporter thread drains the ring and periodically writes p50/p95/p99
+// summaries, so the render thread never blocks on the output.
+//
+// Enabled by WITH_SMAA_TELEMETRY, either a file the summaries are
+// appended to or unix:<path> for a datagram socket to send them to.
+// WITH_SMAA_TELEMETRY_INTERVAL sets the seconds between summaries.
+
+enum {
+    // Copying the backbuffer (and depth buffer) into the pool
+    SMAA_PASS_COPY,
+    SMAA_PASS_EDGE,
+    SMAA_PASS_BLEND,
+    SMAA_PASS_NEIGHBOR,
+    SMAA_PASS_COUNT
+};
+
+// Starts the exporter thread, once. Returns 1 if WITH_SMAA_TELEMETRY is
+// set, valid and the thread runs, i.e. timings should be pushed.
+internal int smaa_exporter_start(void);
+
+// Timings of a frame in ms per SMAA_PASS_*, from any thread
+internal void smaa_exporter_push(const float *ms);
+
+// A frame that wasn't measured, e.g. because the GPU is too far behind
+internal void smaa_exporter_drop(void);
+
+#endif
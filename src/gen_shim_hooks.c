@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shim_hash.h"
+
+// Build time tool: reads shim_hooks.list and writes shim_hooks.h, the
+// table shim.c looks intercepted names up in. Every name gets a slot of
+// its own, so a lookup never probes.
+//
+//     gen_shim_hooks shim_hooks.list shim_hooks.h
+
+#define GEN_MAX_HOOKS 256
+
+typedef struct Hook {
+    char name[64];
+    int always;
+    int state;
+} Hook;
+
+static Hook hooks[GEN_MAX_HOOKS];
+static int hook_count = 0;
+
+static
+int gen_read(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(!file) {
+	perror(path);
+	return 0;
+    }
+
+    char line[256];
+    int number = 0;
+    while(fgets(line, sizeof(line), file)) {
+	number++;
+	char name[64], flag[64];
+	int fields = sscanf(line, "%63s %63s", name, flag);
+	if(fields < 1 || name[0] == '#') {
+	    continue;
+	}
+	if(hook_count == GEN_MAX_HOOKS || (fields == 2 && strcmp(flag, "always") && strcmp(flag, "state"))) {
+	    fprintf(stderr, "%s:%d: cannot parse\n", path, number);
+	    fclose(file);
+	    return 0;
+	}
+	for(int i = 0; i < hook_count; i++) {
+	    if(!strcmp(hooks[i].name, name)) {
+		fprintf(stderr, "%s:%d: %s listed twice\n", path, number, name);
+		fclose(file);
+		return 0;
+	    }
+	}
+	strcpy(hooks[hook_count].name, name);
+	hooks[hook_count].always = fields == 2 && !strcmp(flag, "always");
+	hooks[hook_count].state = fields == 2 && !strcmp(flag, "state");
+	hook_count++;
+    }
+
+    fclose(file);
+    return 1;
+}
+
+// Returns 1 if seed puts every hook in a slot of its own
+static
+int gen_try(uint32_t seed, int bits, int *slots)
+{
+    int size = 1 << bits;
+    for(int i = 0; i < size; i++) {
+	slots[i] = -1;
+    }
+    for(int i = 0; i < hook_count; i++) {
+	int slot = shim_hash(hooks[i].name, seed) & (size - 1);
+	if(slots[slot] >= 0) {
+	    return 0;
+	}
+	slots[slot] = i;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 3) {
+	fprintf(stderr, "usage: gen_shim_hooks LIST HEADER\n");
+	return 1;
+    }
+    if(!gen_read(argv[1])) {
+	return 1;
+    }
+
+    // Start at a load factor of at most 1/2, a seed is found after a few
+    // thousand tries at most
+    int bits = 1;
+    while((1 << bits) < 2 * hook_count) {
+	bits++;
+    }
+
+    static int slots[1 << 16];
+    uint32_t seed = 0;
+    for(;;) {
+	for(seed = 1; seed < (1u << 20) && !gen_try(seed, bits, slots); seed++);
+	if(seed < (1u << 20)) {
+	    break;
+	}
+	bits++;
+    }
+
+    FILE *out = fopen(argv[2], "w");
+    if(!out) {
+	perror(argv[2]);
+	return 1;
+    }
+
+    fprintf(out, "// Generated by gen_shim_hooks from shim_hooks.list, don't edit\n\n");
+    fprintf(out, "#define SHIM_HOOK_SEED 0x%08xu\n", seed);
+    fprintf(out, "#define SHIM_HOOK_SLOTS %d\n\n", 1 << bits);
+    fprintf(out, "static const ShimHook shim_hooks[SHIM_HOOK_SLOTS] = {\n");
+    for(int i = 0; i < (1 << bits); i++) {
+	if(slots[i] >= 0) {
+	    fprintf(out, "    [%d] = SHIM_HOOK(%s, %d, %d),\n", i, hooks[slots[i]].name,
+		    hooks[slots[i]].always, hooks[slots[i]].state);
+	}
+    }
+    fprintf(out, "};\n");
+
+    if(fclose(out)) {
+	perror(argv[2]);
+	return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,445 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "smaa_sources.h"
+
+// Build time tool: preprocesses SMAA.hlsl for every entry of
+// smaa_sources[] (see smaa_sources.h) with the C compiler's
+// preprocessor, keeps only the functions the shader's main calls,
+// directly or not, and writes the results to smaa_shader.h. Identical
+// results are stored once.
+//
+//     gen_smaa_shaders CC SMAA.hlsl smaa_shader.h
+
+#define GEN_MAX_ITEMS 1024
+#define GEN_MAX_DISTINCT SMAA_SOURCE_TABLE_SIZE
+
+// Functions the mains in smaa.c call, space separated
+static const char *gen_entries[SMAA_SOURCE_COUNT] = {
+    [SMAA_SOURCE_EDGE_VS] = "SMAAEdgeDetectionVS",
+    [SMAA_SOURCE_BLEND_VS] = "SMAABlendingWeightCalculationVS",
+    [SMAA_SOURCE_NEIGHBOR_VS] = "SMAANeighborhoodBlendingVS",
+    [SMAA_SOURCE_LUMA_EDGE_PS] = "SMAALumaEdgeDetectionPS",
+    [SMAA_SOURCE_COLOR_EDGE_PS] = "SMAAColorEdgeDetectionPS",
+    [SMAA_SOURCE_DEPTH_EDGE_PS] = "SMAADepthEdgeDetectionPS",
+    [SMAA_SOURCE_BLEND_PS] = "SMAABlendingWeightCalculationPS",
+    [SMAA_SOURCE_NEIGHBOR_PS] = "SMAANeighborhoodBlendingPS",
+    [SMAA_SOURCE_BLEND_CS] = "SMAABlendingWeightCalculationVS SMAABlendingWeightCalculationPS",
+};
+
+// Settings defined at runtime. Defined as themselves here, so they pass
+// through the preprocessor unexpanded.
+static const char *gen_runtime[] = {
+    "SMAA_THRESHOLD",
+    "SMAA_MAX_SEARCH_STEPS",
+    "SMAA_MAX_SEARCH_STEPS_DIAG",
+    "SMAA_CORNER_ROUNDING",
+    "SMAA_RT_METRICS",
+};
+
+typedef struct Buffer {
+    char *data;
+    size_t length;
+    size_t size;
+} Buffer;
+
+// A top level declaration of the preprocessed source
+typedef struct Item {
+    const char *start;
+    size_t length;
+    // Of a function (definition or prototype), empty otherwise
+    char name[64];
+    int keep;
+} Item;
+
+static char *distinct[GEN_MAX_DISTINCT];
+static int distinct_count = 0;
+// Index into distinct of every smaa_sources[] entry
+static int table[SMAA_SOURCE_TABLE_SIZE];
+
+static
+void gen_append(Buffer *buffer, const char *data, size_t length)
+{
+    if(buffer->length + length + 1 > buffer->size) {
+	buffer->size = (buffer->length + length + 1) * 2;
+	buffer->data = realloc(buffer->data, buffer->size);
+	if(!buffer->data) {
+	    perror("gen_smaa_shaders");
+	    exit(1);
+	}
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = 0;
+}
+
+static
+int gen_read_file(const char *path, Buffer *buffer)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+	perror(path);
+	return 0;
+    }
+    char chunk[4096];
+    size_t length;
+    while((length = fread(chunk, 1, sizeof(chunk), file))) {
+	gen_append(buffer, chunk, length);
+    }
+    gen_append(buffer, "", 0);
+    fclose(file);
+    return 1;
+}
+
+static
+int gen_identifier_char(char c)
+{
+    return isalnum((unsigned char)c) || c == '_';
+}
+
+// Runs the preprocessor, fails if one of gen_runtime is tested with #if,
+// as that can't be left to runtime
+static
+int gen_preprocess(const char *cc, const char *hlsl, const char *tmp,
+		   int glsl4, int source, int flags, Buffer *output)
+{
+    char command[8192];
+    int length = snprintf(command, sizeof(command),
+			  "%s -E -P -undef -nostdinc -x c -Wundef -DSMAA_GLSL_%d=1", cc, glsl4 ? 4 : 3);
+    for(size_t i = 0; i < sizeof(gen_runtime) / sizeof(gen_runtime[0]); i++) {
+	length += snprintf(command + length, sizeof(command) - length, " -D%s=%s",
+			   gen_runtime[i], gen_runtime[i]);
+    }
+    if(source <= SMAA_SOURCE_NEIGHBOR_VS) {
+	length += snprintf(command + length, sizeof(command) - length, " -DSMAA_INCLUDE_PS=0");
+    }
+    if(flags & SMAA_SOURCE_PREDICATION) {
+	length += snprintf(command + length, sizeof(command) - length, " -DSMAA_PREDICATION=1");
+    }
+    if(flags & SMAA_SOURCE_NO_DIAG) {
+	length += snprintf(command + length, sizeof(command) - length, " -DSMAA_DISABLE_DIAG_DETECTION=1");
+    }
+    if(flags & SMAA_SOURCE_NO_CORNER) {
+	length += snprintf(command + length, sizeof(command) - length, " -DSMAA_DISABLE_CORNER_DETECTION=1");
+    }
+    snprintf(command + length, sizeof(command) - length, " -o '%s' '%s' 2>&1", tmp, hlsl);
+
+    FILE *pipe = popen(command, "r");
+    if(!pipe) {
+	perror("gen_smaa_shaders: popen");
+	return 0;
+    }
+    Buffer diagnostics = { 0 };
+    char chunk[4096];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), pipe))) {
+	gen_append(&diagnostics, chunk, read);
+    }
+    int status = pclose(pipe);
+
+    int ok = status == 0;
+    for(size_t i = 0; ok && diagnostics.data && i < sizeof(gen_runtime) / sizeof(gen_runtime[0]); i++) {
+	if(strstr(diagnostics.data, gen_runtime[i])) {
+	    fprintf(stderr, "gen_smaa_shaders: SMAA.hlsl tests %s with #if\n", gen_runtime[i]);
+	    ok = 0;
+	}
+    }
+    if(diagnostics.data) {
+	fputs(diagnostics.data, stderr);
+	free(diagnostics.data);
+    }
+    if(!ok) {
+	fprintf(stderr, "gen_smaa_shaders: failed: %s\n", command);
+	return 0;
+    }
+
+    output->length = 0;
+    return gen_read_file(tmp, output);
+}
+
+// Splits the source at top level semicolons and closing braces
+static
+int gen_split(const char *text, Item *items)
+{
+    int count = 0;
+    const char *p = text;
+    for(;;) {
+	while(isspace((unsigned char)*p)) {
+	    p++;
+	}
+	if(!*p) {
+	    return count;
+	}
+	if(count == GEN_MAX_ITEMS) {
+	    fprintf(stderr, "gen_smaa_shaders: more than %d declarations\n", GEN_MAX_ITEMS);
+	    return -1;
+	}
+
+	Item *item = &items[count++];
+	memset(item, 0, sizeof(*item));
+	item->start = p;
+
+	int braces = 0, parens = 0, assignment = 0;
+	const char *paren = 0;
+	for(; *p; p++) {
+	    if(*p == '(') {
+		if(!braces && !parens && !paren) {
+		    paren = p;
+		}
+		parens++;
+	    } else if(*p == ')') {
+		parens--;
+	    } else if(*p == '=' && !braces && !parens && !paren) {
+		assignment = 1;
+	    } else if(*p == '{') {
+		braces++;
+	    } else if(*p == '}') {
+		if(!--braces && !parens) {
+		    p++;
+		    // A struct's declarator list
+		    const char *q = p;
+		    while(isspace((unsigned char)*q)) {
+			q++;
+		    }
+		    if(*q == ';') {
+			p = q + 1;
+		    }
+		    break;
+		}
+	    } else if(*p == ';' && !braces && !parens) {
+		p++;
+		break;
+	    }
+	}
+	item->length = p - item->start;
+
+	// "type name(", but not "type name = f("
+	if(paren && !assignment) {
+	    const char *end = paren;
+	    while(end > item->start && isspace((unsigned char)end[-1])) {
+		end--;
+	    }
+	    const char *start = end;
+	    while(start > item->start && gen_identifier_char(start[-1])) {
+		start--;
+	    }
+	    if(end > start && (size_t)(end - start) < sizeof(item->name)) {
+		memcpy(item->name, start, end - start);
+		item->name[end - start] = 0;
+	    }
+	}
+    }
+}
+
+static
+int gen_mark(Item *items, int count, const char *name, size_t length)
+{
+    int marked = 0;
+    for(int i = 0; i < count; i++) {
+	if(!items[i].keep && strlen(items[i].name) == length
+	   && !strncmp(items[i].name, name, length)) {
+	    items[i].keep = 1;
+	    marked = 1;
+	}
+    }
+    return marked;
+}
+
+// Keeps the entries and, transitively, the functions they use, as well
+// as all declarations that aren't functions
+static
+int gen_shake(Item *items, int count, const char *entries)
+{
+    for(int i = 0; i < count; i++) {
+	items[i].keep = !items[i].name[0];
+    }
+
+    const char *entry = entries;
+    while(*entry) {
+	size_t length = strcspn(entry, " ");
+	if(!gen_mark(items, count, entry, length)) {
+	    fprintf(stderr, "gen_smaa_shaders: SMAA.hlsl has no %.*s\n", (int)length, entry);
+	    return 0;
+	}
+	entry += length;
+	entry += *entry == ' ';
+    }
+
+    int changed = 1;
+    while(changed) {
+	changed = 0;
+	for(int i = 0; i < count; i++) {
+	    if(!items[i].keep) {
+		continue;
+	    }
+	    const char *p = items[i].start, *end = p + items[i].length;
+	    while(p < end) {
+		if(!gen_identifier_char(*p)) {
+		    p++;
+		    continue;
+		}
+		const char *start = p;
+		while(p < end && gen_identifier_char(*p)) {
+		    p++;
+		}
+		if(!isdigit((unsigned char)*start)) {
+		    changed |= gen_mark(items, count, start, p - start);
+		}
+	    }
+	}
+    }
+    return 1;
+}
+
+static
+int gen_tight(char c)
+{
+    return c && strchr("(){}[];,", c);
+}
+
+// Collapses whitespace, one declaration per line
+static
+void gen_compact(const Item *items, int count, Buffer *out)
+{
+    out->length = 0;
+    for(int i = 0; i < count; i++) {
+	if(!items[i].keep) {
+	    continue;
+	}
+	int space = 0;
+	char last = 0;
+	for(size_t j = 0; j < items[i].length; j++) {
+	    char c = items[i].start[j];
+	    if(isspace((unsigned char)c)) {
+		space = 1;
+		continue;
+	    }
+	    if(space && last && !gen_tight(last) && !gen_tight(c)) {
+		gen_append(out, " ", 1);
+	    }
+	    space = 0;
+	    gen_append(out, &c, 1);
+	    last = c;
+	}
+	gen_append(out, "\n", 1);
+    }
+}
+
+static
+void gen_write_string(FILE *out, const char *text)
+{
+    int column = 0;
+    fputs("    \"", out);
+    for(const char *p = text; *p; p++) {
+	if(*p == '\n') {
+	    fputs(p[1] ? "\\n\"\n    \"" : "\\n\"", out);
+	    column = 0;
+	    continue;
+	}
+	if(*p == '\\' || *p == '"') {
+	    fputc('\\', out);
+	}
+	fputc(*p, out);
+	column++;
+	// Long functions are split across string literals
+	if(column > 90 && gen_tight(*p) && p[1] != '\n') {
+	    fputs("\"\n    \"", out);
+	    column = 0;
+	}
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 4) {
+	fprintf(stderr, "usage: gen_smaa_shaders CC SMAA.hlsl HEADER\n");
+	return 1;
+    }
+    const char *cc = argv[1], *hlsl = argv[2], *header = argv[3];
+
+    Buffer original = { 0 };
+    if(!gen_read_file(hlsl, &original)) {
+	return 1;
+    }
+
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.i", header);
+
+    static Item items[GEN_MAX_ITEMS];
+    Buffer preprocessed = { 0 }, compact = { 0 };
+    size_t total = 0;
+
+    for(int glsl4 = 0; glsl4 < 2; glsl4++) {
+	for(int source = 0; source < SMAA_SOURCE_COUNT; source++) {
+	    for(int flags = 0; flags < SMAA_SOURCE_FLAGS; flags++) {
+		if(!gen_preprocess(cc, hlsl, tmp, glsl4, source, flags, &preprocessed)) {
+		    remove(tmp);
+		    return 1;
+		}
+		int count = gen_split(preprocessed.data, items);
+		if(count < 0 || !gen_shake(items, count, gen_entries[source])) {
+		    remove(tmp);
+		    return 1;
+		}
+		gen_compact(items, count, &compact);
+
+		int index = SMAA_SOURCE_INDEX(glsl4, source, flags), found = -1;
+		for(int i = 0; i < distinct_count && found < 0; i++) {
+		    if(!strcmp(distinct[i], compact.data)) {
+			found = i;
+		    }
+		}
+		if(found < 0) {
+		    found = distinct_count++;
+		    distinct[found] = malloc(compact.length + 1);
+		    memcpy(distinct[found], compact.data, compact.length + 1);
+		    total += compact.length;
+		}
+		table[index] = found;
+	    }
+	}
+    }
+    remove(tmp);
+
+    FILE *out = fopen(header, "w");
+    if(!out) {
+	perror(header);
+	return 1;
+    }
+
+    // Identifies the sources for the program cache, see cache.h
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(int i = 0; i < distinct_count; i++) {
+	for(const char *p = distinct[i]; *p; p++) {
+	    hash ^= (unsigned char)*p;
+	    hash *= 0x100000001b3ULL;
+	}
+	hash ^= 0xff;
+	hash *= 0x100000001b3ULL;
+    }
+
+    fprintf(out, "// Generated by gen_smaa_shaders from SMAA.hlsl, don't edit\n\n");
+    fprintf(out, "static const char smaa_source_id[] = \"%016llx\";\n", (unsigned long long)hash);
+    for(int i = 0; i < distinct_count; i++) {
+	fprintf(out, "\nstatic const char smaa_source_%d[] =\n", i);
+	gen_write_string(out, distinct[i]);
+	fprintf(out, ";\n");
+    }
+    fprintf(out, "\nstatic const char *const smaa_sources[SMAA_SOURCE_TABLE_SIZE] = {\n");
+    for(int i = 0; i < SMAA_SOURCE_TABLE_SIZE; i++) {
+	fprintf(out, "    [%d] = smaa_source_%d,\n", i, table[i]);
+    }
+    fprintf(out, "};\n");
+
+    if(fclose(out)) {
+	perror(header);
+	return 1;
+    }
+
+    printf("gen_smaa_shaders: %d distinct sources, %zu bytes (SMAA.hlsl: %zu bytes)\n",
+	   distinct_count, total, original.length);
+    return 0;
+}
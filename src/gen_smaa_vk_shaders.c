@@ -0,0 +1,323 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "smaa_vk_sources.h"
+
+// Build time tool: compiles the shaders of the Vulkan layer (see
+// smaa_vk_sources.h) to SPIR-V with glslangValidator and writes them to
+// smaa_vk_shader.h. Each is the prologue below, SMAA.hlsl and a main of
+// its own; glslangValidator does the preprocessing.
+//
+//     gen_smaa_vk_shaders GLSLANG SMAA.hlsl smaa_vk_shader.h
+
+// The runtime settings smaa_settings() in smaa.c defines as macros,
+// defined as the constants here before SMAA.hlsl defaults them
+static const char *gen_prologue =
+    "#version 450\n"
+    "layout(constant_id = %d) const float in_threshold = 0.05f;\n"
+    "layout(constant_id = %d) const int in_max_search_steps = 32;\n"
+    "layout(constant_id = %d) const int in_max_search_steps_diag = 16;\n"
+    "layout(constant_id = %d) const int in_corner_rounding = 25;\n"
+    "layout(push_constant) uniform SMAAPushConstants {\n"
+    "    vec4 in_rt_metrics;\n"
+    "};\n"
+    "#define SMAA_THRESHOLD in_threshold\n"
+    "#define SMAA_MAX_SEARCH_STEPS in_max_search_steps\n"
+    "#define SMAA_MAX_SEARCH_STEPS_DIAG in_max_search_steps_diag\n"
+    "#define SMAA_CORNER_ROUNDING in_corner_rounding\n"
+    "#define SMAA_RT_METRICS in_rt_metrics\n"
+    "#define SMAA_GLSL_4 1\n"
+    "%s"
+    "%s"
+    "%s";
+
+// A triangle covering the frame, without vertex buffers
+#define GEN_FULLSCREEN \
+    "    vec2 coord = vec2((gl_VertexIndex << 1) & 2, gl_VertexIndex & 2);\n"
+
+#define GEN_POSITION \
+    "    texcoord = coord;\n" \
+    "    gl_Position = vec4(coord * 2.0f - 1.0f, 0.0f, 1.0f);\n"
+
+static const char *gen_edge_vs =
+    "layout(location = 0) out vec2 texcoord;\n"
+    "layout(location = 1) out vec4 offset[3];\n"
+    "void main() {\n"
+    GEN_FULLSCREEN
+    "    SMAAEdgeDetectionVS(coord, offset);\n"
+    GEN_POSITION
+    "}\n";
+
+static const char *gen_blend_vs =
+    "layout(location = 0) out vec2 texcoord;\n"
+    "layout(location = 1) out vec2 pixcoord;\n"
+    "layout(location = 2) out vec4 offset[3];\n"
+    "void main() {\n"
+    GEN_FULLSCREEN
+    "    SMAABlendingWeightCalculationVS(coord, pixcoord, offset);\n"
+    GEN_POSITION
+    "}\n";
+
+static const char *gen_neighbor_vs =
+    "layout(location = 0) out vec2 texcoord;\n"
+    "layout(location = 1) out vec4 offset;\n"
+    "void main() {\n"
+    GEN_FULLSCREEN
+    "    SMAANeighborhoodBlendingVS(coord, offset);\n"
+    GEN_POSITION
+    "}\n";
+
+#define GEN_EDGE_FS(function) \
+    "layout(set = 0, binding = 0) uniform sampler2D in_tex;\n" \
+    "layout(location = 0) in vec2 texcoord;\n" \
+    "layout(location = 1) in vec4 offset[3];\n" \
+    "layout(location = 0) out vec4 out_color;\n" \
+    "void main() {\n" \
+    "    out_color = vec4(" function "(texcoord, offset, in_tex), 0.0f, 1.0f);\n" \
+    "}\n"
+
+static const char *gen_blend_fs =
+    "layout(set = 0, binding = 0) uniform sampler2D in_tex;\n"
+    "layout(set = 0, binding = 1) uniform sampler2D in_area_tex;\n"
+    "layout(set = 0, binding = 2) uniform sampler2D in_search_tex;\n"
+    "layout(location = 0) in vec2 texcoord;\n"
+    "layout(location = 1) in vec2 pixcoord;\n"
+    "layout(location = 2) in vec4 offset[3];\n"
+    "layout(location = 0) out vec4 out_color;\n"
+    "void main() {\n"
+    "    out_color = SMAABlendingWeightCalculationPS(texcoord, pixcoord, offset,\n"
+    "        in_tex, in_area_tex, in_search_tex, vec4(0.0f));\n"
+    "}\n";
+
+static const char *gen_neighbor_fs =
+    "layout(set = 0, binding = 0) uniform sampler2D in_tex;\n"
+    "layout(set = 0, binding = 1) uniform sampler2D in_blend_tex;\n"
+    "layout(location = 0) in vec2 texcoord;\n"
+    "layout(location = 1) in vec4 offset;\n"
+    "layout(location = 0) out vec4 out_color;\n"
+    "void main() {\n"
+    "    out_color = SMAANeighborhoodBlendingPS(texcoord, offset, in_tex, in_blend_tex);\n"
+    "}\n";
+
+typedef struct Shader {
+    // File extension glslangValidator takes the stage from
+    const char *stage;
+    // Of the blending weights, see SMAA_VK_SHADER_BLEND()
+    int diag_detection;
+    int corner_detection;
+    const char *main;
+} Shader;
+
+typedef struct Buffer {
+    char *data;
+    size_t length;
+    size_t size;
+} Buffer;
+
+static
+Shader gen_shader(int shader)
+{
+    Shader s = { "frag", 1, 1, 0 };
+    switch(shader) {
+    case SMAA_VK_SHADER_EDGE_VS:
+	s.stage = "vert";
+	s.main = gen_edge_vs;
+	break;
+    case SMAA_VK_SHADER_BLEND_VS:
+	s.stage = "vert";
+	s.main = gen_blend_vs;
+	break;
+    case SMAA_VK_SHADER_NEIGHBOR_VS:
+	s.stage = "vert";
+	s.main = gen_neighbor_vs;
+	break;
+    case SMAA_VK_SHADER_LUMA_EDGE_FS:
+	s.main = GEN_EDGE_FS("SMAALumaEdgeDetectionPS");
+	break;
+    case SMAA_VK_SHADER_COLOR_EDGE_FS:
+	s.main = GEN_EDGE_FS("SMAAColorEdgeDetectionPS");
+	break;
+    case SMAA_VK_SHADER_NEIGHBOR_FS:
+	s.main = gen_neighbor_fs;
+	break;
+    default:
+	s.diag_detection = !((shader - SMAA_VK_SHADER_BLEND_FS) & 1);
+	s.corner_detection = !((shader - SMAA_VK_SHADER_BLEND_FS) & 2);
+	s.main = gen_blend_fs;
+	break;
+    }
+    return s;
+}
+
+static
+void gen_append(Buffer *buffer, const char *data, size_t length)
+{
+    if(buffer->length + length + 1 > buffer->size) {
+	buffer->size = (buffer->length + length + 1) * 2;
+	buffer->data = realloc(buffer->data, buffer->size);
+	if(!buffer->data) {
+	    perror("gen_smaa_vk_shaders");
+	    exit(1);
+	}
+    }
+    memcpy(buffer->data + buffer->length, data, length);
+    buffer->length += length;
+    buffer->data[buffer->length] = 0;
+}
+
+static
+int gen_write_file(const char *path, const char *text)
+{
+    FILE *file = fopen(path, "w");
+    if(!file) {
+	perror(path);
+	return 0;
+    }
+    fputs(text, file);
+    if(fclose(file)) {
+	perror(path);
+	return 0;
+    }
+    return 1;
+}
+
+static
+int gen_read_file(const char *path, Buffer *buffer)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+	perror(path);
+	return 0;
+    }
+    buffer->length = 0;
+    char chunk[4096];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), file))) {
+	gen_append(buffer, chunk, read);
+    }
+    fclose(file);
+    return 1;
+}
+
+// Compiles source, the SPIR-V words end up in spirv
+static
+int gen_compile(const char *glslang, const char *glsl, const char *spv, const char *source, Buffer *spirv)
+{
+    if(!gen_write_file(glsl, source)) {
+	return 0;
+    }
+
+    char command[8192];
+    if(snprintf(command, sizeof(command), "'%s' -V -o '%s' '%s' 2>&1", glslang, spv, glsl) >= (int)sizeof(command)) {
+	fprintf(stderr, "gen_smaa_vk_shaders: paths too long\n");
+	return 0;
+    }
+    FILE *pipe = popen(command, "r");
+    if(!pipe) {
+	perror("gen_smaa_vk_shaders: popen");
+	return 0;
+    }
+    Buffer diagnostics = { 0 };
+    char chunk[4096];
+    size_t read;
+    while((read = fread(chunk, 1, sizeof(chunk), pipe))) {
+	gen_append(&diagnostics, chunk, read);
+    }
+    if(pclose(pipe)) {
+	if(diagnostics.data) {
+	    fputs(diagnostics.data, stderr);
+	}
+	fprintf(stderr, "gen_smaa_vk_shaders: failed: %s\n", command);
+	free(diagnostics.data);
+	return 0;
+    }
+    free(diagnostics.data);
+
+    if(!gen_read_file(spv, spirv)) {
+	return 0;
+    }
+    if(spirv->length < 20 || spirv->length % 4) {
+	fprintf(stderr, "gen_smaa_vk_shaders: %s is no SPIR-V\n", spv);
+	return 0;
+    }
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    if(argc != 4) {
+	fprintf(stderr, "usage: gen_smaa_vk_shaders GLSLANG SMAA.hlsl HEADER\n");
+	return 1;
+    }
+    const char *glslang = argv[1], *hlsl = argv[2], *header = argv[3];
+
+    Buffer smaa = { 0 };
+    if(!gen_read_file(hlsl, &smaa)) {
+	return 1;
+    }
+
+    char spv[4096], glsl[4096];
+    snprintf(spv, sizeof(spv), "%s.spv", header);
+
+    FILE *out = fopen(header, "w");
+    if(!out) {
+	perror(header);
+	return 1;
+    }
+    fprintf(out, "// Generated by gen_smaa_vk_shaders from SMAA.hlsl, don't edit\n");
+
+    Buffer source = { 0 }, spirv = { 0 };
+    size_t total = 0;
+    for(int i = 0; i < SMAA_VK_SHADER_COUNT; i++) {
+	Shader shader = gen_shader(i);
+
+	char prologue[1024];
+	snprintf(prologue, sizeof(prologue), gen_prologue,
+		 SMAA_VK_CONSTANT_THRESHOLD, SMAA_VK_CONSTANT_MAX_SEARCH_STEPS,
+		 SMAA_VK_CONSTANT_MAX_SEARCH_STEPS_DIAG, SMAA_VK_CONSTANT_CORNER_ROUNDING,
+		 // Vertex shaders without the pixel shader functions
+		 !strcmp(shader.stage, "vert") ? "#define SMAA_INCLUDE_PS 0\n" : "",
+		 shader.diag_detection ? "" : "#define SMAA_DISABLE_DIAG_DETECTION 1\n",
+		 shader.corner_detection ? "" : "#define SMAA_DISABLE_CORNER_DETECTION 1\n");
+	source.length = 0;
+	gen_append(&source, prologue, strlen(prologue));
+	gen_append(&source, smaa.data, smaa.length);
+	gen_append(&source, shader.main, strlen(shader.main));
+
+	snprintf(glsl, sizeof(glsl), "%s.%s", header, shader.stage);
+	int ok = gen_compile(glslang, glsl, spv, source.data, &spirv);
+	remove(glsl);
+	remove(spv);
+	if(!ok) {
+	    fclose(out);
+	    remove(header);
+	    return 1;
+	}
+
+	// In host order, as glslangValidator writes them
+	fprintf(out, "\nstatic const uint32_t smaa_vk_shader_%d[] = {", i);
+	for(size_t word = 0; word < spirv.length / 4; word++) {
+	    uint32_t value;
+	    memcpy(&value, spirv.data + word * 4, 4);
+	    fprintf(out, "%s0x%08x,", word % 8 ? " " : "\n    ", value);
+	}
+	fprintf(out, "\n};\n");
+	total += spirv.length;
+    }
+
+    fprintf(out, "\nstatic const SMAAVkShaderCode smaa_vk_shaders[SMAA_VK_SHADER_COUNT] = {\n");
+    for(int i = 0; i < SMAA_VK_SHADER_COUNT; i++) {
+	fprintf(out, "    [%d] = { smaa_vk_shader_%d, sizeof(smaa_vk_shader_%d) },\n", i, i, i);
+    }
+    fprintf(out, "};\n");
+
+    if(fclose(out)) {
+	perror(header);
+	return 1;
+    }
+
+    printf("gen_smaa_vk_shaders: %d shaders, %zu bytes of SPIR-V\n", SMAA_VK_SHADER_COUNT, total);
+    return 0;
+}
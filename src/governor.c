@@ -0,0 +1,253 @@
+
+#include <stdio.h>
+
+#include "smaa.h"
+
+// Samples at a level before it may be left for a cheaper one
+#define GOVERNOR_SETTLE 20
+// Samples well under budget before trying a more expensive level,
+// multiplied by the backoff of that level
+#define GOVERNOR_STEP_UP 240
+// "Well under budget"
+#define GOVERNOR_HEADROOM 0.6f
+#define GOVERNOR_MAX_BACKOFF 16
+
+// Queries not belonging to any level, read back and dropped
+#define GOVERNOR_STALE SMAA_GOVERNOR_LEVELS
+
+internal
+void smaa_governor_init(SMAAGovernor *governor, int timer_query)
+{
+    governor->timer_query = timer_query;
+    if(timer_query) {
+	glGenQueries(SMAA_GOVERNOR_QUERIES, governor->queries);
+    }
+    for(int i = 0; i < SMAA_GOVERNOR_QUERIES; i++) {
+	governor->query_level[i] = -1;
+    }
+    governor->next_query = 0;
+    governor->timing = 0;
+    governor->levels = 0;
+    governor->level = 0;
+}
+
+static
+void governor_reset_level(SMAAGovernor *governor)
+{
+    governor->samples = 0;
+    governor->average = 0;
+    governor->under = 0;
+}
+
+internal
+void smaa_governor_configure(SMAAGovernor *governor, const SMAAConfig *config)
+{
+    SMAAConfig *ladder = governor->ladder;
+    int levels = 0;
+
+    ladder[levels++] = *config;
+
+    // FXAA only has itself to fall back on
+    if(config->method == SMAA_METHOD_SMAA) {
+	for(int quality = config->quality - 1; quality >= SMAA_QUALITY_LOW; quality--) {
+	    SMAAConfig lower = *smaa_config_preset(quality);
+	    lower.edge_mode = config->edge_mode;
+	    lower.predication = config->predication;
+	    lower.backend = config->backend;
+	    lower.budget = config->budget;
+	    lower.sharpen = config->sharpen;
+	    ladder[levels++] = lower;
+	}
+
+	SMAAConfig luma = *smaa_config_preset(SMAA_QUALITY_LOW);
+	luma.backend = config->backend;
+	luma.budget = config->budget;
+	luma.sharpen = config->sharpen;
+	if(!smaa_config_same_shaders(&luma, &ladder[levels - 1])) {
+	    ladder[levels++] = luma;
+	}
+
+	SMAAConfig cheap = luma;
+	cheap.max_search_steps = 2;
+	ladder[levels++] = cheap;
+
+	SMAAConfig fxaa = luma;
+	fxaa.method = SMAA_METHOD_FXAA;
+	ladder[levels++] = fxaa;
+    }
+
+    // Off
+    levels++;
+
+    governor->levels = levels;
+    governor->level = 0;
+    governor->budget = config->budget;
+    governor->enabled = governor->timer_query && config->budget > 0;
+    governor->stepped_up = 0;
+    for(int i = 0; i < SMAA_GOVERNOR_LEVELS; i++) {
+	governor->backoff[i] = 1;
+    }
+    governor_reset_level(governor);
+
+    for(int i = 0; i < SMAA_GOVERNOR_QUERIES; i++) {
+	if(governor->query_level[i] >= 0) {
+	    governor->query_level[i] = GOVERNOR_STALE;
+	}
+    }
+
+    if(config->budget > 0 && !governor->timer_query) {
+	fprintf(stderr, "with_smaa: no timer queries, ignoring the budget\n");
+    }
+}
+
+internal
+const SMAAConfig *smaa_governor_config(SMAAGovernor *governor)
+{
+    if(governor->level == governor->levels - 1) {
+	return 0;
+    }
+    return &governor->ladder[governor->level];
+}
+
+internal
+void smaa_governor_begin(SMAAGovernor *governor)
+{
+    governor->timing = 0;
+    if(!governor->enabled) {
+	return;
+    }
+
+    // Results of this slot weren't read yet, skip measuring this frame
+    // rather than waiting for them.
+    int slot = governor->next_query;
+    if(governor->query_level[slot] >= 0) {
+	return;
+    }
+
+    // Time elapsed queries don't nest, don't break the game's own
+    GLint active;
+    glGetQueryiv(GL_TIME_ELAPSED, GL_CURRENT_QUERY, &active);
+    if(active) {
+	return;
+    }
+
+    glBeginQuery(GL_TIME_ELAPSED, governor->queries[slot]);
+    governor->query_level[slot] = governor->level;
+    governor->timing = 1;
+}
+
+internal
+void smaa_governor_end(SMAAGovernor *governor)
+{
+    if(!governor->timing) {
+	return;
+    }
+
+    glEndQuery(GL_TIME_ELAPSED);
+    governor->next_query = (governor->next_query + 1) % SMAA_GOVERNOR_QUERIES;
+    governor->timing = 0;
+}
+
+static
+void governor_describe(SMAAGovernor *governor, int level, char *buf, size_t size)
+{
+    if(level == governor->levels - 1) {
+	snprintf(buf, size, "SMAA off");
+	return;
+    }
+
+    const SMAAConfig *config = &governor->ladder[level];
+    if(config->method == SMAA_METHOD_FXAA) {
+	snprintf(buf, size, "FXAA");
+	return;
+    }
+    snprintf(buf, size, "preset %s, %s edge detection%s, %d search steps",
+	     smaa_config_quality_name(config->quality), smaa_config_edge_name(config->edge_mode),
+	     config->predication ? " with predication" : "", config->max_search_steps);
+}
+
+static
+void governor_switch(SMAAGovernor *governor, int level, const char *reason)
+{
+    char description[256];
+    governor_describe(governor, level, description, sizeof(description));
+    if(governor->level == governor->levels - 1) {
+	fprintf(stderr, "with_smaa: governor: retrying with %s\n", description);
+    } else {
+	fprintf(stderr, "with_smaa: governor: %.2f ms %s the %.2f ms budget, switching to %s\n",
+		governor->average, reason, governor->budget, description);
+    }
+
+    if(level > governor->level && governor->stepped_up) {
+	// The level we tried was too expensive after all
+	int *backoff = &governor->backoff[governor->level];
+	if(*backoff < GOVERNOR_MAX_BACKOFF) {
+	    *backoff *= 2;
+	}
+    }
+
+    governor->stepped_up = level < governor->level;
+    governor->level = level;
+    governor_reset_level(governor);
+}
+
+static
+void governor_sample(SMAAGovernor *governor, float ms)
+{
+    if(!governor->samples) {
+	governor->average = ms;
+    } else {
+	governor->average += (ms - governor->average) * 0.1f;
+    }
+    governor->samples++;
+
+    if(governor->average < governor->budget * GOVERNOR_HEADROOM) {
+	governor->under++;
+    } else {
+	governor->under = 0;
+    }
+}
+
+internal
+int smaa_governor_update(SMAAGovernor *governor)
+{
+    if(!governor->enabled) {
+	return 0;
+    }
+
+    for(int i = 0; i < SMAA_GOVERNOR_QUERIES; i++) {
+	if(governor->query_level[i] < 0 || (governor->timing && i == governor->next_query)) {
+	    continue;
+	}
+
+	GLuint available;
+	glGetQueryObjectuiv(governor->queries[i], GL_QUERY_RESULT_AVAILABLE, &available);
+	if(!available) {
+	    continue;
+	}
+
+	GLuint64 ns;
+	glGetQueryObjectui64v(governor->queries[i], GL_QUERY_RESULT, &ns);
+	if(governor->query_level[i] == governor->level) {
+	    governor_sample(governor, ns / 1000000.0f);
+	}
+	governor->query_level[i] = -1;
+    }
+
+    int off = governor->levels - 1;
+    if(governor->level == off) {
+	// Nothing to measure, try again after a while
+	governor->under++;
+    } else if(governor->samples >= GOVERNOR_SETTLE && governor->average > governor->budget) {
+	governor_switch(governor, governor->level + 1, "over");
+	return 1;
+    }
+
+    if(governor->level > 0
+       && governor->under >= GOVERNOR_STEP_UP * governor->backoff[governor->level - 1]) {
+	governor_switch(governor, governor->level - 1, "under");
+	return 1;
+    }
+
+    return 0;
+}
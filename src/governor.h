@@ -0,0 +1,71 @@
+#ifndef WITH_SMAA_GOVERNOR_H
+#define WITH_SMAA_GOVERNOR_H
+
+// Include smaa.h instead, which needs SMAAGovernor itself
+
+// Keeps the GPU time of SMAA within the configured budget. The cost of
+// every frame is measured with GL_TIME_ELAPSED queries that are read a
+// few frames later, so measuring never stalls. When over budget the
+// governor steps down a ladder of cheaper configurations:
+//
+//   configured settings
+//   lower presets, keeping the edge detection mode
+//   low preset with luma edge detection, no predication
+//   cheap fallback (low preset, 2 search steps)
+//   FXAA
+//   SMAA off
+//
+// With FXAA configured it is followed by off right away.
+//
+// Stepping back up takes much longer than stepping down, and the wait
+// doubles each time a level turns out to be over budget again.
+
+#define SMAA_GOVERNOR_QUERIES 4
+#define SMAA_GOVERNOR_LEVELS 8
+
+typedef struct SMAAGovernor {
+    int timer_query;
+    // Timer queries supported and a budget configured
+    int enabled;
+    float budget;
+
+    GLuint queries[SMAA_GOVERNOR_QUERIES];
+    // Level a query measured, -1 if it is not in flight
+    int query_level[SMAA_GOVERNOR_QUERIES];
+    int next_query;
+    int timing;
+
+    // The last level is "off" and has no configuration
+    SMAAConfig ladder[SMAA_GOVERNOR_LEVELS];
+    int levels;
+    int level;
+
+    // Moving average of the samples taken at the current level
+    float average;
+    int samples;
+    // Consecutive samples (frames, when off) well under budget
+    int under;
+    int backoff[SMAA_GOVERNOR_LEVELS];
+    // Level was entered from below
+    int stepped_up;
+} SMAAGovernor;
+
+// Call with a current context
+internal void smaa_governor_init(SMAAGovernor *governor, int timer_query);
+
+// Rebuilds the ladder for a new configuration
+internal void smaa_governor_configure(SMAAGovernor *governor, const SMAAConfig *config);
+
+// Configuration to render with, 0 if SMAA should be skipped
+internal const SMAAConfig *smaa_governor_config(SMAAGovernor *governor);
+
+// Bracket the SMAA passes. Only call them while the programs for
+// smaa_governor_config() are in use.
+internal void smaa_governor_begin(SMAAGovernor *governor);
+internal void smaa_governor_end(SMAAGovernor *governor);
+
+// Once per frame: collects finished queries and returns 1 when the
+// level changed.
+internal int smaa_governor_update(SMAAGovernor *governor);
+
+#endif
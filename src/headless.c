@@ -0,0 +1,146 @@
+#define _GNU_SOURCE 1
+
+#include <stdio.h>
+#include <string.h>
+#include <dlfcn.h>
+
+#include "headless.h"
+
+#include <EGL/eglext.h>
+
+#include "state.h"
+
+#ifndef EGL_PLATFORM_SURFACELESS_MESA
+#define EGL_PLATFORM_SURFACELESS_MESA 0x31DD
+#endif
+
+// Without the shim, state.c's wrappers call straight into libGL
+internal
+void *shim_real_proc(const char *name)
+{
+    void *proc = dlsym(RTLD_NEXT, name);
+    if(!proc) {
+	proc = (void*) eglGetProcAddress(name);
+    }
+    return proc;
+}
+
+static
+EGLDisplay headless_display()
+{
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+	(PFNEGLGETPLATFORMDISPLAYEXTPROC) eglGetProcAddress("eglGetPlatformDisplayEXT");
+    const char *extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+
+    if(get_platform_display && extensions && strstr(extensions, "EGL_MESA_platform_surfaceless")) {
+	EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+	if(display != EGL_NO_DISPLAY) {
+	    return display;
+	}
+    }
+
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+}
+
+internal
+int smaa_headless_init(SMAAHeadless *headless)
+{
+    memset(headless, 0, sizeof(*headless));
+
+    headless->display = headless_display();
+    EGLint major, minor;
+    if(headless->display == EGL_NO_DISPLAY || !eglInitialize(headless->display, &major, &minor)) {
+	fprintf(stderr, "with_smaa: cannot initialize EGL\n");
+	return 0;
+    }
+
+    if(!eglBindAPI(EGL_OPENGL_API)) {
+	fprintf(stderr, "with_smaa: EGL has no desktop OpenGL\n");
+	return 0;
+    }
+
+    // Like a typical game's backbuffer
+    static const EGLint config_attributes[] = {
+	EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+	EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+	EGL_RED_SIZE, 8,
+	EGL_GREEN_SIZE, 8,
+	EGL_BLUE_SIZE, 8,
+	EGL_ALPHA_SIZE, 8,
+	EGL_DEPTH_SIZE, 24,
+	EGL_STENCIL_SIZE, 8,
+	EGL_NONE
+    };
+    EGLint count;
+    if(!eglChooseConfig(headless->display, config_attributes, &headless->config, 1, &count) || !count) {
+	fprintf(stderr, "with_smaa: no EGL config for a pbuffer\n");
+	return 0;
+    }
+
+    static const EGLint versions[][2] = { { 4, 3 }, { 3, 3 } };
+    for(size_t i = 0; i < sizeof(versions) / sizeof(versions[0]) && !headless->context; i++) {
+	const EGLint context_attributes[] = {
+	    EGL_CONTEXT_MAJOR_VERSION, versions[i][0],
+	    EGL_CONTEXT_MINOR_VERSION, versions[i][1],
+	    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+	    EGL_NONE
+	};
+	headless->context = eglCreateContext(headless->display, headless->config,
+					     EGL_NO_CONTEXT, context_attributes);
+    }
+    if(!headless->context) {
+	fprintf(stderr, "with_smaa: cannot create an OpenGL 3.3 context\n");
+	return 0;
+    }
+
+    return 1;
+}
+
+internal
+int smaa_headless_resize(SMAAHeadless *headless, int width, int height)
+{
+    if(headless->surface && headless->width == width && headless->height == height) {
+	return 1;
+    }
+
+    eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    if(headless->surface) {
+	eglDestroySurface(headless->display, headless->surface);
+    }
+
+    const EGLint attributes[] = {
+	EGL_WIDTH, width,
+	EGL_HEIGHT, height,
+	EGL_NONE
+    };
+    headless->surface = eglCreatePbufferSurface(headless->display, headless->config, attributes);
+    if(!headless->surface) {
+	fprintf(stderr, "with_smaa: cannot create a %dx%d pbuffer\n", width, height);
+	return 0;
+    }
+
+    if(!eglMakeCurrent(headless->display, headless->surface, headless->surface, headless->context)) {
+	fprintf(stderr, "with_smaa: cannot make the context current\n");
+	return 0;
+    }
+    smaa_state_make_current(headless->context);
+
+    headless->width = width;
+    headless->height = height;
+    return 1;
+}
+
+internal
+void smaa_headless_destroy(SMAAHeadless *headless)
+{
+    eglMakeCurrent(headless->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    smaa_state_forget(headless->context);
+    if(headless->surface) {
+	eglDestroySurface(headless->display, headless->surface);
+    }
+    if(headless->context) {
+	eglDestroyContext(headless->display, headless->context);
+    }
+    eglTerminate(headless->display);
+    memset(headless, 0, sizeof(*headless));
+}
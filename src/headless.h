@@ -0,0 +1,30 @@
+#ifndef WITH_SMAA_HEADLESS_H
+#define WITH_SMAA_HEADLESS_H
+
+#include <EGL/egl.h>
+
+#include "smaa.h"
+
+// An OpenGL context without a window, for the tools that run SMAA
+// outside of a game. It renders to an EGL pbuffer, so the "backbuffer"
+// SMAA reads from and writes to is the pbuffer's default framebuffer.
+// Works with Mesa's surfaceless platform, e.g. on llvmpipe.
+
+typedef struct SMAAHeadless {
+    EGLDisplay display;
+    EGLConfig config;
+    EGLContext context;
+    EGLSurface surface;
+    int width;
+    int height;
+} SMAAHeadless;
+
+// Creates a core profile context, 4.3 if available, else 3.3
+internal int smaa_headless_init(SMAAHeadless *headless);
+
+// (Re)creates the pbuffer at the given size and makes it current
+internal int smaa_headless_resize(SMAAHeadless *headless, int width, int height);
+
+internal void smaa_headless_destroy(SMAAHeadless *headless);
+
+#endif
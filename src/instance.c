@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "instance.h"
+#include "state.h"
+
+#define INSTANCE_MAX_CONTEXTS 32
+
+typedef struct Instance {
+    void *context;
+    SMAAShare *share;
+    // Created on the first swap
+    SMAA *smaa;
+    // Threads it is current on, 0 or 1 unless the application is broken
+    int current;
+    // Destroyed while current, torn down once released
+    int destroyed;
+} Instance;
+
+static Instance instances[INSTANCE_MAX_CONTEXTS];
+static pthread_mutex_t instance_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Instance of the context current on this thread
+static __thread Instance *instance_current;
+
+// All of the following with instance_mutex held
+
+static
+Instance *instance_find(void *context)
+{
+    for(int i = 0; i < INSTANCE_MAX_CONTEXTS; i++) {
+	if(instances[i].context == context) {
+	    return &instances[i];
+	}
+    }
+    return 0;
+}
+
+static
+Instance *instance_add(void *context, SMAAShare *share)
+{
+    Instance *instance = instance_find(0);
+    if(!instance) {
+	fprintf(stderr, "with_smaa: more than %d contexts, no SMAA for %p\n",
+		INSTANCE_MAX_CONTEXTS, context);
+	return 0;
+    }
+
+    if(!share) {
+	share = smaa_share_create();
+	if(!share) {
+	    return 0;
+	}
+    }
+    share->references++;
+
+    memset(instance, 0, sizeof(*instance));
+    instance->context = context;
+    instance->share = share;
+    return instance;
+}
+
+// With current set, the context is current on this thread
+static
+void instance_teardown(Instance *instance, int current)
+{
+    if(instance->smaa) {
+	smaa_destroy(instance->smaa, current);
+    }
+    if(!--instance->share->references) {
+	smaa_share_destroy(instance->share);
+    }
+    smaa_state_forget(instance->context);
+    memset(instance, 0, sizeof(*instance));
+}
+
+internal
+void smaa_instance_created(void *context, void *share)
+{
+    if(!context) {
+	return;
+    }
+
+    pthread_mutex_lock(&instance_mutex);
+    Instance *parent = share ? instance_find(share) : 0;
+    if(!instance_find(context)) {
+	instance_add(context, parent ? parent->share : 0);
+    }
+    pthread_mutex_unlock(&instance_mutex);
+}
+
+internal
+void smaa_instance_make_current(void *context)
+{
+    Instance *previous = instance_current;
+    instance_current = 0;
+
+    pthread_mutex_lock(&instance_mutex);
+    if(previous) {
+	previous->current--;
+	if(previous->destroyed && !previous->current) {
+	    instance_teardown(previous, 0);
+	}
+    }
+    if(context) {
+	// Contexts created before the shim was loaded, or through an
+	// entry point it doesn't hook, get a share group of their own
+	Instance *instance = instance_find(context);
+	if(!instance) {
+	    instance = instance_add(context, 0);
+	}
+	if(instance) {
+	    instance->current++;
+	    instance_current = instance;
+	}
+    }
+    pthread_mutex_unlock(&instance_mutex);
+
+    smaa_state_make_current(context);
+}
+
+internal
+void smaa_instance_destroyed(void *context)
+{
+    pthread_mutex_lock(&instance_mutex);
+    Instance *instance = instance_find(context);
+    if(instance) {
+	// The context lives on until it isn't current anymore, but SMAA
+	// is done with it. Here its objects can still be deleted.
+	if(instance == instance_current && instance->smaa) {
+	    smaa_destroy(instance->smaa, 1);
+	    instance->smaa = 0;
+	}
+	if(instance->current) {
+	    instance->destroyed = 1;
+	} else {
+	    instance_teardown(instance, 0);
+	}
+    }
+    pthread_mutex_unlock(&instance_mutex);
+}
+
+internal
+SMAA *smaa_instance_current(void *context)
+{
+    Instance *instance = instance_current;
+    if(!instance || instance->context != context) {
+	smaa_instance_make_current(context);
+    }
+    return smaa_instance_active();
+}
+
+internal
+SMAA *smaa_instance_active(void)
+{
+    Instance *instance = instance_current;
+    if(!instance || instance->destroyed) {
+	return 0;
+    }
+
+    // Only this thread uses it while the context is current here
+    if(!instance->smaa) {
+	instance->smaa = smaa_create(instance->share);
+    }
+    return instance->smaa;
+}
+
+internal
+void smaa_instance_prewarm(void)
+{
+    SMAA *smaa = smaa_instance_active();
+    if(smaa) {
+	smaa_prewarm(smaa);
+    }
+}
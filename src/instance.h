@@ -0,0 +1,38 @@
+#ifndef WITH_SMAA_INSTANCE_H
+#define WITH_SMAA_INSTANCE_H
+
+#include "smaa.h"
+
+// One SMAA instance per GL context, so several windows, contexts
+// recreated on a fullscreen toggle and swaps from different threads
+// each get their own targets. Contexts created sharing objects with
+// another one also share its SMAAShare. The shim reports the contexts'
+// lifetimes; the state shadows of state.c follow along.
+
+// From the context creation hooks, share is the context objects are
+// shared with (0 if none)
+internal void smaa_instance_created(void *context, void *share);
+
+// From the MakeCurrent hooks, 0 if no context is current anymore
+internal void smaa_instance_make_current(void *context);
+
+// From the DestroyContext hooks. A context still current on another
+// thread is only torn down once it is released there.
+internal void smaa_instance_destroyed(void *context);
+
+// The instance of context, which must be current on this thread. Created
+// on first use. Without locks unless context isn't the one the shim saw
+// becoming current last (or the first time). 0 if there are too many
+// contexts.
+internal SMAA *smaa_instance_current(void *context);
+
+// The instance of the context the shim last saw becoming current on this
+// thread, for hooks that don't know the context. Never takes a lock.
+internal SMAA *smaa_instance_active(void);
+
+// From the MakeCurrent hooks, after smaa_instance_make_current(), if the
+// context was made current on a drawable. Starts building the programs
+// so the first frames don't wait for them, see smaa_prewarm().
+internal void smaa_instance_prewarm(void);
+
+#endif
@@ -0,0 +1,521 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "smaa.h"
+#include "smaa_vk.h"
+
+// The Vulkan layer, loaded by the Vulkan loader through
+// with_smaa_layer.json whenever ENABLE_WITH_SMAA=1, which with_smaa sets.
+// It intercepts swapchain creation to add the usage SMAA needs, and
+// vkQueuePresentKHR to submit the SMAA command buffers of smaa_vk.c ahead
+// of every present.
+
+// Swapchains presented at once that get SMAA, the others are presented
+// untouched
+#define LAYER_MAX_PRESENTS 16
+
+typedef struct LayerInstance {
+    // The loader's dispatch table pointer, shared by its physical devices
+    void *key;
+    VkInstance instance;
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr;
+    PFN_vkDestroyInstance destroy_instance;
+    PFN_vkGetPhysicalDeviceProperties get_properties;
+    PFN_vkGetPhysicalDeviceMemoryProperties get_memory_properties;
+    PFN_vkGetPhysicalDeviceQueueFamilyProperties get_queue_family_properties;
+    PFN_vkGetPhysicalDeviceFormatProperties get_format_properties;
+    PFN_vkGetPhysicalDeviceSurfaceCapabilitiesKHR get_surface_capabilities;
+    struct LayerInstance *next;
+} LayerInstance;
+
+typedef struct LayerQueue {
+    VkQueue queue;
+    uint32_t family;
+} LayerQueue;
+
+typedef struct LayerDevice {
+    // Shared by its queues and command buffers
+    void *key;
+    SMAAVkDevice smaa;
+    PFN_vkGetDeviceProcAddr get_device_proc_addr;
+    LayerInstance *instance;
+    LayerQueue *queues;
+    int queue_count;
+    struct LayerDevice *next;
+} LayerDevice;
+
+typedef struct LayerSwapchain {
+    VkSwapchainKHR swapchain;
+    LayerDevice *device;
+    // 0 if SMAA can't run on it
+    SMAAVkSwapchain *smaa;
+    struct LayerSwapchain *next;
+} LayerSwapchain;
+
+// Named in with_smaa_layer.json
+public PFN_vkVoidFunction VKAPI_CALL with_smaa_GetInstanceProcAddr(VkInstance handle, const char *name);
+public PFN_vkVoidFunction VKAPI_CALL with_smaa_GetDeviceProcAddr(VkDevice handle, const char *name);
+
+static pthread_mutex_t layer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static LayerInstance *layer_instances = 0;
+static LayerDevice *layer_devices = 0;
+static LayerSwapchain *layer_swapchains = 0;
+
+static
+void *layer_key(const void *handle)
+{
+    return *(void**)handle;
+}
+
+static
+LayerInstance *layer_instance(const void *handle)
+{
+    void *key = layer_key(handle);
+    pthread_mutex_lock(&layer_mutex);
+    LayerInstance *instance = layer_instances;
+    while(instance && instance->key != key) {
+	instance = instance->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+    return instance;
+}
+
+static
+LayerDevice *layer_device(const void *handle)
+{
+    void *key = layer_key(handle);
+    pthread_mutex_lock(&layer_mutex);
+    LayerDevice *device = layer_devices;
+    while(device && device->key != key) {
+	device = device->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+    return device;
+}
+
+static
+LayerSwapchain *layer_swapchain(LayerDevice *device, VkSwapchainKHR handle)
+{
+    pthread_mutex_lock(&layer_mutex);
+    LayerSwapchain *swapchain = layer_swapchains;
+    while(swapchain && (swapchain->device != device || swapchain->swapchain != handle)) {
+	swapchain = swapchain->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+    return swapchain;
+}
+
+static
+VkResult VKAPI_CALL layer_CreateInstance(const VkInstanceCreateInfo *info, const VkAllocationCallbacks *allocator,
+					 VkInstance *handle)
+{
+    VkLayerInstanceCreateInfo *chain = (VkLayerInstanceCreateInfo*)info->pNext;
+    while(chain && !(chain->sType == VK_STRUCTURE_TYPE_LOADER_INSTANCE_CREATE_INFO
+		     && chain->function == VK_LAYER_LINK_INFO)) {
+	chain = (VkLayerInstanceCreateInfo*)chain->pNext;
+    }
+    if(!chain) {
+	return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr = chain->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+    PFN_vkCreateInstance create_instance =
+	(PFN_vkCreateInstance)get_instance_proc_addr(VK_NULL_HANDLE, "vkCreateInstance");
+    LayerInstance *instance = calloc(1, sizeof(LayerInstance));
+    if(!create_instance || !instance) {
+	free(instance);
+	return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    // The next layer finds its own link
+    chain->u.pLayerInfo = chain->u.pLayerInfo->pNext;
+    VkResult result = create_instance(info, allocator, handle);
+    if(result != VK_SUCCESS) {
+	free(instance);
+	return result;
+    }
+
+    instance->key = layer_key(*handle);
+    instance->instance = *handle;
+    instance->get_instance_proc_addr = get_instance_proc_addr;
+#define LAYER_INSTANCE_FUNCTION(field, name) \
+    instance->field = (__typeof__(instance->field))get_instance_proc_addr(*handle, name)
+    LAYER_INSTANCE_FUNCTION(destroy_instance, "vkDestroyInstance");
+    LAYER_INSTANCE_FUNCTION(get_properties, "vkGetPhysicalDeviceProperties");
+    LAYER_INSTANCE_FUNCTION(get_memory_properties, "vkGetPhysicalDeviceMemoryProperties");
+    LAYER_INSTANCE_FUNCTION(get_queue_family_properties, "vkGetPhysicalDeviceQueueFamilyProperties");
+    LAYER_INSTANCE_FUNCTION(get_format_properties, "vkGetPhysicalDeviceFormatProperties");
+    LAYER_INSTANCE_FUNCTION(get_surface_capabilities, "vkGetPhysicalDeviceSurfaceCapabilitiesKHR");
+#undef LAYER_INSTANCE_FUNCTION
+
+    pthread_mutex_lock(&layer_mutex);
+    instance->next = layer_instances;
+    layer_instances = instance;
+    pthread_mutex_unlock(&layer_mutex);
+    return VK_SUCCESS;
+}
+
+static
+void VKAPI_CALL layer_DestroyInstance(VkInstance handle, const VkAllocationCallbacks *allocator)
+{
+    if(!handle) {
+	return;
+    }
+
+    void *key = layer_key(handle);
+    pthread_mutex_lock(&layer_mutex);
+    LayerInstance **link = &layer_instances;
+    while(*link && (*link)->key != key) {
+	link = &(*link)->next;
+    }
+    LayerInstance *instance = *link;
+    if(instance) {
+	*link = instance->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+
+    if(instance) {
+	instance->destroy_instance(handle, allocator);
+	free(instance);
+    }
+}
+
+static
+VkResult VKAPI_CALL layer_CreateDevice(VkPhysicalDevice physical_device, const VkDeviceCreateInfo *info,
+				       const VkAllocationCallbacks *allocator, VkDevice *handle)
+{
+    LayerInstance *instance = layer_instance(physical_device);
+    VkLayerDeviceCreateInfo *link = 0;
+    PFN_vkSetDeviceLoaderData set_loader_data = 0;
+    for(VkLayerDeviceCreateInfo *chain = (VkLayerDeviceCreateInfo*)info->pNext; chain;
+	chain = (VkLayerDeviceCreateInfo*)chain->pNext) {
+	if(chain->sType != VK_STRUCTURE_TYPE_LOADER_DEVICE_CREATE_INFO) {
+	    continue;
+	}
+	if(chain->function == VK_LAYER_LINK_INFO && !link) {
+	    link = chain;
+	} else if(chain->function == VK_LOADER_DATA_CALLBACK) {
+	    set_loader_data = chain->u.pfnSetDeviceLoaderData;
+	}
+    }
+    if(!instance || !link) {
+	return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    PFN_vkGetInstanceProcAddr get_instance_proc_addr = link->u.pLayerInfo->pfnNextGetInstanceProcAddr;
+    PFN_vkGetDeviceProcAddr get_device_proc_addr = link->u.pLayerInfo->pfnNextGetDeviceProcAddr;
+    PFN_vkCreateDevice create_device =
+	(PFN_vkCreateDevice)get_instance_proc_addr(instance->instance, "vkCreateDevice");
+    LayerDevice *device = calloc(1, sizeof(LayerDevice));
+    if(!create_device || !device) {
+	free(device);
+	return VK_ERROR_INITIALIZATION_FAILED;
+    }
+
+    link->u.pLayerInfo = link->u.pLayerInfo->pNext;
+    VkResult result = create_device(physical_device, info, allocator, handle);
+    if(result != VK_SUCCESS) {
+	free(device);
+	return result;
+    }
+
+    device->key = layer_key(*handle);
+    device->get_device_proc_addr = get_device_proc_addr;
+    device->instance = instance;
+
+    SMAAVkDevice *smaa = &device->smaa;
+    smaa->device = *handle;
+    smaa->physical_device = physical_device;
+#define LAYER_DEVICE_FUNCTION(name) \
+    smaa->vk.name = (PFN_vk##name)get_device_proc_addr(*handle, "vk" #name);
+    SMAA_VK_DEVICE_FUNCTIONS(LAYER_DEVICE_FUNCTION)
+#undef LAYER_DEVICE_FUNCTION
+    smaa->set_loader_data = set_loader_data;
+    smaa->get_format_properties = instance->get_format_properties;
+
+    VkPhysicalDeviceProperties properties;
+    instance->get_properties(physical_device, &properties);
+    smaa->timestamp_period = properties.limits.timestampPeriod;
+    instance->get_memory_properties(physical_device, &smaa->memory);
+    instance->get_queue_family_properties(physical_device, &smaa->family_count, 0);
+    smaa->families = calloc(smaa->family_count ? smaa->family_count : 1, sizeof(VkQueueFamilyProperties));
+    if(smaa->families) {
+	instance->get_queue_family_properties(physical_device, &smaa->family_count, smaa->families);
+    } else {
+	smaa->family_count = 0;
+    }
+
+    pthread_mutex_lock(&layer_mutex);
+    device->next = layer_devices;
+    layer_devices = device;
+    pthread_mutex_unlock(&layer_mutex);
+    return VK_SUCCESS;
+}
+
+static
+void VKAPI_CALL layer_DestroyDevice(VkDevice handle, const VkAllocationCallbacks *allocator)
+{
+    if(!handle) {
+	return;
+    }
+
+    void *key = layer_key(handle);
+    pthread_mutex_lock(&layer_mutex);
+    LayerDevice **link = &layer_devices;
+    while(*link && (*link)->key != key) {
+	link = &(*link)->next;
+    }
+    LayerDevice *device = *link;
+    if(device) {
+	*link = device->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+
+    if(device) {
+	device->smaa.vk.DestroyDevice(handle, allocator);
+	free(device->smaa.families);
+	free(device->queues);
+	free(device);
+    }
+}
+
+static
+void layer_add_queue(LayerDevice *device, VkQueue queue, uint32_t family)
+{
+    pthread_mutex_lock(&layer_mutex);
+    int known = 0;
+    for(int i = 0; i < device->queue_count; i++) {
+	known |= device->queues[i].queue == queue;
+    }
+    if(!known) {
+	LayerQueue *queues = realloc(device->queues, (device->queue_count + 1) * sizeof(LayerQueue));
+	if(queues) {
+	    queues[device->queue_count].queue = queue;
+	    queues[device->queue_count].family = family;
+	    device->queues = queues;
+	    device->queue_count++;
+	}
+    }
+    pthread_mutex_unlock(&layer_mutex);
+}
+
+// UINT32_MAX if the queue wasn't retrieved through the layer
+static
+uint32_t layer_queue_family(LayerDevice *device, VkQueue queue)
+{
+    uint32_t family = UINT32_MAX;
+    pthread_mutex_lock(&layer_mutex);
+    for(int i = 0; i < device->queue_count; i++) {
+	if(device->queues[i].queue == queue) {
+	    family = device->queues[i].family;
+	}
+    }
+    pthread_mutex_unlock(&layer_mutex);
+    return family;
+}
+
+static
+void VKAPI_CALL layer_GetDeviceQueue(VkDevice handle, uint32_t family, uint32_t index, VkQueue *queue)
+{
+    LayerDevice *device = layer_device(handle);
+    device->smaa.vk.GetDeviceQueue(handle, family, index, queue);
+    if(*queue) {
+	layer_add_queue(device, *queue, family);
+    }
+}
+
+static
+void VKAPI_CALL layer_GetDeviceQueue2(VkDevice handle, const VkDeviceQueueInfo2 *info, VkQueue *queue)
+{
+    LayerDevice *device = layer_device(handle);
+    device->smaa.vk.GetDeviceQueue2(handle, info, queue);
+    if(*queue) {
+	layer_add_queue(device, *queue, info->queueFamilyIndex);
+    }
+}
+
+static
+VkResult VKAPI_CALL layer_CreateSwapchainKHR(VkDevice handle, const VkSwapchainCreateInfoKHR *info,
+					     const VkAllocationCallbacks *allocator, VkSwapchainKHR *swapchain)
+{
+    LayerDevice *device = layer_device(handle);
+    SMAAVkDevice *smaa = &device->smaa;
+
+    // SMAA copies from and renders into the images
+    int usable = info->imageArrayLayers == 1;
+    if(usable && device->instance->get_surface_capabilities) {
+	VkSurfaceCapabilitiesKHR capabilities;
+	usable = device->instance->get_surface_capabilities(smaa->physical_device, info->surface, &capabilities)
+	    == VK_SUCCESS && (capabilities.supportedUsageFlags & SMAA_VK_USAGE) == SMAA_VK_USAGE;
+    }
+    if(!usable) {
+	fprintf(stderr, "with_smaa: swapchain images can't be rendered to, SMAA disabled\n");
+	return smaa->vk.CreateSwapchainKHR(handle, info, allocator, swapchain);
+    }
+
+    VkSwapchainCreateInfoKHR smaa_info = *info;
+    smaa_info.imageUsage |= SMAA_VK_USAGE;
+    VkResult result = smaa->vk.CreateSwapchainKHR(handle, &smaa_info, allocator, swapchain);
+    if(result != VK_SUCCESS) {
+	return result;
+    }
+
+    LayerSwapchain *layer_swapchain = calloc(1, sizeof(LayerSwapchain));
+    if(!layer_swapchain) {
+	return VK_SUCCESS;
+    }
+    layer_swapchain->swapchain = *swapchain;
+    layer_swapchain->device = device;
+    layer_swapchain->smaa = smaa_vk_create(smaa, *swapchain, &smaa_info);
+
+    pthread_mutex_lock(&layer_mutex);
+    layer_swapchain->next = layer_swapchains;
+    layer_swapchains = layer_swapchain;
+    pthread_mutex_unlock(&layer_mutex);
+    return VK_SUCCESS;
+}
+
+static
+void VKAPI_CALL layer_DestroySwapchainKHR(VkDevice handle, VkSwapchainKHR swapchain,
+					  const VkAllocationCallbacks *allocator)
+{
+    LayerDevice *device = layer_device(handle);
+
+    pthread_mutex_lock(&layer_mutex);
+    LayerSwapchain **link = &layer_swapchains;
+    while(*link && ((*link)->device != device || (*link)->swapchain != swapchain)) {
+	link = &(*link)->next;
+    }
+    LayerSwapchain *layer_swapchain = *link;
+    if(layer_swapchain) {
+	*link = layer_swapchain->next;
+    }
+    pthread_mutex_unlock(&layer_mutex);
+
+    // Its framebuffers use the swapchain's images
+    if(layer_swapchain) {
+	if(layer_swapchain->smaa) {
+	    smaa_vk_destroy(layer_swapchain->smaa);
+	}
+	free(layer_swapchain);
+    }
+    device->smaa.vk.DestroySwapchainKHR(handle, swapchain, allocator);
+}
+
+static
+VkResult VKAPI_CALL layer_QueuePresentKHR(VkQueue queue, const VkPresentInfoKHR *info)
+{
+    LayerDevice *device = layer_device(queue);
+    SMAAVkDevice *smaa = &device->smaa;
+    uint32_t family = layer_queue_family(device, queue);
+
+    VkCommandBuffer commands[2 * LAYER_MAX_PRESENTS];
+    uint32_t command_count = 0;
+    VkSemaphore semaphores[LAYER_MAX_PRESENTS];
+    VkFence fences[LAYER_MAX_PRESENTS];
+    uint32_t handled = 0;
+    if(family < smaa->family_count && (smaa->families[family].queueFlags & VK_QUEUE_GRAPHICS_BIT)) {
+	for(uint32_t i = 0; i < info->swapchainCount && handled < LAYER_MAX_PRESENTS; i++) {
+	    LayerSwapchain *swapchain = layer_swapchain(device, info->pSwapchains[i]);
+	    if(swapchain && swapchain->smaa
+	       && smaa_vk_present(swapchain->smaa, queue, family, info->pImageIndices[i],
+				  commands, &command_count, &semaphores[handled], &fences[handled])) {
+		handled++;
+	    }
+	}
+    }
+    if(!handled) {
+	return smaa->vk.QueuePresentKHR(queue, info);
+    }
+
+    // Our command buffers wait for the application's semaphores, the
+    // present for theirs. Images not handled are behind them too.
+    VkPipelineStageFlags *stages = malloc((info->waitSemaphoreCount + 1) * sizeof(VkPipelineStageFlags));
+    if(!stages) {
+	return VK_ERROR_OUT_OF_HOST_MEMORY;
+    }
+    for(uint32_t i = 0; i < info->waitSemaphoreCount; i++) {
+	stages[i] = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    }
+    VkSubmitInfo submit = {
+	.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+	.waitSemaphoreCount = info->waitSemaphoreCount,
+	.pWaitSemaphores = info->pWaitSemaphores,
+	.pWaitDstStageMask = stages,
+	.commandBufferCount = command_count,
+	.pCommandBuffers = commands,
+	.signalSemaphoreCount = handled,
+	.pSignalSemaphores = semaphores,
+    };
+    VkResult result = smaa->vk.QueueSubmit(queue, 1, &submit, fences[0]);
+    free(stages);
+    // Signaled once everything before is done, i.e. along with fences[0]
+    for(uint32_t i = 1; i < handled && result == VK_SUCCESS; i++) {
+	result = smaa->vk.QueueSubmit(queue, 0, 0, fences[i]);
+    }
+    if(result != VK_SUCCESS) {
+	fprintf(stderr, "with_smaa: cannot submit the SMAA command buffers\n");
+	return result;
+    }
+
+    VkPresentInfoKHR present = *info;
+    present.waitSemaphoreCount = handled;
+    present.pWaitSemaphores = semaphores;
+    return smaa->vk.QueuePresentKHR(queue, &present);
+}
+
+static
+PFN_vkVoidFunction layer_device_function(const char *name)
+{
+#define LAYER_HOOK(function) \
+    if(!strcmp(name, "vk" #function)) { \
+	return (PFN_vkVoidFunction)layer_##function; \
+    }
+    LAYER_HOOK(DestroyDevice)
+    LAYER_HOOK(GetDeviceQueue)
+    LAYER_HOOK(GetDeviceQueue2)
+    LAYER_HOOK(CreateSwapchainKHR)
+    LAYER_HOOK(DestroySwapchainKHR)
+    LAYER_HOOK(QueuePresentKHR)
+#undef LAYER_HOOK
+    if(!strcmp(name, "vkGetDeviceProcAddr")) {
+	return (PFN_vkVoidFunction)with_smaa_GetDeviceProcAddr;
+    }
+    return 0;
+}
+
+public
+PFN_vkVoidFunction VKAPI_CALL with_smaa_GetDeviceProcAddr(VkDevice handle, const char *name)
+{
+    LayerDevice *device = layer_device(handle);
+    PFN_vkVoidFunction function = device ? device->get_device_proc_addr(handle, name) : 0;
+    // Not hooking what the device doesn't have, e.g. vkGetDeviceQueue2 of Vulkan 1.0
+    PFN_vkVoidFunction hook = function ? layer_device_function(name) : 0;
+    return hook ? hook : function;
+}
+
+public
+PFN_vkVoidFunction VKAPI_CALL with_smaa_GetInstanceProcAddr(VkInstance handle, const char *name)
+{
+    if(!strcmp(name, "vkGetInstanceProcAddr")) {
+	return (PFN_vkVoidFunction)with_smaa_GetInstanceProcAddr;
+    }
+    if(!strcmp(name, "vkCreateInstance")) {
+	return (PFN_vkVoidFunction)layer_CreateInstance;
+    }
+    if(!strcmp(name, "vkDestroyInstance")) {
+	return (PFN_vkVoidFunction)layer_DestroyInstance;
+    }
+    if(!strcmp(name, "vkCreateDevice")) {
+	return (PFN_vkVoidFunction)layer_CreateDevice;
+    }
+    PFN_vkVoidFunction function = layer_device_function(name);
+    if(function) {
+	return function;
+    }
+    LayerInstance *instance = handle ? layer_instance(handle) : 0;
+    return instance ? instance->get_instance_proc_addr(handle, name) : 0;
+}
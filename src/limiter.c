@@ -0,0 +1,98 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "smaa.h"
+
+// Also starts the next report over
+static
+void limiter_reset(SMAALimiter *limiter, int current)
+{
+    for(int i = 0; i < SMAA_LIMITER_MAX_FRAMES; i++) {
+	if(current && limiter->fences[i]) {
+	    glDeleteSync(limiter->fences[i]);
+	}
+	limiter->fences[i] = 0;
+    }
+    limiter->next = 0;
+
+    limiter->count = 0;
+    limiter->waited = 0;
+    limiter->wait_ms = 0;
+    limiter->max_ms = 0;
+}
+
+static
+void limiter_report(SMAALimiter *limiter)
+{
+    fprintf(stderr, "with_smaa: limiter: waited in %u of the last %u frames, %.2f ms per frame"
+	    " on average, %.2f ms at most\n", limiter->waited, limiter->count,
+	    limiter->wait_ms / limiter->count, limiter->max_ms);
+
+    limiter->count = 0;
+    limiter->waited = 0;
+    limiter->wait_ms = 0;
+    limiter->max_ms = 0;
+}
+
+internal
+void smaa_limiter_init(SMAALimiter *limiter, int sync)
+{
+    memset(limiter, 0, sizeof(*limiter));
+    limiter->sync = sync;
+}
+
+internal
+void smaa_limiter_configure(SMAALimiter *limiter, const SMAAConfig *config)
+{
+    if(config->max_queued_frames == limiter->frames) {
+	return;
+    }
+
+    // The ring is sized by the number of frames
+    limiter_reset(limiter, 1);
+    limiter->frames = limiter->sync ? config->max_queued_frames : 0;
+
+    if(!limiter->sync && config->max_queued_frames) {
+	fprintf(stderr, "with_smaa: no fences, not limiting queued frames\n");
+    } else if(limiter->frames) {
+	fprintf(stderr, "with_smaa: limiting queued frames to %d\n", limiter->frames);
+    }
+}
+
+internal
+void smaa_limiter_frame(SMAALimiter *limiter)
+{
+    if(!limiter->frames) {
+	return;
+    }
+
+    GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    GLsync oldest = limiter->fences[limiter->next];
+    limiter->fences[limiter->next] = fence;
+    limiter->next = (limiter->next + 1) % limiter->frames;
+
+    if(oldest) {
+	double start = smaa_time_ms();
+	GLenum status = glClientWaitSync(oldest, GL_SYNC_FLUSH_COMMANDS_BIT, SMAA_LIMITER_TIMEOUT);
+	glDeleteSync(oldest);
+
+	if(status != GL_ALREADY_SIGNALED) {
+	    double ms = smaa_time_ms() - start;
+	    limiter->waited++;
+	    limiter->wait_ms += ms;
+	    if(ms > limiter->max_ms) {
+		limiter->max_ms = ms;
+	    }
+	}
+    }
+
+    if(++limiter->count == SMAA_LIMITER_REPORT) {
+	limiter_report(limiter);
+    }
+}
+
+internal
+void smaa_limiter_destroy(SMAALimiter *limiter, int current)
+{
+    limiter_reset(limiter, current);
+}
@@ -0,0 +1,47 @@
+#ifndef WITH_SMAA_LIMITER_H
+#define WITH_SMAA_LIMITER_H
+
+// Include smaa.h instead, which needs SMAALimiter itself
+
+// Keeps the driver from queueing more frames than configured, at the
+// cost of some throughput: after every swap a fence is inserted, and the
+// game only gets back control once the fence of max_queued_frames swaps
+// ago has signaled. With SMAA's passes at swap time the driver otherwise
+// tends to queue more, which adds input latency.
+//
+// The time spent waiting is logged every SMAA_LIMITER_REPORT frames.
+
+#define SMAA_LIMITER_MAX_FRAMES 3
+#define SMAA_LIMITER_REPORT 600
+// A fence that takes longer than this is given up on, in ns
+#define SMAA_LIMITER_TIMEOUT 1000000000
+
+typedef struct SMAALimiter {
+    // Fences are available, without them nothing is limited
+    int sync;
+    // Frames the GPU may be behind, 0 when off
+    int frames;
+
+    // Ring of the last frames' fences, the next one is the oldest
+    GLsync fences[SMAA_LIMITER_MAX_FRAMES];
+    int next;
+
+    // Since the last report
+    unsigned count;
+    unsigned waited;
+    double wait_ms;
+    double max_ms;
+} SMAALimiter;
+
+// Call with a current context
+internal void smaa_limiter_init(SMAALimiter *limiter, int sync);
+
+internal void smaa_limiter_configure(SMAALimiter *limiter, const SMAAConfig *config);
+
+// After every swap, with the context still current
+internal void smaa_limiter_frame(SMAALimiter *limiter);
+
+// With current set, the context is current and the fences are deleted
+internal void smaa_limiter_destroy(SMAALimiter *limiter, int current);
+
+#endif
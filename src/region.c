@@ -0,0 +1,279 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "smaa.h"
+
+// Bars on opposite sides may differ by this much, e.g. for odd sizes
+#define REGION_SYMMETRY 2
+
+internal
+void smaa_region_init(SMAARegion *region, int sync)
+{
+    region->sync = sync;
+    region->buffer = 0;
+    region->buffer_size = 0;
+    region->fence = 0;
+    region->countdown = SMAA_REGION_INTERVAL;
+    region->frame = (SMAARect){ 0, 0, 0, 0 };
+    region->agreed = 0;
+}
+
+internal
+void smaa_region_configure(SMAARegion *region, const SMAAConfig *config)
+{
+    region->letterbox = config->letterbox;
+    region->exclusion_count = config->exclusion_count;
+    memcpy(region->exclusions, config->exclusions, config->exclusion_count * sizeof(SMAAExclusion));
+
+    if(!region->sync && config->letterbox) {
+	fprintf(stderr, "with_smaa: no fences, not detecting letterbox bars\n");
+    }
+}
+
+static
+int region_equal(const SMAARect *a, const SMAARect *b)
+{
+    return a->x == b->x && a->y == b->y && a->width == b->width && a->height == b->height;
+}
+
+static
+int region_contains(const SMAARect *outer, const SMAARect *inner)
+{
+    return inner->x >= outer->x && inner->y >= outer->y
+	&& inner->x + inner->width <= outer->x + outer->width
+	&& inner->y + inner->height <= outer->y + outer->height;
+}
+
+static
+SMAARect region_intersect(const SMAARect *a, const SMAARect *b)
+{
+    int x0 = a->x > b->x ? a->x : b->x;
+    int y0 = a->y > b->y ? a->y : b->y;
+    int x1 = a->x + a->width < b->x + b->width ? a->x + a->width : b->x + b->width;
+    int y1 = a->y + a->height < b->y + b->height ? a->y + a->height : b->y + b->height;
+    return (SMAARect){ x0, y0, x1 > x0 ? x1 - x0 : 0, y1 > y0 ? y1 - y0 : 0 };
+}
+
+static
+int region_black(const uint8_t *pixel)
+{
+    return pixel[0] <= SMAA_REGION_BLACK && pixel[1] <= SMAA_REGION_BLACK
+	&& pixel[2] <= SMAA_REGION_BLACK;
+}
+
+// First and last pixel that isn't black over count lines of length
+// pixels. Returns 0 if all of them are black.
+static
+int region_extent(const uint8_t *lines, int count, int length, int *first, int *last)
+{
+    *first = length;
+    *last = -1;
+    for(int i = 0; i < count; i++) {
+	const uint8_t *line = lines + (size_t)i * length * 4;
+	for(int p = 0; p < *first; p++) {
+	    if(!region_black(line + p * 4)) {
+		*first = p;
+		break;
+	    }
+	}
+	for(int p = length - 1; p > *last; p--) {
+	    if(!region_black(line + p * 4)) {
+		*last = p;
+		break;
+	    }
+	}
+    }
+    return *last >= 0;
+}
+
+// Bars on both sides of the same size, otherwise the dark parts are
+// content rather than bars and the whole length is kept
+static
+void region_bars(int first, int last, int length, int *start, int *size)
+{
+    int after = length - 1 - last;
+    if(abs(first - after) > REGION_SYMMETRY) {
+	first = 0;
+	last = length - 1;
+    }
+    *start = first;
+    *size = last - first + 1;
+}
+
+static
+void region_read(SMAARegion *region, const SMAARect *frame)
+{
+    GLsizeiptr size = (GLsizeiptr)SMAA_REGION_LINES * (frame->width + frame->height) * 4;
+
+    // Neither buffers nor pixel storage modes the game left set may
+    // affect the transfers
+    GLint pack_buffer, pack_alignment, pack_row_length, pack_skip_rows, pack_skip_pixels;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &pack_row_length);
+    glGetIntegerv(GL_PACK_SKIP_ROWS, &pack_skip_rows);
+    glGetIntegerv(GL_PACK_SKIP_PIXELS, &pack_skip_pixels);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_PACK_SKIP_ROWS, 0);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, 0);
+
+    if(!region->buffer) {
+	glGenBuffers(1, &region->buffer);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, region->buffer);
+    if(region->buffer_size != size) {
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+	region->buffer_size = size;
+    }
+
+    // Rows for the pillarbox bars, then columns for the letterbox ones,
+    // evenly spaced and away from the edges
+    GLintptr offset = 0;
+    for(int i = 0; i < SMAA_REGION_LINES; i++) {
+	int y = frame->y + frame->height * (i + 1) / (SMAA_REGION_LINES + 1);
+	glReadPixels(frame->x, y, frame->width, 1, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+	offset += frame->width * 4;
+    }
+    for(int i = 0; i < SMAA_REGION_LINES; i++) {
+	int x = frame->x + frame->width * (i + 1) / (SMAA_REGION_LINES + 1);
+	glReadPixels(x, frame->y, 1, frame->height, GL_RGBA, GL_UNSIGNED_BYTE, (void*)offset);
+	offset += frame->height * 4;
+    }
+
+    region->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region->sampled = *frame;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+    glPixelStorei(GL_PACK_ROW_LENGTH, pack_row_length);
+    glPixelStorei(GL_PACK_SKIP_ROWS, pack_skip_rows);
+    glPixelStorei(GL_PACK_SKIP_PIXELS, pack_skip_pixels);
+}
+
+// The content of the lines read back, 0 if the frame was all black
+static
+int region_measure(SMAARegion *region, SMAARect *content)
+{
+    const SMAARect *frame = &region->sampled;
+
+    GLint pack_buffer;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, region->buffer);
+    const uint8_t *lines = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, region->buffer_size, GL_MAP_READ_BIT);
+
+    int found = 0;
+    if(lines) {
+	int left, right, bottom, top;
+	found = region_extent(lines, SMAA_REGION_LINES, frame->width, &left, &right)
+	    && region_extent(lines + (size_t)SMAA_REGION_LINES * frame->width * 4,
+			     SMAA_REGION_LINES, frame->height, &bottom, &top);
+	if(found) {
+	    region_bars(left, right, frame->width, &content->x, &content->width);
+	    region_bars(bottom, top, frame->height, &content->y, &content->height);
+	}
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+    return found;
+}
+
+static
+void region_found(SMAARegion *region, const SMAARect *content)
+{
+    if(region_equal(content, &region->content)) {
+	region->agreed = 0;
+	return;
+    }
+
+    // Growing is never wrong, shrinking only once it's certain
+    if(!region_contains(&region->content, content)) {
+	region->agreed = SMAA_REGION_AGREE;
+    } else if(region->agreed && region_equal(content, &region->candidate)) {
+	region->agreed++;
+    } else {
+	region->candidate = *content;
+	region->agreed = 1;
+    }
+
+    if(region->agreed >= SMAA_REGION_AGREE) {
+	region->content = *content;
+	region->agreed = 0;
+	fprintf(stderr, "with_smaa: letterbox: anti-aliasing %dx%d at %d,%d of %dx%d\n",
+		content->width, content->height, content->x, content->y,
+		region->frame.width, region->frame.height);
+    }
+}
+
+internal
+SMAARect smaa_region_update(SMAARegion *region, const SMAARect *frame)
+{
+    if(!region_equal(frame, &region->frame)) {
+	region->frame = *frame;
+	region->content = (SMAARect){ 0, 0, frame->width, frame->height };
+	region->agreed = 0;
+    }
+
+    if(!region->sync || !region->letterbox || frame->width <= 0 || frame->height <= 0) {
+	return *frame;
+    }
+
+    if(region->fence) {
+	GLenum status = glClientWaitSync(region->fence, 0, 0);
+	if(status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+	    glDeleteSync(region->fence);
+	    region->fence = 0;
+
+	    // Lines of a frame of another size tell nothing
+	    SMAARect content;
+	    if(region_equal(&region->sampled, frame) && region_measure(region, &content)) {
+		region_found(region, &content);
+	    }
+	}
+    } else if(--region->countdown <= 0) {
+	region->countdown = SMAA_REGION_INTERVAL;
+	region_read(region, frame);
+    }
+
+    return (SMAARect){
+	frame->x + region->content.x, frame->y + region->content.y,
+	region->content.width, region->content.height
+    };
+}
+
+internal
+int smaa_region_exclusions(const SMAARegion *region, const SMAARect *frame,
+			   const SMAARect *active, int grow, SMAARect *rects)
+{
+    int count = 0;
+    for(int i = 0; i < region->exclusion_count; i++) {
+	const SMAAExclusion *exclusion = &region->exclusions[i];
+
+	// Rounded outwards, and upside down for GL
+	int x0 = floorf(exclusion->left * frame->width) - grow;
+	int x1 = ceilf((exclusion->left + exclusion->width) * frame->width) + grow;
+	int y0 = floorf((1 - exclusion->top - exclusion->height) * frame->height) - grow;
+	int y1 = ceilf((1 - exclusion->top) * frame->height) + grow;
+	SMAARect rect = { frame->x + x0, frame->y + y0, x1 - x0, y1 - y0 };
+
+	rect = region_intersect(&rect, active);
+	if(rect.width > 0 && rect.height > 0) {
+	    rect.x -= active->x;
+	    rect.y -= active->y;
+	    rects[count++] = rect;
+	}
+    }
+    return count;
+}
+
+internal
+void smaa_region_destroy(SMAARegion *region, int current)
+{
+    if(current && region->fence) {
+	glDeleteSync(region->fence);
+    }
+    region->fence = 0;
+}
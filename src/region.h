@@ -0,0 +1,70 @@
+#ifndef WITH_SMAA_REGION_H
+#define WITH_SMAA_REGION_H
+
+// Include smaa.h instead, which needs SMAARegion itself
+
+// The part of the frame SMAA runs on, and the parts of it to leave
+// alone. The frame is the viewport, or the whole drawable if its size is
+// known. Letterbox and pillarbox bars are left out: every
+// SMAA_REGION_INTERVAL frames a few rows and columns of the frame are
+// read back, without waiting for them (fences), and the black bars on
+// opposite sides, of the same size, are measured. Content found outside
+// the region grows it right away, it only shrinks once
+// SMAA_REGION_AGREE detections in a row found the same bars.
+//
+// The configured exclusions (the HUD) stay part of the region, but are
+// kept out of edge detection, see smaa_region_exclusions().
+
+#define SMAA_REGION_LINES 8
+#define SMAA_REGION_INTERVAL 30
+#define SMAA_REGION_AGREE 3
+// Brightest value of a color channel that still counts as black
+#define SMAA_REGION_BLACK 8
+
+typedef struct SMAARect {
+    int x, y, width, height;
+} SMAARect;
+
+typedef struct SMAARegion {
+    // Fences are available, without them nothing is detected
+    int sync;
+    int letterbox;
+    SMAAExclusion exclusions[SMAA_MAX_EXCLUSIONS];
+    int exclusion_count;
+
+    // Pixel pack buffer the lines are read into, in flight until fence
+    // is signaled
+    GLuint buffer;
+    GLsizeiptr buffer_size;
+    GLsync fence;
+    // Frame the lines in flight were read from
+    SMAARect sampled;
+    int countdown;
+
+    // Frame the content was found in, and the content, relative to it
+    SMAARect frame;
+    SMAARect content;
+    // Smaller content the last detections agreed on
+    SMAARect candidate;
+    int agreed;
+} SMAARegion;
+
+// Call with a current context
+internal void smaa_region_init(SMAARegion *region, int sync);
+
+internal void smaa_region_configure(SMAARegion *region, const SMAAConfig *config);
+
+// Once per frame, with the frame in the read framebuffer: the part of
+// the frame to anti-alias
+internal SMAARect smaa_region_update(SMAARegion *region, const SMAARect *frame);
+
+// The exclusions of frame that intersect active, grown by grow pixels on
+// every side, relative to active. Returns their number.
+internal int smaa_region_exclusions(const SMAARegion *region, const SMAARect *frame,
+				    const SMAARect *active, int grow, SMAARect *rects);
+
+// With current set, the context is current and the fence is deleted.
+// The buffer is left to the caller.
+internal void smaa_region_destroy(SMAARegion *region, int current);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <stdarg.h>
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
@@ -10,46 +11,105 @@
 #include <dlfcn.h>
 
 #include "smaa.h"
+#include "state.h"
+#include "instance.h"
+#include "shim_hash.h"
+#include "trace.h"
 
 #include <GL/glx.h>
 #include <EGL/egl.h>
 
-#ifndef __LP64__
-#define lib_path(lib) "/usr/lib32/" lib
-#else
-#define lib_path(lib) "/usr/lib/" lib
-#endif
-
+// Where the real GLX and EGL functions are looked up: RTLD_NEXT if the
+// application is linked against the library, else the library opened by
+// soname, which also finds it if the application loaded it privately.
 static void *libGL = 0;
 static void (*_glXSwapBuffers)(Display *dpy, GLXDrawable drawable);
 static void (*(*_glXGetProcAddress)(const GLubyte *procName))();
+static Bool (*_glXMakeCurrent)(Display *dpy, GLXDrawable drawable, GLXContext ctx);
+static Bool (*_glXMakeContextCurrent)(Display *dpy, GLXDrawable draw, GLXDrawable read, GLXContext ctx);
+static void (*_glXDestroyContext)(Display *dpy, GLXContext ctx);
+static GLXContext (*_glXGetCurrentContext)(void);
+static GLXContext (*_glXCreateContext)(Display *dpy, XVisualInfo *vis, GLXContext share_list, Bool direct);
+static GLXContext (*_glXCreateNewContext)(Display *dpy, GLXFBConfig config, int render_type, GLXContext share_list, Bool direct);
+static GLXContext (*_glXCreateContextAttribsARB)(Display *dpy, GLXFBConfig config, GLXContext share_context, Bool direct, const int *attrib_list);
 
 static void *libEGL = 0;
 static EGLBoolean (*_eglSwapBuffers)(EGLDisplay display, EGLSurface surface);
+static void (*(*_eglGetProcAddress)(const char *procname))();
+static EGLBoolean (*_eglMakeCurrent)(EGLDisplay display, EGLSurface draw, EGLSurface read, EGLContext context);
+static EGLBoolean (*_eglDestroyContext)(EGLDisplay display, EGLContext context);
+static EGLContext (*_eglGetCurrentContext)(void);
+static EGLContext (*_eglCreateContext)(EGLDisplay display, EGLConfig config, EGLContext share_context, const EGLint *attrib_list);
+static EGLBoolean (*_eglQuerySurface)(EGLDisplay display, EGLSurface surface, EGLint attribute, EGLint *value);
 
 static void * (*real_dlsym)(void *, const char *) = 0;
 
+static void *shim_redirect(const char *name);
+static void shim_load_dlsym();
+
+// Logging from the lookup hooks is off unless WITH_SMAA_VERBOSE=1, games
+// look up thousands of functions
+static
+void shim_log(const char *format, ...)
+{
+    static int verbose = -1;
+    if(verbose < 0) {
+	const char *env = getenv("WITH_SMAA_VERBOSE");
+	verbose = env && env[0] && strcmp(env, "0");
+    }
+    if(!verbose) {
+	return;
+    }
+
+    va_list arguments;
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+}
+
+static
+void *shim_open(const char *soname, const char *probe)
+{
+    shim_load_dlsym();
+
+    if(real_dlsym(RTLD_NEXT, probe)) {
+	return RTLD_NEXT;
+    }
+
+    void *library = dlopen(soname, RTLD_LAZY);
+    if(!library) {
+	fputs(dlerror(), stderr);
+	exit(1);
+    }
+    shim_log("with_smaa: opened %s\n", soname);
+    return library;
+}
+
 static
 void shim_load_libGL()
 {
     if(!libGL) {
-	libGL = dlopen(lib_path("libGL.so"), RTLD_LAZY);
-
-	fprintf(stderr, "%s\n", lib_path("libGL.so"));
-	
-	if(!libGL) {
-	    fputs(dlerror(), stderr);
-	    exit(1);
-	}
+	libGL = shim_open("libGL.so.1", "glXSwapBuffers");
+	dlerror();
 
 	_glXSwapBuffers = (void (*)(Display*, GLXDrawable))real_dlsym(libGL, "glXSwapBuffers");
 	_glXGetProcAddress = (void (*(*)(const GLubyte *procName))())real_dlsym(libGL, "glXGetProcAddressARB");
+	_glXMakeCurrent = (Bool (*)(Display*, GLXDrawable, GLXContext))real_dlsym(libGL, "glXMakeCurrent");
+	_glXMakeContextCurrent = (Bool (*)(Display*, GLXDrawable, GLXDrawable, GLXContext))real_dlsym(libGL, "glXMakeContextCurrent");
+	_glXDestroyContext = (void (*)(Display*, GLXContext))real_dlsym(libGL, "glXDestroyContext");
+	_glXGetCurrentContext = (GLXContext (*)(void))real_dlsym(libGL, "glXGetCurrentContext");
+	_glXCreateContext = (GLXContext (*)(Display*, XVisualInfo*, GLXContext, Bool))real_dlsym(libGL, "glXCreateContext");
+	_glXCreateNewContext = (GLXContext (*)(Display*, GLXFBConfig, int, GLXContext, Bool))real_dlsym(libGL, "glXCreateNewContext");
 
 	const char *error;
 	if((error = dlerror())) {
 	    fputs(error, stderr);
 	    exit(1);
 	}
+
+	// An extension, libGL needn't export it
+	_glXCreateContextAttribsARB = (GLXContext (*)(Display*, GLXFBConfig, GLXContext, Bool, const int*))
+	    (void*) _glXGetProcAddress((const GLubyte*) "glXCreateContextAttribsARB");
     }
 }
 
@@ -57,13 +117,17 @@ static
 void shim_load_libEGL()
 {
     if(!libEGL) {
-	libEGL = dlopen(lib_path("libEGL.so"), RTLD_LAZY);
-	if(!libEGL) {
-	    fputs(dlerror(), stderr);
-	    exit(1);
-	}
-
-	_eglSwapBuffers = (EGLBoolean (*)(EGLDisplay, EGLSurface))dlsym(libEGL, "eglSwapBuffers");
+	libEGL = shim_open("libEGL.so.1", "eglSwapBuffers");
+	dlerror();
+
+	// Not through dlsym, that would return the hooks
+	_eglSwapBuffers = (EGLBoolean (*)(EGLDisplay, EGLSurface))real_dlsym(libEGL, "eglSwapBuffers");
+	_eglGetProcAddress = (void (*(*)(const char*))())real_dlsym(libEGL, "eglGetProcAddress");
+	_eglMakeCurrent = (EGLBoolean (*)(EGLDisplay, EGLSurface, EGLSurface, EGLContext))real_dlsym(libEGL, "eglMakeCurrent");
+	_eglDestroyContext = (EGLBoolean (*)(EGLDisplay, EGLContext))real_dlsym(libEGL, "eglDestroyContext");
+	_eglGetCurrentContext = (EGLContext (*)(void))real_dlsym(libEGL, "eglGetCurrentContext");
+	_eglCreateContext = (EGLContext (*)(EGLDisplay, EGLConfig, EGLContext, const EGLint*))real_dlsym(libEGL, "eglCreateContext");
+	_eglQuerySurface = (EGLBoolean (*)(EGLDisplay, EGLSurface, EGLint, EGLint*))real_dlsym(libEGL, "eglQuerySurface");
 
 	const char *error;
 	if((error = dlerror())) {
@@ -73,21 +137,30 @@ void shim_load_libEGL()
     }
 }
 
-static SMAA *global_smaa = 0;
-
 void glXSwapBuffers(Display *dpy, GLXDrawable drawable)
 {
+    SMAA_TRACE("glXSwapBuffers");
     if(!libGL) {
 	shim_load_libGL();
     }
 
-    if(!global_smaa) {
-	global_smaa = smaa_create();
+    // glXQueryDrawable raises BadDrawable for plain X windows on some
+    // servers, so GLX sticks with the viewport for the size
+    SMAA *smaa = smaa_instance_current(_glXGetCurrentContext());
+    if(smaa) {
+	SMAA_TRACE("smaa_update");
+	smaa_update(smaa, 0, 0);
     }
 
-    smaa_update(global_smaa);
-
-    _glXSwapBuffers(dpy, drawable);
+    {
+	SMAA_TRACE("swap");
+	_glXSwapBuffers(dpy, drawable);
+    }
+    if(smaa) {
+	SMAA_TRACE("limit");
+	smaa_limit(smaa);
+    }
+    SMAA_TRACE_POLL();
 }
 
 void (*(glXGetProcAddress)(const GLubyte *procName))()
@@ -96,9 +169,10 @@ void (*(glXGetProcAddress)(const GLubyte *procName))()
 	shim_load_libGL();
     }
 
-    if(!strcmp((const char*) procName, "glXSwapBuffers")) {
-	fprintf(stderr, "with_smaa: glXGetProcAddress[ARB]: redirecting glXSwapBuffers\n");
-	return (void (*)()) glXSwapBuffers;
+    void *redirect = shim_redirect((const char*) procName);
+    if(redirect) {
+	shim_log("with_smaa: glXGetProcAddress: redirecting %s\n", procName);
+	return (void (*)()) redirect;
     }
 
     return _glXGetProcAddress(procName);
@@ -109,44 +183,330 @@ void (*(glXGetProcAddressARB)(const GLubyte *procName))()
     return glXGetProcAddress(procName);
 }
 
+Bool glXMakeCurrent(Display *dpy, GLXDrawable drawable, GLXContext ctx)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    Bool r = _glXMakeCurrent(dpy, drawable, ctx);
+    if(r) {
+	smaa_instance_make_current(ctx);
+	if(ctx && drawable) {
+	    smaa_instance_prewarm();
+	}
+    }
+    return r;
+}
+
+Bool glXMakeContextCurrent(Display *dpy, GLXDrawable draw, GLXDrawable read, GLXContext ctx)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    Bool r = _glXMakeContextCurrent(dpy, draw, read, ctx);
+    if(r) {
+	smaa_instance_make_current(ctx);
+	if(ctx && draw) {
+	    smaa_instance_prewarm();
+	}
+    }
+    return r;
+}
+
+GLXContext glXCreateContext(Display *dpy, XVisualInfo *vis, GLXContext share_list, Bool direct)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    GLXContext ctx = _glXCreateContext(dpy, vis, share_list, direct);
+    smaa_instance_created(ctx, share_list);
+    return ctx;
+}
+
+GLXContext glXCreateNewContext(Display *dpy, GLXFBConfig config, int render_type, GLXContext share_list, Bool direct)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    GLXContext ctx = _glXCreateNewContext(dpy, config, render_type, share_list, direct);
+    smaa_instance_created(ctx, share_list);
+    return ctx;
+}
+
+GLXContext glXCreateContextAttribsARB(Display *dpy, GLXFBConfig config, GLXContext share_context, Bool direct, const int *attrib_list)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    if(!_glXCreateContextAttribsARB) {
+	return 0;
+    }
+    GLXContext ctx = _glXCreateContextAttribsARB(dpy, config, share_context, direct, attrib_list);
+    smaa_instance_created(ctx, share_context);
+    return ctx;
+}
+
+void glXDestroyContext(Display *dpy, GLXContext ctx)
+{
+    if(!libGL) {
+	shim_load_libGL();
+    }
+
+    smaa_instance_destroyed(ctx);
+    _glXDestroyContext(dpy, ctx);
+}
+
 EGLBoolean eglSwapBuffers(EGLDisplay display, EGLSurface surface)
+{
+    SMAA_TRACE("eglSwapBuffers");
+    if(!libEGL) {
+	shim_load_libEGL();
+    }
+
+    SMAA *smaa = smaa_instance_current(_eglGetCurrentContext());
+    if(smaa) {
+	EGLint width = 0, height = 0;
+	if(!_eglQuerySurface(display, surface, EGL_WIDTH, &width)
+	   || !_eglQuerySurface(display, surface, EGL_HEIGHT, &height)) {
+	    width = height = 0;
+	}
+	SMAA_TRACE("smaa_update");
+	smaa_update(smaa, width, height);
+    }
+
+    EGLBoolean r;
+    {
+	SMAA_TRACE("swap");
+	r = _eglSwapBuffers(display, surface);
+    }
+    if(smaa) {
+	SMAA_TRACE("limit");
+	smaa_limit(smaa);
+    }
+    SMAA_TRACE_POLL();
+    return r;
+}
+
+EGLBoolean eglMakeCurrent(EGLDisplay display, EGLSurface draw, EGLSurface read, EGLContext context)
 {
     if(!libEGL) {
 	shim_load_libEGL();
     }
 
-    if(!global_smaa) {
-	global_smaa = smaa_create();
+    EGLBoolean r = _eglMakeCurrent(display, draw, read, context);
+    if(r) {
+	smaa_instance_make_current(context);
+	if(context != EGL_NO_CONTEXT && draw != EGL_NO_SURFACE) {
+	    smaa_instance_prewarm();
+	}
     }
+    return r;
+}
+
+EGLContext eglCreateContext(EGLDisplay display, EGLConfig config, EGLContext share_context, const EGLint *attrib_list)
+{
+    if(!libEGL) {
+	shim_load_libEGL();
+    }
+
+    EGLContext context = _eglCreateContext(display, config, share_context, attrib_list);
+    smaa_instance_created(context, share_context);
+    return context;
+}
 
-    smaa_update(global_smaa);
+EGLBoolean eglDestroyContext(EGLDisplay display, EGLContext context)
+{
+    if(!libEGL) {
+	shim_load_libEGL();
+    }
 
-    return _eglSwapBuffers(display, surface);
+    smaa_instance_destroyed(context);
+    return _eglDestroyContext(display, context);
 }
 
-void *__libc_dlsym (void *, const char *);
+void (*(eglGetProcAddress)(const char *procname))()
+{
+    if(!libEGL) {
+	shim_load_libEGL();
+    }
 
-void *dlsym(void *handle, const char *name)
+    void *redirect = shim_redirect(procname);
+    if(redirect) {
+	shim_log("with_smaa: eglGetProcAddress: redirecting %s\n", procname);
+	return (void (*)()) redirect;
+    }
+
+    return _eglGetProcAddress(procname);
+}
+
+// Zero copy: SMAA reads the texture the game blits to the default
+// framebuffer, see smaa_blit(). SMAA's own blits come through here too.
+static
+void shim_blit(__typeof__(glBlitFramebuffer) *real,
+	       GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+	       GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+	       GLbitfield mask, GLenum filter)
+{
+    SMAA *smaa = smaa_instance_active();
+    if(smaa && smaa_blit(smaa, src_x0, src_y0, src_x1, src_y1, dst_x0, dst_y0, dst_x1, dst_y1, mask)) {
+	mask &= ~GL_COLOR_BUFFER_BIT;
+	if(!mask) {
+	    return;
+	}
+    }
+    real(src_x0, src_y0, src_x1, src_y1, dst_x0, dst_y0, dst_x1, dst_y1, mask, filter);
+}
+
+void glBlitFramebuffer(GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+		       GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+		       GLbitfield mask, GLenum filter)
+{
+    static __typeof__(glBlitFramebuffer) *real;
+    if(!real) {
+	real = (__typeof__(glBlitFramebuffer)*) shim_real_proc("glBlitFramebuffer");
+    }
+    shim_blit(real, src_x0, src_y0, src_x1, src_y1, dst_x0, dst_y0, dst_x1, dst_y1, mask, filter);
+}
+
+void glBlitFramebufferEXT(GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+			  GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1,
+			  GLbitfield mask, GLenum filter)
+{
+    static __typeof__(glBlitFramebuffer) *real;
+    if(!real) {
+	real = (__typeof__(glBlitFramebuffer)*) shim_real_proc("glBlitFramebufferEXT");
+    }
+    shim_blit(real, src_x0, src_y0, src_x1, src_y1, dst_x0, dst_y0, dst_x1, dst_y1, mask, filter);
+}
+
+// Everything in shim_hooks.list, generated at build time
+typedef struct ShimHook {
+    const char *name;
+    void *proc;
+    // Returned by dlsym even if the library asked doesn't have it
+    int always;
+    // A setter state.c shadows
+    int state;
+} ShimHook;
+
+#define SHIM_HOOK(name, always, state) { #name, (void*) name, always, state }
+
+#include "shim_hooks.h"
+
+// The real functions behind the hooks, see shim_real_proc()
+static void *shim_real[SHIM_HOOK_SLOTS];
+
+// Slot of name in shim_hooks, -1 if it isn't intercepted
+static
+int shim_hook_find(const char *name)
 {
+    int slot = shim_hash(name, SHIM_HOOK_SEED) & (SHIM_HOOK_SLOTS - 1);
+    if(shim_hooks[slot].name && !strcmp(shim_hooks[slot].name, name)) {
+	return slot;
+    }
+    return -1;
+}
+
+static
+void *shim_redirect(const char *name)
+{
+    int slot = shim_hook_find(name);
+    return slot >= 0 ? shim_hooks[slot].proc : 0;
+}
+
+// For what the libraries don't export, from the API the application
+// uses. Doesn't open either library, an EGL application needn't have
+// libGL and a GLX one libEGL.
+static
+void *shim_get_proc_address(const char *name)
+{
+    if(libEGL && (!libGL || _eglGetCurrentContext() != EGL_NO_CONTEXT)) {
+	return (void*) _eglGetProcAddress(name);
+    }
+    if(libGL) {
+	return (void*) _glXGetProcAddress((const GLubyte*) name);
+    }
+
+    // Nothing went through the hooks yet
+    void (*(*egl)(const char*))() = (void (*(*)(const char*))()) real_dlsym(RTLD_NEXT, "eglGetProcAddress");
+    if(egl) {
+	return (void*) egl(name);
+    }
+    void (*(*glx)(const GLubyte*))() = (void (*(*)(const GLubyte*))()) real_dlsym(RTLD_NEXT, "glXGetProcAddressARB");
+    if(glx) {
+	return (void*) glx((const GLubyte*) name);
+    }
+    return 0;
+}
+
+internal
+void *shim_real_proc(const char *name)
+{
+    int slot = shim_hook_find(name);
+    void *proc = slot >= 0 ? __atomic_load_n(&shim_real[slot], __ATOMIC_ACQUIRE) : 0;
+    if(proc) {
+	return proc;
+    }
+
+    shim_load_dlsym();
+
+    // Whichever library the application gets GL from comes after us
+    proc = real_dlsym(RTLD_NEXT, name);
+    if(!proc) {
+	proc = shim_get_proc_address(name);
+    }
+    if(!proc) {
+	fprintf(stderr, "with_smaa: cannot find %s\n", name);
+    }
+
+    if(slot >= 0) {
+	__atomic_store_n(&shim_real[slot], proc, __ATOMIC_RELEASE);
+    }
+    return proc;
+}
+
+// glibc >= 2.34 has dlsym in libc, older versions in libdl. Either comes
+// after us, asking for the version finds the real one instead of ours.
+static
+void shim_load_dlsym()
+{
+    static const char *versions[] = { "GLIBC_2.34", "GLIBC_2.2.5", "GLIBC_2.17", "GLIBC_2.0" };
+
     if(!real_dlsym) {
-	fprintf(stderr, "with_smaa: Getting real dlsym...\n");
-	void *libdl = dlopen(lib_path("libdl.so"), RTLD_NOW);
-	real_dlsym = __libc_dlsym(libdl, "dlsym");	
-	fprintf(stderr, "with_smaa: real_dlsym=%p\n", real_dlsym);
-    }
-    
-    if (!strcmp(name, "dlsym")) {
-	return (void*) dlsym;
-    } else if(!strcmp(name, "glXGetProcAddressARB")) {
-	fprintf(stderr, "with_smaa: dlsym: redirecting glXGetProcAddressARB\n");
-	return (void*) glXGetProcAddress;
-    } else if(!strcmp(name, "glXGetProcAddress")) {
-	fprintf(stderr, "with_smaa: dlsym: redirecting glXGetProcAddress\n");
-	return (void*) glXGetProcAddress;
-    } else if(!strcmp(name, "glXSwapBuffers")) {
-	fprintf(stderr, "with_smaa: dlsym: redirecting glXSwapBuffers\n");
-	return (void*) glXSwapBuffers;
-    }
-
-    return real_dlsym(handle, name);
+	for(size_t i = 0; !real_dlsym && i < sizeof(versions) / sizeof(versions[0]); i++) {
+	    real_dlsym = (void* (*)(void*, const char*)) dlvsym(RTLD_NEXT, "dlsym", versions[i]);
+	}
+	if(!real_dlsym) {
+	    fprintf(stderr, "with_smaa: cannot find the real dlsym\n");
+	    exit(1);
+	}
+	shim_log("with_smaa: real_dlsym=%p\n", (void*) real_dlsym);
+    }
+}
+
+void *dlsym(void *handle, const char *name)
+{
+    shim_load_dlsym();
+
+    void *proc = real_dlsym(handle, name);
+
+    int slot = shim_hook_find(name);
+    if(slot < 0 || (!proc && !shim_hooks[slot].always)) {
+	return proc;
+    }
+    if(shim_hooks[slot].state && proc != shim_real_proc(name)) {
+	// A GL library looking up a vendor implementation, or the
+	// application getting GL from another library than the one the
+	// wrapper calls. Either way calls to it don't reach state.c.
+	smaa_state_unwrapped(name);
+	return proc;
+    }
+
+    shim_log("with_smaa: dlsym: redirecting %s\n", name);
+    return shim_hooks[slot].proc;
 }
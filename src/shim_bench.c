@@ -0,0 +1,249 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include <dlfcn.h>
+
+// Measures what the shim adds to the function lookups a game does at
+// startup: dlsym() and glXGetProcAddress() for every GL entry point of
+// a header, like an extension loader does. With --shim, runs the lookups
+// once without and once with the shim preloaded and compares them.
+//
+//     shim_bench --shim ./libwith_smaa_shim.so
+
+#define BENCH_MAX_NAMES 8192
+
+typedef struct BenchLookups {
+    // The first round, with the libraries' own caches cold
+    double first_ms;
+    // Best of the remaining rounds
+    double warm_ms;
+    int count;
+} BenchLookups;
+
+static char *bench_names[BENCH_MAX_NAMES];
+static int bench_name_count = 0;
+
+static
+double bench_time_ms()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+// Collects "APIENTRY glName (" prototypes, as in glcorearb.h and glext.h
+static
+int bench_load_names(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if(!file) {
+	fprintf(stderr, "shim_bench: cannot open %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+
+    char line[1024];
+    while(fgets(line, sizeof(line), file) && bench_name_count < BENCH_MAX_NAMES) {
+	char *name = strstr(line, "APIENTRY gl");
+	if(!name || strstr(line, "typedef")) {
+	    continue;
+	}
+	name += strlen("APIENTRY ");
+	size_t length = strcspn(name, " (");
+	bench_names[bench_name_count] = malloc(length + 1);
+	memcpy(bench_names[bench_name_count], name, length);
+	bench_names[bench_name_count][length] = 0;
+	bench_name_count++;
+    }
+
+    fclose(file);
+    if(!bench_name_count) {
+	fprintf(stderr, "shim_bench: no GL prototypes in %s\n", path);
+    }
+    return bench_name_count > 0;
+}
+
+static
+int bench_lookups(int rounds, BenchLookups *result)
+{
+    result->first_ms = 0;
+    result->warm_ms = -1;
+    result->count = 0;
+
+    double start = bench_time_ms();
+
+    void *libGL = dlopen("libGL.so.1", RTLD_LAZY | RTLD_LOCAL);
+    if(!libGL) {
+	fprintf(stderr, "shim_bench: %s\n", dlerror());
+	return 0;
+    }
+    void *(*get_proc_address)(const unsigned char*) =
+	(void *(*)(const unsigned char*)) dlsym(libGL, "glXGetProcAddressARB");
+    if(!get_proc_address) {
+	fprintf(stderr, "shim_bench: no glXGetProcAddressARB\n");
+	return 0;
+    }
+
+    // Keeps the lookups from being optimized away
+    volatile size_t found = 0;
+
+    for(int round = 0; round < rounds; round++) {
+	if(round) {
+	    start = bench_time_ms();
+	}
+	for(int i = 0; i < bench_name_count; i++) {
+	    found += dlsym(libGL, bench_names[i]) != 0;
+	    found += get_proc_address((const unsigned char*) bench_names[i]) != 0;
+	}
+	double time = bench_time_ms() - start;
+
+	if(!round) {
+	    result->first_ms = time;
+	} else if(result->warm_ms < 0 || time < result->warm_ms) {
+	    result->warm_ms = time;
+	}
+    }
+    result->count = 2 * bench_name_count;
+
+    return found > 0;
+}
+
+// Runs this program again with --child, with LD_PRELOAD set to shim or
+// unset, and reads its results
+static
+int bench_run_child(const char *self, const char *header, int rounds, const char *shim,
+		    BenchLookups *result)
+{
+    int fds[2];
+    if(pipe(fds)) {
+	perror("shim_bench: pipe");
+	return 0;
+    }
+
+    pid_t pid = fork();
+    if(pid < 0) {
+	perror("shim_bench: fork");
+	return 0;
+    }
+    if(!pid) {
+	close(fds[0]);
+	dup2(fds[1], 1);
+	if(shim) {
+	    setenv("LD_PRELOAD", shim, 1);
+	} else {
+	    unsetenv("LD_PRELOAD");
+	}
+	char rounds_arg[16];
+	snprintf(rounds_arg, sizeof(rounds_arg), "%d", rounds);
+	execl(self, self, "--header", header, "--rounds", rounds_arg, "--child", "1", (char*)0);
+	perror("shim_bench: exec");
+	_exit(127);
+    }
+
+    close(fds[1]);
+    FILE *output = fdopen(fds[0], "r");
+    int ok = output && fscanf(output, "%lf %lf %d", &result->first_ms, &result->warm_ms, &result->count) == 3;
+    if(output) {
+	fclose(output);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return ok && WIFEXITED(status) && !WEXITSTATUS(status);
+}
+
+static
+void bench_print(const char *label, const BenchLookups *lookups)
+{
+    printf("%-12s first %8.3f ms, then %7.1f ns per lookup\n", label,
+	   lookups->first_ms, lookups->warm_ms * 1000000.0 / lookups->count);
+}
+
+static
+void bench_usage()
+{
+    fprintf(stderr,
+	    "usage: shim_bench [options]\n"
+	    "  --shim LIB     compare against a run with LIB preloaded\n"
+	    "  --header FILE  GL header to take the names from\n"
+	    "                 (default /usr/include/GL/glcorearb.h)\n"
+	    "  --rounds N     lookups of every name (default 10)\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *shim = 0;
+    const char *header = "/usr/include/GL/glcorearb.h";
+    int rounds = 10;
+    int child = 0;
+
+    for(int i = 1; i < argc; i++) {
+	const char *option = argv[i];
+	const char *value = i + 1 < argc ? argv[i + 1] : 0;
+	if(!value) {
+	    bench_usage();
+	    return 1;
+	}
+	i++;
+
+	if(!strcmp(option, "--shim")) {
+	    shim = value;
+	} else if(!strcmp(option, "--header")) {
+	    header = value;
+	} else if(!strcmp(option, "--rounds")) {
+	    rounds = atoi(value) > 1 ? atoi(value) : 2;
+	} else if(!strcmp(option, "--child")) {
+	    child = 1;
+	} else {
+	    bench_usage();
+	    return 1;
+	}
+    }
+
+    if(!bench_load_names(header)) {
+	return 1;
+    }
+
+    if(child || !shim) {
+	BenchLookups lookups;
+	if(!bench_lookups(rounds, &lookups)) {
+	    return 1;
+	}
+	if(child) {
+	    printf("%f %f %d\n", lookups.first_ms, lookups.warm_ms, lookups.count);
+	} else {
+	    printf("%d lookups (dlsym and glXGetProcAddress of %d names)\n", lookups.count, bench_name_count);
+	    bench_print("this process", &lookups);
+	}
+	return 0;
+    }
+
+    // The shim is found through the dynamic linker's search path unless
+    // a path is given, like with_smaa does
+    char self[4096];
+    ssize_t length = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    if(length < 0) {
+	perror("shim_bench: /proc/self/exe");
+	return 1;
+    }
+    self[length] = 0;
+
+    BenchLookups without, with;
+    if(!bench_run_child(self, header, rounds, 0, &without)
+       || !bench_run_child(self, header, rounds, shim, &with)) {
+	fprintf(stderr, "shim_bench: lookups failed\n");
+	return 1;
+    }
+
+    printf("%d lookups (dlsym and glXGetProcAddress of %d names)\n", without.count, bench_name_count);
+    bench_print("without shim", &without);
+    bench_print("with shim", &with);
+    printf("%-12s first %+8.3f ms, then %+7.1f ns per lookup\n", "overhead",
+	   with.first_ms - without.first_ms,
+	   (with.warm_ms - without.warm_ms) * 1000000.0 / without.count);
+    return 0;
+}
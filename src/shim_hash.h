@@ -0,0 +1,21 @@
+#ifndef WITH_SMAA_SHIM_HASH_H
+#define WITH_SMAA_SHIM_HASH_H
+
+#include <stdint.h>
+
+// Hash of the names the shim intercepts. gen_shim_hooks picks a seed for
+// which no two of them land in the same slot, so a lookup in shim.c is
+// one hash and at most one strcmp.
+static inline
+uint32_t shim_hash(const char *name, uint32_t seed)
+{
+    // FNV-1a, with the high bits folded into the ones used for the slot
+    uint32_t hash = 2166136261u ^ seed;
+    while(*name) {
+	hash ^= (unsigned char)*name++;
+	hash *= 16777619u;
+    }
+    return hash ^ (hash >> 16);
+}
+
+#endif
@@ -2,11 +2,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "AreaTex.h"
 #include "SearchTex.h"
 
 #include "smaa.h"
+#include "cache.h"
+#include "state.h"
+#include "trace.h"
+#include "smaa_sources.h"
 #include "smaa_shader.h"
 
 static
@@ -26,11 +31,27 @@ GLuint smaa_compile_shader(const char *source, int source_length, GLenum type)
     glShaderSource(shader, 1, &source, &source_length);
     glCompileShader(shader);
 
+    // The compile status is only queried once the program has been
+    // linked (smaa_finish_program), so this does not wait for the driver.
+    return shader;
+}
+
+static
+void smaa_check_shader(GLuint shader)
+{
     GLint compile_status;
     glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
     if(compile_status == GL_FALSE) {
 	fprintf(stderr, "smaa_compile_shader error\n");
+
+	GLint source_length;
+	glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &source_length);
+
+	char *source = malloc(source_length);
+	glGetShaderSource(shader, source_length, 0, source);
 	fputs(source, stderr);
+	free(source);
+
 	fprintf(stderr, "\n\nShader info log:\n");
 
 	GLint info_log_length;
@@ -40,12 +61,7 @@ GLuint smaa_compile_shader(const char *source, int source_length, GLenum type)
 	glGetShaderInfoLog(shader, info_log_length, 0, info_log);
 	fputs(info_log, stderr);
 	free(info_log);
-
-	glDeleteShader(shader);
-	return 0;
     }
-
-    return shader;
 }
 
 static
@@ -72,37 +88,41 @@ const char *strErrorGl(GLenum error)
 
 
 static
-void smaa_compile_smaa(GLuint program, GLenum type, const char *defs, const char *main)
+void smaa_compile_smaa(GLuint program, GLenum type, const char *defs,
+		       const char *body, const char *main)
 {
     // It appears there is a bug regarding passing multiple strings
     // to glShaderSource with MESA. It won't replace #defines made in
     // a string passed after a string #defining it.
-
-    char *fs_vs = "";
-    if(type == GL_VERTEX_SHADER) {
-	fs_vs = "#define SMAA_INCLUDE_PS 0\n";
-    }
-
-    size_t source_size = strlen(defs) + strlen(fs_vs)
-	+ strlen(main) + sizeof(SMAA_hlsl) + 1;
-    char *source = malloc(source_size);
-    source[0] = 0;
-    strncat(source, defs, source_size);
-    strncat(source, fs_vs, source_size);
-    strncat(source, (char*) SMAA_hlsl, source_size);
-    strncat(source, main, source_size);
-
-    glAttachShader(program, smaa_compile_shader(source, source_size, type));
+    size_t defs_length = strlen(defs), body_length = strlen(body);
+    size_t main_length = strlen(main);
+    size_t source_length = defs_length + body_length + main_length;
+    char *source = malloc(source_length + 1);
+    memcpy(source, defs, defs_length);
+    memcpy(source + defs_length, body, body_length);
+    memcpy(source + defs_length + body_length, main, main_length + 1);
+
+    GLuint shader = smaa_compile_shader(source, source_length, type);
+    free(source);
+
+    // Flagged for deletion, goes away with the program
+    glAttachShader(program, shader);
+    glDeleteShader(shader);
 }
 
 static
-int smaa_link_program(GLuint program)
-{ 
-    glLinkProgram(program);
-
+int smaa_check_program(GLuint program)
+{
     GLint status;
     glGetProgramiv(program, GL_LINK_STATUS, &status);
     if(!status) {
+	GLuint shaders[2];
+	GLsizei count;
+	glGetAttachedShaders(program, 2, &count, shaders);
+	for(int i = 0; i < count; i++) {
+	    smaa_check_shader(shaders[i]);
+	}
+
 	fprintf(stderr, "shader linking failure\n");
 
 	GLint info_log_length;
@@ -120,32 +140,186 @@ int smaa_link_program(GLuint program)
 }
 
 static
-int smaa_create_fbo(GLuint *_fbo, GLuint *_tex, int width, int height)
+void smaa_resize_stencil(GLuint rb, int width, int height)
 {
-    GLuint fbo, tex, rb;
-    glGenFramebuffers(1, &fbo);
-    glGenTextures(1, &tex);
-    glGenRenderbuffers(1, &rb);
+    // Only the stencil bits are used, but DEPTH24_STENCIL8 is the one
+    // stencil format every GL 3.0 implementation supports in an FBO.
+    glBindRenderbuffer(GL_RENDERBUFFER, rb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+}
 
-    if(!fbo || !tex || !rb) {
-	return 1;
+static
+int smaa_has_extension(const char *name)
+{
+    GLint count;
+    glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+    for(int i = 0; i < count; i++) {
+	if(!strcmp((const char*)glGetStringi(GL_EXTENSIONS, i), name)) {
+	    return 1;
+	}
     }
+    return 0;
+}
 
-    glBindTexture(GL_TEXTURE_2D, tex);
-    smaa_texture_filter_setup();
+// Objects shared with the other instances of the share group. All of
+// them are only touched with the share's mutex held.
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width , height, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+static
+GLuint smaa_share_find_program(SMAAShare *share, uint64_t key)
+{
+    GLuint program = 0;
+
+    pthread_mutex_lock(&share->mutex);
+    for(int i = 0; i < SMAA_SHARE_PROGRAMS; i++) {
+	SMAASharedProgram *shared = &share->programs[i];
+	if(shared->users && shared->key == key) {
+	    shared->users++;
+	    program = shared->program;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&share->mutex);
+
+    return program;
+}
+
+// Returns 0 if there's no room, the program then just isn't shared
+static
+int smaa_share_add_program(SMAAShare *share, uint64_t key, GLuint program)
+{
+    int added = 0;
+
+    pthread_mutex_lock(&share->mutex);
+    for(int i = 0; i < SMAA_SHARE_PROGRAMS; i++) {
+	SMAASharedProgram *shared = &share->programs[i];
+	if(!shared->users) {
+	    shared->key = key;
+	    shared->program = program;
+	    shared->users = 1;
+	    added = 1;
+	    break;
+	}
+    }
+    pthread_mutex_unlock(&share->mutex);
+
+    return added;
+}
+
+// With the mutex held
+static
+void smaa_share_delete(SMAAShare *share, GLenum type, GLuint name, int current)
+{
+    if(!name) {
+	return;
+    }
+
+    if(!current) {
+	if(share->orphan_count == SMAA_SHARE_ORPHANS) {
+	    fprintf(stderr, "with_smaa: too many orphaned objects, leaking %u\n", name);
+	    return;
+	}
+	share->orphans[share->orphan_count].type = type;
+	share->orphans[share->orphan_count].name = name;
+	__atomic_store_n(&share->orphan_count, share->orphan_count + 1, __ATOMIC_RELEASE);
+	return;
+    }
+
+    switch(type) {
+    case GL_TEXTURE: glDeleteTextures(1, &name); break;
+    case GL_RENDERBUFFER: glDeleteRenderbuffers(1, &name); break;
+    case GL_BUFFER: glDeleteBuffers(1, &name); break;
+    case GL_PROGRAM: glDeleteProgram(name); break;
+    case GL_SAMPLER: glDeleteSamplers(1, &name); break;
+    }
+}
+
+// Deletes what instances of other contexts left behind
+static
+void smaa_share_collect(SMAAShare *share)
+{
+    if(!__atomic_load_n(&share->orphan_count, __ATOMIC_ACQUIRE)) {
+	return;
+    }
+
+    pthread_mutex_lock(&share->mutex);
+    for(int i = 0; i < share->orphan_count; i++) {
+	smaa_share_delete(share, share->orphans[i].type, share->orphans[i].name, 1);
+    }
+    __atomic_store_n(&share->orphan_count, 0, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&share->mutex);
+}
+
+static
+void smaa_release_program(SMAA *smaa, SMAAProgram *program, int current)
+{
+    GLuint name = program->program;
+    if(!name) {
+	return;
+    }
+
+    SMAAShare *share = smaa->share;
+    pthread_mutex_lock(&share->mutex);
+    if(program->shared) {
+	for(int i = 0; i < SMAA_SHARE_PROGRAMS; i++) {
+	    SMAASharedProgram *shared = &share->programs[i];
+	    if(shared->users && shared->program == name) {
+		if(--shared->users) {
+		    // Still used by another variant
+		    name = 0;
+		}
+		break;
+	    }
+	}
+    }
+    smaa_share_delete(share, GL_PROGRAM, name, current);
+    pthread_mutex_unlock(&share->mutex);
+}
+
+static
+void smaa_texture_storage(SMAA *smaa, GLenum format, int width, int height)
+{
+    if(smaa->tex_storage) {
+	glTexStorage2D(GL_TEXTURE_2D, 1, format, width, height);
+    } else {
+	glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    }
+}
+
+// Creates the texture an intermediate target renders to and attaches it
+// to fbo, along with the shared stencil buffer
+static
+void smaa_create_target(SMAA *smaa, GLuint fbo, GLuint *tex, GLenum format, int width, int height)
+{
+    glGenTextures(1, tex);
+    glBindTexture(GL_TEXTURE_2D, *tex);
+    smaa_texture_filter_setup();
+    smaa_texture_storage(smaa, format, width, height);
 
     glBindFramebuffer(GL_FRAMEBUFFER, fbo);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *tex, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, smaa->stencil_rb);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+static
+int smaa_create_fbo(SMAA *smaa, GLuint *_fbo, GLuint *_tex, GLenum format, int width, int height)
+{
+    GLuint fbo;
+    glGenFramebuffers(1, &fbo);
+
+    if(!fbo) {
+	return 0;
+    }
 
+    smaa_create_target(smaa, fbo, _tex, format, width, height);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	
+
     if(status == GL_FRAMEBUFFER_COMPLETE) {
 	(*_fbo) = fbo;
-	(*_tex) = tex;
 	return 1;
     } else {
 	fprintf(stderr, "smaa_create_fbo failed, status=%d\n", status);
@@ -154,80 +328,770 @@ int smaa_create_fbo(GLuint *_fbo, GLuint *_tex, int width, int height)
 }
 
 static
-void smaa_resize_fbo_texture(GLuint tex, int width, int height)
+void smaa_create_color(SMAA *smaa, int width, int height)
+{
+    glGenTextures(1, &smaa->color_tex);
+    glBindTexture(GL_TEXTURE_2D, smaa->color_tex);
+    smaa_texture_filter_setup();
+
+    switch(smaa->color_mode) {
+    case SMAA_COLOR_VIEW:
+	smaa_texture_storage(smaa, GL_RGBA8, width, height);
+
+	// The view name must not have been bound before glTextureView
+	glGenTextures(1, &smaa->color_srgb_tex);
+	glTextureView(smaa->color_srgb_tex, GL_TEXTURE_2D, smaa->color_tex,
+		      GL_SRGB8_ALPHA8, 0, 1, 0, 1);
+	glBindTexture(GL_TEXTURE_2D, smaa->color_srgb_tex);
+	smaa_texture_filter_setup();
+	break;
+
+    case SMAA_COLOR_DECODE:
+	smaa_texture_storage(smaa, GL_SRGB8_ALPHA8, width, height);
+	smaa->color_srgb_tex = smaa->color_tex;
+	break;
+
+    case SMAA_COLOR_COPY:
+	smaa_texture_storage(smaa, GL_RGBA8, width, height);
+
+	glGenTextures(1, &smaa->color_srgb_tex);
+	glBindTexture(GL_TEXTURE_2D, smaa->color_srgb_tex);
+	smaa_texture_filter_setup();
+	smaa_texture_storage(smaa, GL_SRGB8_ALPHA8, width, height);
+	break;
+    }
+}
+
+static
+void smaa_delete_color(SMAA *smaa)
+{
+    if(smaa->color_srgb_tex != smaa->color_tex) {
+	glDeleteTextures(1, &smaa->color_srgb_tex);
+    }
+    glDeleteTextures(1, &smaa->color_tex);
+    smaa->color_tex = smaa->color_srgb_tex = 0;
+}
+
+static
+void smaa_detect_depth(SMAA *smaa)
 {
-    glBindTexture(GL_TEXTURE_2D, tex);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_BGRA, GL_UNSIGNED_BYTE, 0);
+    GLint type = GL_NONE, depth_bits = 0, stencil_bits = 0;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH,
+					  GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+    if(type != GL_NONE) {
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH,
+					      GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depth_bits);
+	glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL,
+					      GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencil_bits);
+    }
+
+    // Copying is cheapest (and most portable) with a matching format
+    switch(depth_bits) {
+    case 0: smaa->depth_format = 0; break;
+    case 16: smaa->depth_format = GL_DEPTH_COMPONENT16; break;
+    case 32: smaa->depth_format = GL_DEPTH_COMPONENT32F; break;
+    default:
+	smaa->depth_format = stencil_bits ? GL_DEPTH24_STENCIL8 : GL_DEPTH_COMPONENT24;
+	break;
+    }
+
+    if(smaa->depth_format) {
+	fprintf(stderr, "with_smaa: default framebuffer has %d bit depth, %d bit stencil\n",
+		depth_bits, stencil_bits);
+    } else {
+	fprintf(stderr, "with_smaa: default framebuffer has no depth buffer\n");
+    }
 }
 
 static
-const char *smaa_settings(SMAA *smaa)
+void smaa_create_depth(SMAA *smaa, int width, int height)
 {
-    if(!smaa->legacy) {
-	return
-	    "#version 330\n"
-	    "#define SMAA_PRESET_ULTRA 1\n"
-	    "#define SMAA_RT_METRICS in_rt_metrics\n"
-	    "#define SMAA_GLSL_3 1\n"
-	    "uniform vec4 in_rt_metrics;\n";
+    glGenTextures(1, &smaa->depth_tex);
+    glBindTexture(GL_TEXTURE_2D, smaa->depth_tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+
+    if(smaa->tex_storage) {
+	glTexStorage2D(GL_TEXTURE_2D, 1, smaa->depth_format, width, height);
+    } else if(smaa->depth_format == GL_DEPTH24_STENCIL8) {
+	glTexImage2D(GL_TEXTURE_2D, 0, smaa->depth_format, width, height, 0,
+		     GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, 0);
     } else {
-	return
-	    "#version 130\n"
-	    "#define SMAA_PRESET_ULTRA 1\n"
-	    "#define SMAA_RT_METRICS in_rt_metrics\n"
-	    "#define SMAA_GLSL_3 1\n"
-	    "uniform vec4 in_rt_metrics;\n";
+	glTexImage2D(GL_TEXTURE_2D, 0, smaa->depth_format, width, height, 0,
+		     GL_DEPTH_COMPONENT, GL_FLOAT, 0);
     }
 }
 
 static
-int smaa_init_smaa_program(SMAA *smaa, GLuint *program, const char *vsmain, const char *fsmain)
+void smaa_delete_depth(SMAA *smaa)
+{
+    glDeleteTextures(1, &smaa->depth_tex);
+    smaa->depth_tex = 0;
+}
+
+static
+int smaa_needs_depth(const SMAAConfig *config)
+{
+    return config->method == SMAA_METHOD_SMAA
+	&& (config->edge_mode == SMAA_EDGE_DEPTH || config->predication);
+}
+
+static
+void smaa_resize_edge_list(SMAA *smaa, int width, int height)
 {
-    *program = glCreateProgram();
+    // Room for every pixel, plus the header of SMAA_EDGE_LIST
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, smaa->edge_list);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint) + (GLsizeiptr)width * height * sizeof(GLuint),
+		 0, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
 
-    smaa_compile_smaa(*program, GL_VERTEX_SHADER, smaa_settings(smaa), vsmain);
+// The pool (color_tex and all intermediate targets) is allocated in
+// steps of SMAA_POOL_GRANULARITY and only the frame-sized corner is
+// rendered to. It grows with some headroom as soon as a frame does not
+// fit anymore, but is only shrunk after the frame stayed much smaller
+// for SMAA_POOL_SHRINK_FRAMES frames.
+#define SMAA_POOL_GRANULARITY 64
+#define SMAA_POOL_SHRINK_FRAMES 120
 
-    smaa_compile_smaa(*program, GL_FRAGMENT_SHADER, smaa_settings(smaa), fsmain);
+static
+int smaa_pool_round(int size)
+{
+    return (size + SMAA_POOL_GRANULARITY - 1) / SMAA_POOL_GRANULARITY * SMAA_POOL_GRANULARITY;
+}
+
+static
+int smaa_pool_fit(SMAA *smaa, int width, int height, int *pool_width, int *pool_height)
+{
+    if(width > smaa->pool_width || height > smaa->pool_height) {
+	smaa->pool_shrink_frames = 0;
+	*pool_width = smaa_pool_round(width + width / 8);
+	*pool_height = smaa_pool_round(height + height / 8);
+	return 1;
+    }
+
+    if(2L * width * height < (long)smaa->pool_width * smaa->pool_height) {
+	if(++smaa->pool_shrink_frames >= SMAA_POOL_SHRINK_FRAMES) {
+	    smaa->pool_shrink_frames = 0;
+	    *pool_width = smaa_pool_round(width);
+	    *pool_height = smaa_pool_round(height);
+	    return 1;
+	}
+    } else {
+	smaa->pool_shrink_frames = 0;
+    }
+
+    return 0;
+}
+
+// What the pool takes of video memory, as allocated. Drivers may pad
+// or compress the targets, so this is an estimate.
+static
+void smaa_report_pool(SMAA *smaa)
+{
+    const double mib = 1024.0 * 1024.0;
+    double pixels = (double)smaa->pool_width * smaa->pool_height;
+
+    // RGBA8, twice when there's neither a view nor decode control
+    double color = pixels * (smaa->color_mode == SMAA_COLOR_COPY ? 8 : 4);
+    double depth = !smaa->depth_tex ? 0
+	: pixels * (smaa->depth_format == GL_DEPTH_COMPONENT16 ? 2 : 4);
+    // RG8, RGBA8 and DEPTH24_STENCIL8
+    double edges = pixels * 2, weights = pixels * 4, stencil = pixels * 4;
+    double list = smaa->compute ? 4 * sizeof(GLuint) + pixels * sizeof(GLuint) : 0;
+
+    fprintf(stderr, "with_smaa: targets %dx%d take %.1f MiB (color %.1f, depth %.1f, "
+	    "edges %.1f, weights %.1f, stencil %.1f, edge list %.1f)\n",
+	    smaa->pool_width, smaa->pool_height,
+	    (color + depth + edges + weights + stencil + list) / mib,
+	    color / mib, depth / mib, edges / mib, weights / mib, stencil / mib, list / mib);
+}
+
+static
+void smaa_resize_pool(SMAA *smaa, int width, int height)
+{
+    fprintf(stderr, "with_smaa: resizing targets %dx%d -> %dx%d\n",
+	    smaa->pool_width, smaa->pool_height, width, height);
+
+    // Immutable storage cannot be respecified, so color_tex is recreated
+    smaa_delete_color(smaa);
+    smaa_create_color(smaa, width, height);
+
+    if(smaa->depth_tex) {
+	smaa_delete_depth(smaa);
+	smaa_create_depth(smaa, width, height);
+    }
+
+    smaa_resize_stencil(smaa->stencil_rb, width, height);
+    glDeleteTextures(1, &smaa->edge_tex);
+    glDeleteTextures(1, &smaa->blend_tex);
+    smaa_create_target(smaa, smaa->edge_fbo, &smaa->edge_tex, GL_RG8, width, height);
+    smaa_create_target(smaa, smaa->blend_fbo, &smaa->blend_tex, GL_RGBA8, width, height);
+
+    if(smaa->compute) {
+	smaa_resize_edge_list(smaa, width, height);
+    }
+
+    smaa->pool_width = width;
+    smaa->pool_height = height;
+    smaa_report_pool(smaa);
+}
+
+static
+void smaa_resize_cpu(SMAA *smaa, int width, int height)
+{
+    fprintf(stderr, "with_smaa: resizing CPU frame %dx%d -> %dx%d\n",
+	    smaa->pool_width, smaa->pool_height, width, height);
+
+    glBindTexture(GL_TEXTURE_2D, smaa->cpu_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, smaa->cpu_fbo);
+    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, smaa->cpu_tex, 0);
+
+    // Read back into the first half, processed into the second
+    free(smaa->cpu_frame);
+    smaa->cpu_frame = malloc((size_t)width * height * 4 * 2);
+
+    smaa->pool_width = width;
+    smaa->pool_height = height;
+    smaa_report_pool(smaa);
+}
+
+internal
+SMAACPUSettings smaa_cpu_settings(const SMAAConfig *config)
+{
+    if(config->edge_mode == SMAA_EDGE_DEPTH || config->predication) {
+	fprintf(stderr, "with_smaa: no depth on the CPU backend, using luma edge detection\n");
+    }
+    if(config->method == SMAA_METHOD_FXAA || config->sharpen > 0) {
+	fprintf(stderr, "with_smaa: no FXAA or sharpening on the CPU backend, using SMAA alone\n");
+    }
+
+    SMAACPUSettings settings = {
+	config->edge_mode == SMAA_EDGE_COLOR ? SMAA_CPU_EDGE_COLOR : SMAA_CPU_EDGE_LUMA,
+	config->threshold,
+	config->max_search_steps,
+	config->diag_detection ? config->max_search_steps_diag : 0,
+	config->corner_detection ? config->corner_rounding : -1,
+	// Like the neighborhood blending pass reading an sRGB view
+	1
+    };
+    return settings;
+}
+
+static
+void smaa_configure_cpu(SMAA *smaa, const SMAAConfig *config)
+{
+    SMAACPUSettings settings = smaa_cpu_settings(config);
+    smaa_cpu_configure(smaa->cpu, &settings);
+}
+
+static
+void smaa_update_cpu(SMAA *smaa)
+{
+    unsigned generation;
+    const SMAAConfig *config = smaa_config_get(&generation);
+    if(generation != smaa->config_generation) {
+	smaa->config_generation = generation;
+	smaa_configure_cpu(smaa, config);
+	smaa_region_configure(&smaa->region, config);
+	smaa_limiter_configure(&smaa->limiter, config);
+    }
+
+    int x = smaa->x, y = smaa->y, width = smaa->width, height = smaa->height;
+    if(width <= 0 || height <= 0) {
+	return;
+    }
+
+    // Neither buffers nor pixel storage modes the game left set may
+    // affect the transfers
+    GLint pack_buffer, unpack_buffer, pack_alignment, unpack_alignment, pack_row_length, unpack_row_length;
+    glGetIntegerv(GL_PIXEL_PACK_BUFFER_BINDING, &pack_buffer);
+    glGetIntegerv(GL_PIXEL_UNPACK_BUFFER_BINDING, &unpack_buffer);
+    glGetIntegerv(GL_PACK_ALIGNMENT, &pack_alignment);
+    glGetIntegerv(GL_UNPACK_ALIGNMENT, &unpack_alignment);
+    glGetIntegerv(GL_PACK_ROW_LENGTH, &pack_row_length);
+    glGetIntegerv(GL_UNPACK_ROW_LENGTH, &unpack_row_length);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+    int pool_width, pool_height;
+    if(smaa_pool_fit(smaa, width, height, &pool_width, &pool_height)) {
+	glActiveTexture(GL_TEXTURE0);
+	smaa_resize_cpu(smaa, pool_width, pool_height);
+    }
+
+    if(smaa->cpu_frame) {
+	// From the same read buffer the shader path copies from
+	uint8_t *input = smaa->cpu_frame, *output = smaa->cpu_frame + (size_t)width * height * 4;
+	{
+	    SMAA_TRACE("cpu_readback");
+	    glReadPixels(x, y, width, height, GL_RGBA, GL_UNSIGNED_BYTE, input);
+	}
+
+	int processed;
+	{
+	    SMAA_TRACE("cpu_process");
+	    processed = smaa_cpu_process(smaa->cpu, input, output, width, height, width * 4);
+	}
+	if(processed) {
+	    // The exclusions get their original pixels back
+	    SMAARect rects[SMAA_MAX_EXCLUSIONS];
+	    SMAARect active = { x, y, width, height };
+	    int count = smaa_region_exclusions(&smaa->region, &smaa->bounds, &active, 0, rects);
+	    for(int i = 0; i < count; i++) {
+		for(int row = rects[i].y; row < rects[i].y + rects[i].height; row++) {
+		    size_t offset = ((size_t)row * width + rects[i].x) * 4;
+		    memcpy(output + offset, input + offset, (size_t)rects[i].width * 4);
+		}
+	    }
+
+	    SMAA_TRACE("cpu_upload");
+	    glActiveTexture(GL_TEXTURE0);
+	    glBindTexture(GL_TEXTURE_2D, smaa->cpu_tex);
+	    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, output);
+
+	    // The output is encoded already, copy it as is
+	    glDisable(GL_FRAMEBUFFER_SRGB);
+	    glBindFramebuffer(GL_READ_FRAMEBUFFER, smaa->cpu_fbo);
+	    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	    GLenum db = GL_BACK_LEFT;
+	    glDrawBuffers(1, &db);
+	    glBlitFramebuffer(0, 0, width, height, x, y, x + width, y + height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	}
+    }
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, pack_buffer);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffer);
+    glPixelStorei(GL_PACK_ALIGNMENT, pack_alignment);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, unpack_alignment);
+    glPixelStorei(GL_PACK_ROW_LENGTH, pack_row_length);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, unpack_row_length);
+}
+
+internal
+int smaa_software_renderer(void)
+{
+    const char *renderer = (const char*)glGetString(GL_RENDERER);
+    return renderer && (strstr(renderer, "llvmpipe") || strstr(renderer, "softpipe")
+			|| strstr(renderer, "Software Rasterizer") || strstr(renderer, "SWR"));
+}
+
+static
+void smaa_init_cpu(SMAA *smaa)
+{
+    const char *threads = getenv("WITH_SMAA_CPU_THREADS");
+    smaa->cpu = smaa_cpu_create(threads ? atoi(threads) : 0);
+    if(!smaa->cpu) {
+	fprintf(stderr, "with_smaa: cannot create the CPU backend\n");
+	smaa->incompatible = 1;
+	return;
+    }
+    fprintf(stderr, "with_smaa: using CPU backend, %d threads, %s\n",
+	    smaa_cpu_threads(smaa->cpu), smaa_cpu_isa(smaa->cpu));
+
+    // Sized on the first frame
+    glGenTextures(1, &smaa->cpu_tex);
+    glGenFramebuffers(1, &smaa->cpu_fbo);
+
+    smaa->incompatible = 0;
+    smaa->initialized = 1;
+}
+
+static
+void smaa_settings(const char *version, const SMAAConfig *config, char *settings, size_t size)
+{
+    // Printed by hand, snprintf("%f") would follow the game's locale
+    int threshold = config->threshold * 10000 + 0.5f;
+
+    snprintf(settings, size,
+	     "#version %s\n"
+	     "#define SMAA_THRESHOLD %d.%04d\n"
+	     "#define SMAA_MAX_SEARCH_STEPS %d\n"
+	     "#define SMAA_MAX_SEARCH_STEPS_DIAG %d\n"
+	     "#define SMAA_CORNER_ROUNDING %d\n"
+	     "%s"
+	     "%s"
+	     "%s"
+	     "#define SMAA_RT_METRICS in_rt_metrics\n"
+	     "#define SMAA_GLSL_%c 1\n"
+	     "uniform vec4 in_rt_metrics;\n",
+	     version,
+	     threshold / 10000, threshold % 10000,
+	     config->max_search_steps,
+	     config->max_search_steps_diag,
+	     config->corner_rounding,
+	     config->diag_detection ? "" : "#define SMAA_DISABLE_DIAG_DETECTION 1\n",
+	     config->corner_detection ? "" : "#define SMAA_DISABLE_CORNER_DETECTION 1\n",
+	     config->predication ? "#define SMAA_PREDICATION 1\n" : "",
+	     version[0] >= '4' ? '4' : '3');
+}
+
+// The preprocessed SMAA.hlsl functions source needs, see smaa_sources.h
+static
+const char *smaa_source(const SMAAConfig *config, int glsl4, int source)
+{
+    int flags = (config->predication ? SMAA_SOURCE_PREDICATION : 0)
+	| (config->diag_detection ? 0 : SMAA_SOURCE_NO_DIAG)
+	| (config->corner_detection ? 0 : SMAA_SOURCE_NO_CORNER);
+    return smaa_sources[SMAA_SOURCE_INDEX(glsl4, source, flags)];
+}
+
+static
+int smaa_edge_source(int edge_mode)
+{
+    switch(edge_mode) {
+    case SMAA_EDGE_COLOR: return SMAA_SOURCE_COLOR_EDGE_PS;
+    case SMAA_EDGE_DEPTH: return SMAA_SOURCE_DEPTH_EDGE_PS;
+    default: return SMAA_SOURCE_LUMA_EDGE_PS;
+    }
+}
+
+static
+const char *smaa_edge_function(int edge_mode)
+{
+    switch(edge_mode) {
+    case SMAA_EDGE_COLOR: return "SMAAColorEdgeDetectionPS";
+    case SMAA_EDGE_DEPTH: return "SMAADepthEdgeDetectionPS";
+    default: return "SMAALumaEdgeDetectionPS";
+    }
+}
+
+static
+const char *smaa_edge_arguments(const SMAAConfig *config)
+{
+    if(config->edge_mode == SMAA_EDGE_DEPTH) {
+	return "in_depth_tex";
+    } else if(config->predication) {
+	return "in_tex, in_depth_tex";
+    } else {
+	return "in_tex";
+    }
+}
+
+// Starts building a program. With GL_KHR_parallel_shader_compile the
+// driver does so in the background, see smaa_poll_variant(). Without
+// vsmain, fsmain is the main of a compute shader. vsbody and fsbody are
+// the SMAA functions the mains call, from smaa_source().
+static
+int smaa_init_smaa_program(SMAA *smaa, const char *settings, SMAAProgram *program,
+			   const char *vsbody, const char *vsmain,
+			   const char *fsbody, const char *fsmain)
+{
+    const char *key_parts[] = { settings, vsmain, fsmain };
+    program->key = smaa_cache_key(key_parts, 3);
+
+    // Another context of the share group may have linked it already
+    if((program->program = smaa_share_find_program(smaa->share, program->key))) {
+	program->cached = 1;
+	program->shared = 1;
+	return 1;
+    }
+    program->shared = 0;
+
+    if((program->program = smaa_cache_load(program->key))) {
+	program->cached = 1;
+	return 1;
+    }
+
+    program->cached = 0;
+    program->start = smaa_time_ms();
+    program->program = glCreateProgram();
+    smaa_cache_prepare(program->program);
+
+    if(vsmain) {
+	smaa_compile_smaa(program->program, GL_VERTEX_SHADER, settings, vsbody, vsmain);
+
+	smaa_compile_smaa(program->program, GL_FRAGMENT_SHADER, settings, fsbody, fsmain);
+    } else {
+	smaa_compile_smaa(program->program, GL_COMPUTE_SHADER, settings, fsbody, fsmain);
+    }
 
     if(smaa->legacy) {
 	// All legacy programs have an in_texcoord attribute
-	glBindAttribLocation(*program, 0, "in_texcoord");
+	glBindAttribLocation(program->program, 0, "in_texcoord");
     }
 
     GLint attached_shaders;
-    glGetProgramiv(*program, GL_ATTACHED_SHADERS, &attached_shaders);
-    if(attached_shaders != 2 || !smaa_link_program(*program)) {
+    glGetProgramiv(program->program, GL_ATTACHED_SHADERS, &attached_shaders);
+    if(attached_shaders != (vsmain ? 2 : 1)) {
 	fprintf(stderr, "smaa_init_smaa_program error.!\n");
 	return 0;
     }
 
+    glLinkProgram(program->program);
+
     return 1;
 }
 
 static
-int smaa_init_smaa_core(SMAA *smaa)
+int smaa_program_completed(SMAA *smaa, SMAAProgram *program)
 {
+    // FXAA variants only have the last program
+    if(!program->program || program->cached || !smaa->parallel_compile) {
+	return 1;
+    }
+
+    GLint completed;
+    glGetProgramiv(program->program, GL_COMPLETION_STATUS_KHR, &completed);
+    return completed;
+}
+
+static
+int smaa_finish_program(SMAA *smaa, SMAAProgram *program)
+{
+    if(!program->program) {
+	return 1;
+    }
+
+    if(!program->cached) {
+	if(!smaa_check_program(program->program)) {
+	    fprintf(stderr, "smaa_init_smaa_program error.!\n");
+	    return 0;
+	}
+
+	smaa_cache_store(program->key, program->program, program->start);
+    }
+
+    if(!program->shared) {
+	program->shared = smaa_share_add_program(smaa->share, program->key, program->program);
+    }
+    return 1;
+}
+
+static const char *smaa_core_edge_vs =
+    "layout(location = 0) in vec2 in_texcoord;\n"
+    "uniform vec2 in_tex_scale;\n"
+    "out vec2 texcoord;\n"
+    "out vec4 offset[3];\n"
+    "void main() {\n"
+    "    vec2 coord = in_texcoord * in_tex_scale;\n"
+    "    SMAAEdgeDetectionVS(coord, offset);\n"
+    "    texcoord = coord;\n"
+    "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
+    "}";
+
+static const char *smaa_core_neighbor_vs =
+    "layout(location = 0) in vec2 in_texcoord;\n"
+    "uniform vec2 in_tex_scale;\n"
+    "out vec2 texcoord;\n"
+    "out vec4 offset;\n"
+    "void main() {\n"
+    "    vec2 coord = in_texcoord * in_tex_scale;\n"
+    "    SMAANeighborhoodBlendingVS(coord, offset);\n"
+    "    texcoord = coord;\n"
+    "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
+    "}";
+
+static const char *smaa_legacy_neighbor_vs =
+    "attribute vec2 in_texcoord;\n"
+    "uniform vec2 in_tex_scale;\n"
+    "varying vec2 texcoord;\n"
+    "varying vec4 offset;\n"
+    "void main() {\n"
+    "    vec2 coord = in_texcoord * in_tex_scale;\n"
+    "    SMAANeighborhoodBlendingVS(coord, offset);\n"
+    "    texcoord = coord;\n"
+    "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
+    "}";
+
+// Neighbors are clamped to the frame: the pooled targets are larger, and
+// past the lower left width x height corner they hold whatever was there.
+static const char *smaa_clamp_fs =
+    "uniform vec2 in_tex_scale;\n"
+    "vec2 smaa_clamp(vec2 coord) {\n"
+    "    vec2 texel = SMAA_RT_METRICS.xy;\n"
+    "    return clamp(coord, 0.5f * texel, in_tex_scale - 0.5f * texel);\n"
+    "}\n"
+    "vec4 smaa_clamp_offset(vec4 offset) {\n"
+    "    vec2 texel = SMAA_RT_METRICS.xy;\n"
+    "    return clamp(offset, 0.5f * texel.xyxy, (in_tex_scale - 0.5f * texel).xyxy);\n"
+    "}\n";
+
+// The edge detection offsets, clamped for the local contrast adaptation
+// across the right and top borders of the frame
+static const char *smaa_clamp_offsets =
+    "    vec4 clamped[3];\n"
+    "    clamped[0] = smaa_clamp_offset(offset[0]);\n"
+    "    clamped[1] = smaa_clamp_offset(offset[1]);\n"
+    "    clamped[2] = smaa_clamp_offset(offset[2]);\n";
+
+// Contrast adaptive sharpening of the anti-aliased pixel against the
+// four neighbors of the input around it. The less headroom those leave
+// to black or white, the less it sharpens, so it doesn't ring.
+static const char *smaa_sharpen_fs =
+    "vec4 smaa_sharpen(sampler2D tex, vec2 coord, vec4 color) {\n"
+    "    vec2 texel = SMAA_RT_METRICS.xy;\n"
+    "    vec3 n = textureLod(tex, smaa_clamp(coord + vec2(0.0f, texel.y)), 0.0f).rgb;\n"
+    "    vec3 s = textureLod(tex, smaa_clamp(coord - vec2(0.0f, texel.y)), 0.0f).rgb;\n"
+    "    vec3 e = textureLod(tex, smaa_clamp(coord + vec2(texel.x, 0.0f)), 0.0f).rgb;\n"
+    "    vec3 w = textureLod(tex, smaa_clamp(coord - vec2(texel.x, 0.0f)), 0.0f).rgb;\n"
+    "    vec3 low = min(min(min(n, s), min(e, w)), color.rgb);\n"
+    "    vec3 high = max(max(max(n, s), max(e, w)), color.rgb);\n"
+    "    vec3 amount = sqrt(clamp(min(low, 1.0f - high) / max(high, 1.0f / 256.0f), 0.0f, 1.0f));\n"
+    "    vec3 weight = amount * (-1.0f / mix(8.0f, 5.0f, SMAA_SHARPEN));\n"
+    "    vec3 sharp = (color.rgb + (n + s + e + w) * weight) / (1.0f + 4.0f * weight);\n"
+    "    return vec4(clamp(sharp, 0.0f, 1.0f), color.a);\n"
+    "}\n";
+
+// FXAA in one pass: where the local contrast is high enough, finds the
+// direction of the edge and searches along it for both of its ends. The
+// pixel is blended with the one across the edge by how close the nearer
+// end is, and by how much it stands out of its neighbors. Luma is taken
+// of the square root of the linear color, close enough to sRGB.
+static const char *smaa_fxaa_fs =
+    "float smaa_fxaa_luma(sampler2D tex, vec2 coord) {\n"
+    "    return sqrt(dot(textureLod(tex, smaa_clamp(coord), 0.0f).rgb, vec3(0.299f, 0.587f, 0.114f)));\n"
+    "}\n"
+    "vec4 smaa_fxaa(sampler2D tex, vec2 coord) {\n"
+    "    vec2 texel = SMAA_RT_METRICS.xy;\n"
+    "    vec4 color = textureLod(tex, coord, 0.0f);\n"
+    "    float m = sqrt(dot(color.rgb, vec3(0.299f, 0.587f, 0.114f)));\n"
+    "    float n = smaa_fxaa_luma(tex, coord + vec2(0.0f, texel.y));\n"
+    "    float s = smaa_fxaa_luma(tex, coord - vec2(0.0f, texel.y));\n"
+    "    float e = smaa_fxaa_luma(tex, coord + vec2(texel.x, 0.0f));\n"
+    "    float w = smaa_fxaa_luma(tex, coord - vec2(texel.x, 0.0f));\n"
+    "    float high = max(max(max(n, s), max(e, w)), m);\n"
+    "    float low = min(min(min(n, s), min(e, w)), m);\n"
+    "    float range = high - low;\n"
+    "    if(range < max(0.0833f, high * 0.166f)) {\n"
+    "        return color;\n"
+    "    }\n"
+    "    float ne = smaa_fxaa_luma(tex, coord + texel);\n"
+    "    float nw = smaa_fxaa_luma(tex, coord + vec2(-texel.x, texel.y));\n"
+    "    float se = smaa_fxaa_luma(tex, coord + vec2(texel.x, -texel.y));\n"
+    "    float sw = smaa_fxaa_luma(tex, coord - texel);\n"
+    "    float average = (2.0f * (n + s + e + w) + ne + nw + se + sw) / 12.0f;\n"
+    "    float subpixel = smoothstep(0.0f, 1.0f, clamp(abs(average - m) / range, 0.0f, 1.0f));\n"
+    "    subpixel = subpixel * subpixel * 0.75f;\n"
+    "    bool horizontal = 2.0f * abs(n + s - 2.0f * m) + abs(ne + se - 2.0f * e) + abs(nw + sw - 2.0f * w)\n"
+    "        >= 2.0f * abs(e + w - 2.0f * m) + abs(ne + nw - 2.0f * n) + abs(se + sw - 2.0f * s);\n"
+    "    vec2 across = horizontal ? vec2(0.0f, texel.y) : vec2(texel.x, 0.0f);\n"
+    "    vec2 along = horizontal ? vec2(texel.x, 0.0f) : vec2(0.0f, texel.y);\n"
+    "    float opposite = horizontal ? n : e;\n"
+    "    float other = horizontal ? s : w;\n"
+    "    if(abs(other - m) > abs(opposite - m)) {\n"
+    "        across = -across;\n"
+    "        opposite = other;\n"
+    "    }\n"
+    "    float gradient = 0.25f * abs(opposite - m);\n"
+    "    float edge = 0.5f * (m + opposite);\n"
+    "    vec2 forward = coord + 0.5f * across + along;\n"
+    "    vec2 backward = coord + 0.5f * across - along;\n"
+    "    float forward_delta = smaa_fxaa_luma(tex, forward) - edge;\n"
+    "    float backward_delta = smaa_fxaa_luma(tex, backward) - edge;\n"
+    "    bool forward_done = abs(forward_delta) >= gradient;\n"
+    "    bool backward_done = abs(backward_delta) >= gradient;\n"
+    "    for(int i = 1; i < 12 && !(forward_done && backward_done); i++) {\n"
+    "        float stride = i < 5 ? 1.0f : i < 9 ? 2.0f : 4.0f;\n"
+    "        if(!forward_done) {\n"
+    "            forward += stride * along;\n"
+    "            forward_delta = smaa_fxaa_luma(tex, forward) - edge;\n"
+    "            forward_done = abs(forward_delta) >= gradient;\n"
+    "        }\n"
+    "        if(!backward_done) {\n"
+    "            backward -= stride * along;\n"
+    "            backward_delta = smaa_fxaa_luma(tex, backward) - edge;\n"
+    "            backward_done = abs(backward_delta) >= gradient;\n"
+    "        }\n"
+    "    }\n"
+    "    float to_forward = dot(forward - coord, along) / dot(along, along);\n"
+    "    float to_backward = dot(coord - backward, along) / dot(along, along);\n"
+    "    float delta = to_forward < to_backward ? forward_delta : backward_delta;\n"
+    "    float blend = (delta < 0.0f) != (m < edge)\n"
+    "        ? 0.5f - min(to_forward, to_backward) / (to_forward + to_backward) : 0.0f;\n"
+    "    return textureLod(tex, smaa_clamp(coord + max(blend, subpixel) * across), 0.0f);\n"
+    "}\n";
+
+// Fragment shader of the last pass: neighborhood blending, or FXAA in
+// place of all three passes, followed by the sharpening if configured
+static
+void smaa_final_fs(const SMAAConfig *config, int legacy, char *fs, size_t size)
+{
+    const char *output = legacy ? "gl_FragColor" : "out_color";
+    const char *input = legacy ? "varying" : "in";
+    // Printed by hand, see smaa_settings()
+    int sharpen = config->sharpen * 10000 + 0.5f;
+
+    snprintf(fs, size,
+	     "uniform sampler2D in_tex;\n"
+	     "uniform sampler2D in_blend_tex;\n"
+	     "%s vec2 texcoord;\n"
+	     "%s vec4 offset;\n"
+	     "%s"
+	     "#define SMAA_SHARPEN %d.%04d\n"
+	     "%s"
+	     "%s"
+	     "%s"
+	     "void main() {\n"
+	     "    vec4 color = %s;\n"
+	     "    %s = %s;\n"
+	     "}",
+	     input, input,
+	     legacy ? "" : "layout(location = 0) out vec4 out_color;\n",
+	     sharpen / 10000, sharpen % 10000,
+	     config->method == SMAA_METHOD_FXAA || sharpen ? smaa_clamp_fs : "",
+	     config->method == SMAA_METHOD_FXAA ? smaa_fxaa_fs : "",
+	     sharpen ? smaa_sharpen_fs : "",
+	     config->method == SMAA_METHOD_FXAA ? "smaa_fxaa(in_tex, texcoord)"
+	     : "SMAANeighborhoodBlendingPS(texcoord, offset, in_tex, in_blend_tex)",
+	     output, sharpen ? "smaa_sharpen(in_tex, texcoord, color)" : "color");
+}
+
+// The program of the last pass, see smaa_final_fs()
+static
+int smaa_init_final(SMAA *smaa, SMAAVariant *variant, const char *settings)
+{
+    const SMAAConfig *config = &variant->config;
+    char fs[8192];
+    smaa_final_fs(config, smaa->legacy, fs, sizeof(fs));
+
+    return smaa_init_smaa_program
+	(smaa, settings, &variant->neighbor,
+	 smaa_source(config, 0, SMAA_SOURCE_NEIGHBOR_VS),
+	 smaa->legacy ? smaa_legacy_neighbor_vs : smaa_core_neighbor_vs,
+	 config->method == SMAA_METHOD_FXAA ? "" : smaa_source(config, 0, SMAA_SOURCE_NEIGHBOR_PS),
+	 fs);
+}
+
+static
+int smaa_init_smaa_core(SMAA *smaa, SMAAVariant *variant, const char *settings)
+{
+    const SMAAConfig *config = &variant->config;
+    char edge_fs[2048];
+    snprintf(edge_fs, sizeof(edge_fs),
+	     "uniform sampler2D in_tex;\n"
+	     "uniform sampler2D in_depth_tex;\n"
+	     "in vec2 texcoord;\n"
+	     "in vec4 offset[3];\n"
+	     "layout(location = 0) out vec4 out_color;\n"
+
+	     "%s"
+	     "void main() {\n"
+	     "%s"
+	     "    out_color = vec4(%s(texcoord, clamped, %s), 0.0f, 1.0f);\n"
+	     "}",
+	     smaa_clamp_fs, smaa_clamp_offsets,
+	     smaa_edge_function(variant->config.edge_mode),
+	     smaa_edge_arguments(&variant->config));
+
     int r = 
 	smaa_init_smaa_program
-	(smaa, &smaa->edge_shader,
-	 "layout(location = 0) in vec2 in_texcoord;\n"
-	 "out vec2 texcoord;\n"
-	 "out vec4 offset[3];\n"
-	 
-	 "void main() {\n"
-	 "    SMAAEdgeDetectionVS(in_texcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
-	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
-	 "}",
-	 
-	 "uniform sampler2D in_tex;\n"
-	 "in vec2 texcoord;\n"
-	 "in vec4 offset[3];\n"
-	 "layout(location = 0) out vec4 out_color;\n"
+	(smaa, settings, &variant->edge,
+	 smaa_source(config, 0, SMAA_SOURCE_EDGE_VS),
+	 smaa_core_edge_vs,
 
-	 "void main() {\n"
-	 "    out_color = vec4(SMAALumaEdgeDetectionPS(texcoord, offset, in_tex), 0.0f, 1.0f);\n"
-	 "}");
+	 smaa_source(config, 0, smaa_edge_source(config->edge_mode)),
+	 edge_fs);
 
     if(!r) {
 	return r;
@@ -235,18 +1099,22 @@ int smaa_init_smaa_core(SMAA *smaa)
 
     r = 
 	smaa_init_smaa_program
-	(smaa, &smaa->blend_shader,
+	(smaa, settings, &variant->blend,
+	 smaa_source(config, 0, SMAA_SOURCE_BLEND_VS),
 	 "layout(location = 0) in vec2 in_texcoord;\n"
+	 "uniform vec2 in_tex_scale;\n"
 	 "out vec2 texcoord;\n"
 	 "out vec2 pixcoord;\n"
 	 "out vec4 offset[3];\n"
 	 
 	 "void main() {\n"
-	 "    SMAABlendingWeightCalculationVS(in_texcoord, pixcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
+	 "    vec2 coord = in_texcoord * in_tex_scale;\n"
+	 "    SMAABlendingWeightCalculationVS(coord, pixcoord, offset);\n"
+	 "    texcoord = coord;\n"
 	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
 	 "}",
 	 
+	 smaa_source(config, 0, SMAA_SOURCE_BLEND_PS),
 	 "uniform sampler2D in_tex;\n"
 	 "uniform sampler2D in_area_tex;\n"
 	 "uniform sampler2D in_search_tex;\n"
@@ -264,59 +1132,137 @@ int smaa_init_smaa_core(SMAA *smaa)
 	return r;
     }
 
-    r = smaa_init_smaa_program
-	(smaa, &smaa->neighbor_shader,
-	 "layout(location = 0) in vec2 in_texcoord;\n"
-	 "out vec2 texcoord;\n"
-	 "out vec4 offset;\n"
-	 
-	 "void main() {\n"
-	 "    SMAANeighborhoodBlendingVS(in_texcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
-	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
-	 "}",
-	 
-	 "uniform sampler2D in_tex;\n"
-	 "uniform sampler2D in_blend_tex;\n"
-	 "in vec2 texcoord;\n"
-	 "in vec4 offset;\n"
-	 "layout(location = 0) out vec4 out_color;\n"
+    return smaa_init_final(smaa, variant, settings);
+}
 
-	 
-	 "void main() {\n"
-	 "    out_color = SMAANeighborhoodBlendingPS(texcoord, offset, in_tex, in_blend_tex);\n"
-	 "}");
+// Layout of smaa->edge_list. The first three members double as the
+// indirect dispatch arguments of the blending weight pass.
+#define SMAA_EDGE_LIST \
+    "layout(std430, binding = 0) buffer EdgeList {\n" \
+    "    uint groups_x, groups_y, groups_z;\n" \
+    "    uint count;\n" \
+    "    uint pixels[];\n" \
+    "};\n"
+
+#define SMAA_EDGE_LIST_GROUP_SIZE 64
+
+static
+int smaa_init_smaa_compute(SMAA *smaa, SMAAVariant *variant, const SMAAConfig *config)
+{
+    char settings[1024], compute_settings[1024];
+    smaa_settings("330", config, settings, sizeof(settings));
+    smaa_settings("430", config, compute_settings, sizeof(compute_settings));
+
+    // Edge detection stays a fragment shader, as it relies on discard
+    // (and the stencil mask). Edge pixels are appended to the edge list.
+    // Without early tests pixels the stencil mask leaves out would still
+    // run, the appends have side effects.
+    char edge_fs[2048];
+    snprintf(edge_fs, sizeof(edge_fs),
+	     "layout(early_fragment_tests) in;\n"
+	     "uniform sampler2D in_tex;\n"
+	     "uniform sampler2D in_depth_tex;\n"
+	     "in vec2 texcoord;\n"
+	     "in vec4 offset[3];\n"
+	     "layout(location = 0) out vec4 out_color;\n"
+	     SMAA_EDGE_LIST
+
+	     "%s"
+	     "void main() {\n"
+	     "%s"
+	     "    out_color = vec4(%s(texcoord, clamped, %s), 0.0f, 1.0f);\n"
+	     "    uint index = atomicAdd(count, 1u);\n"
+	     "    if(index %% %du == 0u) {\n"
+	     "        atomicAdd(groups_x, 1u);\n"
+	     "    }\n"
+	     "    pixels[index] = uint(gl_FragCoord.x) | (uint(gl_FragCoord.y) << 16);\n"
+	     "}",
+	     smaa_clamp_fs, smaa_clamp_offsets,
+	     smaa_edge_function(config->edge_mode),
+	     smaa_edge_arguments(config),
+	     SMAA_EDGE_LIST_GROUP_SIZE);
+
+    int r = smaa_init_smaa_program(smaa, compute_settings, &variant->edge,
+				   smaa_source(config, 1, SMAA_SOURCE_EDGE_VS), smaa_core_edge_vs,
+				   smaa_source(config, 1, smaa_edge_source(config->edge_mode)),
+				   edge_fs);
 
     if(!r) {
 	return r;
     }
 
-    return 1;
+    char blend_cs[2048];
+    snprintf(blend_cs, sizeof(blend_cs),
+	     "layout(local_size_x = %d) in;\n"
+	     "uniform sampler2D in_tex;\n"
+	     "uniform sampler2D in_area_tex;\n"
+	     "uniform sampler2D in_search_tex;\n"
+	     "layout(rgba8, binding = 0) uniform writeonly image2D out_blend;\n"
+	     SMAA_EDGE_LIST
+
+	     "void main() {\n"
+	     "    uint index = gl_GlobalInvocationID.x;\n"
+	     "    if(index >= count) {\n"
+	     "        return;\n"
+	     "    }\n"
+	     "    ivec2 pixel = ivec2(pixels[index] & 0xffffu, pixels[index] >> 16);\n"
+	     "    vec2 texcoord = (vec2(pixel) + 0.5f) * SMAA_RT_METRICS.xy;\n"
+	     "    vec2 pixcoord;\n"
+	     "    vec4 offset[3];\n"
+	     "    SMAABlendingWeightCalculationVS(texcoord, pixcoord, offset);\n"
+	     "    imageStore(out_blend, pixel, SMAABlendingWeightCalculationPS(texcoord, pixcoord,\n"
+	     "        offset, in_tex, in_area_tex, in_search_tex, vec4(0.0f)));\n"
+	     "}",
+	     SMAA_EDGE_LIST_GROUP_SIZE);
+
+    r = smaa_init_smaa_program(smaa, compute_settings, &variant->blend, 0, 0,
+			       smaa_source(config, 1, SMAA_SOURCE_BLEND_CS), blend_cs);
+
+    if(!r) {
+	return r;
+    }
+
+    return smaa_init_final(smaa, variant, settings);
 }
 
 static
-int smaa_init_smaa_legacy(SMAA *smaa)
+int smaa_init_smaa_legacy(SMAA *smaa, SMAAVariant *variant, const char *settings)
 {
+    const SMAAConfig *config = &variant->config;
+    char edge_fs[2048];
+    snprintf(edge_fs, sizeof(edge_fs),
+	     "uniform sampler2D in_tex;\n"
+	     "uniform sampler2D in_depth_tex;\n"
+	     "varying vec2 texcoord;\n"
+	     "varying vec4 offset[3];\n"
+
+	     "%s"
+	     "void main() {\n"
+	     "%s"
+	     "    gl_FragColor = vec4(%s(texcoord, clamped, %s), 0.0f, 1.0f);\n"
+	     "}",
+	     smaa_clamp_fs, smaa_clamp_offsets,
+	     smaa_edge_function(variant->config.edge_mode),
+	     smaa_edge_arguments(&variant->config));
+
     int r = 
 	smaa_init_smaa_program
-	(smaa, &smaa->edge_shader,
+	(smaa, settings, &variant->edge,
+	 smaa_source(config, 0, SMAA_SOURCE_EDGE_VS),
 	 "attribute vec2 in_texcoord;\n"
+	 "uniform vec2 in_tex_scale;\n"
 	 "varying vec2 texcoord;\n"
 	 "varying vec4 offset[3];\n"
 	 
 	 "void main() {\n"
-	 "    SMAAEdgeDetectionVS(in_texcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
+	 "    vec2 coord = in_texcoord * in_tex_scale;\n"
+	 "    SMAAEdgeDetectionVS(coord, offset);\n"
+	 "    texcoord = coord;\n"
 	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
 	 "}",
-	 
-	 "uniform sampler2D in_tex;\n"
-	 "varying vec2 texcoord;\n"
-	 "varying vec4 offset[3];\n"
 
-	 "void main() {\n"
-	 "    gl_FragColor = vec4(SMAALumaEdgeDetectionPS(texcoord, offset, in_tex), 0.0f, 1.0f);\n"
-	 "}");
+	 smaa_source(config, 0, smaa_edge_source(config->edge_mode)),
+	 edge_fs);
 
     if(!r) {
 	return r;
@@ -324,18 +1270,22 @@ int smaa_init_smaa_legacy(SMAA *smaa)
 
     r = 
 	smaa_init_smaa_program
-	(smaa, &smaa->blend_shader,
+	(smaa, settings, &variant->blend,
+	 smaa_source(config, 0, SMAA_SOURCE_BLEND_VS),
 	 "attribute vec2 in_texcoord;\n"
+	 "uniform vec2 in_tex_scale;\n"
 	 "varying vec2 texcoord;\n"
 	 "varying vec2 pixcoord;\n"
 	 "varying vec4 offset[3];\n"
 	 
 	 "void main() {\n"
-	 "    SMAABlendingWeightCalculationVS(in_texcoord, pixcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
+	 "    vec2 coord = in_texcoord * in_tex_scale;\n"
+	 "    SMAABlendingWeightCalculationVS(coord, pixcoord, offset);\n"
+	 "    texcoord = coord;\n"
 	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
 	 "}",
 	 
+	 smaa_source(config, 0, SMAA_SOURCE_BLEND_PS),
 	 "uniform sampler2D in_tex;\n"
 	 "uniform sampler2D in_area_tex;\n"
 	 "uniform sampler2D in_search_tex;\n"
@@ -352,47 +1302,274 @@ int smaa_init_smaa_legacy(SMAA *smaa)
 	return r;
     }
 
-    r = smaa_init_smaa_program
-	(smaa, &smaa->neighbor_shader,
-	 "attribute vec2 in_texcoord;\n"
-	 "varying vec2 texcoord;\n"
-	 "varying vec4 offset;\n"
-	 
-	 "void main() {\n"
-	 "    SMAANeighborhoodBlendingVS(in_texcoord, offset);\n"
-	 "    texcoord = in_texcoord;\n"
-	 "    gl_Position = vec4(in_texcoord * 2.0f + vec2(-1.0f, -1.0f), 0.0f, 1.0f);\n"
-	 "}",
-	 
-	 "uniform sampler2D in_tex;\n"
-	 "uniform sampler2D in_blend_tex;\n"
-	 "varying vec2 texcoord;\n"
-	 "varying vec4 offset;\n"
-	 
-	 "void main() {\n"
-	 "    gl_FragColor = SMAANeighborhoodBlendingPS(texcoord, offset, in_tex, in_blend_tex);\n"
-	 "}");
+    return smaa_init_final(smaa, variant, settings);
+}
+
+static
+void smaa_delete_variant(SMAA *smaa, SMAAVariant *variant, int current)
+{
+    smaa_release_program(smaa, &variant->edge, current);
+    smaa_release_program(smaa, &variant->blend, current);
+    smaa_release_program(smaa, &variant->neighbor, current);
+    memset(variant, 0, sizeof(*variant));
+}
+
+static
+SMAAVariant *smaa_begin_variant(SMAA *smaa, const SMAAConfig *config)
+{
+    // Take a free slot, or evict the least recently used variant
+    SMAAVariant *variant = 0;
+    for(int i = 0; i < SMAA_MAX_VARIANTS; i++) {
+	SMAAVariant *candidate = &smaa->variants[i];
+	if(candidate == smaa->variant || candidate == smaa->pending) {
+	    continue;
+	}
+	if(candidate->state == SMAA_VARIANT_FREE) {
+	    variant = candidate;
+	    break;
+	}
+	if(!variant || candidate->last_used < variant->last_used) {
+	    variant = candidate;
+	}
+    }
+
+    smaa_delete_variant(smaa, variant, 1);
+    variant->config = *config;
+    variant->state = SMAA_VARIANT_BUILDING;
+    variant->last_used = smaa->frame;
+
+    char settings[1024];
+    smaa_settings(smaa->legacy ? "130" : "330", config, settings, sizeof(settings));
+
+    int r;
+    if(config->method == SMAA_METHOD_FXAA) {
+	r = smaa_init_final(smaa, variant, settings);
+    } else if(smaa->legacy) {
+	r = smaa_init_smaa_legacy(smaa, variant, settings);
+    } else if(smaa->compute) {
+	r = smaa_init_smaa_compute(smaa, variant, config);
+    } else {
+	r = smaa_init_smaa_core(smaa, variant, settings);
+    }
 
     if(!r) {
-	return r;
+	variant->state = SMAA_VARIANT_FAILED;
     }
 
-    return 1;
+    return variant;
+}
+
+// Finishes building the variant as soon as the driver is done with all
+// its programs. With wait set it blocks until then.
+static
+int smaa_poll_variant(SMAA *smaa, SMAAVariant *variant, int wait)
+{
+    if(variant->state != SMAA_VARIANT_BUILDING) {
+	return variant->state;
+    }
+
+    if(!wait && !(smaa_program_completed(smaa, &variant->edge)
+		  && smaa_program_completed(smaa, &variant->blend)
+		  && smaa_program_completed(smaa, &variant->neighbor))) {
+	return variant->state;
+    }
+
+    int ok = smaa_finish_program(smaa, &variant->edge)
+	& smaa_finish_program(smaa, &variant->blend)
+	& smaa_finish_program(smaa, &variant->neighbor);
+
+    variant->state = ok ? SMAA_VARIANT_READY : SMAA_VARIANT_FAILED;
+
+    smaa_cache_report();
+    return variant->state;
+}
+
+static
+SMAAConfig smaa_effective_config(SMAA *smaa, const SMAAConfig *config)
+{
+    SMAAConfig effective = *config;
+
+    if(!smaa->depth_format && smaa_needs_depth(&effective)) {
+	fprintf(stderr, "with_smaa: no depth buffer for depth edge detection/predication,"
+		" using luma edge detection\n");
+	effective.edge_mode = SMAA_EDGE_LUMA;
+	effective.predication = 0;
+    }
+
+    // Predication only applies to luma and color edge detection
+    if(effective.edge_mode == SMAA_EDGE_DEPTH) {
+	effective.predication = 0;
+    }
+
+    return effective;
+}
+
+// Logs how long the first programs took and whether frames waited
+static
+void smaa_report_startup(SMAA *smaa, int waited)
+{
+    double now = smaa_time_ms();
+    if(!waited) {
+	// Initialized on the first frame unless prewarmed
+	double ahead = (smaa->first_frame_ms ? smaa->first_frame_ms : now) - smaa->init_ms;
+	fprintf(stderr, "with_smaa: shaders ready %.1f ms after initialization, %.1f ms of it before"
+		" the first frame, %u frames passed through meanwhile\n",
+		now - smaa->init_ms, ahead > 0 ? ahead : 0, smaa->frames_waiting);
+    } else if(!smaa->first_frame_ms) {
+	fprintf(stderr, "with_smaa: built shaders in %.1f ms before the first frame\n", now - smaa->init_ms);
+    } else {
+	fprintf(stderr, "with_smaa: the first frame waited %.1f ms for the shaders\n", now - smaa->init_ms);
+    }
+}
+
+// The first programs failed to build. The compute backend falls back to
+// raster, which is picked up by the next smaa_update_variant().
+static
+void smaa_startup_failed(SMAA *smaa)
+{
+    if(!smaa->compute) {
+	fprintf(stderr, "smaa_init_smaa error.\n");
+	smaa->incompatible = 1;
+	return;
+    }
+
+    fprintf(stderr, "with_smaa: compute backend failed, falling back to raster\n");
+    for(int i = 0; i < SMAA_MAX_VARIANTS; i++) {
+	smaa_delete_variant(smaa, &smaa->variants[i], 1);
+    }
+    smaa->compute = 0;
+    smaa->config_generation = 0;
+}
+
+static
+void smaa_select_variant(SMAA *smaa, const SMAAConfig *config)
+{
+    SMAAVariant *variant = 0;
+    for(int i = 0; i < SMAA_MAX_VARIANTS; i++) {
+	if(smaa->variants[i].state != SMAA_VARIANT_FREE
+	   && smaa_config_same_shaders(&smaa->variants[i].config, config)) {
+	    variant = &smaa->variants[i];
+	    break;
+	}
+    }
+
+    if(!variant) {
+	variant = smaa_begin_variant(smaa, config);
+    }
+
+    smaa->pending = variant == smaa->variant ? 0 : variant;
+}
+
+// Picks up configuration changes. New programs are built while the
+// current ones keep being used, so changes apply without a stall when
+// the driver compiles in parallel (GL_KHR_parallel_shader_compile).
+static
+void smaa_update_variant(SMAA *smaa)
+{
+    unsigned generation;
+    const SMAAConfig *config = smaa_config_get(&generation);
+
+    int changed = 0;
+    if(generation != smaa->config_generation) {
+	smaa->config_generation = generation;
+	smaa_governor_configure(&smaa->governor, config);
+	smaa_region_configure(&smaa->region, config);
+	smaa_limiter_configure(&smaa->limiter, config);
+	smaa_change_configure(&smaa->change, config);
+	changed = 1;
+    }
+
+    if(smaa_governor_update(&smaa->governor)) {
+	changed = 1;
+    }
+
+    // Keeps the current variant while the governor has SMAA off
+    const SMAAConfig *target = smaa_governor_config(&smaa->governor);
+    if(changed && target) {
+	SMAAConfig effective = smaa_effective_config(smaa, target);
+	smaa_select_variant(smaa, &effective);
+    }
+
+    if(smaa->pending) {
+	SMAAConfig *pending = &smaa->pending->config;
+
+	// Only the first programs are waited for, and only if the driver
+	// can't build them in the background
+	int wait = !smaa->variant && !smaa->parallel_compile;
+
+	switch(smaa_poll_variant(smaa, smaa->pending, wait)) {
+	case SMAA_VARIANT_READY:
+	    if(!smaa->variant) {
+		smaa_report_startup(smaa, wait);
+	    }
+	    char sharpen[32] = "";
+	    if(pending->sharpen > 0) {
+		snprintf(sharpen, sizeof(sharpen), ", sharpening %.2f", pending->sharpen);
+	    }
+	    if(pending->method == SMAA_METHOD_FXAA) {
+		fprintf(stderr, "with_smaa: using FXAA%s\n", sharpen);
+	    } else {
+		fprintf(stderr, "with_smaa: using preset %s (threshold %.3f, search steps %d/%d%s),"
+			" %s edge detection%s\n",
+			smaa_config_quality_name(pending->quality), pending->threshold,
+			pending->max_search_steps,
+			pending->diag_detection ? pending->max_search_steps_diag : 0,
+			pending->corner_detection ? "" : ", no corner detection",
+			smaa_config_edge_name(pending->edge_mode), sharpen);
+	    }
+	    smaa->variant = smaa->pending;
+	    smaa->pending = 0;
+	    break;
+
+	case SMAA_VARIANT_FAILED:
+	    fprintf(stderr, "with_smaa: building shaders for the new settings failed%s\n",
+		    smaa->variant ? ", keeping the previous ones" : "");
+	    smaa->pending = 0;
+	    if(!smaa->variant) {
+		smaa_startup_failed(smaa);
+	    }
+	    break;
+	}
+    }
+
+    if(smaa->variant) {
+	smaa->variant->last_used = smaa->frame;
+    }
+    smaa->frame++;
 }
 
 static
 int smaa_init_smaa(SMAA *smaa)
 {
-    if(smaa->legacy) {
-	return smaa_init_smaa_legacy(smaa);
+    smaa_cache_init((const unsigned char*) smaa_source_id, sizeof(smaa_source_id) - 1);
+
+    smaa->parallel_compile = smaa_has_extension("GL_KHR_parallel_shader_compile");
+    if(smaa->parallel_compile) {
+	// Let the driver pick the number of threads
+	glMaxShaderCompilerThreadsKHR(0xffffffff);
     } else {
-	return smaa_init_smaa_core(smaa);
+	fprintf(stderr, "with_smaa: no GL_KHR_parallel_shader_compile, startup and settings changes will stall\n");
     }
+
+    // With parallel compilation the programs are only started here, the
+    // frames until they are done pass through untouched
+    smaa->variant = smaa->pending = 0;
+    smaa->config_generation = 0;
+    smaa_update_variant(smaa);
+
+    // Compute programs that failed right away, again for raster
+    if(!smaa->variant && !smaa->pending && !smaa->incompatible) {
+	smaa_update_variant(smaa);
+    }
+
+    return !smaa->incompatible;
 }
 
 static
 void smaa_init(SMAA *smaa)
 {
+    smaa->init_ms = smaa_time_ms();
+
     fprintf(stderr, "with_smaa: GLSL_VERSION: %s\n",
 	    (const char*)glGetString(GL_SHADING_LANGUAGE_VERSION));
     fprintf(stderr, "with_smaa: GL_VERSION: %s\n",
@@ -419,54 +1596,133 @@ void smaa_init(SMAA *smaa)
 	return;
     }
 
+    // Fences are core in 3.2
+    int sync = !smaa->legacy || smaa_has_extension("GL_ARB_sync");
+    smaa_region_init(&smaa->region, sync);
+    smaa_capture_init(&smaa->capture, sync);
+    smaa_limiter_init(&smaa->limiter, sync);
+
+    // Captures want depth with the CPU backend too
+    smaa_detect_depth(smaa);
+
+    unsigned generation;
+    int backend = smaa_config_get(&generation)->backend;
+
+    // Readback included, a software rasterizer is much faster off
+    // running SMAA natively than through its shader emulation
+    if(backend == SMAA_BACKEND_CPU || (backend == SMAA_BACKEND_AUTO && smaa_software_renderer())) {
+	smaa_init_cpu(smaa);
+	return;
+    }
+
+    // Compute shaders, SSBOs and indirect dispatch are all core in 4.3
+    int has_compute = major > 4 || (major == 4 && minor >= 3);
+
+    smaa->compute = has_compute && backend != SMAA_BACKEND_RASTER;
+    if(smaa->compute) {
+	fprintf(stderr, "with_smaa: using compute backend\n");
+	smaa_state_save_compute(&smaa->state);
+    } else if(backend == SMAA_BACKEND_COMPUTE) {
+	fprintf(stderr, "with_smaa: compute backend needs OpenGL 4.3\n");
+    }
+
+    // Integer targets and uint outputs of GLSL 3.30
+    smaa_change_init(&smaa->change, major > 3 || (major == 3 && minor >= 3));
+
+    // Timer queries are core in 3.3
+    int timer_query = major > 3 || (major == 3 && minor >= 3)
+	|| smaa_has_extension("GL_ARB_timer_query");
+    smaa_governor_init(&smaa->governor, timer_query);
+    smaa_telemetry_init(&smaa->telemetry, timer_query);
+
     smaa->incompatible = 0;
 
-    glGenTextures(1, &smaa->area_tex);
-    glGenTextures(1, &smaa->search_tex);
-    glGenTextures(1, &smaa->color_tex);
+    // A single copy of the backbuffer is made per frame. Edge detection
+    // and neighborhood blending need it without and with sRGB decoding.
+    smaa->tex_storage = major > 4 || (major == 4 && minor >= 2)
+	|| smaa_has_extension("GL_ARB_texture_storage");
+
+    if(smaa->tex_storage && (major > 4 || (major == 4 && minor >= 3)
+			     || smaa_has_extension("GL_ARB_texture_view"))) {
+	smaa->color_mode = SMAA_COLOR_VIEW;
+	fprintf(stderr, "with_smaa: using sRGB texture view\n");
+    } else if(smaa_has_extension("GL_EXT_texture_sRGB_decode")) {
+	smaa->color_mode = SMAA_COLOR_DECODE;
+	fprintf(stderr, "with_smaa: using sRGB decode toggling\n");
+    } else {
+	smaa->color_mode = SMAA_COLOR_COPY;
+	fprintf(stderr, "with_smaa: no texture views or sRGB decode control, copying twice\n");
+    }
 
-    glBindTexture(GL_TEXTURE_2D, smaa->area_tex);
-    smaa_texture_filter_setup();
+    smaa->direct_state_access = major > 4 || (major == 4 && minor >= 5)
+	|| smaa_has_extension("GL_ARB_direct_state_access");
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, AREATEX_WIDTH, AREATEX_HEIGHT, 0, GL_RG, GL_UNSIGNED_BYTE, areaTexBytes);
+    // Lets the driver drop the targets' contents once a frame is done
+    // instead of keeping (and on tilers, writing back) them
+    smaa->invalidate = major > 4 || (major == 4 && minor >= 3)
+	|| smaa_has_extension("GL_ARB_invalidate_subdata");
 
-    glBindTexture(GL_TEXTURE_2D, smaa->search_tex);
-    smaa_texture_filter_setup();
+    SMAAShare *share = smaa->share;
+    pthread_mutex_lock(&share->mutex);
+    if(!share->area_tex) {
+	glGenTextures(1, &share->area_tex);
+	glGenTextures(1, &share->search_tex);
 
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SEARCHTEX_WIDTH, SEARCHTEX_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, searchTexBytes);
+	glBindTexture(GL_TEXTURE_2D, share->area_tex);
+	smaa_texture_filter_setup();
 
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, AREATEX_WIDTH, AREATEX_HEIGHT, 0, GL_RG, GL_UNSIGNED_BYTE, areaTexBytes);
 
-    glBindTexture(GL_TEXTURE_2D, smaa->color_tex);
-    smaa_texture_filter_setup();
+	glBindTexture(GL_TEXTURE_2D, share->search_tex);
+	smaa_texture_filter_setup();
+
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, SEARCHTEX_WIDTH, SEARCHTEX_HEIGHT, 0, GL_RED, GL_UNSIGNED_BYTE, searchTexBytes);
 
-    glBindTexture(GL_TEXTURE_2D, 0);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	// Other contexts of the group may use them from other threads
+	glFinish();
+    }
+    pthread_mutex_unlock(&share->mutex);
 
     checkGl();
 
     if(!smaa_init_smaa(smaa)) {
-	fprintf(stderr, "smaa_init_smaa error.\n");
 	return;
     }
 
     checkGl();
 
-    GLint size[4];
-    glGetIntegerv(GL_VIEWPORT, size);
-    int width = size[2], height = size[3];
+    int width = smaa->width, height = smaa->height;
+
+    smaa->pool_width = smaa_pool_round(width);
+    smaa->pool_height = smaa_pool_round(height);
+    smaa->pool_shrink_frames = 0;
+    width = smaa->pool_width;
+    height = smaa->pool_height;
 
-    smaa->old_width = width;
-    smaa->old_height = height;
+    smaa_create_color(smaa, width, height);
 
-    if(!smaa_create_fbo(&smaa->edge_fbo, &smaa->edge_tex, width, height)) {
+    glGenRenderbuffers(1, &smaa->stencil_rb);
+    smaa_resize_stencil(smaa->stencil_rb, width, height);
+
+    // The edge pass only writes two channels, RG8 halves what the blend
+    // pass reads back while searching along them
+    if(!smaa_create_fbo(smaa, &smaa->edge_fbo, &smaa->edge_tex, GL_RG8, width, height)) {
 	fprintf(stderr, "smaa_create_fbo(edge_fbo) failed.\n");
 	return;
     }
 
-    if(!smaa_create_fbo(&smaa->blend_fbo, &smaa->blend_tex, width, height)) {
+    if(!smaa_create_fbo(smaa, &smaa->blend_fbo, &smaa->blend_tex, GL_RGBA8, width, height)) {
 	fprintf(stderr, "smaa_create_fbo(blend_fbo) failed.\n");
 	return;
     }
 
+    if(smaa->compute) {
+	glGenBuffers(1, &smaa->edge_list);
+	smaa_resize_edge_list(smaa, width, height);
+    }
+
     checkGl();
 
     glGenVertexArrays(1, &smaa->vao);
@@ -474,13 +1730,13 @@ void smaa_init(SMAA *smaa)
 
     glGenBuffers(1, &smaa->vbo);
     glBindBuffer(GL_ARRAY_BUFFER, smaa->vbo);
+    // One triangle covering the viewport, texture coordinates 0 to 1
+    // across it. Unlike two triangles it has no diagonal, along which the
+    // GPU shades the 2x2 pixel quads of both.
     float vertices[] = {
 	0, 0,
-	0, 1,
-	1, 1,
-	0, 0,
-	1, 1,
-	1, 0
+	2, 0,
+	0, 2
     };
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     glEnableVertexAttribArray(0);
@@ -493,155 +1749,494 @@ void smaa_init(SMAA *smaa)
 
     fprintf(stderr, "with_smaa: smaa_init() success.\n");
     fprintf(stderr, "with_smaa: initial size: %dx%d\n", width, height);
+    smaa_report_pool(smaa);
 
     smaa->initialized = 1;
 }
 
-static
-void smaa_state_save(SMAAState *state)
+internal
+double smaa_time_ms(void)
 {
-    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &state->vao);
-    glGetIntegerv(GL_CURRENT_PROGRAM, &state->program);
-    glGetIntegerv(GL_ACTIVE_TEXTURE, &state->texture);
-    glGetIntegerv(GL_DEPTH_TEST, &state->depth);
-    glGetFloatv(GL_COLOR_CLEAR_VALUE, state->clear_color);
-    glGetIntegerv(GL_BLEND, &state->blending);
-    glGetIntegerv(GL_FRAMEBUFFER_SRGB, &state->srgb);
-
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
 
-    for(int i = 0; i < 3; i++) {
-	glActiveTexture(GL_TEXTURE0 + i);
-	glGetIntegerv(GL_TEXTURE_BINDING_2D, &state->textures[i]);
+internal
+SMAAShare *smaa_share_create(void)
+{
+    SMAAShare *share = calloc(1, sizeof(SMAAShare));
+    if(share) {
+	pthread_mutex_init(&share->mutex, 0);
     }
+    return share;
+}
 
-    glActiveTexture(GL_TEXTURE0);
+internal
+void smaa_share_destroy(SMAAShare *share)
+{
+    pthread_mutex_destroy(&share->mutex);
+    free(share);
 }
 
-static
-void smaa_state_restore(SMAAState *state)
+internal
+SMAA *smaa_create(SMAAShare *share)
 {
-    glBindVertexArray(state->vao);
-    glUseProgram(state->program);
-    if(state->depth) {
-	glEnable(GL_DEPTH_TEST);
-    } else {
-	glDisable(GL_DEPTH_TEST);
-    }
-    glClearColor(state->clear_color[0], state->clear_color[1],
-		 state->clear_color[2], state->clear_color[3]);
-    if(state->blending) {
-	glEnable(GL_BLEND);
-    } else {
-	glDisable(GL_BLEND);
-    }
-    for(int i = 0; i < 3; i++) {
-	glActiveTexture(GL_TEXTURE0 + i);
-	glBindTexture(GL_TEXTURE_2D, state->textures[i]);
+    SMAA *smaa = calloc(1, sizeof(SMAA));
+    if(!smaa) {
+	return 0;
     }
-    glActiveTexture(state->texture);
-    if(state->srgb) {
-	glEnable(GL_FRAMEBUFFER_SRGB);
-    } else {
-	glDisable(GL_FRAMEBUFFER_SRGB);
+
+    smaa->share = share;
+    if(!share) {
+	smaa->share = smaa_share_create();
+	smaa->own_share = 1;
+	if(!smaa->share) {
+	    free(smaa);
+	    return 0;
+	}
     }
+    return smaa;
 }
 
 internal
-SMAA *smaa_create()
+void smaa_destroy(SMAA *smaa, int current)
 {
-    SMAA *smaa = malloc(sizeof(SMAA));
-    smaa->initialized = 0;
-    smaa->incompatible = 0;
-    return smaa;
+    for(int i = 0; i < SMAA_MAX_VARIANTS; i++) {
+	smaa_delete_variant(smaa, &smaa->variants[i], current);
+    }
+
+    SMAAShare *share = smaa->share;
+    pthread_mutex_lock(&share->mutex);
+    if(smaa->color_srgb_tex != smaa->color_tex) {
+	smaa_share_delete(share, GL_TEXTURE, smaa->color_srgb_tex, current);
+    }
+    smaa_share_delete(share, GL_TEXTURE, smaa->color_tex, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->depth_tex, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->edge_tex, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->blend_tex, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->cpu_tex, current);
+    smaa_share_delete(share, GL_RENDERBUFFER, smaa->stencil_rb, current);
+    smaa_share_delete(share, GL_BUFFER, smaa->edge_list, current);
+    smaa_share_delete(share, GL_BUFFER, smaa->vbo, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->source_view, current);
+    smaa_share_delete(share, GL_SAMPLER, smaa->sampler, current);
+    smaa_share_delete(share, GL_BUFFER, smaa->region.buffer, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->change.hash_tex, current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->change.tile_tex[0], current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->change.tile_tex[1], current);
+    smaa_share_delete(share, GL_TEXTURE, smaa->change.mask_tex, current);
+    smaa_share_delete(share, GL_PROGRAM, smaa->change.hash_program, current);
+    smaa_share_delete(share, GL_PROGRAM, smaa->change.tile_program, current);
+    smaa_share_delete(share, GL_PROGRAM, smaa->change.compare_program, current);
+    smaa_share_delete(share, GL_PROGRAM, smaa->change.mark_program, current);
+    for(int i = 0; i < SMAA_CAPTURE_BUFFERS; i++) {
+	smaa_share_delete(share, GL_BUFFER, smaa->capture.slots[i].buffer, current);
+    }
+    pthread_mutex_unlock(&share->mutex);
+
+    smaa_region_destroy(&smaa->region, current);
+    smaa_capture_destroy(&smaa->capture, current);
+    smaa_change_destroy(&smaa->change, current);
+    smaa_limiter_destroy(&smaa->limiter, current);
+
+    // Not shared, otherwise they go with the context
+    if(current) {
+	glDeleteFramebuffers(1, &smaa->edge_fbo);
+	glDeleteFramebuffers(1, &smaa->blend_fbo);
+	glDeleteFramebuffers(1, &smaa->cpu_fbo);
+	glDeleteVertexArrays(1, &smaa->vao);
+	if(smaa->governor.timer_query) {
+	    glDeleteQueries(SMAA_GOVERNOR_QUERIES, smaa->governor.queries);
+	}
+	if(smaa->telemetry.enabled) {
+	    glDeleteQueries(SMAA_TELEMETRY_FRAMES * (SMAA_PASS_COUNT + 1), &smaa->telemetry.queries[0][0]);
+	}
+    }
+
+    smaa_cpu_destroy(smaa->cpu);
+    free(smaa->cpu_frame);
+
+    if(smaa->own_share) {
+	smaa_share_destroy(share);
+    }
+    free(smaa);
 }
 
-internal
-void smaa_update(SMAA *smaa)
+// Where the passes read the frame from: a copy of the default
+// framebuffer, or the texture smaa_blit() was about to blit from.
+typedef struct SMAAInput {
+    // Framebuffer the frame is read from for copies
+    GLuint fbo;
+    // Edge detection reads tex without sRGB decoding, neighborhood
+    // blending srgb_tex with
+    GLuint tex;
+    GLuint srgb_tex;
+    // The frame (and depth, if needed) is copied into tex first
+    int copy;
+    // The frame is copied into this before neighborhood blending
+    GLuint copy_srgb;
+    // tex == srgb_tex, GL_TEXTURE_SRGB_DECODE_EXT is switched in between
+    int decode;
+    // Bound to unit 0, for textures whose parameters aren't SMAA's. The
+    // caller restores the previous binding.
+    GLuint sampler;
+    // Not a frame, but a run to have the driver finish the programs for
+    // the state they're used with, see smaa_prewarm(). Not measured.
+    int warm_up;
+} SMAAInput;
+
+// Saves the state and (re)initializes SMAA for a frame of the given
+// size. Returns 0 with the state restored if SMAA can't run here.
+static
+int smaa_begin(SMAA *smaa, int width, int height)
 {
-    if(smaa->incompatible) {
-	return;
+    {
+	SMAA_TRACE("state_save");
+	smaa_state_save(&smaa->state);
+	if(smaa->compute) {
+	    smaa_state_save_compute(&smaa->state);
+	}
     }
 
-    smaa_state_save(&smaa->state);
+    // The viewport is processed where it is, the drawable as a whole
+    GLint *viewport = smaa->state.viewport;
+    if(width > 0 && height > 0) {
+	smaa->bounds = (SMAARect){ 0, 0, width, height };
+    } else {
+	smaa->bounds = (SMAARect){ viewport[0], viewport[1], viewport[2], viewport[3] };
+    }
+    smaa->x = smaa->bounds.x;
+    smaa->y = smaa->bounds.y;
+    smaa->width = smaa->bounds.width;
+    smaa->height = smaa->bounds.height;
+
+    smaa_share_collect(smaa->share);
 
+    if(!smaa->first_frame_ms) {
+	smaa->first_frame_ms = smaa_time_ms();
+    }
     if(!smaa->initialized) {
+	SMAA_TRACE("init");
 	smaa_init(smaa);
     }
 
     if(smaa->incompatible) {
 	smaa_state_restore(&smaa->state);
+	return 0;
+    }
+    return 1;
+}
+
+// Edges, weights and the stencil mask are dead once the frame is done,
+// unless the next frame reuses them (see change.h). They are still
+// cleared before the next frame, the passes rely on the zeros wherever
+// they discard.
+static
+void smaa_invalidate(SMAA *smaa)
+{
+    if(!smaa->invalidate) {
 	return;
     }
 
+    if(!smaa->change.enabled) {
+	static const GLenum targets[] = { GL_COLOR_ATTACHMENT0, GL_DEPTH_STENCIL_ATTACHMENT };
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, smaa->edge_fbo);
+	glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, 2, targets);
+	// Shares the stencil buffer with edge_fbo
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, smaa->blend_fbo);
+	glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, 1, targets);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    }
+
+    // So are the copies of the frame
+    glInvalidateTexImage(smaa->color_tex, 0);
+    if(smaa->color_srgb_tex != smaa->color_tex) {
+	glInvalidateTexImage(smaa->color_srgb_tex, 0);
+    }
+    if(smaa->depth_tex) {
+	glInvalidateTexImage(smaa->depth_tex, 0);
+    }
+}
+
+// The state of the game that the passes don't set themselves
+static
+void smaa_reset_state()
+{
     glDisable(GL_DEPTH_TEST);
     glDisable(GL_BLEND);
     glDisable(GL_CULL_FACE);
     glDisable(GL_FRAMEBUFFER_SRGB);
     glClearColor(0, 0, 0, 0);
+}
 
+// The variant to render the frame with, 0 with the state restored if
+// the governor turned SMAA off or the first programs aren't ready yet
+static
+SMAAVariant *smaa_prepare(SMAA *smaa)
+{
+    smaa_update_variant(smaa);
 
-    GLint size[4];
-    glGetIntegerv(GL_VIEWPORT, size);
-    int width = size[2], height = size[3];
+    if(!smaa->variant) {
+	// The first programs are still being built (or failed)
+	smaa_state_restore(&smaa->state);
+	return 0;
+    }
 
-    GLfloat rt_metrics[4] = {
-	1.0f / width, 1.0f / height, width, height
-    };
+    if(!smaa_governor_config(&smaa->governor)) {
+	// Over budget even with the cheapest settings
+	smaa_state_restore(&smaa->state);
+	return 0;
+    }
 
-    if(width != smaa->old_width || height != smaa->old_height) {
-	fprintf(stderr, "with_smaa: resizing %dx%d -> %dx%d\n", smaa->old_width, smaa->old_height,
-		width, height);
-	smaa_resize_fbo_texture(smaa->edge_tex, width, height);
-	smaa_resize_fbo_texture(smaa->blend_tex, width, height);
-	smaa->old_width = width;
-	smaa->old_height = height;
-	checkGl();
+    smaa_reset_state();
+    return smaa->variant;
+}
+
+// Bits of the stencil buffer shared by the edge and blend passes
+#define SMAA_STENCIL_EDGE 0x1
+// Left alone, see smaa_exclude()
+#define SMAA_STENCIL_EXCLUDED 0x2
+// Where edge detection and the blending weights run, all of the frame
+// unless parts are reused, see change.h
+#define SMAA_STENCIL_EDGES 0x4
+#define SMAA_STENCIL_WEIGHTS 0x8
+
+// The exclusions, relative to the part of the frame SMAA runs on. They
+// are grown by a pixel, as neighborhood blending also reads the weights
+// of the pixels around.
+static
+int smaa_exclusions(SMAA *smaa, SMAARect *rects)
+{
+    SMAARect active = { smaa->x, smaa->y, smaa->width, smaa->height };
+    return smaa_region_exclusions(&smaa->region, &smaa->bounds, &active, 1, rects);
+}
+
+// Marks the exclusions in the stencil buffer of the edge pass, which
+// then leaves them out. The scissor is put back as saved in state.
+static
+void smaa_exclude(const SMAAState *state, const SMAARect *rects, int count)
+{
+    if(!count) {
+	return;
     }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, smaa->color_tex);
-    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 0, 0, width, height, 0);
+    glEnable(GL_SCISSOR_TEST);
+    glClearStencil(SMAA_STENCIL_EXCLUDED);
+    for(int i = 0; i < count; i++) {
+	glScissor(rects[i].x, rects[i].y, rects[i].width, rects[i].height);
+	glClear(GL_STENCIL_BUFFER_BIT);
+    }
+    glClearStencil(0);
+    glScissor(state->scissor_box[0], state->scissor_box[1], state->scissor_box[2], state->scissor_box[3]);
+    if(!state->scissor) {
+	glDisable(GL_SCISSOR_TEST);
+    }
+}
 
-    // I don't really have any better idea on how to get this right.
-    // Except the neighborhood blending pass no pass should use sRGB reads/writes.
-    // So I just copy it again below, just with sRGB flag set.
+// The edge detection and blending weight passes of smaa_render(), into
+// smaa->blend_tex
+static
+void smaa_render_weights(SMAA *smaa, SMAAVariant *variant, const SMAAInput *input,
+			 const GLfloat *rt_metrics, const GLfloat *tex_scale)
+{
+    int x = smaa->x, y = smaa->y, width = smaa->width, height = smaa->height;
+
+    SMAARect exclusions[SMAA_MAX_EXCLUSIONS];
+    int exclusion_count = smaa_exclusions(smaa, exclusions);
+
+    // Parts that didn't change keep their edges and weights, see change.h
+    int partial = 0;
+    if(!input->warm_up) {
+	SMAAChangeKey key;
+	memset(&key, 0, sizeof(key));
+	key.edge = variant->edge.key;
+	key.blend = variant->blend.key;
+	key.x = x;
+	key.y = y;
+	key.width = width;
+	key.height = height;
+	key.pool_width = smaa->pool_width;
+	key.pool_height = smaa->pool_height;
+	memcpy(key.exclusions, exclusions, exclusion_count * sizeof(SMAARect));
+	key.exclusion_count = exclusion_count;
+	partial = smaa_change_detect(&smaa->change, input->tex, &key, &variant->config);
+    }
 
     // SMAA edge detection pass
-    // Reads rendered image from smaa->color_tex and renders into smaa->edge_fbo+tex.
-    glUseProgram(smaa->edge_shader);
-    glBindVertexArray(smaa->vao);
+    // Reads rendered image from input->tex and renders into smaa->edge_fbo+tex.
+    glBindFramebuffer(GL_FRAMEBUFFER, smaa->edge_fbo);
+
+    glEnable(GL_STENCIL_TEST);
+    glStencilMask(0xff);
+    if(partial) {
+	// Only the regions of the last frame are dropped, its edges stay.
+	// The marks also clear the edges and weights they cover.
+	glStencilMask(SMAA_STENCIL_EDGES | SMAA_STENCIL_WEIGHTS);
+	glClearStencil(0);
+	glClear(GL_STENCIL_BUFFER_BIT);
+	smaa_change_mark(&smaa->change, SMAA_CHANGE_EDGES, SMAA_STENCIL_EDGES);
+	glBindFramebuffer(GL_FRAMEBUFFER, smaa->blend_fbo);
+	smaa_change_mark(&smaa->change, SMAA_CHANGE_WEIGHTS, SMAA_STENCIL_EDGES | SMAA_STENCIL_WEIGHTS);
+	glBindFramebuffer(GL_FRAMEBUFFER, smaa->edge_fbo);
+    } else {
+	glClearStencil(SMAA_STENCIL_EDGES | SMAA_STENCIL_WEIGHTS);
+	glClear(GL_COLOR_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+	glClearStencil(0);
+    }
+    // The warm-up's empty scissor box must stay
+    if(!input->warm_up) {
+	smaa_exclude(&smaa->state, exclusions, exclusion_count);
+    }
 
-    glUniform1i(glGetUniformLocation(smaa->edge_shader, "in_tex"), 0);
-    glUniform4fv(glGetUniformLocation(smaa->edge_shader, "in_rt_metrics"), 1, rt_metrics);
+    glUseProgram(variant->edge.program);
 
-    glBindFramebuffer(GL_FRAMEBUFFER, smaa->edge_fbo);
-    glClear(GL_COLOR_BUFFER_BIT);
+    glUniform1i(glGetUniformLocation(variant->edge.program, "in_tex"), 0);
+    glUniform1i(glGetUniformLocation(variant->edge.program, "in_depth_tex"), 1);
+    glUniform4fv(glGetUniformLocation(variant->edge.program, "in_rt_metrics"), 1, rt_metrics);
+    glUniform2fv(glGetUniformLocation(variant->edge.program, "in_tex_scale"), 1, tex_scale);
 
     GLenum db = GL_COLOR_ATTACHMENT0;
     glDrawBuffers(1, &db);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    // The edge detection shaders discard pixels without edges, so
+    // this sets SMAA_STENCIL_EDGE exactly where edges were found. Excluded
+    // pixels fail the test and keep no edges. The compute backend's
+    // shader is tested early, before it discards, and doesn't write it.
+    glStencilFunc(GL_EQUAL, SMAA_STENCIL_EDGES | SMAA_STENCIL_EDGE,
+		  SMAA_STENCIL_EDGES | SMAA_STENCIL_EXCLUDED);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glStencilMask(smaa->compute ? 0 : SMAA_STENCIL_EDGE);
+
+    if(smaa->compute) {
+	// Empty edge list, and zero groups to dispatch
+	static const GLuint header[4] = { 0, 1, 1, 0 };
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, smaa->edge_list);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(header), header);
+    }
+
+    // Both passes are skipped on the GPU when nothing changed
+    if(partial) {
+	glBeginConditionalRender(smaa->change.query, GL_QUERY_WAIT);
+    }
+
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_EDGE);
 
     // SMAA blending weight calculation pass
     // Reads edges from smaa->edge_tex and renders into smaa->blend_fbo+tex.
+    // Stencil-tested against the edge mask, so only edge pixels run the
+    // (expensive) pattern search. The rest keeps the cleared zero weights.
     glBindFramebuffer(GL_FRAMEBUFFER, smaa->blend_fbo);
-    glClear(GL_COLOR_BUFFER_BIT);
+    if(!partial) {
+	glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    glStencilFunc(GL_EQUAL, SMAA_STENCIL_WEIGHTS | SMAA_STENCIL_EDGE,
+		  SMAA_STENCIL_WEIGHTS | SMAA_STENCIL_EDGE);
+    glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
 
     glBindTexture(GL_TEXTURE_2D, smaa->edge_tex);
-    glUseProgram(smaa->blend_shader);
-    glUniform1i(glGetUniformLocation(smaa->blend_shader, "in_tex"), 0);
-    glUniform1i(glGetUniformLocation(smaa->blend_shader, "in_area_tex"), 1);
-    glUniform1i(glGetUniformLocation(smaa->blend_shader, "in_search_tex"), 2);
-    glUniform4fv(glGetUniformLocation(smaa->blend_shader, "in_rt_metrics"), 1, rt_metrics);
+    glUseProgram(variant->blend.program);
+    glUniform1i(glGetUniformLocation(variant->blend.program, "in_tex"), 0);
+    glUniform1i(glGetUniformLocation(variant->blend.program, "in_area_tex"), 1);
+    glUniform1i(glGetUniformLocation(variant->blend.program, "in_search_tex"), 2);
+    glUniform4fv(glGetUniformLocation(variant->blend.program, "in_rt_metrics"), 1, rt_metrics);
+    glUniform2fv(glGetUniformLocation(variant->blend.program, "in_tex_scale"), 1, tex_scale);
 
     glActiveTexture(GL_TEXTURE0);
     glBindTexture(GL_TEXTURE_2D, smaa->edge_tex);
     glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, smaa->area_tex);
+    glBindTexture(GL_TEXTURE_2D, smaa->share->area_tex);
     glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, smaa->search_tex);
+    glBindTexture(GL_TEXTURE_2D, smaa->share->search_tex);
+
+    if(smaa->compute) {
+	// One invocation per pixel in the edge list, which the edge pass
+	// also sized the dispatch for.
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+	glBindImageTexture(0, smaa->blend_tex, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, smaa->edge_list);
+	glDispatchComputeIndirect(0);
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    } else {
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    if(partial) {
+	glEndConditionalRender();
+    }
+    smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_BLEND);
+}
+
+// Runs the three passes on the frame (FXAA: only the last one), of
+// smaa->width x smaa->height at smaa->x, smaa->y of the input, into the
+// same place of the default framebuffer. The intermediate targets only use their lower left
+// width x height corner.
+static
+void smaa_render(SMAA *smaa, SMAAVariant *variant, const SMAAInput *input)
+{
+    int x = smaa->x, y = smaa->y, width = smaa->width, height = smaa->height;
+
+    // All SMAA offsets are in texels of the pooled targets, of which
+    // only the lower left width x height corner is used.
+    GLfloat rt_metrics[4] = {
+	1.0f / smaa->pool_width, 1.0f / smaa->pool_height, smaa->pool_width, smaa->pool_height
+    };
+    GLfloat tex_scale[2] = {
+	(GLfloat)width / smaa->pool_width, (GLfloat)height / smaa->pool_height
+    };
+
+    glViewport(0, 0, width, height);
+
+    // The governor's measurements are meaningless while the programs it
+    // asked for are still being built.
+    if(input->warm_up) {
+	smaa->telemetry.current = -1;
+    } else {
+	if(!smaa->pending) {
+	    smaa_governor_begin(&smaa->governor);
+	}
+	smaa_telemetry_begin(&smaa->telemetry);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, input->fbo);
+    if(input->sampler) {
+	glBindSampler(0, input->sampler);
+    }
+
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, input->tex);
+    if(input->copy) {
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+
+	if(smaa_needs_depth(&variant->config)) {
+	    if(!smaa->depth_tex) {
+		smaa_create_depth(smaa, smaa->pool_width, smaa->pool_height);
+	    }
+	    glActiveTexture(GL_TEXTURE1);
+	    glBindTexture(GL_TEXTURE_2D, smaa->depth_tex);
+	    glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+	    glActiveTexture(GL_TEXTURE0);
+	    glBindTexture(GL_TEXTURE_2D, input->tex);
+	}
+    }
+
+    // Except the neighborhood blending pass no pass should use sRGB reads,
+    // see SMAA_COLOR_* on how the final pass gets to decode them.
+    if(input->decode) {
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SRGB_DECODE_EXT, GL_SKIP_DECODE_EXT);
+    }
+    smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_COPY);
 
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glBindVertexArray(smaa->vao);
+
+    if(variant->config.method == SMAA_METHOD_SMAA) {
+	smaa_render_weights(smaa, variant, input, rt_metrics, tex_scale);
+    } else {
+	// FXAA only has the last pass
+	smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_EDGE);
+	smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_BLEND);
+    }
 
     /*
     // To see if edge detection works corretcly
@@ -653,28 +2248,343 @@ void smaa_update(SMAA *smaa)
     return;
     */
 
-    // SMAA neighborhood blending pass
-    // Reads blending weights from smaa->blend_tex, rendered image from smaa->color_tex
+    // SMAA neighborhood blending pass, or FXAA, see smaa_final_fs()
+    // Reads blending weights from smaa->blend_tex, rendered image from input->srgb_tex
     // and renders into the standard framebuffer.
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    glUseProgram(smaa->neighbor_shader);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, input->fbo);
+    glDisable(GL_STENCIL_TEST);
+    glUseProgram(variant->neighbor.program);
 
-    glUniform1i(glGetUniformLocation(smaa->neighbor_shader, "in_tex"), 0);
-    glUniform1i(glGetUniformLocation(smaa->neighbor_shader, "in_blend_tex"), 1);
-    glUniform4fv(glGetUniformLocation(smaa->neighbor_shader, "in_rt_metrics"), 1, rt_metrics);
+    glUniform1i(glGetUniformLocation(variant->neighbor.program, "in_tex"), 0);
+    glUniform1i(glGetUniformLocation(variant->neighbor.program, "in_blend_tex"), 1);
+    glUniform4fv(glGetUniformLocation(variant->neighbor.program, "in_rt_metrics"), 1, rt_metrics);
+    glUniform2fv(glGetUniformLocation(variant->neighbor.program, "in_tex_scale"), 1, tex_scale);
 
     glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, smaa->color_tex);
-    glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, 0, 0, width, height, 0);
+    if(input->copy_srgb) {
+	glBindTexture(GL_TEXTURE_2D, input->copy_srgb);
+	glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, x, y, width, height);
+    }
+    glBindTexture(GL_TEXTURE_2D, input->srgb_tex);
+    if(input->decode) {
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_SRGB_DECODE_EXT, GL_DECODE_EXT);
+    }
 
     glActiveTexture(GL_TEXTURE1);
     glBindTexture(GL_TEXTURE_2D, smaa->blend_tex);
 
-    db = GL_BACK_LEFT;
+    GLenum db = GL_BACK_LEFT;
     glDrawBuffers(1, &db);
+    glViewport(x, y, width, height);
 
     glEnable(GL_FRAMEBUFFER_SRGB);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    smaa_telemetry_pass(&smaa->telemetry, SMAA_PASS_NEIGHBOR);
+
+    smaa_invalidate(smaa);
+
+    smaa_governor_end(&smaa->governor);
+}
+
+internal
+void smaa_prewarm(SMAA *smaa)
+{
+    if(smaa->initialized || smaa->incompatible) {
+	return;
+    }
+    SMAA_TRACE("smaa_prewarm");
+
+    smaa_state_save(&smaa->state);
+
+    // The first time a context is made current, GL sets the viewport to
+    // the drawable's size. Targets are resized on the first frame anyway.
+    smaa->x = smaa->y = 0;
+    smaa->width = smaa->state.viewport[2] > 0 ? smaa->state.viewport[2] : 1;
+    smaa->height = smaa->state.viewport[3] > 0 ? smaa->state.viewport[3] : 1;
+    smaa->bounds = (SMAARect){ 0, 0, smaa->width, smaa->height };
+
+    smaa_share_collect(smaa->share);
+    smaa_init(smaa);
+
+    // Drivers finish compiling on the first draw or copy, for the state
+    // it's done with. Running the passes once takes that off the first
+    // frame too. The empty scissor box keeps them from writing anything,
+    // copies aren't scissored.
+    if(smaa->initialized && smaa->variant && !smaa->cpu) {
+	double start = smaa_time_ms();
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(0, 0, 0, 0);
+
+	smaa_reset_state();
+	SMAAInput input = {
+	    .fbo = 0,
+	    .tex = smaa->color_tex,
+	    .srgb_tex = smaa->color_srgb_tex,
+	    .copy = 1,
+	    .copy_srgb = smaa->color_mode == SMAA_COLOR_COPY ? smaa->color_srgb_tex : 0,
+	    .decode = smaa->color_mode == SMAA_COLOR_DECODE,
+	    .warm_up = 1,
+	};
+	smaa_render(smaa, smaa->variant, &input);
+	glFinish();
+	fprintf(stderr, "with_smaa: warmed up the passes in %.1f ms\n", smaa_time_ms() - start);
+    }
+
+    smaa_state_restore(&smaa->state);
+}
+
+internal
+void smaa_update(SMAA *smaa, int width, int height)
+{
+    if(smaa->incompatible) {
+	return;
+    }
+
+    if(smaa->blitted) {
+	// Done on the blit already, whatever was drawn since (the HUD)
+	// stays as it is
+	smaa->blitted = 0;
+	return;
+    }
+
+    if(!smaa_begin(smaa, width, height)) {
+	return;
+    }
+
+    // Copies, targets and passes only cover what's left of the frame
+    // without letterbox bars
+    SMAARect active;
+    {
+	SMAA_TRACE("region");
+	active = smaa_region_update(&smaa->region, &smaa->bounds);
+    }
+    smaa->x = active.x;
+    smaa->y = active.y;
+    smaa->width = active.width;
+    smaa->height = active.height;
+
+    // The whole frame, bars included, as the game drew it
+    if(smaa->capture.enabled) {
+	SMAA_TRACE("capture");
+	smaa_capture_frame(&smaa->capture, 0, &smaa->bounds, smaa->depth_format != 0);
+    }
+
+    if(smaa->cpu) {
+	smaa_update_cpu(smaa);
+	SMAA_TRACE("state_restore");
+	smaa_state_restore(&smaa->state);
+	return;
+    }
+
+    SMAAVariant *variant;
+    {
+	SMAA_TRACE("prepare");
+	variant = smaa_prepare(smaa);
+    }
+    if(!variant) {
+	smaa->frames_waiting += !smaa->variant && !smaa->incompatible;
+	return;
+    }
+
+    int pool_width, pool_height;
+    if(smaa_pool_fit(smaa, smaa->width, smaa->height, &pool_width, &pool_height)) {
+	SMAA_TRACE("resize");
+	smaa_resize_pool(smaa, pool_width, pool_height);
+	checkGl();
+    }
+
+    SMAAInput input = {
+	.fbo = 0,
+	.tex = smaa->color_tex,
+	.srgb_tex = smaa->color_srgb_tex,
+	.copy = 1,
+	.copy_srgb = smaa->color_mode == SMAA_COLOR_COPY ? smaa->color_srgb_tex : 0,
+	.decode = smaa->color_mode == SMAA_COLOR_DECODE,
+    };
+    {
+	SMAA_TRACE("render");
+	smaa_render(smaa, variant, &input);
+    }
+
+    SMAA_TRACE("state_restore");
+    smaa_state_restore(&smaa->state);
+}
+
+// The texture of the read framebuffer's read buffer, if smaa_blit() can
+// sample it in place: level 0 of a 2D RGBA8 texture
+static
+GLuint smaa_blit_source(GLint *width, GLint *height, GLint *immutable)
+{
+    GLint read_buffer, type = GL_NONE, name = 0, level = 0, layer = 0, face = 0;
+    glGetIntegerv(GL_READ_BUFFER, &read_buffer);
+    if(read_buffer < GL_COLOR_ATTACHMENT0 || read_buffer > GL_COLOR_ATTACHMENT15) {
+	return 0;
+    }
+
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, read_buffer,
+					  GL_FRAMEBUFFER_ATTACHMENT_OBJECT_TYPE, &type);
+    if(type != GL_TEXTURE) {
+	return 0;
+    }
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, read_buffer,
+					  GL_FRAMEBUFFER_ATTACHMENT_OBJECT_NAME, &name);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, read_buffer,
+					  GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LEVEL, &level);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, read_buffer,
+					  GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_LAYER, &layer);
+    glGetFramebufferAttachmentParameteriv(GL_READ_FRAMEBUFFER, read_buffer,
+					  GL_FRAMEBUFFER_ATTACHMENT_TEXTURE_CUBE_MAP_FACE, &face);
+    if(level || layer || face) {
+	return 0;
+    }
+
+    // Multisampled, array, rectangle, ... textures aren't read by the
+    // shaders' sampler2D
+    GLint target = 0, format = 0;
+    glGetTextureParameteriv(name, GL_TEXTURE_TARGET, &target);
+    if(target != GL_TEXTURE_2D) {
+	return 0;
+    }
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_INTERNAL_FORMAT, &format);
+    if(format != GL_RGBA8) {
+	return 0;
+    }
+
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_WIDTH, width);
+    glGetTextureLevelParameteriv(name, 0, GL_TEXTURE_HEIGHT, height);
+    glGetTextureParameteriv(name, GL_TEXTURE_IMMUTABLE_FORMAT, immutable);
+    return name;
+}
+
+// An sRGB view of source, kept as long as the application keeps it
+static
+GLuint smaa_blit_view(SMAA *smaa, GLuint source)
+{
+    if(smaa->source_view && (smaa->source_tex != source
+			     || smaa->source_deletions != smaa_state_texture_deletions())) {
+	glDeleteTextures(1, &smaa->source_view);
+	smaa->source_view = 0;
+    }
+
+    if(!smaa->source_view) {
+	glGenTextures(1, &smaa->source_view);
+	glTextureView(smaa->source_view, GL_TEXTURE_2D, source, GL_SRGB8_ALPHA8, 0, 1, 0, 1);
+	smaa->source_tex = source;
+	smaa->source_deletions = smaa_state_texture_deletions();
+    }
+    return smaa->source_view;
+}
+
+internal
+void smaa_limit(SMAA *smaa)
+{
+    if(!smaa->initialized || smaa->incompatible) {
+	return;
+    }
+    smaa_limiter_frame(&smaa->limiter);
+}
+
+internal
+int smaa_blit(SMAA *smaa, GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+	      GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1, GLbitfield mask)
+{
+    // Only unscaled, unflipped copies of a whole frame at the origin, as
+    // SMAA renders to the lower left corner of the default framebuffer
+    if(smaa->incompatible || smaa->cpu || !(mask & GL_COLOR_BUFFER_BIT)
+       || src_x0 || src_y0 || dst_x0 || dst_y0
+       || src_x1 != dst_x1 || src_y1 != dst_y1 || src_x1 <= 0 || src_y1 <= 0) {
+	return 0;
+    }
+
+    unsigned generation;
+    if(!smaa_config_get(&generation)->zero_copy) {
+	return 0;
+    }
+    SMAA_TRACE("smaa_blit");
+
+    if(!smaa_begin(smaa, src_x1, src_y1)) {
+	return 0;
+    }
+
+    // The state SMAA saved tells where the blit goes
+    GLint width, height, immutable = 0;
+    GLuint source = 0;
+    if(!smaa->cpu && smaa->direct_state_access
+       && smaa->state.draw_fbo == 0 && smaa->state.read_fbo != 0
+       && !smaa->state.scissor) {
+	// smaa_init() may just have bound other framebuffers
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, smaa->state.read_fbo);
+	source = smaa_blit_source(&width, &height, &immutable);
+    }
+    if(!source || width < src_x1 || height < src_y1) {
+	smaa_state_restore(&smaa->state);
+	return 0;
+    }
+
+    SMAAVariant *variant = smaa_prepare(smaa);
+    if(!variant) {
+	return 0;
+    }
+    // The depth SMAA would copy is the default framebuffer's
+    if(smaa_needs_depth(&variant->config)) {
+	smaa_state_restore(&smaa->state);
+	return 0;
+    }
+
+    int pool_width, pool_height;
+    if(smaa_pool_fit(smaa, smaa->width, smaa->height, &pool_width, &pool_height)) {
+	smaa_resize_pool(smaa, pool_width, pool_height);
+    }
+
+    if(!smaa->sampler) {
+	glGenSamplers(1, &smaa->sampler);
+	glSamplerParameteri(smaa->sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(smaa->sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(smaa->sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(smaa->sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    }
+
+    // The source is read with the targets' texel metrics, in place only
+    // if it's as large as they are. Otherwise it's copied like the
+    // backbuffer, still saving the blit and the copy of the backbuffer.
+    SMAAInput input = {
+	.fbo = smaa->state.read_fbo,
+	.tex = source,
+	.sampler = smaa->sampler,
+    };
+    if(width != smaa->pool_width || height != smaa->pool_height) {
+	input = (SMAAInput){
+	    .fbo = smaa->state.read_fbo,
+	    .tex = smaa->color_tex,
+	    .srgb_tex = smaa->color_srgb_tex,
+	    .copy = 1,
+	    .copy_srgb = smaa->color_mode == SMAA_COLOR_COPY ? smaa->color_srgb_tex : 0,
+	    .decode = smaa->color_mode == SMAA_COLOR_DECODE,
+	};
+    } else if(immutable && smaa->color_mode == SMAA_COLOR_VIEW) {
+	// Neighborhood blending needs the source with sRGB decoding.
+	// Without a view of it, it's copied once.
+	input.srgb_tex = smaa_blit_view(smaa, source);
+    } else {
+	input.srgb_tex = smaa->color_srgb_tex;
+	input.copy_srgb = smaa->color_mode == SMAA_COLOR_VIEW ? smaa->color_tex : smaa->color_srgb_tex;
+    }
+
+    // Not the default framebuffer's depth, which the frame may not match
+    if(smaa->capture.enabled) {
+	SMAA_TRACE("capture");
+	SMAARect frame = { 0, 0, src_x1, src_y1 };
+	smaa_capture_frame(&smaa->capture, smaa->state.read_fbo, &frame, 0);
+    }
+
+    GLint sampler;
+    glActiveTexture(GL_TEXTURE0);
+    glGetIntegerv(GL_SAMPLER_BINDING, &sampler);
+    smaa_render(smaa, variant, &input);
+    glBindSampler(0, sampler);
 
     smaa_state_restore(&smaa->state);
+    smaa->blitted = 1;
+    return 1;
 }
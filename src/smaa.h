@@ -1,4 +1,7 @@
 
+#ifndef WITH_SMAA_SMAA_H
+#define WITH_SMAA_SMAA_H
+
 // This is a Linux-only utility anyway so we don't bother with
 // getprocaddress for everything.
 #define GL_GLEXT_PROTOTYPES
@@ -11,44 +14,274 @@
 // As a shim library we should only export symbols we want to override
 #define internal  __attribute__ ((visibility ("hidden")))
 
+#include <stdint.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "governor.h"
+#include "exporter.h"
+#include "telemetry.h"
+#include "region.h"
+#include "capture.h"
+#include "change.h"
+#include "limiter.h"
+#include "smaa_cpu.h"
+
+typedef struct SMAAStencilFace {
+    GLint func, ref, value_mask;
+    GLint fail, depth_fail, depth_pass;
+    GLint writemask;
+} SMAAStencilFace;
+
 typedef struct SMAAState {
-    GLint vao, program, texture, depth, blending, srgb;
+    GLint vao, program, texture, depth, blending, srgb, stencil, cull, scissor;
+    GLint draw_fbo, read_fbo;
+    GLint viewport[4];
+    GLint scissor_box[4];
     GLfloat clear_color[4];
+    GLint clear_stencil;
+    SMAAStencilFace stencil_front, stencil_back;
     GLint textures[3];
+
+    // Only saved for the compute backend
+    int compute_saved;
+    GLint storage_buffer, storage_binding, indirect_buffer;
+    GLint image_name, image_level, image_layered, image_layer, image_access, image_format;
 } SMAAState;
 
+// How the neighborhood blending pass gets an sRGB-decoding view of the
+// frame, while edge detection reads the very same bytes undecoded.
+enum {
+    // color_srgb_tex is an ARB_texture_view of immutable color_tex
+    SMAA_COLOR_VIEW,
+    // color_srgb_tex == color_tex, EXT_texture_sRGB_decode toggled per pass
+    SMAA_COLOR_DECODE,
+    // Two textures, the backbuffer is copied into both
+    SMAA_COLOR_COPY
+};
+
+typedef struct SMAAProgram {
+    GLuint program;
+    // Program cache key, see cache.h
+    uint64_t key;
+    // Loaded as a binary from the cache, i.e. already linked
+    int cached;
+    // smaa_time_ms() when compiling started
+    double start;
+    // Registered in the share's programs, see SMAAShare
+    int shared;
+} SMAAProgram;
+
+enum {
+    SMAA_VARIANT_FREE,
+    SMAA_VARIANT_BUILDING,
+    SMAA_VARIANT_READY,
+    SMAA_VARIANT_FAILED
+};
+
+// The three SMAA programs built for one configuration. FXAA only has
+// neighbor, the others stay 0.
+typedef struct SMAAVariant {
+    SMAAConfig config;
+    int state;
+    unsigned last_used;
+
+    SMAAProgram edge;
+    SMAAProgram blend;
+    SMAAProgram neighbor;
+} SMAAVariant;
+
+#define SMAA_MAX_VARIANTS 8
+
+#define SMAA_SHARE_PROGRAMS 64
+#define SMAA_SHARE_ORPHANS 64
+
+// A linked program every instance of a share group can use
+typedef struct SMAASharedProgram {
+    uint64_t key;
+    GLuint program;
+    // Variants using it, over all instances
+    int users;
+} SMAASharedProgram;
+
+// What the instances of contexts sharing objects have in common: the
+// lookup textures and the programs. Frame sized targets stay per
+// instance, since the contexts may swap concurrently, and FBOs, VAOs
+// and queries aren't shared by GL anyway. See instance.h.
+typedef struct SMAAShare {
+    pthread_mutex_t mutex;
+    // Contexts of the group, counted by instance.c
+    int references;
+
+    // Created by the first instance of the group
+    GLuint area_tex;
+    GLuint search_tex;
+
+    SMAASharedProgram programs[SMAA_SHARE_PROGRAMS];
+
+    // Objects of instances destroyed while their context wasn't current,
+    // deleted by the next instance of the group to update
+    struct {
+	GLenum type;
+	GLuint name;
+    } orphans[SMAA_SHARE_ORPHANS];
+    int orphan_count;
+} SMAAShare;
+
 typedef struct SMAA {
+    SMAAShare *share;
+    // Created by smaa_create() itself, destroyed along with the instance
+    int own_share;
+
     int initialized;
     int incompatible;
     int legacy;
+    // Blending weights through a compute shader over edge_list
+    int compute;
+    int tex_storage;
+    int color_mode;
+    // GL 4.5 or ARB_direct_state_access, to look at the textures
+    // smaa_blit() is given without binding them
+    int direct_state_access;
+    // GL 4.3 or ARB_invalidate_subdata, see smaa_invalidate()
+    int invalidate;
 
-    GLuint area_tex;
-    GLuint search_tex;
+    // The frame being swapped: the viewport, or the whole drawable if
+    // its size is known. See smaa_begin().
+    SMAARect bounds;
+    // The part of it SMAA runs on, see region.h
+    int x;
+    int y;
+    int width;
+    int height;
+    SMAARegion region;
+    SMAACapture capture;
+    SMAAChange change;
+    SMAALimiter limiter;
 
     // Contains a copy of the original color buffer
     GLuint color_tex;
+    // Same, but sampled with sRGB decoding, see color_mode
+    GLuint color_srgb_tex;
+    // Copy of the default framebuffer's depth, for depth edge detection
+    // and predication. Only allocated once a variant needs it.
+    GLuint depth_tex;
+    // Matches the default framebuffer, 0 if it has no depth buffer
+    GLenum depth_format;
     // Target of the edge pass
     GLuint edge_tex;
     // Target of the blend pass
     GLuint blend_tex;
 
+    // Depth-stencil buffer shared by edge_fbo and blend_fbo. The edge
+    // pass marks edge pixels in it, the blend pass only runs on those.
+    // See SMAA_STENCIL_* in smaa.c.
+    GLuint stencil_rb;
+
     GLuint edge_fbo;
     GLuint blend_fbo;
 
-    GLuint edge_shader;
-    GLuint blend_shader;
-    GLuint neighbor_shader;
+    // Pixels with edges, appended to by the edge pass of the compute
+    // backend. See SMAA_EDGE_LIST in smaa.c.
+    GLuint edge_list;
+
+    // Software rasterizers run SMAA on the CPU instead: the frame is read
+    // back into cpu_frame, processed and blitted back from cpu_tex.
+    SMAACPU *cpu;
+    GLuint cpu_tex;
+    GLuint cpu_fbo;
+    // Input and output, pool_width x pool_height each
+    uint8_t *cpu_frame;
+
+    // Programs are built per configuration and kept around, so switching
+    // back and forth is cheap. variant is used for rendering while
+    // pending is being built in the background.
+    int parallel_compile;
+    SMAAVariant variants[SMAA_MAX_VARIANTS];
+    SMAAVariant *variant;
+    SMAAVariant *pending;
+    unsigned config_generation;
+    unsigned frame;
+
+    // Startup, see smaa_prewarm(): when smaa_init() ran, when the first
+    // frame came, and the frames passed through untouched while the
+    // first programs were still being built
+    double init_ms;
+    double first_frame_ms;
+    unsigned frames_waiting;
+
+    SMAAGovernor governor;
+    SMAATelemetry telemetry;
 
     GLuint vao;
     GLuint vbo;
 
-    int old_width;
-    int old_height;
+    // Zero copy, see smaa_blit(). Set once the frame was anti-aliased on
+    // its way to the default framebuffer, the swap then leaves it alone.
+    int blitted;
+    // sRGB view of the immutable texture last blitted from, valid while
+    // smaa_state_texture_deletions() stays at source_deletions
+    GLuint source_tex;
+    GLuint source_view;
+    unsigned source_deletions;
+    // Linear, clamped sampling of the application's textures
+    GLuint sampler;
+
+    // Allocated size of color_tex and the intermediate targets. It may
+    // be larger than the frame, see smaa_pool_fit().
+    int pool_width;
+    int pool_height;
+    int pool_shrink_frames;
 
     SMAAState state;
 } SMAA;
 
-internal SMAA *smaa_create();
+internal SMAAShare *smaa_share_create(void);
+
+// Frees the share, once the last context of the group is gone. Its GL
+// objects are freed by the driver along with the group.
+internal void smaa_share_destroy(SMAAShare *share);
+
+// Without a share the instance gets its own
+internal SMAA *smaa_create(SMAAShare *share);
+
+// With current set, the instance's context is current on this thread
+// and its objects are deleted right away, otherwise they are left to the
+// next instance of the share group.
+internal void smaa_destroy(SMAA *smaa, int current);
+
+// Monotonic clock in milliseconds
+internal double smaa_time_ms(void);
+
+// Initializes the instance and starts building its programs ahead of
+// the first frame, with its context just made current on a drawable.
+// Frames are passed through untouched until the programs are ready, if
+// the driver builds them in the background (GL_KHR_parallel_shader_compile).
+// Otherwise this waits for them. Does nothing once initialized.
+internal void smaa_prewarm(SMAA *smaa);
+
+// With a current context: the renderer is a software rasterizer, on
+// which the CPU backend is faster
+internal int smaa_software_renderer(void);
+
+// The settings of the CPU backend closest to the configuration
+internal SMAACPUSettings smaa_cpu_settings(const SMAAConfig *config);
+
+// Anti-aliases the default framebuffer, of the given size. Without a
+// size (0) the viewport is processed, at its offset. Letterbox bars and
+// configured exclusions are left alone, see region.h.
+internal void smaa_update(SMAA *smaa, int width, int height);
+
+// Right after the swap of a frame smaa_update() was called for: waits
+// until no more frames are queued than configured, see limiter.h
+internal void smaa_limit(SMAA *smaa);
 
-internal void smaa_update(SMAA *smaa);
+// For glBlitFramebuffer with the bound framebuffers. If the blit copies
+// a texture unscaled to the default framebuffer, SMAA reads the texture
+// directly and writes the result to the default framebuffer instead, and
+// the next smaa_update() does nothing. Returns 1 if the color part of
+// the blit was done that way, 0 if it's still up to the caller.
+internal int smaa_blit(SMAA *smaa, GLint src_x0, GLint src_y0, GLint src_x1, GLint src_y1,
+		       GLint dst_x0, GLint dst_y0, GLint dst_x1, GLint dst_y1, GLbitfield mask);
 
+#endif
@@ -0,0 +1,685 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "smaa.h"
+#include "headless.h"
+
+// Anti-aliases a stream of frames outside of a game, Y4M or raw RGBA
+// from files or stdin to a file or stdout, in the same format. Frames go
+// through smaa_update() in a headless context, or straight through the
+// CPU engine on a software rasterizer.
+//
+// A thread reads and converts the input, another converts and writes
+// the output. In between BATCH_IN_FLIGHT frames are in flight on the
+// GPU: uploaded through a pixel unpack buffer, anti-aliased and read
+// back into a pixel pack buffer, which is mapped only once its fence
+// has signaled, by the time the frames after it were submitted.
+//
+// Frames are kept bottom row first between the threads, the way GL
+// reads and writes them, so results match the shim's.
+
+#define BATCH_IN_FLIGHT 3
+// Per direction, for the reader and writer to run ahead and behind
+#define BATCH_BUFFERS (BATCH_IN_FLIGHT + 2)
+#define BATCH_MAX_INPUTS 256
+#define BATCH_MAX_LINE 256
+
+enum {
+    BATCH_RGBA,
+    BATCH_Y4M_420,
+    BATCH_Y4M_444
+};
+
+typedef struct BatchQueue {
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    uint8_t *items[BATCH_BUFFERS];
+    unsigned head;
+    unsigned tail;
+    int closed;
+} BatchQueue;
+
+typedef struct BatchStream {
+    const char *inputs[BATCH_MAX_INPUTS];
+    int input_count;
+    int input;
+    FILE *file;
+    const char *output_path;
+    FILE *output;
+
+    int format;
+    int width;
+    int height;
+    // Y4M: full range rather than studio swing
+    int full_range;
+    // Of the first input, written as the output's
+    char header[BATCH_MAX_LINE + 1];
+    // Y4M planes of a frame, converted from and to
+    uint8_t *planes;
+    size_t planes_size;
+    uint8_t *out_planes;
+
+    int failed;
+    unsigned frames;
+
+    // Empty buffers, and frames read, for and from the reader
+    BatchQueue free_in, read;
+    // Empty buffers, and frames to write, for and from the writer
+    BatchQueue free_out, done;
+} BatchStream;
+
+static
+void batch_queue_init(BatchQueue *queue)
+{
+    memset(queue, 0, sizeof(*queue));
+    pthread_mutex_init(&queue->mutex, 0);
+    pthread_cond_init(&queue->cond, 0);
+}
+
+// Never blocks, a queue holds all buffers of its pool
+static
+void batch_queue_push(BatchQueue *queue, uint8_t *item)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->items[queue->head++ % BATCH_BUFFERS] = item;
+    pthread_cond_signal(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+// 0 once the queue is closed and empty
+static
+uint8_t *batch_queue_pop(BatchQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    while(queue->head == queue->tail && !queue->closed) {
+	pthread_cond_wait(&queue->cond, &queue->mutex);
+    }
+    uint8_t *item = 0;
+    if(queue->head != queue->tail) {
+	item = queue->items[queue->tail++ % BATCH_BUFFERS];
+    }
+    pthread_mutex_unlock(&queue->mutex);
+    return item;
+}
+
+static
+void batch_queue_close(BatchQueue *queue)
+{
+    pthread_mutex_lock(&queue->mutex);
+    queue->closed = 1;
+    pthread_cond_broadcast(&queue->cond);
+    pthread_mutex_unlock(&queue->mutex);
+}
+
+static
+uint8_t batch_clamp(float value)
+{
+    return value <= 0 ? 0 : value >= 255 ? 255 : (uint8_t)(value + 0.5f);
+}
+
+// BT.601, Y4M has no way to tell the matrix
+static
+void batch_yuv_to_rgba(const BatchStream *stream, const uint8_t *planes, uint8_t *rgba)
+{
+    int width = stream->width, height = stream->height;
+    int shift = stream->format == BATCH_Y4M_420;
+    int chroma_width = (width + shift) >> shift, chroma_height = (height + shift) >> shift;
+    const uint8_t *y_plane = planes;
+    const uint8_t *u_plane = y_plane + (size_t)width * height;
+    const uint8_t *v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+    float scale = stream->full_range ? 1 : 255.0f / 219, offset = stream->full_range ? 0 : 16;
+    float chroma = stream->full_range ? 1 : 255.0f / 224;
+
+    for(int row = 0; row < height; row++) {
+	uint8_t *out = rgba + (size_t)(height - 1 - row) * width * 4;
+	const uint8_t *ys = y_plane + (size_t)row * width;
+	const uint8_t *us = u_plane + (size_t)(row >> shift) * chroma_width;
+	const uint8_t *vs = v_plane + (size_t)(row >> shift) * chroma_width;
+	for(int x = 0; x < width; x++) {
+	    float y = (ys[x] - offset) * scale;
+	    float u = (us[x >> shift] - 128) * chroma, v = (vs[x >> shift] - 128) * chroma;
+	    out[x * 4 + 0] = batch_clamp(y + 1.402f * v);
+	    out[x * 4 + 1] = batch_clamp(y - 0.344136f * u - 0.714136f * v);
+	    out[x * 4 + 2] = batch_clamp(y + 1.772f * u);
+	    out[x * 4 + 3] = 255;
+	}
+    }
+}
+
+// Chroma of 4:2:0 is the average of the 2x2 pixels it covers
+static
+void batch_rgba_to_yuv(const BatchStream *stream, const uint8_t *rgba, uint8_t *planes)
+{
+    int width = stream->width, height = stream->height;
+    int shift = stream->format == BATCH_Y4M_420;
+    int chroma_width = (width + shift) >> shift, chroma_height = (height + shift) >> shift;
+    uint8_t *y_plane = planes;
+    uint8_t *u_plane = y_plane + (size_t)width * height;
+    uint8_t *v_plane = u_plane + (size_t)chroma_width * chroma_height;
+
+    float scale = stream->full_range ? 1 : 219.0f / 255, offset = stream->full_range ? 0 : 16;
+    float chroma = stream->full_range ? 1 : 224.0f / 255;
+
+    for(int row = 0; row < height; row++) {
+	const uint8_t *in = rgba + (size_t)(height - 1 - row) * width * 4;
+	for(int x = 0; x < width; x++) {
+	    float r = in[x * 4 + 0], g = in[x * 4 + 1], b = in[x * 4 + 2];
+	    y_plane[(size_t)row * width + x] = batch_clamp((0.299f * r + 0.587f * g + 0.114f * b) * scale + offset);
+	}
+    }
+
+    for(int cy = 0; cy < chroma_height; cy++) {
+	for(int cx = 0; cx < chroma_width; cx++) {
+	    float r = 0, g = 0, b = 0;
+	    int count = 0;
+	    for(int dy = 0; dy <= shift; dy++) {
+		for(int dx = 0; dx <= shift; dx++) {
+		    int x = (cx << shift) + dx, y = (cy << shift) + dy;
+		    if(x >= width || y >= height) {
+			continue;
+		    }
+		    const uint8_t *pixel = rgba + ((size_t)(height - 1 - y) * width + x) * 4;
+		    r += pixel[0];
+		    g += pixel[1];
+		    b += pixel[2];
+		    count++;
+		}
+	    }
+	    r /= count;
+	    g /= count;
+	    b /= count;
+	    size_t index = (size_t)cy * chroma_width + cx;
+	    u_plane[index] = batch_clamp((-0.168736f * r - 0.331264f * g + 0.5f * b) * chroma + 128);
+	    v_plane[index] = batch_clamp((0.5f * r - 0.418688f * g - 0.081312f * b) * chroma + 128);
+	}
+    }
+}
+
+static
+int batch_read_line(FILE *file, char *line, size_t size)
+{
+    size_t length = 0;
+    int c;
+    while((c = fgetc(file)) != EOF && c != '\n') {
+	if(length + 1 < size) {
+	    line[length++] = c;
+	}
+    }
+    line[length] = 0;
+    return c == '\n';
+}
+
+// Parses the stream header of a Y4M input. The first one sets the
+// format, the others have to match it.
+static
+int batch_read_y4m_header(BatchStream *stream, const char *name, int first)
+{
+    char line[BATCH_MAX_LINE];
+    if(!batch_read_line(stream->file, line, sizeof(line)) || strncmp(line, "YUV4MPEG2 ", 10)) {
+	fprintf(stderr, "smaa_batch: %s is not Y4M, raw RGBA needs --size\n", name);
+	return 0;
+    }
+
+    int width = 0, height = 0, format = BATCH_Y4M_420, full_range = 0;
+    char copy[BATCH_MAX_LINE];
+    snprintf(copy, sizeof(copy), "%s", line);
+    for(char *token = strtok(copy + 10, " "); token; token = strtok(0, " ")) {
+	if(token[0] == 'W') {
+	    width = atoi(token + 1);
+	} else if(token[0] == 'H') {
+	    height = atoi(token + 1);
+	} else if(token[0] == 'C') {
+	    if(!strncmp(token, "C420", 4)) {
+		format = BATCH_Y4M_420;
+	    } else if(!strcmp(token, "C444")) {
+		format = BATCH_Y4M_444;
+	    } else {
+		fprintf(stderr, "smaa_batch: %s: only 8 bit 4:2:0 and 4:4:4 are supported, not %s\n",
+			name, token + 1);
+		return 0;
+	    }
+	} else if(!strcmp(token, "XCOLORRANGE=FULL")) {
+	    full_range = 1;
+	}
+    }
+
+    if(width <= 0 || height <= 0) {
+	fprintf(stderr, "smaa_batch: %s has no size\n", name);
+	return 0;
+    }
+    if(first) {
+	stream->width = width;
+	stream->height = height;
+	stream->format = format;
+	stream->full_range = full_range;
+	snprintf(stream->header, sizeof(stream->header), "%s\n", line);
+    } else if(width != stream->width || height != stream->height || format != stream->format
+	      || full_range != stream->full_range) {
+	fprintf(stderr, "smaa_batch: %s does not match the format of %s\n", name, stream->inputs[0]);
+	return 0;
+    }
+    return 1;
+}
+
+// Opens the next input, 0 after the last one
+static
+int batch_open_next(BatchStream *stream)
+{
+    if(stream->file && stream->file != stdin) {
+	fclose(stream->file);
+    }
+    stream->file = 0;
+
+    while(!stream->file && stream->input < stream->input_count) {
+	const char *name = stream->inputs[stream->input];
+	int first = stream->input == 0;
+	stream->input++;
+
+	stream->file = strcmp(name, "-") ? fopen(name, "rb") : stdin;
+	if(!stream->file) {
+	    fprintf(stderr, "smaa_batch: cannot open %s: %s\n", name, strerror(errno));
+	    return 0;
+	}
+	if(stream->format != BATCH_RGBA && !batch_read_y4m_header(stream, name, first)) {
+	    return 0;
+	}
+    }
+    return stream->file != 0;
+}
+
+// Reads a frame of the current input, bottom row first. 0 at its end.
+static
+int batch_read_frame(BatchStream *stream, uint8_t *rgba)
+{
+    int width = stream->width, height = stream->height;
+    size_t row_size = (size_t)width * 4;
+
+    if(stream->format == BATCH_RGBA) {
+	for(int row = 0; row < height; row++) {
+	    size_t r = fread(rgba + (size_t)(height - 1 - row) * row_size, 1, row_size, stream->file);
+	    if(r != row_size) {
+		if(r || row) {
+		    fprintf(stderr, "smaa_batch: incomplete frame at the end of %s\n",
+			    stream->inputs[stream->input - 1]);
+		}
+		return 0;
+	    }
+	}
+	return 1;
+    }
+
+    char line[BATCH_MAX_LINE];
+    if(!batch_read_line(stream->file, line, sizeof(line))) {
+	return 0;
+    }
+    if(strncmp(line, "FRAME", 5)) {
+	fprintf(stderr, "smaa_batch: broken frame header in %s\n", stream->inputs[stream->input - 1]);
+	return 0;
+    }
+    if(fread(stream->planes, 1, stream->planes_size, stream->file) != stream->planes_size) {
+	fprintf(stderr, "smaa_batch: incomplete frame at the end of %s\n", stream->inputs[stream->input - 1]);
+	return 0;
+    }
+    batch_yuv_to_rgba(stream, stream->planes, rgba);
+    return 1;
+}
+
+static
+void *batch_reader(void *arg)
+{
+    BatchStream *stream = arg;
+
+    uint8_t *rgba;
+    while((rgba = batch_queue_pop(&stream->free_in))) {
+	int ok = batch_read_frame(stream, rgba);
+	while(!ok && batch_open_next(stream)) {
+	    ok = batch_read_frame(stream, rgba);
+	}
+	if(!ok) {
+	    break;
+	}
+	batch_queue_push(&stream->read, rgba);
+    }
+
+    batch_queue_close(&stream->read);
+    return 0;
+}
+
+static
+void *batch_writer(void *arg)
+{
+    BatchStream *stream = arg;
+    int width = stream->width, height = stream->height;
+    size_t row_size = (size_t)width * 4;
+
+    if(stream->format != BATCH_RGBA && fputs(stream->header, stream->output) < 0) {
+	stream->failed = 1;
+    }
+
+    uint8_t *rgba;
+    while((rgba = batch_queue_pop(&stream->done))) {
+	// Frames keep being taken after a failure, so the pipeline drains
+	int failed = stream->failed;
+	if(!stream->failed && stream->format == BATCH_RGBA) {
+	    for(int row = height - 1; row >= 0; row--) {
+		if(fwrite(rgba + (size_t)row * row_size, 1, row_size, stream->output) != row_size) {
+		    stream->failed = 1;
+		    break;
+		}
+	    }
+	} else if(!stream->failed) {
+	    batch_rgba_to_yuv(stream, rgba, stream->out_planes);
+	    if(fputs("FRAME\n", stream->output) < 0
+	       || fwrite(stream->out_planes, 1, stream->planes_size, stream->output) != stream->planes_size) {
+		stream->failed = 1;
+	    }
+	}
+	if(stream->failed && !failed) {
+	    fprintf(stderr, "smaa_batch: cannot write %s: %s\n", stream->output_path, strerror(errno));
+	}
+	stream->frames += !stream->failed;
+	batch_queue_push(&stream->free_out, rgba);
+    }
+
+    if(fflush(stream->output)) {
+	stream->failed = 1;
+    }
+    return 0;
+}
+
+static
+void batch_run_cpu(BatchStream *stream, SMAACPU *cpu)
+{
+    unsigned generation;
+    SMAACPUSettings settings = smaa_cpu_settings(smaa_config_get(&generation));
+    smaa_cpu_configure(cpu, &settings);
+
+    uint8_t *input;
+    while((input = batch_queue_pop(&stream->read))) {
+	uint8_t *output = batch_queue_pop(&stream->free_out);
+	if(!smaa_cpu_process(cpu, input, output, stream->width, stream->height, stream->width * 4)) {
+	    memcpy(output, input, (size_t)stream->width * stream->height * 4);
+	}
+	batch_queue_push(&stream->free_in, input);
+	batch_queue_push(&stream->done, output);
+    }
+}
+
+typedef struct BatchSlot {
+    GLuint unpack;
+    GLuint pack;
+    GLsync fence;
+} BatchSlot;
+
+// Hands the frame read back into the slot to the writer, once the GPU
+// is done with it
+static
+void batch_finish(BatchStream *stream, BatchSlot *slot)
+{
+    size_t size = (size_t)stream->width * stream->height * 4;
+
+    glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+    glDeleteSync(slot->fence);
+    slot->fence = 0;
+
+    uint8_t *output = batch_queue_pop(&stream->free_out);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pack);
+    const uint8_t *pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, size, GL_MAP_READ_BIT);
+    if(pixels) {
+	memcpy(output, pixels, size);
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    } else {
+	fprintf(stderr, "smaa_batch: cannot map a pixel buffer\n");
+	memset(output, 0, size);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    batch_queue_push(&stream->done, output);
+}
+
+static
+int batch_run_gl(BatchStream *stream, SMAA *smaa)
+{
+    int width = stream->width, height = stream->height;
+    GLsizeiptr size = (GLsizeiptr)width * height * 4;
+
+    GLuint scene_tex, scene_fbo;
+    glGenTextures(1, &scene_tex);
+    glBindTexture(GL_TEXTURE_2D, scene_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glGenFramebuffers(1, &scene_fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_tex, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    BatchSlot slots[BATCH_IN_FLIGHT];
+    for(int i = 0; i < BATCH_IN_FLIGHT; i++) {
+	glGenBuffers(1, &slots[i].unpack);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slots[i].unpack);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, size, 0, GL_STREAM_DRAW);
+	glGenBuffers(1, &slots[i].pack);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slots[i].pack);
+	glBufferData(GL_PIXEL_PACK_BUFFER, size, 0, GL_STREAM_READ);
+	slots[i].fence = 0;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+    // Every frame has to be anti-aliased, none may pass through while
+    // the programs are being built
+    for(int i = 0; i < 1000 && (i < 3 || smaa->pending || !smaa->variant); i++) {
+	glClear(GL_COLOR_BUFFER_BIT);
+	smaa_update(smaa, width, height);
+	if(smaa->incompatible) {
+	    fprintf(stderr, "smaa_batch: SMAA not supported by this context\n");
+	    return 0;
+	}
+    }
+
+    unsigned frame = 0;
+    uint8_t *input;
+    while((input = batch_queue_pop(&stream->read))) {
+	BatchSlot *slot = &slots[frame++ % BATCH_IN_FLIGHT];
+	if(slot->fence) {
+	    batch_finish(stream, slot);
+	}
+
+	// The slot's buffers are idle, no need to synchronize
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot->unpack);
+	void *pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size,
+					GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if(pixels) {
+	    memcpy(pixels, input, size);
+	    glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	    glBindTexture(GL_TEXTURE_2D, scene_tex);
+	    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	batch_queue_push(&stream->free_in, input);
+
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+	smaa_update(smaa, width, height);
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pack);
+	glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
+    }
+
+    // The frames still in flight, in order
+    for(int i = 0; i < BATCH_IN_FLIGHT; i++) {
+	BatchSlot *slot = &slots[(frame + i) % BATCH_IN_FLIGHT];
+	if(slot->fence) {
+	    batch_finish(stream, slot);
+	}
+    }
+
+    for(int i = 0; i < BATCH_IN_FLIGHT; i++) {
+	glDeleteBuffers(1, &slots[i].unpack);
+	glDeleteBuffers(1, &slots[i].pack);
+    }
+    glDeleteFramebuffers(1, &scene_fbo);
+    glDeleteTextures(1, &scene_tex);
+    return 1;
+}
+
+static
+void batch_usage()
+{
+    fprintf(stderr,
+	    "usage: smaa_batch [options] [INPUT...]\n"
+	    "Anti-aliases Y4M (8 bit 4:2:0 or 4:4:4) or raw RGBA frames, read from the\n"
+	    "inputs in turn or from stdin (-), into a stream of the same format.\n"
+	    "  --size WxH       the input is raw RGBA frames of this size\n"
+	    "  --preset NAME    low, medium, high or ultra (default: as configured)\n"
+	    "  --output FILE    instead of stdout\n"
+	    "The backend is chosen by WITH_SMAA_BACKEND, as in the shim.\n");
+}
+
+int main(int argc, char **argv)
+{
+    static BatchStream stream;
+    stream.format = BATCH_Y4M_420;
+    stream.output_path = "stdout";
+    stream.output = stdout;
+
+    for(int i = 1; i < argc; i++) {
+	const char *option = argv[i];
+	if(strncmp(option, "--", 2)) {
+	    if(stream.input_count == BATCH_MAX_INPUTS) {
+		fprintf(stderr, "smaa_batch: more than %d inputs\n", BATCH_MAX_INPUTS);
+		return 1;
+	    }
+	    stream.inputs[stream.input_count++] = option;
+	    continue;
+	}
+
+	const char *value = i + 1 < argc ? argv[i + 1] : 0;
+	if(!value) {
+	    batch_usage();
+	    return 1;
+	}
+	i++;
+
+	if(!strcmp(option, "--size")) {
+	    if(sscanf(value, "%dx%d", &stream.width, &stream.height) != 2
+	       || stream.width <= 0 || stream.height <= 0) {
+		fprintf(stderr, "smaa_batch: invalid size %s\n", value);
+		return 1;
+	    }
+	    stream.format = BATCH_RGBA;
+	} else if(!strcmp(option, "--preset")) {
+	    setenv("WITH_SMAA_PRESET", value, 1);
+	} else if(!strcmp(option, "--output")) {
+	    stream.output_path = value;
+	} else {
+	    batch_usage();
+	    return 1;
+	}
+    }
+    if(!stream.input_count) {
+	stream.inputs[stream.input_count++] = "-";
+    }
+
+    if(!batch_open_next(&stream)) {
+	return 1;
+    }
+    if(strcmp(stream.output_path, "stdout")) {
+	stream.output = fopen(stream.output_path, "wb");
+	if(!stream.output) {
+	    fprintf(stderr, "smaa_batch: cannot write %s: %s\n", stream.output_path, strerror(errno));
+	    return 1;
+	}
+    }
+
+    size_t frame_size = (size_t)stream.width * stream.height * 4;
+    if(stream.format != BATCH_RGBA) {
+	int shift = stream.format == BATCH_Y4M_420;
+	size_t chroma = (size_t)((stream.width + shift) >> shift) * ((stream.height + shift) >> shift);
+	stream.planes_size = (size_t)stream.width * stream.height + 2 * chroma;
+	stream.planes = malloc(stream.planes_size);
+	stream.out_planes = malloc(stream.planes_size);
+    }
+    batch_queue_init(&stream.free_in);
+    batch_queue_init(&stream.read);
+    batch_queue_init(&stream.free_out);
+    batch_queue_init(&stream.done);
+    for(int i = 0; i < BATCH_BUFFERS; i++) {
+	batch_queue_push(&stream.free_in, malloc(frame_size));
+	batch_queue_push(&stream.free_out, malloc(frame_size));
+    }
+
+    // Only the settings asked for, not the user's budget. Letterbox
+    // detection stays, recordings have bars too.
+    setenv("WITH_SMAA_BUDGET", "0", 1);
+
+    // The GPU, unless it's a software rasterizer, where the CPU engine
+    // is much faster than emulated shaders
+    unsigned generation;
+    int backend = smaa_config_get(&generation)->backend;
+    SMAAHeadless headless;
+    int gl = backend != SMAA_BACKEND_CPU && smaa_headless_init(&headless)
+	&& smaa_headless_resize(&headless, stream.width, stream.height);
+    if(gl && backend == SMAA_BACKEND_AUTO && smaa_software_renderer()) {
+	fprintf(stderr, "smaa_batch: software rasterizer, using the CPU engine\n");
+	smaa_headless_destroy(&headless);
+	gl = 0;
+    } else if(!gl && backend != SMAA_BACKEND_CPU) {
+	fprintf(stderr, "smaa_batch: no OpenGL, using the CPU engine\n");
+    }
+
+    SMAACPU *cpu = 0;
+    if(!gl) {
+	const char *threads = getenv("WITH_SMAA_CPU_THREADS");
+	cpu = smaa_cpu_create(threads ? atoi(threads) : 0);
+	if(!cpu) {
+	    fprintf(stderr, "smaa_batch: cannot create the CPU engine\n");
+	    return 1;
+	}
+    }
+
+    pthread_t reader, writer;
+    if(pthread_create(&reader, 0, batch_reader, &stream) || pthread_create(&writer, 0, batch_writer, &stream)) {
+	fprintf(stderr, "smaa_batch: cannot start threads\n");
+	return 1;
+    }
+
+    double start = smaa_time_ms();
+    int ok = 1;
+    if(gl) {
+	SMAA *smaa = smaa_create(0);
+	ok = batch_run_gl(&stream, smaa);
+	smaa_destroy(smaa, 1);
+	smaa_headless_destroy(&headless);
+    } else {
+	batch_run_cpu(&stream, cpu);
+	smaa_cpu_destroy(cpu);
+    }
+
+    // On failure the reader may still wait for a buffer
+    batch_queue_close(&stream.free_in);
+    batch_queue_close(&stream.done);
+    pthread_join(reader, 0);
+    pthread_join(writer, 0);
+    double elapsed = smaa_time_ms() - start;
+
+    fprintf(stderr, "smaa_batch: %.1f fps, %u frames of %dx%d in %.2f s on the %s\n",
+	    stream.frames ? stream.frames * 1000 / elapsed : 0, stream.frames,
+	    stream.width, stream.height, elapsed / 1000, gl ? "GPU" : "CPU");
+
+    if(stream.output != stdout && fclose(stream.output)) {
+	stream.failed = 1;
+    }
+    return ok && !stream.failed ? 0 : 1;
+}
@@ -0,0 +1,744 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+
+#include "smaa.h"
+#include "headless.h"
+
+// Runs SMAA on synthetic scenes in a headless context and reports the
+// CPU time of smaa_update() and the GPU time of every pass, for every
+// combination of scene, preset, size and pass chain. A chain is the
+// method, optionally with "+sharpen" for the sharpening fused into the
+// last pass; FXAA's time is that of the neighbor pass. Optionally checks the output
+// against golden images and the timings against an earlier run.
+
+#define BENCH_MAX_ITEMS 16
+// Strength of "+sharpen" chains
+#define BENCH_SHARPEN "0.5"
+
+typedef struct BenchList {
+    const char *items[BENCH_MAX_ITEMS];
+    int count;
+} BenchList;
+
+typedef struct BenchOptions {
+    BenchList scenes;
+    BenchList presets;
+    BenchList chains;
+    BenchList sizes;
+    int frames;
+    const char *output;
+    const char *golden;
+    int tolerance;
+    const char *baseline;
+    float max_regression;
+} BenchOptions;
+
+typedef struct BenchResult {
+    char scene[32];
+    char preset[32];
+    char chain[32];
+    int width, height;
+    float cpu_ms;
+    // Per SMAA_PASS_*, then the total; negative without timer queries
+    float gpu_ms[SMAA_PASS_COUNT + 1];
+} BenchResult;
+
+typedef struct BenchTimings {
+    double sum[SMAA_PASS_COUNT];
+    int frames;
+} BenchTimings;
+
+static const char *bench_pass_names[SMAA_PASS_COUNT + 1] = { "copy", "edge", "blend", "neighbor", "total" };
+
+// Deterministic, so golden images are comparable between runs
+static unsigned bench_seed;
+
+static
+unsigned bench_random()
+{
+    bench_seed = bench_seed * 1103515245u + 12345u;
+    return bench_seed >> 8;
+}
+
+static
+float bench_random_float()
+{
+    return (bench_random() & 0xffff) / 65535.0f;
+}
+
+static
+void bench_pixel(unsigned char *image, int width, int height, int x, int y,
+		 unsigned char r, unsigned char g, unsigned char b)
+{
+    if(x < 0 || y < 0 || x >= width || y >= height) {
+	return;
+    }
+    unsigned char *pixel = image + ((size_t)y * width + x) * 4;
+    pixel[0] = r;
+    pixel[1] = g;
+    pixel[2] = b;
+    pixel[3] = 255;
+}
+
+static
+void bench_fill(unsigned char *image, int width, int height,
+		unsigned char r, unsigned char g, unsigned char b)
+{
+    for(int y = 0; y < height; y++) {
+	for(int x = 0; x < width; x++) {
+	    bench_pixel(image, width, height, x, y, r, g, b);
+	}
+    }
+}
+
+static
+void bench_line(unsigned char *image, int width, int height, int x0, int y0, int x1, int y1,
+		unsigned char r, unsigned char g, unsigned char b)
+{
+    // Bresenham, i.e. as aliased as it gets
+    int dx = abs(x1 - x0), sx = x0 < x1 ? 1 : -1;
+    int dy = -abs(y1 - y0), sy = y0 < y1 ? 1 : -1;
+    int error = dx + dy;
+    for(;;) {
+	bench_pixel(image, width, height, x0, y0, r, g, b);
+	if(x0 == x1 && y0 == y1) {
+	    break;
+	}
+	int e2 = 2 * error;
+	if(e2 >= dy) {
+	    error += dy;
+	    x0 += sx;
+	}
+	if(e2 <= dx) {
+	    error += dx;
+	    y0 += sy;
+	}
+    }
+}
+
+// Edge dense: a perspective grid and lots of random segments
+static
+void bench_scene_wireframe(unsigned char *image, int width, int height)
+{
+    bench_fill(image, width, height, 16, 20, 28);
+
+    int horizon = height / 3;
+    for(int i = -40; i <= 40; i++) {
+	bench_line(image, width, height, width / 2, horizon,
+		   width / 2 + i * width / 16, height - 1, 60, 200, 90);
+    }
+    for(int i = 1; i < 40; i++) {
+	int y = horizon + (height - horizon) * i * i / 1600;
+	bench_line(image, width, height, 0, y, width - 1, y, 60, 200, 90);
+    }
+
+    int segments = width * height / 2000;
+    for(int i = 0; i < segments; i++) {
+	int x = bench_random() % width, y = bench_random() % horizon;
+	int length = 8 + bench_random() % (width / 8);
+	float angle = bench_random_float() * 6.2831853f;
+	bench_line(image, width, height, x, y, x + length * cosf(angle), y + length * sinf(angle),
+		   200 + bench_random() % 56, 200 + bench_random() % 56, 255);
+    }
+}
+
+static
+float bench_noise(const float *lattice, int size, float x, float y)
+{
+    int xi = (int)x, yi = (int)y;
+    float fx = x - xi, fy = y - yi;
+    fx = fx * fx * (3 - 2 * fx);
+    fy = fy * fy * (3 - 2 * fy);
+    float a = lattice[(yi % size) * size + xi % size];
+    float b = lattice[(yi % size) * size + (xi + 1) % size];
+    float c = lattice[((yi + 1) % size) * size + xi % size];
+    float d = lattice[((yi + 1) % size) * size + (xi + 1) % size];
+    return (a + (b - a) * fx) + ((c + (d - c) * fx) - (a + (b - a) * fx)) * fy;
+}
+
+// Smooth gradients and textures with natural, irregular edges: sky,
+// hills and trees as silhouettes, and some round objects.
+static
+void bench_scene_photo(unsigned char *image, int width, int height)
+{
+    enum { LATTICE = 64 };
+    float lattice[LATTICE * LATTICE];
+    for(int i = 0; i < LATTICE * LATTICE; i++) {
+	lattice[i] = bench_random_float();
+    }
+
+    float scale = 1.0f / height;
+    for(int y = 0; y < height; y++) {
+	for(int x = 0; x < width; x++) {
+	    float u = x * scale, v = y * scale;
+	    float detail = 0, amplitude = 0.5f, frequency = 4;
+	    for(int octave = 0; octave < 4; octave++) {
+		detail += amplitude * bench_noise(lattice, LATTICE, u * frequency, v * frequency);
+		amplitude *= 0.5f;
+		frequency *= 2;
+	    }
+
+	    float ridge = 0.45f + 0.15f * bench_noise(lattice, LATTICE, u * 3, 7.5f)
+		+ 0.05f * bench_noise(lattice, LATTICE, u * 40, 3.5f);
+	    float r, g, b;
+	    if(v < ridge) {
+		// Sky, with clouds
+		float cloud = detail > 0.55f ? (detail - 0.55f) * 2 : 0;
+		r = 0.35f + 0.3f * v + cloud;
+		g = 0.55f + 0.25f * v + cloud;
+		b = 0.9f + cloud;
+	    } else {
+		// Grass and rocks
+		r = 0.2f + 0.3f * detail;
+		g = 0.35f + 0.35f * detail;
+		b = 0.15f + 0.1f * detail;
+	    }
+
+	    unsigned char pixel[3];
+	    float color[3] = { r, g, b };
+	    for(int c = 0; c < 3; c++) {
+		float value = color[c] > 1 ? 1 : color[c];
+		pixel[c] = value * 255;
+	    }
+	    bench_pixel(image, width, height, x, height - 1 - y, pixel[0], pixel[1], pixel[2]);
+	}
+    }
+
+    int objects = 12;
+    for(int i = 0; i < objects; i++) {
+	int cx = bench_random() % width, cy = bench_random() % height;
+	int radius = height / 40 + bench_random() % (height / 10);
+	unsigned char r = bench_random() % 256, g = bench_random() % 256, b = bench_random() % 256;
+	for(int y = -radius; y <= radius; y++) {
+	    for(int x = -radius; x <= radius; x++) {
+		if(x * x + y * y <= radius * radius) {
+		    bench_pixel(image, width, height, cx + x, cy + y, r, g, b);
+		}
+	    }
+	}
+    }
+}
+
+// 5x7 glyphs for A-Z and 0-9, one byte per row, bit 4 is the left column
+static const unsigned char bench_font[36][7] = {
+    { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e },
+    { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e }, { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c },
+    { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f }, { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 },
+    { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f }, { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },
+    { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e }, { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c },
+    { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 }, { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f },
+    { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 }, { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+    { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 },
+    { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d }, { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 },
+    { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e }, { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+    { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e }, { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 },
+    { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a }, { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 },
+    { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 }, { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f },
+    { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e }, { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },
+    { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f }, { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },
+    { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 }, { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },
+    { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e }, { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+    { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e }, { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },
+};
+
+// Pages of random words in a few sizes, as in menus, HUDs and consoles
+static
+void bench_scene_text(unsigned char *image, int width, int height)
+{
+    bench_fill(image, width, height, 235, 232, 220);
+
+    int y = 8;
+    for(int line = 0; y < height; line++) {
+	int size = 1 + line % 3 + height / 1080;
+	unsigned char shade = line % 4 == 0 ? 160 : 20;
+	int x = 8;
+	while(x < width - 6 * size) {
+	    int letters = 2 + bench_random() % 8;
+	    for(int i = 0; i < letters && x < width - 6 * size; i++) {
+		const unsigned char *glyph = bench_font[bench_random() % 36];
+		for(int row = 0; row < 7 * size; row++) {
+		    for(int column = 0; column < 5 * size; column++) {
+			if(glyph[row / size] & (0x10 >> (column / size))) {
+			    bench_pixel(image, width, height, x + column, height - 1 - (y + row),
+					shade, 20, 20);
+			}
+		    }
+		}
+		x += 6 * size;
+	    }
+	    x += 4 * size;
+	}
+	y += 10 * size;
+    }
+}
+
+static const struct {
+    const char *name;
+    void (*render)(unsigned char *image, int width, int height);
+} bench_scenes[] = {
+    { "wireframe", bench_scene_wireframe },
+    { "photo", bench_scene_photo },
+    { "text", bench_scene_text },
+};
+
+static
+int bench_write_ppm(const char *path, const unsigned char *image, int width, int height)
+{
+    FILE *file = fopen(path, "wb");
+    if(!file) {
+	fprintf(stderr, "smaa_bench: cannot write %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for(int y = height - 1; y >= 0; y--) {
+	for(int x = 0; x < width; x++) {
+	    fwrite(image + ((size_t)y * width + x) * 4, 1, 3, file);
+	}
+    }
+    return !fclose(file);
+}
+
+static
+unsigned char *bench_read_ppm(const char *path, int *width, int *height)
+{
+    FILE *file = fopen(path, "rb");
+    if(!file) {
+	return 0;
+    }
+
+    int max;
+    unsigned char *image = 0;
+    if(fscanf(file, "P6 %d %d %d", width, height, &max) == 3 && max == 255 && fgetc(file) != EOF) {
+	image = malloc((size_t)*width * *height * 4);
+	for(int y = *height - 1; y >= 0 && image; y--) {
+	    for(int x = 0; x < *width; x++) {
+		unsigned char *pixel = image + ((size_t)y * *width + x) * 4;
+		if(fread(pixel, 1, 3, file) != 3) {
+		    free(image);
+		    image = 0;
+		    break;
+		}
+		pixel[3] = 255;
+	    }
+	}
+    }
+
+    fclose(file);
+    return image;
+}
+
+// Writes the golden image if there is none yet, compares against it
+// otherwise. Returns 0 on a mismatch.
+static
+int bench_golden(const BenchOptions *options, const char *name, int width, int height)
+{
+    unsigned char *image = malloc((size_t)width * height * 4);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, image);
+
+    char path[4096];
+    snprintf(path, sizeof(path), "%s/%s.ppm", options->golden, name);
+
+    int golden_width, golden_height;
+    unsigned char *golden = bench_read_ppm(path, &golden_width, &golden_height);
+    if(!golden) {
+	int ok = bench_write_ppm(path, image, width, height);
+	if(ok) {
+	    printf("wrote golden image %s\n", path);
+	}
+	free(image);
+	return ok;
+    }
+
+    int ok = golden_width == width && golden_height == height;
+    if(ok) {
+	size_t pixels = (size_t)width * height, differing = 0;
+	int max_difference = 0;
+	for(size_t i = 0; i < pixels; i++) {
+	    int difference = 0;
+	    for(int c = 0; c < 3; c++) {
+		int d = abs(image[i * 4 + c] - golden[i * 4 + c]);
+		difference = d > difference ? d : difference;
+	    }
+	    if(difference > options->tolerance) {
+		differing++;
+	    }
+	    max_difference = difference > max_difference ? difference : max_difference;
+	}
+
+	// Drivers round differently, allow a few stray pixels
+	ok = differing <= pixels / 1000;
+	printf("%s: %zu pixels over tolerance, max difference %d%s\n",
+	       path, differing, max_difference, ok ? "" : ", MISMATCH");
+    } else {
+	printf("%s: size %dx%d, expected %dx%d, MISMATCH\n",
+	       path, width, height, golden_width, golden_height);
+    }
+
+    free(golden);
+    free(image);
+    return ok;
+}
+
+static
+void bench_timings_sink(void *data, const float *ms)
+{
+    BenchTimings *timings = data;
+    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	timings->sum[pass] += ms[pass];
+    }
+    timings->frames++;
+}
+
+static
+void bench_draw_scene(GLuint scene_fbo, int width, int height)
+{
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+}
+
+static
+int bench_run(const BenchOptions *options, SMAA *smaa, const char *scene, const char *preset,
+	      const char *chain, GLuint scene_fbo, int width, int height, int golden,
+	      BenchResult *result)
+{
+    const char *sharpen = strchr(chain, '+');
+    char method[32];
+    snprintf(method, sizeof(method), "%.*s", sharpen ? (int)(sharpen - chain) : 31, chain);
+    setenv("WITH_SMAA_PRESET", preset, 1);
+    setenv("WITH_SMAA_METHOD", method, 1);
+    setenv("WITH_SMAA_SHARPEN", sharpen ? BENCH_SHARPEN : "0", 1);
+    smaa_config_reload();
+
+    // Until the programs for the preset are built and in use
+    for(int i = 0; i < 1000 && (i < 3 || smaa->pending); i++) {
+	bench_draw_scene(scene_fbo, width, height);
+	smaa_update(smaa, width, height);
+	if(smaa->incompatible) {
+	    fprintf(stderr, "smaa_bench: SMAA not supported by this context\n");
+	    return 0;
+	}
+    }
+
+    BenchTimings timings;
+    int gpu = smaa_telemetry_capture(&smaa->telemetry, bench_timings_sink, &timings);
+    glFinish();
+    smaa_telemetry_flush(&smaa->telemetry);
+    memset(&timings, 0, sizeof(timings));
+
+    double cpu = 0;
+    for(int i = 0; i < options->frames; i++) {
+	bench_draw_scene(scene_fbo, width, height);
+	double start = smaa_time_ms();
+	smaa_update(smaa, width, height);
+	cpu += smaa_time_ms() - start;
+    }
+    glFinish();
+    smaa_telemetry_flush(&smaa->telemetry);
+
+    snprintf(result->scene, sizeof(result->scene), "%s", scene);
+    snprintf(result->preset, sizeof(result->preset), "%s", preset);
+    snprintf(result->chain, sizeof(result->chain), "%s", chain);
+    result->width = width;
+    result->height = height;
+    result->cpu_ms = cpu / options->frames;
+    // No GPU timings without timer queries or with the CPU backend,
+    // where all the work is in cpu_ms
+    int measured = gpu && timings.frames;
+    result->gpu_ms[SMAA_PASS_COUNT] = measured ? 0 : -1;
+    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	float ms = measured ? timings.sum[pass] / timings.frames : -1;
+	result->gpu_ms[pass] = ms;
+	if(measured) {
+	    result->gpu_ms[SMAA_PASS_COUNT] += ms;
+	}
+    }
+
+    if(golden) {
+	// Plain SMAA keeps the names from before there were chains
+	char name[128];
+	snprintf(name, sizeof(name), "%s-%s%s%s", scene, preset,
+		 strcmp(chain, "smaa") ? "-" : "", strcmp(chain, "smaa") ? chain : "");
+	return bench_golden(options, name, width, height);
+    }
+    return 1;
+}
+
+static
+void bench_print(FILE *file, const BenchResult *result)
+{
+    fprintf(file, "%s,%s,%s,%d,%d,%.3f", result->scene, result->preset, result->chain,
+	    result->width, result->height, result->cpu_ms);
+    for(int pass = 0; pass <= SMAA_PASS_COUNT; pass++) {
+	fprintf(file, ",%.3f", result->gpu_ms[pass]);
+    }
+    fprintf(file, "\n");
+}
+
+static
+void bench_print_header(FILE *file)
+{
+    fprintf(file, "scene,preset,chain,width,height,cpu_ms");
+    for(int pass = 0; pass <= SMAA_PASS_COUNT; pass++) {
+	fprintf(file, ",gpu_%s_ms", bench_pass_names[pass]);
+    }
+    fprintf(file, "\n");
+}
+
+// Compares against the CSV of an earlier run. Returns 0 if anything got
+// slower by more than the allowed regression.
+static
+int bench_compare(const BenchOptions *options, const BenchResult *results, int count)
+{
+    FILE *file = fopen(options->baseline, "r");
+    if(!file) {
+	fprintf(stderr, "smaa_bench: cannot read %s: %s\n", options->baseline, strerror(errno));
+	return 0;
+    }
+
+    int ok = 1;
+    char line[1024];
+    while(fgets(line, sizeof(line), file)) {
+	BenchResult old;
+	float *gpu = old.gpu_ms;
+	if(sscanf(line, "%31[^,],%31[^,],%31[^,],%d,%d,%f,%f,%f,%f,%f,%f", old.scene, old.preset,
+		  old.chain, &old.width, &old.height, &old.cpu_ms,
+		  &gpu[0], &gpu[1], &gpu[2], &gpu[3], &gpu[4]) != 11) {
+	    // Runs from before there were chains only had SMAA
+	    if(sscanf(line, "%31[^,],%31[^,],%d,%d,%f,%f,%f,%f,%f,%f", old.scene, old.preset,
+		      &old.width, &old.height, &old.cpu_ms,
+		      &gpu[0], &gpu[1], &gpu[2], &gpu[3], &gpu[4]) != 10) {
+		continue;
+	    }
+	    strcpy(old.chain, "smaa");
+	}
+
+	for(int i = 0; i < count; i++) {
+	    const BenchResult *new = &results[i];
+	    if(strcmp(new->scene, old.scene) || strcmp(new->preset, old.preset)
+	       || strcmp(new->chain, old.chain) || new->width != old.width || new->height != old.height) {
+		continue;
+	    }
+
+	    // Ignore sub-10us noise on tiny timings
+	    float limit = 1 + options->max_regression / 100;
+	    float cpu = new->cpu_ms, total = new->gpu_ms[SMAA_PASS_COUNT];
+	    int slower = (cpu > old.cpu_ms * limit && cpu - old.cpu_ms > 0.01f)
+		|| (total > 0 && total > gpu[SMAA_PASS_COUNT] * limit
+		    && total - gpu[SMAA_PASS_COUNT] > 0.01f);
+	    if(slower) {
+		printf("REGRESSION %s/%s/%s %dx%d: cpu %.3f -> %.3f ms, gpu %.3f -> %.3f ms\n",
+		       new->scene, new->preset, new->chain, new->width, new->height,
+		       old.cpu_ms, cpu, gpu[SMAA_PASS_COUNT], total);
+		ok = 0;
+	    }
+	}
+    }
+
+    fclose(file);
+    return ok;
+}
+
+// "smaa" or "fxaa", optionally followed by "+sharpen"
+static
+int bench_valid_chain(const char *chain)
+{
+    const char *sharpen = strchr(chain, '+');
+    size_t length = sharpen ? (size_t)(sharpen - chain) : strlen(chain);
+    return (length == 4 && (!strncmp(chain, "smaa", 4) || !strncmp(chain, "fxaa", 4)))
+	&& (!sharpen || !strcmp(sharpen, "+sharpen"));
+}
+
+static
+void bench_split(BenchList *list, char *value)
+{
+    list->count = 0;
+    for(char *item = strtok(value, ","); item && list->count < BENCH_MAX_ITEMS; item = strtok(0, ",")) {
+	list->items[list->count++] = item;
+    }
+}
+
+static
+void bench_usage()
+{
+    fprintf(stderr,
+	    "usage: smaa_bench [options]\n"
+	    "  --scenes wireframe,photo,text\n"
+	    "  --presets low,medium,high,ultra\n"
+	    "  --chains smaa,smaa+sharpen,fxaa,fxaa+sharpen\n"
+	    "  --sizes 1280x720,1920x1080,2560x1440,3840x2160,7680x4320\n"
+	    "  --frames N          measured frames per combination (default 20)\n"
+	    "  --output FILE       write the results as CSV\n"
+	    "  --golden DIR        compare the output at the first size against the\n"
+	    "                      images in DIR, writing missing ones\n"
+	    "  --tolerance N       per channel difference allowed (default 2)\n"
+	    "  --baseline FILE     fail on regressions against an earlier --output\n"
+	    "  --max-regression P  allowed slowdown in percent (default 10)\n");
+}
+
+int main(int argc, char **argv)
+{
+    char scenes[] = "wireframe,photo,text";
+    char presets[] = "low,medium,high,ultra";
+    char chains[] = "smaa,smaa+sharpen,fxaa,fxaa+sharpen";
+    char sizes[] = "1280x720,1920x1080,2560x1440,3840x2160,7680x4320";
+
+    BenchOptions options;
+    memset(&options, 0, sizeof(options));
+    bench_split(&options.scenes, scenes);
+    bench_split(&options.presets, presets);
+    bench_split(&options.chains, chains);
+    bench_split(&options.sizes, sizes);
+    options.frames = 20;
+    options.tolerance = 2;
+    options.max_regression = 10;
+
+    for(int i = 1; i < argc; i++) {
+	const char *option = argv[i];
+	char *value = i + 1 < argc ? argv[i + 1] : 0;
+	if(!value) {
+	    bench_usage();
+	    return 1;
+	}
+	i++;
+
+	if(!strcmp(option, "--scenes")) {
+	    bench_split(&options.scenes, value);
+	} else if(!strcmp(option, "--presets")) {
+	    bench_split(&options.presets, value);
+	} else if(!strcmp(option, "--chains")) {
+	    bench_split(&options.chains, value);
+	} else if(!strcmp(option, "--sizes")) {
+	    bench_split(&options.sizes, value);
+	} else if(!strcmp(option, "--frames")) {
+	    options.frames = atoi(value) > 0 ? atoi(value) : 1;
+	} else if(!strcmp(option, "--output")) {
+	    options.output = value;
+	} else if(!strcmp(option, "--golden")) {
+	    options.golden = value;
+	} else if(!strcmp(option, "--tolerance")) {
+	    options.tolerance = atoi(value);
+	} else if(!strcmp(option, "--baseline")) {
+	    options.baseline = value;
+	} else if(!strcmp(option, "--max-regression")) {
+	    options.max_regression = atof(value);
+	} else {
+	    bench_usage();
+	    return 1;
+	}
+    }
+
+    for(int i = 0; i < options.chains.count; i++) {
+	if(!bench_valid_chain(options.chains.items[i])) {
+	    fprintf(stderr, "smaa_bench: invalid chain %s\n", options.chains.items[i]);
+	    return 1;
+	}
+    }
+
+    // Only the settings under test, not the user's profile or budget
+    setenv("WITH_SMAA_PROFILE", "/dev/null", 1);
+    setenv("WITH_SMAA_BUDGET", "0", 1);
+    // Scenes with dark borders would be measured smaller
+    setenv("WITH_SMAA_LETTERBOX", "off", 1);
+
+    SMAAHeadless headless;
+    if(!smaa_headless_init(&headless)) {
+	return 1;
+    }
+
+    SMAA *smaa = smaa_create(0);
+    int results_size = options.scenes.count * options.presets.count * options.chains.count
+	* options.sizes.count;
+    BenchResult *results = calloc(results_size, sizeof(BenchResult));
+    int count = 0, ok = 1;
+
+    bench_print_header(stdout);
+
+    for(int s = 0; s < options.sizes.count; s++) {
+	int width, height;
+	if(sscanf(options.sizes.items[s], "%dx%d", &width, &height) != 2 || width <= 0 || height <= 0) {
+	    fprintf(stderr, "smaa_bench: invalid size %s\n", options.sizes.items[s]);
+	    return 1;
+	}
+	if(!smaa_headless_resize(&headless, width, height)) {
+	    return 1;
+	}
+
+	unsigned char *image = malloc((size_t)width * height * 4);
+	GLuint scene_tex, scene_fbo;
+	glGenTextures(1, &scene_tex);
+	glGenFramebuffers(1, &scene_fbo);
+
+	for(int c = 0; c < options.scenes.count; c++) {
+	    const char *scene = options.scenes.items[c];
+	    size_t index = 0;
+	    while(index < sizeof(bench_scenes) / sizeof(bench_scenes[0])
+		  && strcmp(bench_scenes[index].name, scene)) {
+		index++;
+	    }
+	    if(index == sizeof(bench_scenes) / sizeof(bench_scenes[0])) {
+		fprintf(stderr, "smaa_bench: unknown scene %s\n", scene);
+		return 1;
+	    }
+
+	    bench_seed = 1;
+	    bench_scenes[index].render(image, width, height);
+
+	    glBindTexture(GL_TEXTURE_2D, scene_tex);
+	    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image);
+	    glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+	    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_tex, 0);
+
+	    for(int p = 0; p < options.presets.count; p++) {
+		for(int h = 0; h < options.chains.count; h++) {
+		    BenchResult *result = &results[count++];
+		    int golden = options.golden && s == 0;
+		    if(!bench_run(&options, smaa, scene, options.presets.items[p], options.chains.items[h],
+				  scene_fbo, width, height, golden, result)) {
+			ok = 0;
+		    }
+		    if(smaa->incompatible) {
+			return 1;
+		    }
+		    bench_print(stdout, result);
+		    fflush(stdout);
+		}
+	    }
+	}
+
+	glDeleteFramebuffers(1, &scene_fbo);
+	glDeleteTextures(1, &scene_tex);
+	free(image);
+    }
+
+    if(options.output) {
+	FILE *file = fopen(options.output, "w");
+	if(file) {
+	    bench_print_header(file);
+	    for(int i = 0; i < count; i++) {
+		bench_print(file, &results[i]);
+	    }
+	    fclose(file);
+	} else {
+	    fprintf(stderr, "smaa_bench: cannot write %s: %s\n", options.output, strerror(errno));
+	    ok = 0;
+	}
+    }
+
+    if(options.baseline && !bench_compare(&options, results, count)) {
+	ok = 0;
+    }
+
+    free(results);
+    smaa_destroy(smaa, 1);
+    smaa_headless_destroy(&headless);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,1009 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CPU_X86 1
+#include <immintrin.h>
+#endif
+
+#include "smaa_cpu.h"
+
+#include "AreaTex.h"
+#include "SearchTex.h"
+
+// Rows per tile, the unit of work handed to the threads
+#define CPU_TILE_ROWS 16
+// Entries of the linear to sRGB table
+#define CPU_SRGB_LUT 8192
+
+// Luma weights of SMAALumaEdgeDetectionPS, for bytes instead of [0, 1]
+#define CPU_LUMA_R (0.2126f / 255)
+#define CPU_LUMA_G (0.7152f / 255)
+#define CPU_LUMA_B (0.0722f / 255)
+
+typedef struct CPUKernels {
+    const char *isa;
+    // One row of RGBA8 pixels to luma
+    void (*luma)(const uint8_t *pixels, float *luma, int width);
+    // One row of luma edges, from the row and its neighbors above
+    // (lower in memory) and below
+    void (*luma_edges)(const float *row, const float *top, const float *toptop,
+		       const float *bottom, int width, float threshold, uint8_t *edges);
+} CPUKernels;
+
+typedef void (*CPUJob)(SMAACPU *cpu, int y0, int y1);
+
+struct SMAACPU {
+    SMAACPUSettings settings;
+    const CPUKernels *kernels;
+
+    // The calling thread works on tiles as well
+    int threads;
+    pthread_t *workers;
+    pthread_mutex_t mutex;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    unsigned job_id;
+    // Workers that haven't finished the current job yet
+    int busy;
+    int quit;
+
+    CPUJob job;
+    int tiles;
+    // Claimed with atomics
+    int next_tile;
+
+    // The frame being processed
+    const uint8_t *input;
+    uint8_t *output;
+    int width;
+    int height;
+    int stride;
+
+    // Intermediates of the passes, like the shader path's edge_tex and
+    // blend_tex. Edges are 0 or 1 per channel, weights 8 bit like RGBA8.
+    float *luma;
+    uint8_t *edges;
+    uint8_t *weights;
+    size_t capacity;
+
+    float to_linear[256];
+    uint8_t to_srgb[CPU_SRGB_LUT];
+};
+
+static inline
+float cpu_luma(const uint8_t *pixel)
+{
+    return pixel[0] * CPU_LUMA_R + pixel[1] * CPU_LUMA_G + pixel[2] * CPU_LUMA_B;
+}
+
+static inline
+void cpu_luma_edge(const float *row, const float *top, const float *toptop,
+		   const float *bottom, int x, int width, float threshold, uint8_t *edges)
+{
+    int left = x > 0 ? x - 1 : 0, leftleft = x > 1 ? x - 2 : 0;
+    int right = x + 1 < width ? x + 1 : x;
+
+    float l = row[x];
+    float delta_left = fabsf(l - row[left]), delta_top = fabsf(l - top[x]);
+    int ex = delta_left >= threshold, ey = delta_top >= threshold;
+
+    if(ex || ey) {
+	// Local contrast adaptation, a factor of 2 like SMAA.hlsl
+	float max_x = fmaxf(delta_left, fabsf(l - row[right]));
+	float max_y = fmaxf(delta_top, fabsf(l - bottom[x]));
+	max_x = fmaxf(max_x, fabsf(row[left] - row[leftleft]));
+	max_y = fmaxf(max_y, fabsf(top[x] - toptop[x]));
+	float final = fmaxf(max_x, max_y);
+	ex = ex && 2 * delta_left >= final;
+	ey = ey && 2 * delta_top >= final;
+    }
+
+    edges[2 * x] = ex;
+    edges[2 * x + 1] = ey;
+}
+
+static
+void cpu_luma_scalar(const uint8_t *pixels, float *luma, int width)
+{
+    for(int x = 0; x < width; x++) {
+	luma[x] = cpu_luma(pixels + 4 * x);
+    }
+}
+
+static
+void cpu_luma_edges_scalar(const float *row, const float *top, const float *toptop,
+			   const float *bottom, int width, float threshold, uint8_t *edges)
+{
+    for(int x = 0; x < width; x++) {
+	cpu_luma_edge(row, top, toptop, bottom, x, width, threshold, edges);
+    }
+}
+
+static const CPUKernels cpu_kernels_scalar = { "scalar", cpu_luma_scalar, cpu_luma_edges_scalar };
+
+#ifdef CPU_X86
+
+// The vector kernels do the same float operations in the same order as
+// the scalar ones, so all of them give identical edges.
+
+__attribute__ ((target ("sse4.1")))
+static
+void cpu_luma_sse41(const uint8_t *pixels, float *luma, int width)
+{
+    const __m128i mask = _mm_set1_epi32(0xff);
+    const __m128 wr = _mm_set1_ps(CPU_LUMA_R), wg = _mm_set1_ps(CPU_LUMA_G), wb = _mm_set1_ps(CPU_LUMA_B);
+
+    int x = 0;
+    for(; x + 4 <= width; x += 4) {
+	__m128i p = _mm_loadu_si128((const __m128i*)(pixels + 4 * x));
+	__m128 r = _mm_cvtepi32_ps(_mm_and_si128(p, mask));
+	__m128 g = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 8), mask));
+	__m128 b = _mm_cvtepi32_ps(_mm_and_si128(_mm_srli_epi32(p, 16), mask));
+	_mm_storeu_ps(luma + x, _mm_add_ps(_mm_add_ps(_mm_mul_ps(r, wr), _mm_mul_ps(g, wg)), _mm_mul_ps(b, wb)));
+    }
+    for(; x < width; x++) {
+	luma[x] = cpu_luma(pixels + 4 * x);
+    }
+}
+
+__attribute__ ((target ("sse4.1")))
+static
+void cpu_luma_edges_sse41(const float *row, const float *top, const float *toptop,
+			  const float *bottom, int width, float threshold, uint8_t *edges)
+{
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 thresholds = _mm_set1_ps(threshold);
+
+    int x = 0;
+    for(; x < 2 && x < width; x++) {
+	cpu_luma_edge(row, top, toptop, bottom, x, width, threshold, edges);
+    }
+    // Up to the last pixel, which needs its right neighbor clamped
+    for(; x + 4 < width; x += 4) {
+	__m128 l = _mm_loadu_ps(row + x);
+	__m128 left = _mm_loadu_ps(row + x - 1);
+	__m128 t = _mm_loadu_ps(top + x);
+	__m128 delta_left = _mm_andnot_ps(sign, _mm_sub_ps(l, left));
+	__m128 delta_top = _mm_andnot_ps(sign, _mm_sub_ps(l, t));
+
+	__m128 ex = _mm_cmpge_ps(delta_left, thresholds);
+	__m128 ey = _mm_cmpge_ps(delta_top, thresholds);
+	if(!_mm_movemask_ps(_mm_or_ps(ex, ey))) {
+	    memset(edges + 2 * x, 0, 2 * 4);
+	    continue;
+	}
+
+	__m128 max_x = _mm_max_ps(delta_left, _mm_andnot_ps(sign, _mm_sub_ps(l, _mm_loadu_ps(row + x + 1))));
+	__m128 max_y = _mm_max_ps(delta_top, _mm_andnot_ps(sign, _mm_sub_ps(l, _mm_loadu_ps(bottom + x))));
+	max_x = _mm_max_ps(max_x, _mm_andnot_ps(sign, _mm_sub_ps(left, _mm_loadu_ps(row + x - 2))));
+	max_y = _mm_max_ps(max_y, _mm_andnot_ps(sign, _mm_sub_ps(t, _mm_loadu_ps(toptop + x))));
+	__m128 final = _mm_max_ps(max_x, max_y);
+	ex = _mm_and_ps(ex, _mm_cmpge_ps(_mm_add_ps(delta_left, delta_left), final));
+	ey = _mm_and_ps(ey, _mm_cmpge_ps(_mm_add_ps(delta_top, delta_top), final));
+
+	int mx = _mm_movemask_ps(ex), my = _mm_movemask_ps(ey);
+	for(int i = 0; i < 4; i++) {
+	    edges[2 * (x + i)] = mx >> i & 1;
+	    edges[2 * (x + i) + 1] = my >> i & 1;
+	}
+    }
+    for(; x < width; x++) {
+	cpu_luma_edge(row, top, toptop, bottom, x, width, threshold, edges);
+    }
+}
+
+__attribute__ ((target ("avx2")))
+static
+void cpu_luma_avx2(const uint8_t *pixels, float *luma, int width)
+{
+    const __m256i mask = _mm256_set1_epi32(0xff);
+    const __m256 wr = _mm256_set1_ps(CPU_LUMA_R), wg = _mm256_set1_ps(CPU_LUMA_G), wb = _mm256_set1_ps(CPU_LUMA_B);
+
+    int x = 0;
+    for(; x + 8 <= width; x += 8) {
+	__m256i p = _mm256_loadu_si256((const __m256i*)(pixels + 4 * x));
+	__m256 r = _mm256_cvtepi32_ps(_mm256_and_si256(p, mask));
+	__m256 g = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+	__m256 b = _mm256_cvtepi32_ps(_mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+	_mm256_storeu_ps(luma + x, _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(r, wr), _mm256_mul_ps(g, wg)),
+						 _mm256_mul_ps(b, wb)));
+    }
+    for(; x < width; x++) {
+	luma[x] = cpu_luma(pixels + 4 * x);
+    }
+}
+
+__attribute__ ((target ("avx2")))
+static
+void cpu_luma_edges_avx2(const float *row, const float *top, const float *toptop,
+			 const float *bottom, int width, float threshold, uint8_t *edges)
+{
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 thresholds = _mm256_set1_ps(threshold);
+
+    int x = 0;
+    for(; x < 2 && x < width; x++) {
+	cpu_luma_edge(row, top, toptop, bottom, x, width, threshold, edges);
+    }
+    for(; x + 8 < width; x += 8) {
+	__m256 l = _mm256_loadu_ps(row + x);
+	__m256 left = _mm256_loadu_ps(row + x - 1);
+	__m256 t = _mm256_loadu_ps(top + x);
+	__m256 delta_left = _mm256_andnot_ps(sign, _mm256_sub_ps(l, left));
+	__m256 delta_top = _mm256_andnot_ps(sign, _mm256_sub_ps(l, t));
+
+	__m256 ex = _mm256_cmp_ps(delta_left, thresholds, _CMP_GE_OQ);
+	__m256 ey = _mm256_cmp_ps(delta_top, thresholds, _CMP_GE_OQ);
+	if(!_mm256_movemask_ps(_mm256_or_ps(ex, ey))) {
+	    memset(edges + 2 * x, 0, 2 * 8);
+	    continue;
+	}
+
+	__m256 max_x = _mm256_max_ps(delta_left, _mm256_andnot_ps(sign, _mm256_sub_ps(l, _mm256_loadu_ps(row + x + 1))));
+	__m256 max_y = _mm256_max_ps(delta_top, _mm256_andnot_ps(sign, _mm256_sub_ps(l, _mm256_loadu_ps(bottom + x))));
+	max_x = _mm256_max_ps(max_x, _mm256_andnot_ps(sign, _mm256_sub_ps(left, _mm256_loadu_ps(row + x - 2))));
+	max_y = _mm256_max_ps(max_y, _mm256_andnot_ps(sign, _mm256_sub_ps(t, _mm256_loadu_ps(toptop + x))));
+	__m256 final = _mm256_max_ps(max_x, max_y);
+	ex = _mm256_and_ps(ex, _mm256_cmp_ps(_mm256_add_ps(delta_left, delta_left), final, _CMP_GE_OQ));
+	ey = _mm256_and_ps(ey, _mm256_cmp_ps(_mm256_add_ps(delta_top, delta_top), final, _CMP_GE_OQ));
+
+	int mx = _mm256_movemask_ps(ex), my = _mm256_movemask_ps(ey);
+	for(int i = 0; i < 8; i++) {
+	    edges[2 * (x + i)] = mx >> i & 1;
+	    edges[2 * (x + i) + 1] = my >> i & 1;
+	}
+    }
+    for(; x < width; x++) {
+	cpu_luma_edge(row, top, toptop, bottom, x, width, threshold, edges);
+    }
+}
+
+static const CPUKernels cpu_kernels_sse41 = { "sse4.1", cpu_luma_sse41, cpu_luma_edges_sse41 };
+static const CPUKernels cpu_kernels_avx2 = { "avx2", cpu_luma_avx2, cpu_luma_edges_avx2 };
+
+#endif
+
+static
+const CPUKernels *cpu_select_kernels()
+{
+    const char *cap = getenv("WITH_SMAA_CPU_ISA");
+    (void)cap;
+
+#ifdef CPU_X86
+    __builtin_cpu_init();
+    int allow_avx2 = !cap || !cap[0] || !strcmp(cap, "avx2");
+    int allow_sse41 = allow_avx2 || !strcmp(cap, "sse4.1");
+
+    if(allow_avx2 && __builtin_cpu_supports("avx2")) {
+	return &cpu_kernels_avx2;
+    }
+    if(allow_sse41 && __builtin_cpu_supports("sse4.1")) {
+	return &cpu_kernels_sse41;
+    }
+#endif
+    return &cpu_kernels_scalar;
+}
+
+// Thread pool
+
+static
+void cpu_run_tiles(SMAACPU *cpu)
+{
+    int tile;
+    while((tile = __atomic_fetch_add(&cpu->next_tile, 1, __ATOMIC_RELAXED)) < cpu->tiles) {
+	int y0 = tile * CPU_TILE_ROWS;
+	int y1 = y0 + CPU_TILE_ROWS < cpu->height ? y0 + CPU_TILE_ROWS : cpu->height;
+	cpu->job(cpu, y0, y1);
+    }
+}
+
+static
+void *cpu_worker(void *arg)
+{
+    SMAACPU *cpu = arg;
+    unsigned seen = 0;
+
+    pthread_mutex_lock(&cpu->mutex);
+    for(;;) {
+	while(cpu->job_id == seen && !cpu->quit) {
+	    pthread_cond_wait(&cpu->wake, &cpu->mutex);
+	}
+	if(cpu->quit) {
+	    break;
+	}
+	seen = cpu->job_id;
+	pthread_mutex_unlock(&cpu->mutex);
+
+	cpu_run_tiles(cpu);
+
+	pthread_mutex_lock(&cpu->mutex);
+	if(!--cpu->busy) {
+	    pthread_cond_signal(&cpu->done);
+	}
+    }
+    pthread_mutex_unlock(&cpu->mutex);
+
+    return 0;
+}
+
+// Runs job over all rows of the frame, returns once it's done. Each job
+// is a full barrier, like the passes of the shader path.
+static
+void cpu_run(SMAACPU *cpu, CPUJob job)
+{
+    cpu->job = job;
+    cpu->tiles = (cpu->height + CPU_TILE_ROWS - 1) / CPU_TILE_ROWS;
+    cpu->next_tile = 0;
+
+    int workers = cpu->threads - 1;
+    if(workers) {
+	pthread_mutex_lock(&cpu->mutex);
+	cpu->busy = workers;
+	cpu->job_id++;
+	pthread_cond_broadcast(&cpu->wake);
+	pthread_mutex_unlock(&cpu->mutex);
+    }
+
+    cpu_run_tiles(cpu);
+
+    if(workers) {
+	pthread_mutex_lock(&cpu->mutex);
+	while(cpu->busy) {
+	    pthread_cond_wait(&cpu->done, &cpu->mutex);
+	}
+	pthread_mutex_unlock(&cpu->mutex);
+    }
+}
+
+// Edge detection
+
+static
+void cpu_luma_rows(SMAACPU *cpu, int y0, int y1)
+{
+    for(int y = y0; y < y1; y++) {
+	cpu->kernels->luma(cpu->input + (size_t)y * cpu->stride, cpu->luma + (size_t)y * cpu->width, cpu->width);
+    }
+}
+
+static
+void cpu_luma_edge_rows(SMAACPU *cpu, int y0, int y1)
+{
+    int width = cpu->width, height = cpu->height;
+
+    // Out of bounds reads clamp, like CLAMP_TO_EDGE
+    for(int y = y0; y < y1; y++) {
+	const float *row = cpu->luma + (size_t)y * width;
+	const float *top = cpu->luma + (size_t)(y > 0 ? y - 1 : 0) * width;
+	const float *toptop = cpu->luma + (size_t)(y > 1 ? y - 2 : 0) * width;
+	const float *bottom = cpu->luma + (size_t)(y + 1 < height ? y + 1 : y) * width;
+	cpu->kernels->luma_edges(row, top, toptop, bottom, width, cpu->settings.threshold,
+				 cpu->edges + (size_t)y * width * 2);
+    }
+}
+
+static inline
+float cpu_color_delta(const uint8_t *a, const uint8_t *b)
+{
+    int r = abs(a[0] - b[0]), g = abs(a[1] - b[1]), bl = abs(a[2] - b[2]);
+    int d = r > g ? r : g;
+    return (d > bl ? d : bl) / 255.0f;
+}
+
+static
+void cpu_color_edge_rows(SMAACPU *cpu, int y0, int y1)
+{
+    int width = cpu->width, height = cpu->height, stride = cpu->stride;
+    float threshold = cpu->settings.threshold;
+
+    for(int y = y0; y < y1; y++) {
+	const uint8_t *row = cpu->input + (size_t)y * stride;
+	const uint8_t *top = cpu->input + (size_t)(y > 0 ? y - 1 : 0) * stride;
+	const uint8_t *toptop = cpu->input + (size_t)(y > 1 ? y - 2 : 0) * stride;
+	const uint8_t *bottom = cpu->input + (size_t)(y + 1 < height ? y + 1 : y) * stride;
+	uint8_t *edges = cpu->edges + (size_t)y * width * 2;
+
+	for(int x = 0; x < width; x++) {
+	    int left = x > 0 ? x - 1 : 0, leftleft = x > 1 ? x - 2 : 0;
+	    int right = x + 1 < width ? x + 1 : x;
+	    const uint8_t *c = row + 4 * x;
+
+	    float delta_left = cpu_color_delta(c, row + 4 * left);
+	    float delta_top = cpu_color_delta(c, top + 4 * x);
+	    int ex = delta_left >= threshold, ey = delta_top >= threshold;
+
+	    if(ex || ey) {
+		float max_x = fmaxf(delta_left, cpu_color_delta(c, row + 4 * right));
+		float max_y = fmaxf(delta_top, cpu_color_delta(c, bottom + 4 * x));
+		max_x = fmaxf(max_x, cpu_color_delta(row + 4 * left, row + 4 * leftleft));
+		max_y = fmaxf(max_y, cpu_color_delta(top + 4 * x, toptop + 4 * x));
+		float final = fmaxf(max_x, max_y);
+		ex = ex && 2 * delta_left >= final;
+		ey = ey && 2 * delta_top >= final;
+	    }
+
+	    edges[2 * x] = ex;
+	    edges[2 * x + 1] = ey;
+	}
+    }
+}
+
+// Blending weight calculation. Coordinates are in pixels of the frame,
+// with pixel centers at +0.5 like the shaders' texcoord * SMAA_RT_METRICS.zw,
+// so the offsets below are the ones of SMAA.hlsl without the metrics.
+
+static inline
+int cpu_edge(const SMAACPU *cpu, int x, int y, int channel)
+{
+    x = x < 0 ? 0 : x >= cpu->width ? cpu->width - 1 : x;
+    y = y < 0 ? 0 : y >= cpu->height ? cpu->height - 1 : y;
+    return cpu->edges[((size_t)y * cpu->width + x) * 2 + channel];
+}
+
+// Bilinear fetch of both edge channels, like SMAASampleLevelZero
+static
+void cpu_sample_edges(const SMAACPU *cpu, float px, float py, float e[2])
+{
+    float sx = px - 0.5f, sy = py - 0.5f;
+    float fx0 = floorf(sx), fy0 = floorf(sy);
+    int x = (int)fx0, y = (int)fy0;
+    float fx = sx - fx0, fy = sy - fy0;
+
+    for(int c = 0; c < 2; c++) {
+	float top = cpu_edge(cpu, x, y, c) + (cpu_edge(cpu, x + 1, y, c) - cpu_edge(cpu, x, y, c)) * fx;
+	float bottom = cpu_edge(cpu, x, y + 1, c) + (cpu_edge(cpu, x + 1, y + 1, c) - cpu_edge(cpu, x, y + 1, c)) * fx;
+	e[c] = top + (bottom - top) * fy;
+    }
+}
+
+// SMAASearchLength, the search texture is point sampled
+static
+float cpu_search_length(float ex, float ey, float offset)
+{
+    int x = (int)floorf(32.0f * ex + 66.0f * offset + 0.5f);
+    int y = (int)floorf(-32.0f * ey + 32.5f);
+    x = x < 0 ? 0 : x >= SEARCHTEX_WIDTH ? SEARCHTEX_WIDTH - 1 : x;
+    y = y < 0 ? 0 : y >= SEARCHTEX_HEIGHT ? SEARCHTEX_HEIGHT - 1 : y;
+    return searchTexBytes[y * SEARCHTEX_PITCH + x] / 255.0f;
+}
+
+static
+float cpu_search_x_left(const SMAACPU *cpu, float x, float y, float end)
+{
+    float e[2] = { 0, 1 };
+    while(x > end && e[1] > 0.8281f && e[0] == 0) {
+	cpu_sample_edges(cpu, x, y, e);
+	x -= 2;
+    }
+    return x + 3.25f - (255.0f / 127.0f) * cpu_search_length(e[0], e[1], 0);
+}
+
+static
+float cpu_search_x_right(const SMAACPU *cpu, float x, float y, float end)
+{
+    float e[2] = { 0, 1 };
+    while(x < end && e[1] > 0.8281f && e[0] == 0) {
+	cpu_sample_edges(cpu, x, y, e);
+	x += 2;
+    }
+    return x - 3.25f + (255.0f / 127.0f) * cpu_search_length(e[0], e[1], 0.5f);
+}
+
+static
+float cpu_search_y_up(const SMAACPU *cpu, float x, float y, float end)
+{
+    float e[2] = { 1, 0 };
+    while(y > end && e[0] > 0.8281f && e[1] == 0) {
+	cpu_sample_edges(cpu, x, y, e);
+	y -= 2;
+    }
+    return y + 3.25f - (255.0f / 127.0f) * cpu_search_length(e[1], e[0], 0);
+}
+
+static
+float cpu_search_y_down(const SMAACPU *cpu, float x, float y, float end)
+{
+    float e[2] = { 1, 0 };
+    while(y < end && e[0] > 0.8281f && e[1] == 0) {
+	cpu_sample_edges(cpu, x, y, e);
+	y += 2;
+    }
+    return y - 3.25f + (255.0f / 127.0f) * cpu_search_length(e[1], e[0], 0.5f);
+}
+
+// Bilinear fetch from the area texture, at texel coordinates
+static
+void cpu_area(float tx, float ty, float w[2])
+{
+    float fx0 = floorf(tx), fy0 = floorf(ty);
+    int x = (int)fx0, y = (int)fy0;
+    float fx = tx - fx0, fy = ty - fy0;
+
+    int x1 = x + 1 < AREATEX_WIDTH ? x + 1 : AREATEX_WIDTH - 1;
+    int y1 = y + 1 < AREATEX_HEIGHT ? y + 1 : AREATEX_HEIGHT - 1;
+    x = x < 0 ? 0 : x;
+    y = y < 0 ? 0 : y;
+
+    for(int c = 0; c < 2; c++) {
+	float a = areaTexBytes[y * AREATEX_PITCH + 2 * x + c], b = areaTexBytes[y * AREATEX_PITCH + 2 * x1 + c];
+	float d = areaTexBytes[y1 * AREATEX_PITCH + 2 * x + c], e = areaTexBytes[y1 * AREATEX_PITCH + 2 * x1 + c];
+	float top = a + (b - a) * fx, bottom = d + (e - d) * fx;
+	w[c] = (top + (bottom - top) * fy) / 255.0f;
+    }
+}
+
+// SMAAArea, no subpixel offset
+static
+void cpu_area_ortho(float d1, float d2, float e1, float e2, float w[2])
+{
+    cpu_area(16 * roundf(4 * e1) + d1, 16 * roundf(4 * e2) + d2, w);
+}
+
+// SMAAAreaDiag, diagonal areas are in the right half of the texture
+static
+void cpu_area_diag(float d1, float d2, float e1, float e2, float w[2])
+{
+    cpu_area(20 * e1 + d1 + AREATEX_WIDTH / 2, 20 * e2 + d2, w);
+}
+
+// SMAASearchDiag1, always at pixel centers
+static
+void cpu_search_diag1(const SMAACPU *cpu, int x, int y, int dx, int dy, float d[2], float end[2])
+{
+    float steps = -1, w = 1;
+    end[0] = end[1] = 0;
+    while(steps < cpu->settings.max_search_steps_diag - 1 && w > 0.9f) {
+	x += dx;
+	y += dy;
+	steps++;
+	end[0] = cpu_edge(cpu, x, y, 0);
+	end[1] = cpu_edge(cpu, x, y, 1);
+	w = (end[0] + end[1]) * 0.5f;
+    }
+    d[0] = steps;
+    d[1] = w;
+}
+
+// SMAADecodeDiagBilinearAccess
+static inline
+float cpu_decode_diag(float e)
+{
+    return roundf(e * fabsf(5 * e - 5 * 0.75f));
+}
+
+// SMAASearchDiag2, fetching both edges at once with a bilinear fetch
+static
+void cpu_search_diag2(const SMAACPU *cpu, float x, float y, int dx, int dy, float d[2], float end[2])
+{
+    float steps = -1, w = 1;
+    end[0] = end[1] = 0;
+    x += 0.25f;
+    while(steps < cpu->settings.max_search_steps_diag - 1 && w > 0.9f) {
+	x += dx;
+	y += dy;
+	steps++;
+	cpu_sample_edges(cpu, x, y, end);
+	end[0] = cpu_decode_diag(end[0]);
+	end[1] = roundf(end[1]);
+	w = (end[0] + end[1]) * 0.5f;
+    }
+    d[0] = steps;
+    d[1] = w;
+}
+
+// SMAACalculateDiagWeights
+static
+void cpu_diag_weights(const SMAACPU *cpu, int x, int y, int edge_left, float w[2])
+{
+    float px = x + 0.5f, py = y + 0.5f;
+    float d[4], r[2], end[2], a[2], e[2];
+    w[0] = w[1] = 0;
+
+    // Search for the line ends
+    if(edge_left) {
+	cpu_search_diag1(cpu, x, y, -1, 1, r, end);
+	d[0] = r[0] + (end[1] > 0.9f);
+	d[2] = r[1];
+    } else {
+	d[0] = d[2] = 0;
+    }
+    cpu_search_diag1(cpu, x, y, 1, -1, r, end);
+    d[1] = r[0];
+    d[3] = r[1];
+
+    if(d[0] + d[1] > 2) {
+	// Fetch the crossing edges
+	float c[4];
+	cpu_sample_edges(cpu, px - d[0] + 0.25f - 1, py + d[0], e);
+	c[1] = cpu_decode_diag(e[0]);
+	c[0] = roundf(e[1]);
+	cpu_sample_edges(cpu, px + d[1] + 1, py - d[1] - 0.25f, e);
+	c[3] = cpu_decode_diag(e[0]);
+	c[2] = roundf(e[1]);
+
+	// Merge crossing edges at each side into a single value, removing
+	// them if the end of the line wasn't found
+	float cc0 = d[2] >= 0.9f ? 0 : 2 * c[0] + c[1];
+	float cc1 = d[3] >= 0.9f ? 0 : 2 * c[2] + c[3];
+	cpu_area_diag(d[0], d[1], cc0, cc1, a);
+	w[0] += a[0];
+	w[1] += a[1];
+    }
+
+    // Search for the line ends of the other diagonal
+    cpu_search_diag2(cpu, px, py, -1, -1, r, end);
+    d[0] = r[0];
+    d[2] = r[1];
+    if(cpu_edge(cpu, x + 1, y, 0)) {
+	cpu_search_diag2(cpu, px, py, 1, 1, r, end);
+	d[1] = r[0] + (end[1] > 0.9f);
+	d[3] = r[1];
+    } else {
+	d[1] = d[3] = 0;
+    }
+
+    if(d[0] + d[1] > 2) {
+	int x0 = x - (int)d[0], y0 = y - (int)d[0];
+	int x1 = x + (int)d[1], y1 = y + (int)d[1];
+	float c0 = cpu_edge(cpu, x0 - 1, y0, 1);
+	float c1 = cpu_edge(cpu, x0, y0 - 1, 0);
+	float c2 = cpu_edge(cpu, x1 + 1, y1, 1);
+	float c3 = cpu_edge(cpu, x1 + 1, y1, 0);
+
+	float cc0 = d[2] >= 0.9f ? 0 : 2 * c0 + c1;
+	float cc1 = d[3] >= 0.9f ? 0 : 2 * c2 + c3;
+	cpu_area_diag(d[0], d[1], cc0, cc1, a);
+	w[0] += a[1];
+	w[1] += a[0];
+    }
+}
+
+static inline
+float cpu_saturate(float v)
+{
+    return v < 0 ? 0 : v > 1 ? 1 : v;
+}
+
+// SMAADetectHorizontalCornerPattern
+static
+void cpu_corner_horizontal(const SMAACPU *cpu, float w[2], float left, float right, float y, float d1, float d2)
+{
+    float left_closer = d1 <= d2, right_closer = d2 <= d1;
+    float rounding = (1 - cpu->settings.corner_rounding / 100.0f) / (left_closer + right_closer);
+    float r0 = rounding * left_closer, r1 = rounding * right_closer;
+    float e[2];
+
+    float factor0 = 1, factor1 = 1;
+    cpu_sample_edges(cpu, left, y + 1, e);
+    factor0 -= r0 * e[0];
+    cpu_sample_edges(cpu, right + 1, y + 1, e);
+    factor0 -= r1 * e[0];
+    cpu_sample_edges(cpu, left, y - 2, e);
+    factor1 -= r0 * e[0];
+    cpu_sample_edges(cpu, right + 1, y - 2, e);
+    factor1 -= r1 * e[0];
+
+    w[0] *= cpu_saturate(factor0);
+    w[1] *= cpu_saturate(factor1);
+}
+
+// SMAADetectVerticalCornerPattern
+static
+void cpu_corner_vertical(const SMAACPU *cpu, float w[2], float up, float down, float x, float d1, float d2)
+{
+    float up_closer = d1 <= d2, down_closer = d2 <= d1;
+    float rounding = (1 - cpu->settings.corner_rounding / 100.0f) / (up_closer + down_closer);
+    float r0 = rounding * up_closer, r1 = rounding * down_closer;
+    float e[2];
+
+    float factor0 = 1, factor1 = 1;
+    cpu_sample_edges(cpu, x + 1, up, e);
+    factor0 -= r0 * e[1];
+    cpu_sample_edges(cpu, x + 1, down + 1, e);
+    factor0 -= r1 * e[1];
+    cpu_sample_edges(cpu, x - 2, up, e);
+    factor1 -= r0 * e[1];
+    cpu_sample_edges(cpu, x - 2, down + 1, e);
+    factor1 -= r1 * e[1];
+
+    w[0] *= cpu_saturate(factor0);
+    w[1] *= cpu_saturate(factor1);
+}
+
+// SMAABlendingWeightCalculationPS for one pixel with edges
+static
+void cpu_blend_pixel(const SMAACPU *cpu, int x, int y, uint8_t *out)
+{
+    const SMAACPUSettings *settings = &cpu->settings;
+    float px = x + 0.5f, py = y + 0.5f;
+    float search = 2.0f * settings->max_search_steps;
+    float w[4] = { 0, 0, 0, 0 }, e[2];
+
+    int edge_left = cpu_edge(cpu, x, y, 0);
+    int edge_top = cpu_edge(cpu, x, y, 1);
+
+    if(edge_top) {
+	int ortho = 1;
+	if(settings->max_search_steps_diag > 0) {
+	    cpu_diag_weights(cpu, x, y, edge_left, w);
+	    // Diagonals take precedence, skip the vertical processing then
+	    ortho = w[0] == -w[1];
+	    edge_left = edge_left && ortho;
+	}
+
+	if(ortho) {
+	    float left = cpu_search_x_left(cpu, px - 0.25f, py - 0.125f, px - 0.25f - search);
+	    float right = cpu_search_x_right(cpu, px + 1.25f, py - 0.125f, px + 1.25f + search);
+	    float d1 = fabsf(roundf(left - px)), d2 = fabsf(roundf(right - px));
+
+	    cpu_sample_edges(cpu, left, py - 0.25f, e);
+	    float e1 = e[0];
+	    cpu_sample_edges(cpu, right + 1, py - 0.25f, e);
+	    float e2 = e[0];
+
+	    cpu_area_ortho(sqrtf(d1), sqrtf(d2), e1, e2, w);
+	    if(settings->corner_rounding >= 0) {
+		cpu_corner_horizontal(cpu, w, left, right, py, d1, d2);
+	    }
+	}
+    }
+
+    if(edge_left) {
+	float up = cpu_search_y_up(cpu, px - 0.125f, py - 0.25f, py - 0.25f - search);
+	float down = cpu_search_y_down(cpu, px - 0.125f, py + 1.25f, py + 1.25f + search);
+	float d1 = fabsf(roundf(up - py)), d2 = fabsf(roundf(down - py));
+
+	cpu_sample_edges(cpu, px - 0.25f, up, e);
+	float e1 = e[1];
+	cpu_sample_edges(cpu, px - 0.25f, down + 1, e);
+	float e2 = e[1];
+
+	cpu_area_ortho(sqrtf(d1), sqrtf(d2), e1, e2, w + 2);
+	if(settings->corner_rounding >= 0) {
+	    cpu_corner_vertical(cpu, w + 2, up, down, px, d1, d2);
+	}
+    }
+
+    // Stored like an RGBA8 target would
+    for(int c = 0; c < 4; c++) {
+	out[c] = (uint8_t)(cpu_saturate(w[c]) * 255 + 0.5f);
+    }
+}
+
+static
+void cpu_weight_rows(SMAACPU *cpu, int y0, int y1)
+{
+    int width = cpu->width;
+
+    for(int y = y0; y < y1; y++) {
+	const uint8_t *edges = cpu->edges + (size_t)y * width * 2;
+	uint8_t *weights = cpu->weights + (size_t)y * width * 4;
+	memset(weights, 0, (size_t)width * 4);
+
+	// Like the stencil test, only pixels with edges do any work
+	for(int x = 0; x < width; x++) {
+	    if(edges[2 * x] | edges[2 * x + 1]) {
+		cpu_blend_pixel(cpu, x, y, weights + 4 * x);
+	    }
+	}
+    }
+}
+
+// Neighborhood blending
+
+static inline
+void cpu_mix(const SMAACPU *cpu, const uint8_t *center, const uint8_t *side, float weight, float out[4])
+{
+    if(cpu->settings.srgb) {
+	for(int c = 0; c < 3; c++) {
+	    out[c] = cpu->to_linear[center[c]] + (cpu->to_linear[side[c]] - cpu->to_linear[center[c]]) * weight;
+	}
+    } else {
+	for(int c = 0; c < 3; c++) {
+	    out[c] = (center[c] + (side[c] - center[c]) * weight) / 255.0f;
+	}
+    }
+    out[3] = (center[3] + (side[3] - center[3]) * weight) / 255.0f;
+}
+
+static inline
+uint8_t cpu_encode(const SMAACPU *cpu, float value)
+{
+    value = cpu_saturate(value);
+    if(cpu->settings.srgb) {
+	return cpu->to_srgb[(int)(value * (CPU_SRGB_LUT - 1) + 0.5f)];
+    }
+    return (uint8_t)(value * 255 + 0.5f);
+}
+
+static
+void cpu_neighbor_rows(SMAACPU *cpu, int y0, int y1)
+{
+    int width = cpu->width, height = cpu->height, stride = cpu->stride;
+
+    for(int y = y0; y < y1; y++) {
+	const uint8_t *row = cpu->input + (size_t)y * stride;
+	const uint8_t *top = cpu->input + (size_t)(y > 0 ? y - 1 : 0) * stride;
+	const uint8_t *bottom = cpu->input + (size_t)(y + 1 < height ? y + 1 : y) * stride;
+	const uint8_t *weights = cpu->weights + (size_t)y * width * 4;
+	const uint8_t *weights_bottom = cpu->weights + (size_t)(y + 1 < height ? y + 1 : y) * width * 4;
+	uint8_t *out = cpu->output + (size_t)y * stride;
+
+	for(int x = 0; x < width; x++) {
+	    int left = x > 0 ? x - 1 : 0, right = x + 1 < width ? x + 1 : x;
+	    int a_right = weights[4 * right + 3], a_bottom = weights_bottom[4 * x + 1];
+	    int a_left = weights[4 * x + 2], a_top = weights[4 * x];
+
+	    if(!(a_right | a_bottom | a_left | a_top)) {
+		memcpy(out + 4 * x, row + 4 * x, 4);
+		continue;
+	    }
+
+	    // Blend along the stronger direction, with its two neighbors
+	    int a = a_right > a_left ? a_right : a_left, b = a_bottom > a_top ? a_bottom : a_top;
+	    float c1[4], c2[4], w1, w2;
+	    if(a > b) {
+		w1 = a_right / 255.0f;
+		w2 = a_left / 255.0f;
+		cpu_mix(cpu, row + 4 * x, row + 4 * right, w1, c1);
+		cpu_mix(cpu, row + 4 * x, row + 4 * left, w2, c2);
+	    } else {
+		w1 = a_bottom / 255.0f;
+		w2 = a_top / 255.0f;
+		cpu_mix(cpu, row + 4 * x, bottom + 4 * x, w1, c1);
+		cpu_mix(cpu, row + 4 * x, top + 4 * x, w2, c2);
+	    }
+
+	    float sum = w1 + w2;
+	    for(int c = 0; c < 4; c++) {
+		out[4 * x + c] = cpu_encode(cpu, (w1 * c1[c] + w2 * c2[c]) / sum);
+	    }
+	}
+    }
+}
+
+static
+int cpu_reserve(SMAACPU *cpu, int width, int height)
+{
+    size_t pixels = (size_t)width * height;
+    if(pixels <= cpu->capacity) {
+	return 1;
+    }
+
+    free(cpu->luma);
+    free(cpu->edges);
+    free(cpu->weights);
+    cpu->luma = malloc(pixels * sizeof(float));
+    cpu->edges = malloc(pixels * 2);
+    cpu->weights = malloc(pixels * 4);
+    if(!cpu->luma || !cpu->edges || !cpu->weights) {
+	cpu->capacity = 0;
+	return 0;
+    }
+
+    cpu->capacity = pixels;
+    return 1;
+}
+
+SMAA_CPU_API
+SMAACPU *smaa_cpu_create(int threads)
+{
+    SMAACPU *cpu = calloc(1, sizeof(SMAACPU));
+    if(!cpu) {
+	return 0;
+    }
+
+    static const SMAACPUSettings high = { SMAA_CPU_EDGE_LUMA, 0.1f, 16, 8, 25, 1 };
+    cpu->settings = high;
+    cpu->kernels = cpu_select_kernels();
+
+    for(int i = 0; i < 256; i++) {
+	float c = i / 255.0f;
+	cpu->to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+    }
+    for(int i = 0; i < CPU_SRGB_LUT; i++) {
+	float l = i / (float)(CPU_SRGB_LUT - 1);
+	float c = l <= 0.0031308f ? l * 12.92f : 1.055f * powf(l, 1 / 2.4f) - 0.055f;
+	cpu->to_srgb[i] = (uint8_t)(c * 255 + 0.5f);
+    }
+
+    if(threads <= 0) {
+	long online = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = online > 0 ? (int)online : 1;
+    }
+
+    pthread_mutex_init(&cpu->mutex, 0);
+    pthread_cond_init(&cpu->wake, 0);
+    pthread_cond_init(&cpu->done, 0);
+
+    cpu->workers = calloc(threads, sizeof(pthread_t));
+    cpu->threads = 1;
+    for(int i = 1; cpu->workers && i < threads; i++) {
+	int r = pthread_create(&cpu->workers[i - 1], 0, cpu_worker, cpu);
+	if(r) {
+	    fprintf(stderr, "with_smaa: cannot start CPU SMAA thread: %s\n", strerror(r));
+	    break;
+	}
+	cpu->threads++;
+    }
+
+    return cpu;
+}
+
+SMAA_CPU_API
+void smaa_cpu_destroy(SMAACPU *cpu)
+{
+    if(!cpu) {
+	return;
+    }
+
+    pthread_mutex_lock(&cpu->mutex);
+    cpu->quit = 1;
+    pthread_cond_broadcast(&cpu->wake);
+    pthread_mutex_unlock(&cpu->mutex);
+    for(int i = 0; i < cpu->threads - 1; i++) {
+	pthread_join(cpu->workers[i], 0);
+    }
+
+    pthread_cond_destroy(&cpu->done);
+    pthread_cond_destroy(&cpu->wake);
+    pthread_mutex_destroy(&cpu->mutex);
+
+    free(cpu->workers);
+    free(cpu->luma);
+    free(cpu->edges);
+    free(cpu->weights);
+    free(cpu);
+}
+
+SMAA_CPU_API
+void smaa_cpu_configure(SMAACPU *cpu, const SMAACPUSettings *settings)
+{
+    cpu->settings = *settings;
+}
+
+SMAA_CPU_API
+int smaa_cpu_threads(const SMAACPU *cpu)
+{
+    return cpu->threads;
+}
+
+SMAA_CPU_API
+const char *smaa_cpu_isa(const SMAACPU *cpu)
+{
+    return cpu->kernels->isa;
+}
+
+SMAA_CPU_API
+int smaa_cpu_process(SMAACPU *cpu, const uint8_t *input, uint8_t *output,
+		     int width, int height, int stride)
+{
+    if(width <= 0 || height <= 0) {
+	return 1;
+    }
+    if(!cpu_reserve(cpu, width, height)) {
+	return 0;
+    }
+
+    cpu->input = input;
+    cpu->output = output;
+    cpu->width = width;
+    cpu->height = height;
+    cpu->stride = stride;
+
+    if(cpu->settings.edge_mode == SMAA_CPU_EDGE_COLOR) {
+	cpu_run(cpu, cpu_color_edge_rows);
+    } else {
+	cpu_run(cpu, cpu_luma_rows);
+	cpu_run(cpu, cpu_luma_edge_rows);
+    }
+    cpu_run(cpu, cpu_weight_rows);
+    cpu_run(cpu, cpu_neighbor_rows);
+
+    return 1;
+}
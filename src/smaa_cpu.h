@@ -0,0 +1,57 @@
+#ifndef WITH_SMAA_SMAA_CPU_H
+#define WITH_SMAA_SMAA_CPU_H
+
+// SMAA on the CPU, for contexts where the "GPU" is a software rasterizer
+// like llvmpipe anyway. Same algorithm and lookup tables as SMAA.hlsl
+// (1x, no temporal or depth based features), spread over a thread pool
+// in tiles of rows, with SSE4.1 and AVX2 edge detection kernels.
+//
+// Doesn't depend on OpenGL or the rest of with_smaa, the smaa_cpu
+// static library can anti-alias any RGBA8 image.
+
+#include <stdint.h>
+
+// Linked statically, so the symbols needn't leave the final binary
+#define SMAA_CPU_API __attribute__ ((visibility ("hidden")))
+
+enum {
+    SMAA_CPU_EDGE_LUMA,
+    SMAA_CPU_EDGE_COLOR
+};
+
+typedef struct SMAACPUSettings {
+    int edge_mode;
+    float threshold;
+    int max_search_steps;
+    // 0 disables diagonal detection
+    int max_search_steps_diag;
+    // In percent, negative disables corner detection
+    int corner_rounding;
+    // The image is sRGB encoded, blend in linear space like the shader
+    // path does through its sRGB view of the frame
+    int srgb;
+} SMAACPUSettings;
+
+typedef struct SMAACPU SMAACPU;
+
+// threads <= 0 uses one per online CPU. The settings default to the
+// high preset with sRGB blending.
+SMAA_CPU_API SMAACPU *smaa_cpu_create(int threads);
+
+SMAA_CPU_API void smaa_cpu_destroy(SMAACPU *cpu);
+
+SMAA_CPU_API void smaa_cpu_configure(SMAACPU *cpu, const SMAACPUSettings *settings);
+
+SMAA_CPU_API int smaa_cpu_threads(const SMAACPU *cpu);
+
+// "avx2", "sse4.1" or "scalar", WITH_SMAA_CPU_ISA caps it for testing
+SMAA_CPU_API const char *smaa_cpu_isa(const SMAACPU *cpu);
+
+// Anti-aliases width x height RGBA8 pixels from input into output, rows
+// are stride bytes apart in both. Rows are processed in memory order,
+// bottom-up images (as read back from OpenGL) give the same results as
+// the shaders. Returns 0 if out of memory.
+SMAA_CPU_API int smaa_cpu_process(SMAACPU *cpu, const uint8_t *input, uint8_t *output,
+				  int width, int height, int stride);
+
+#endif
@@ -0,0 +1,402 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "smaa.h"
+#include "headless.h"
+
+// Runs SMAA on the frames of a capture (see capture.h) in a headless
+// context, once per preset, and reports the throughput, the CPU time of
+// smaa_update() and the GPU time of every pass. The capture is mapped,
+// frames are uploaded straight from it.
+
+typedef struct ReplayCapture {
+    const uint8_t *data;
+    size_t size;
+    const SMAACaptureHeader *header;
+    const SMAACaptureFrame *frames;
+    uint32_t count;
+} ReplayCapture;
+
+typedef struct ReplayTimings {
+    double sum[SMAA_PASS_COUNT];
+    int frames;
+} ReplayTimings;
+
+// Writes the captured depth into the default framebuffer
+typedef struct ReplayDepth {
+    GLuint program;
+    GLuint vao;
+    GLuint tex;
+} ReplayDepth;
+
+static const char *replay_pass_names[SMAA_PASS_COUNT + 1] = { "copy", "edge", "blend", "neighbor", "total" };
+
+static
+int replay_open(const char *path, ReplayCapture *capture)
+{
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if(fd < 0 || fstat(fd, &st)) {
+	fprintf(stderr, "smaa_replay: cannot open %s: %s\n", path, strerror(errno));
+	if(fd >= 0) {
+	    close(fd);
+	}
+	return 0;
+    }
+
+    capture->size = st.st_size;
+    if(capture->size < sizeof(SMAACaptureHeader)) {
+	fprintf(stderr, "smaa_replay: %s is not a capture\n", path);
+	close(fd);
+	return 0;
+    }
+    capture->data = mmap(0, capture->size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(capture->data == MAP_FAILED) {
+	fprintf(stderr, "smaa_replay: cannot map %s: %s\n", path, strerror(errno));
+	return 0;
+    }
+
+    const SMAACaptureHeader *header = (const SMAACaptureHeader*)capture->data;
+    if(memcmp(header->magic, SMAA_CAPTURE_MAGIC, sizeof(header->magic))
+       || header->version != SMAA_CAPTURE_VERSION
+       || header->frame_count > header->frame_capacity
+       || header->index_offset + (uint64_t)header->frame_capacity * sizeof(SMAACaptureFrame) > capture->size) {
+	fprintf(stderr, "smaa_replay: %s is not a capture\n", path);
+	return 0;
+    }
+    capture->header = header;
+    capture->frames = (const SMAACaptureFrame*)(capture->data + header->index_offset);
+    capture->count = header->frame_count;
+
+    for(uint32_t i = 0; i < capture->count; i++) {
+	const SMAACaptureFrame *frame = &capture->frames[i];
+	uint64_t size = (uint64_t)frame->width * frame->height * 4;
+	if(!frame->width || !frame->height || frame->color_offset + size > capture->size
+	   || (frame->depth_offset && frame->depth_offset + size > capture->size)) {
+	    fprintf(stderr, "smaa_replay: frame %u of %s is truncated\n", i, path);
+	    return 0;
+	}
+    }
+
+    // Frames are read in order, again and again
+    posix_madvise((void*)capture->data, capture->size, POSIX_MADV_SEQUENTIAL);
+    return 1;
+}
+
+static
+GLuint replay_shader(GLenum type, const char *source)
+{
+    GLuint shader = glCreateShader(type);
+    glShaderSource(shader, 1, &source, 0);
+    glCompileShader(shader);
+    return shader;
+}
+
+static
+int replay_depth_init(ReplayDepth *depth)
+{
+    static const char *vs =
+	"#version 330\n"
+	"void main() {\n"
+	"    vec2 p = vec2((gl_VertexID & 1) * 4 - 1, (gl_VertexID & 2) * 2 - 1);\n"
+	"    gl_Position = vec4(p, 0, 1);\n"
+	"}\n";
+    static const char *fs =
+	"#version 330\n"
+	"uniform sampler2D depth;\n"
+	"void main() {\n"
+	"    gl_FragDepth = texelFetch(depth, ivec2(gl_FragCoord.xy), 0).r;\n"
+	"}\n";
+
+    GLuint vertex = replay_shader(GL_VERTEX_SHADER, vs);
+    GLuint fragment = replay_shader(GL_FRAGMENT_SHADER, fs);
+    depth->program = glCreateProgram();
+    glAttachShader(depth->program, vertex);
+    glAttachShader(depth->program, fragment);
+    glLinkProgram(depth->program);
+    glDeleteShader(vertex);
+    glDeleteShader(fragment);
+
+    GLint linked;
+    glGetProgramiv(depth->program, GL_LINK_STATUS, &linked);
+    if(!linked) {
+	fprintf(stderr, "smaa_replay: cannot build the depth program\n");
+	return 0;
+    }
+
+    glGenVertexArrays(1, &depth->vao);
+    glGenTextures(1, &depth->tex);
+    glBindTexture(GL_TEXTURE_2D, depth->tex);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    return 1;
+}
+
+// Draws the frame to the backbuffer, as the game did before swapping
+static
+void replay_draw(const ReplayCapture *capture, const SMAACaptureFrame *frame,
+		 GLuint scene_tex, GLuint scene_fbo, ReplayDepth *depth)
+{
+    int width = frame->width, height = frame->height;
+
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindTexture(GL_TEXTURE_2D, scene_tex);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+		    capture->data + frame->color_offset);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, scene_fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, width, height);
+
+    if(frame->depth_offset) {
+	glBindTexture(GL_TEXTURE_2D, depth->tex);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT,
+		     capture->data + frame->depth_offset);
+
+	glUseProgram(depth->program);
+	glBindVertexArray(depth->vao);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glEnable(GL_DEPTH_TEST);
+	glDepthFunc(GL_ALWAYS);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glDepthFunc(GL_LESS);
+	glDisable(GL_DEPTH_TEST);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+}
+
+static
+void replay_timings_sink(void *data, const float *ms)
+{
+    ReplayTimings *timings = data;
+    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	timings->sum[pass] += ms[pass];
+    }
+    timings->frames++;
+}
+
+static
+void replay_print_header(FILE *file)
+{
+    fprintf(file, "preset,frames,fps,cpu_ms");
+    for(int pass = 0; pass <= SMAA_PASS_COUNT; pass++) {
+	fprintf(file, ",gpu_%s_ms", replay_pass_names[pass]);
+    }
+    fprintf(file, "\n");
+}
+
+static
+void replay_scene(GLuint scene_tex, GLuint scene_fbo, int width, int height)
+{
+    glBindTexture(GL_TEXTURE_2D, scene_tex);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindFramebuffer(GL_FRAMEBUFFER, scene_fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, scene_tex, 0);
+}
+
+// The scene texture and the pbuffer follow the size of the frames
+static
+int replay_resize(SMAAHeadless *headless, const SMAACaptureFrame *frame, GLuint scene_tex, GLuint scene_fbo)
+{
+    if(headless->width == (int)frame->width && headless->height == (int)frame->height) {
+	return 1;
+    }
+    if(!smaa_headless_resize(headless, frame->width, frame->height)) {
+	return 0;
+    }
+    replay_scene(scene_tex, scene_fbo, frame->width, frame->height);
+    return 1;
+}
+
+static
+int replay_run(const ReplayCapture *capture, SMAAHeadless *headless, SMAA *smaa, ReplayDepth *depth,
+	       GLuint scene_tex, GLuint scene_fbo, const char *preset, int loops, FILE *output)
+{
+    setenv("WITH_SMAA_PRESET", preset, 1);
+    smaa_config_reload();
+
+    // Until the programs for the preset are built and in use
+    const SMAACaptureFrame *first = &capture->frames[0];
+    if(!replay_resize(headless, first, scene_tex, scene_fbo)) {
+	return 0;
+    }
+    for(int i = 0; i < 1000 && (i < 3 || smaa->pending); i++) {
+	replay_draw(capture, first, scene_tex, scene_fbo, depth);
+	smaa_update(smaa, first->width, first->height);
+	if(smaa->incompatible) {
+	    fprintf(stderr, "smaa_replay: SMAA not supported by this context\n");
+	    return 0;
+	}
+    }
+
+    ReplayTimings timings;
+    int gpu = smaa_telemetry_capture(&smaa->telemetry, replay_timings_sink, &timings);
+    glFinish();
+    smaa_telemetry_flush(&smaa->telemetry);
+    memset(&timings, 0, sizeof(timings));
+
+    double cpu = 0, start = smaa_time_ms();
+    int frames = 0;
+    for(int loop = 0; loop < loops; loop++) {
+	for(uint32_t i = 0; i < capture->count; i++) {
+	    const SMAACaptureFrame *frame = &capture->frames[i];
+	    if(!replay_resize(headless, frame, scene_tex, scene_fbo)) {
+		return 0;
+	    }
+	    replay_draw(capture, frame, scene_tex, scene_fbo, depth);
+
+	    double update = smaa_time_ms();
+	    smaa_update(smaa, frame->width, frame->height);
+	    cpu += smaa_time_ms() - update;
+	    frames++;
+	}
+    }
+    glFinish();
+    double elapsed = smaa_time_ms() - start;
+    smaa_telemetry_flush(&smaa->telemetry);
+
+    // No GPU timings without timer queries or with the CPU backend,
+    // where all the work is in cpu_ms
+    int measured = gpu && timings.frames;
+    float total = 0;
+    char line[512];
+    int length = snprintf(line, sizeof(line), "%s,%d,%.1f,%.3f", preset, frames,
+			  frames * 1000 / elapsed, cpu / frames);
+    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	float ms = measured ? timings.sum[pass] / timings.frames : -1;
+	total += ms;
+	length += snprintf(line + length, sizeof(line) - length, ",%.3f", ms);
+    }
+    snprintf(line + length, sizeof(line) - length, ",%.3f\n", measured ? total : -1);
+
+    fputs(line, stdout);
+    fflush(stdout);
+    if(output) {
+	fputs(line, output);
+    }
+    return 1;
+}
+
+static
+void replay_usage()
+{
+    fprintf(stderr,
+	    "usage: smaa_replay [options] CAPTURE\n"
+	    "  --presets low,medium,high,ultra\n"
+	    "  --loops N          times the frames are replayed per preset (default 1)\n"
+	    "  --output FILE      write the results as CSV\n"
+	    "The backend is chosen by WITH_SMAA_BACKEND, as in the shim.\n");
+}
+
+int main(int argc, char **argv)
+{
+    char presets[] = "low,medium,high,ultra";
+    char *preset_list = presets;
+    const char *path = 0, *output_path = 0;
+    int loops = 1;
+
+    for(int i = 1; i < argc; i++) {
+	const char *option = argv[i];
+	if(strncmp(option, "--", 2)) {
+	    if(path) {
+		replay_usage();
+		return 1;
+	    }
+	    path = option;
+	    continue;
+	}
+
+	char *value = i + 1 < argc ? argv[i + 1] : 0;
+	if(!value) {
+	    replay_usage();
+	    return 1;
+	}
+	i++;
+
+	if(!strcmp(option, "--presets")) {
+	    preset_list = value;
+	} else if(!strcmp(option, "--loops")) {
+	    loops = atoi(value) > 0 ? atoi(value) : 1;
+	} else if(!strcmp(option, "--output")) {
+	    output_path = value;
+	} else {
+	    replay_usage();
+	    return 1;
+	}
+    }
+    if(!path) {
+	replay_usage();
+	return 1;
+    }
+
+    ReplayCapture capture;
+    if(!replay_open(path, &capture)) {
+	return 1;
+    }
+    if(!capture.count) {
+	fprintf(stderr, "smaa_replay: %s has no frames\n", path);
+	return 1;
+    }
+    fprintf(stderr, "smaa_replay: %u frames of %.64s on %.128s, %ux%u%s\n", capture.count,
+	    capture.header->application, capture.header->renderer,
+	    capture.frames[0].width, capture.frames[0].height,
+	    capture.frames[0].depth_offset ? " with depth" : "");
+
+    // Only the settings under test, not the user's profile or budget.
+    // Letterbox detection stays, the frames are the game's.
+    setenv("WITH_SMAA_PROFILE", "/dev/null", 1);
+    setenv("WITH_SMAA_BUDGET", "0", 1);
+    unsetenv("WITH_SMAA_CAPTURE");
+
+    const SMAACaptureFrame *first = &capture.frames[0];
+    SMAAHeadless headless;
+    if(!smaa_headless_init(&headless) || !smaa_headless_resize(&headless, first->width, first->height)) {
+	return 1;
+    }
+
+    GLuint scene_tex, scene_fbo;
+    glGenTextures(1, &scene_tex);
+    glGenFramebuffers(1, &scene_fbo);
+    replay_scene(scene_tex, scene_fbo, first->width, first->height);
+    ReplayDepth depth;
+    if(!replay_depth_init(&depth)) {
+	return 1;
+    }
+
+    FILE *output = 0;
+    if(output_path) {
+	output = fopen(output_path, "w");
+	if(!output) {
+	    fprintf(stderr, "smaa_replay: cannot write %s: %s\n", output_path, strerror(errno));
+	    return 1;
+	}
+	replay_print_header(output);
+    }
+    replay_print_header(stdout);
+
+    SMAA *smaa = smaa_create(0);
+    int ok = 1;
+    for(char *preset = strtok(preset_list, ","); preset; preset = strtok(0, ",")) {
+	if(!replay_run(&capture, &headless, smaa, &depth, scene_tex, scene_fbo, preset, loops, output)) {
+	    ok = 0;
+	    break;
+	}
+    }
+
+    if(output && fclose(output)) {
+	ok = 0;
+    }
+    smaa_destroy(smaa, 1);
+    smaa_headless_destroy(&headless);
+    munmap((void*)capture.data, capture.size);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,36 @@
+#ifndef WITH_SMAA_SOURCES_H
+#define WITH_SMAA_SOURCES_H
+
+// The parts of SMAA.hlsl each shader needs, preprocessed for GLSL at
+// build time by gen_smaa_shaders into the smaa_sources[] table of
+// smaa_shader.h. Thresholds, search steps and corner rounding stay
+// macros, defined at runtime by smaa_settings(); the switches SMAA.hlsl
+// tests with #if are part of the table index instead.
+
+enum {
+    SMAA_SOURCE_EDGE_VS,
+    SMAA_SOURCE_BLEND_VS,
+    SMAA_SOURCE_NEIGHBOR_VS,
+    SMAA_SOURCE_LUMA_EDGE_PS,
+    SMAA_SOURCE_COLOR_EDGE_PS,
+    SMAA_SOURCE_DEPTH_EDGE_PS,
+    SMAA_SOURCE_BLEND_PS,
+    SMAA_SOURCE_NEIGHBOR_PS,
+    // Blending weights in a compute shader, with the functions of both
+    // the vertex and the pixel shader
+    SMAA_SOURCE_BLEND_CS,
+    SMAA_SOURCE_COUNT
+};
+
+#define SMAA_SOURCE_PREDICATION 1
+#define SMAA_SOURCE_NO_DIAG 2
+#define SMAA_SOURCE_NO_CORNER 4
+#define SMAA_SOURCE_FLAGS 8
+
+// glsl4 selects SMAA_GLSL_4 over SMAA_GLSL_3
+#define SMAA_SOURCE_INDEX(glsl4, source, flags) \
+    (((glsl4) * SMAA_SOURCE_COUNT + (source)) * SMAA_SOURCE_FLAGS + (flags))
+
+#define SMAA_SOURCE_TABLE_SIZE (2 * SMAA_SOURCE_COUNT * SMAA_SOURCE_FLAGS)
+
+#endif
@@ -0,0 +1,1127 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+
+#include "AreaTex.h"
+#include "SearchTex.h"
+
+#include "smaa.h"
+#include "smaa_vk.h"
+#include "smaa_vk_sources.h"
+#include "smaa_vk_shader.h"
+
+// How long destroying a swapchain or changing the configuration waits for
+// the work in flight, in ns
+#define SMAA_VK_TIMEOUT 1000000000ull
+
+// The stencil formats the edge pass can mark pixels in, best first
+static const VkFormat smaa_vk_stencil_formats[] = {
+    VK_FORMAT_S8_UINT,
+    VK_FORMAT_D24_UNORM_S8_UINT,
+    VK_FORMAT_D32_SFLOAT_S8_UINT
+};
+
+// sRGB swapchain formats after their UNORM variant. Edge detection reads
+// the copy of such a frame through the latter, neighborhood blending reads
+// and writes it like it does through GL_FRAMEBUFFER_SRGB.
+static const VkFormat smaa_vk_srgb_formats[][2] = {
+    { VK_FORMAT_B8G8R8A8_UNORM, VK_FORMAT_B8G8R8A8_SRGB },
+    { VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_SRGB },
+    { VK_FORMAT_A8B8G8R8_UNORM_PACK32, VK_FORMAT_A8B8G8R8_SRGB_PACK32 }
+};
+
+// Data of the specialization constants, see smaa_vk_sources.h
+typedef struct SMAAVkConstants {
+    float threshold;
+    int32_t max_search_steps;
+    int32_t max_search_steps_diag;
+    int32_t corner_rounding;
+} SMAAVkConstants;
+
+enum {
+    SMAA_VK_EDGE,
+    SMAA_VK_BLEND,
+    SMAA_VK_NEIGHBOR
+};
+
+static
+uint32_t smaa_vk_memory_type(SMAAVkDevice *device, uint32_t types, VkMemoryPropertyFlags flags)
+{
+    for(uint32_t i = 0; i < device->memory.memoryTypeCount; i++) {
+	if((types & (1u << i)) && (device->memory.memoryTypes[i].propertyFlags & flags) == flags) {
+	    return i;
+	}
+    }
+    return UINT32_MAX;
+}
+
+static
+int smaa_vk_format_supports(SMAAVkDevice *device, VkFormat format, VkFormatFeatureFlags features)
+{
+    VkFormatProperties properties;
+    device->get_format_properties(device->physical_device, format, &properties);
+    return (properties.optimalTilingFeatures & features) == features;
+}
+
+static
+int smaa_vk_allocate(SMAAVkDevice *device, VkMemoryRequirements *requirements,
+		     VkMemoryPropertyFlags flags, VkDeviceMemory *memory)
+{
+    VkMemoryAllocateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+	.allocationSize = requirements->size,
+	.memoryTypeIndex = smaa_vk_memory_type(device, requirements->memoryTypeBits, flags),
+    };
+    if(info.memoryTypeIndex == UINT32_MAX) {
+	return 0;
+    }
+    return device->vk.AllocateMemory(device->device, &info, 0, memory) == VK_SUCCESS;
+}
+
+// With srgb_format differing from format, the image gets an sRGB view too
+static
+int smaa_vk_image(SMAAVkDevice *device, SMAAVkImage *image, VkFormat format, VkFormat srgb_format,
+		  uint32_t width, uint32_t height, VkImageUsageFlags usage, VkImageAspectFlags aspect)
+{
+    VkImageCreateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+	.flags = srgb_format != format ? VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT : 0,
+	.imageType = VK_IMAGE_TYPE_2D,
+	.format = format,
+	.extent = { width, height, 1 },
+	.mipLevels = 1,
+	.arrayLayers = 1,
+	.samples = VK_SAMPLE_COUNT_1_BIT,
+	.tiling = VK_IMAGE_TILING_OPTIMAL,
+	.usage = usage,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+	.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+    };
+    if(device->vk.CreateImage(device->device, &info, 0, &image->image) != VK_SUCCESS) {
+	return 0;
+    }
+
+    VkMemoryRequirements requirements;
+    device->vk.GetImageMemoryRequirements(device->device, image->image, &requirements);
+    if(!smaa_vk_allocate(device, &requirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, &image->memory)
+       || device->vk.BindImageMemory(device->device, image->image, image->memory, 0) != VK_SUCCESS) {
+	return 0;
+    }
+
+    VkImageViewCreateInfo view_info = {
+	.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	.image = image->image,
+	.viewType = VK_IMAGE_VIEW_TYPE_2D,
+	.format = format,
+	.subresourceRange = { aspect, 0, 1, 0, 1 },
+    };
+    if(device->vk.CreateImageView(device->device, &view_info, 0, &image->view) != VK_SUCCESS) {
+	return 0;
+    }
+    if(srgb_format == format) {
+	image->srgb_view = image->view;
+	return 1;
+    }
+    view_info.format = srgb_format;
+    return device->vk.CreateImageView(device->device, &view_info, 0, &image->srgb_view) == VK_SUCCESS;
+}
+
+static
+void smaa_vk_destroy_image(SMAAVkDevice *device, SMAAVkImage *image)
+{
+    if(image->srgb_view != image->view) {
+	device->vk.DestroyImageView(device->device, image->srgb_view, 0);
+    }
+    device->vk.DestroyImageView(device->device, image->view, 0);
+    device->vk.DestroyImage(device->device, image->image, 0);
+    device->vk.FreeMemory(device->device, image->memory, 0);
+    memset(image, 0, sizeof(*image));
+}
+
+// The lookup textures, copied from staging by the upload command buffer
+static
+int smaa_vk_create_lookup(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkImageUsageFlags usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+    if(!smaa_vk_image(device, &swapchain->area, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_UNORM,
+		      AREATEX_WIDTH, AREATEX_HEIGHT, usage, VK_IMAGE_ASPECT_COLOR_BIT)
+       || !smaa_vk_image(device, &swapchain->search, VK_FORMAT_R8_UNORM, VK_FORMAT_R8_UNORM,
+			 SEARCHTEX_WIDTH, SEARCHTEX_HEIGHT, usage, VK_IMAGE_ASPECT_COLOR_BIT)) {
+	return 0;
+    }
+
+    VkBufferCreateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+	.size = AREATEX_SIZE + SEARCHTEX_SIZE,
+	.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+	.sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+    if(device->vk.CreateBuffer(device->device, &info, 0, &swapchain->staging) != VK_SUCCESS) {
+	return 0;
+    }
+    VkMemoryRequirements requirements;
+    device->vk.GetBufferMemoryRequirements(device->device, swapchain->staging, &requirements);
+    if(!smaa_vk_allocate(device, &requirements,
+			 VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+			 &swapchain->staging_memory)
+       || device->vk.BindBufferMemory(device->device, swapchain->staging, swapchain->staging_memory, 0)
+       != VK_SUCCESS) {
+	return 0;
+    }
+
+    void *data;
+    if(device->vk.MapMemory(device->device, swapchain->staging_memory, 0, VK_WHOLE_SIZE, 0, &data)
+       != VK_SUCCESS) {
+	return 0;
+    }
+    memcpy(data, areaTexBytes, AREATEX_SIZE);
+    memcpy((char*)data + AREATEX_SIZE, searchTexBytes, SEARCHTEX_SIZE);
+    device->vk.UnmapMemory(device->device, swapchain->staging_memory);
+    return 1;
+}
+
+static
+void smaa_vk_free_staging(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    device->vk.DestroyBuffer(device->device, swapchain->staging, 0);
+    device->vk.FreeMemory(device->device, swapchain->staging_memory, 0);
+    swapchain->staging = VK_NULL_HANDLE;
+    swapchain->staging_memory = VK_NULL_HANDLE;
+    swapchain->upload_fence = -1;
+}
+
+// A single subpass drawing into format, with a stencil attachment unless
+// stencil_load is VK_ATTACHMENT_LOAD_OP_MAX_ENUM
+static
+VkRenderPass smaa_vk_render_pass(SMAAVkSwapchain *swapchain, VkFormat format, VkAttachmentLoadOp load,
+				 VkImageLayout final_layout, VkAttachmentLoadOp stencil_load)
+{
+    SMAAVkDevice *device = swapchain->device;
+    int stencil = stencil_load != VK_ATTACHMENT_LOAD_OP_MAX_ENUM;
+    VkImageLayout stencil_layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkAttachmentDescription attachments[2] = {
+	{
+	    .format = format,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = load,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+	    .stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+	    .finalLayout = final_layout,
+	},
+	{
+	    .format = swapchain->stencil_format,
+	    .samples = VK_SAMPLE_COUNT_1_BIT,
+	    .loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+	    .storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .stencilLoadOp = stencil_load,
+	    // The edge pass keeps it for the blend pass
+	    .stencilStoreOp = stencil_load == VK_ATTACHMENT_LOAD_OP_CLEAR
+	    ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE,
+	    .initialLayout = stencil_load == VK_ATTACHMENT_LOAD_OP_LOAD ? stencil_layout : VK_IMAGE_LAYOUT_UNDEFINED,
+	    .finalLayout = stencil_layout,
+	}
+    };
+    VkAttachmentReference color_reference = { 0, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL };
+    VkAttachmentReference stencil_reference = { 1, stencil_layout };
+    VkSubpassDescription subpass = {
+	.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS,
+	.colorAttachmentCount = 1,
+	.pColorAttachments = &color_reference,
+	.pDepthStencilAttachment = stencil ? &stencil_reference : 0,
+    };
+
+    // Orders the passes of a frame, and of consecutive frames, among each
+    // other and the copies around them
+    VkPipelineStageFlags stages = VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT
+	| VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT
+	| VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+    VkAccessFlags writes = VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT
+	| VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    VkAccessFlags accesses = writes | VK_ACCESS_TRANSFER_READ_BIT | VK_ACCESS_SHADER_READ_BIT
+	| VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT;
+    VkSubpassDependency dependencies[2] = {
+	{ VK_SUBPASS_EXTERNAL, 0, stages, stages, writes, accesses, 0 },
+	{ 0, VK_SUBPASS_EXTERNAL, stages, stages, writes, accesses, 0 }
+    };
+
+    VkRenderPassCreateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO,
+	.attachmentCount = stencil ? 2 : 1,
+	.pAttachments = attachments,
+	.subpassCount = 1,
+	.pSubpasses = &subpass,
+	.dependencyCount = 2,
+	.pDependencies = dependencies,
+    };
+    VkRenderPass render_pass = VK_NULL_HANDLE;
+    device->vk.CreateRenderPass(device->device, &info, 0, &render_pass);
+    return render_pass;
+}
+
+static
+VkFramebuffer smaa_vk_framebuffer(SMAAVkSwapchain *swapchain, VkRenderPass render_pass,
+				  VkImageView color, VkImageView stencil)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkImageView attachments[2] = { color, stencil };
+    VkFramebufferCreateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+	.renderPass = render_pass,
+	.attachmentCount = stencil ? 2 : 1,
+	.pAttachments = attachments,
+	.width = swapchain->extent.width,
+	.height = swapchain->extent.height,
+	.layers = 1,
+    };
+    VkFramebuffer framebuffer = VK_NULL_HANDLE;
+    device->vk.CreateFramebuffer(device->device, &info, 0, &framebuffer);
+    return framebuffer;
+}
+
+// Descriptor set layouts, pipeline layouts and the sets, with the images
+// of each pass in the bindings of smaa_vk_sources.h
+static
+int smaa_vk_create_sets(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkImageView views[3][3] = {
+	[SMAA_VK_EDGE] = { swapchain->color.view },
+	[SMAA_VK_BLEND] = { swapchain->edges.view, swapchain->area.view, swapchain->search.view },
+	[SMAA_VK_NEIGHBOR] = { swapchain->color.srgb_view, swapchain->weights.view }
+    };
+    static const uint32_t counts[3] = { 1, 3, 2 };
+
+    VkPushConstantRange push_constants = {
+	VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, 4 * sizeof(float)
+    };
+    for(int pass = 0; pass < 3; pass++) {
+	VkDescriptorSetLayoutBinding bindings[3];
+	for(uint32_t i = 0; i < counts[pass]; i++) {
+	    bindings[i] = (VkDescriptorSetLayoutBinding){
+		i, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT, 0
+	    };
+	}
+	VkDescriptorSetLayoutCreateInfo set_info = {
+	    .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+	    .bindingCount = counts[pass],
+	    .pBindings = bindings,
+	};
+	if(device->vk.CreateDescriptorSetLayout(device->device, &set_info, 0, &swapchain->set_layouts[pass])
+	   != VK_SUCCESS) {
+	    return 0;
+	}
+
+	VkPipelineLayoutCreateInfo layout_info = {
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+	    .setLayoutCount = 1,
+	    .pSetLayouts = &swapchain->set_layouts[pass],
+	    .pushConstantRangeCount = 1,
+	    .pPushConstantRanges = &push_constants,
+	};
+	if(device->vk.CreatePipelineLayout(device->device, &layout_info, 0, &swapchain->layouts[pass])
+	   != VK_SUCCESS) {
+	    return 0;
+	}
+    }
+
+    VkDescriptorPoolSize size = { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1 + 3 + 2 };
+    VkDescriptorPoolCreateInfo pool_info = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+	.maxSets = 3,
+	.poolSizeCount = 1,
+	.pPoolSizes = &size,
+    };
+    if(device->vk.CreateDescriptorPool(device->device, &pool_info, 0, &swapchain->descriptor_pool) != VK_SUCCESS) {
+	return 0;
+    }
+    VkDescriptorSetAllocateInfo allocate_info = {
+	.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+	.descriptorPool = swapchain->descriptor_pool,
+	.descriptorSetCount = 3,
+	.pSetLayouts = swapchain->set_layouts,
+    };
+    if(device->vk.AllocateDescriptorSets(device->device, &allocate_info, swapchain->sets) != VK_SUCCESS) {
+	return 0;
+    }
+
+    VkDescriptorImageInfo images[3][3];
+    VkWriteDescriptorSet writes[3 * 3];
+    uint32_t write_count = 0;
+    for(int pass = 0; pass < 3; pass++) {
+	for(uint32_t i = 0; i < counts[pass]; i++) {
+	    images[pass][i] = (VkDescriptorImageInfo){
+		swapchain->sampler, views[pass][i], VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+	    };
+	    writes[write_count++] = (VkWriteDescriptorSet){
+		.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+		.dstSet = swapchain->sets[pass],
+		.dstBinding = i,
+		.descriptorCount = 1,
+		.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+		.pImageInfo = &images[pass][i],
+	    };
+	}
+    }
+    device->vk.UpdateDescriptorSets(device->device, write_count, writes, 0, 0);
+    return 1;
+}
+
+static
+VkPipeline smaa_vk_pipeline(SMAAVkSwapchain *swapchain, int pass, VkRenderPass render_pass,
+			    int vs, int fs, const VkSpecializationInfo *specialization)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkPipeline pipeline = VK_NULL_HANDLE;
+
+    int shaders[2] = { vs, fs };
+    VkShaderModule modules[2] = { VK_NULL_HANDLE, VK_NULL_HANDLE };
+    VkPipelineShaderStageCreateInfo stages[2];
+    for(int i = 0; i < 2; i++) {
+	VkShaderModuleCreateInfo module_info = {
+	    .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+	    .codeSize = smaa_vk_shaders[shaders[i]].size,
+	    .pCode = smaa_vk_shaders[shaders[i]].code,
+	};
+	if(device->vk.CreateShaderModule(device->device, &module_info, 0, &modules[i]) != VK_SUCCESS) {
+	    goto done;
+	}
+	stages[i] = (VkPipelineShaderStageCreateInfo){
+	    .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+	    .stage = i ? VK_SHADER_STAGE_FRAGMENT_BIT : VK_SHADER_STAGE_VERTEX_BIT,
+	    .module = modules[i],
+	    .pName = "main",
+	    .pSpecializationInfo = specialization,
+	};
+    }
+
+    VkPipelineVertexInputStateCreateInfo vertex_input = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+    };
+    VkPipelineInputAssemblyStateCreateInfo input_assembly = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+	.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+    };
+    VkViewport viewport = { 0, 0, swapchain->extent.width, swapchain->extent.height, 0, 1 };
+    VkRect2D scissor = { { 0, 0 }, swapchain->extent };
+    VkPipelineViewportStateCreateInfo viewport_state = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+	.viewportCount = 1,
+	.pViewports = &viewport,
+	.scissorCount = 1,
+	.pScissors = &scissor,
+    };
+    VkPipelineRasterizationStateCreateInfo rasterization = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+	.polygonMode = VK_POLYGON_MODE_FILL,
+	.cullMode = VK_CULL_MODE_NONE,
+	.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE,
+	.lineWidth = 1,
+    };
+    VkPipelineMultisampleStateCreateInfo multisample = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+	.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT,
+    };
+
+    // The edge pass marks the pixels it doesn't discard, the blend pass
+    // only runs on those. See SMAA_STENCIL_* in smaa.c.
+    VkStencilOpState stencil = {
+	VK_STENCIL_OP_KEEP, VK_STENCIL_OP_REPLACE, VK_STENCIL_OP_KEEP, VK_COMPARE_OP_ALWAYS, 0xff, 0xff, 1
+    };
+    if(pass == SMAA_VK_BLEND) {
+	stencil.passOp = VK_STENCIL_OP_KEEP;
+	stencil.compareOp = VK_COMPARE_OP_EQUAL;
+	stencil.writeMask = 0;
+    }
+    VkPipelineDepthStencilStateCreateInfo depth_stencil = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+	.depthCompareOp = VK_COMPARE_OP_ALWAYS,
+	.stencilTestEnable = VK_TRUE,
+	.front = stencil,
+	.back = stencil,
+    };
+
+    VkPipelineColorBlendAttachmentState blend_attachment = {
+	.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT
+	| VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+    };
+    VkPipelineColorBlendStateCreateInfo color_blend = {
+	.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+	.attachmentCount = 1,
+	.pAttachments = &blend_attachment,
+    };
+
+    VkGraphicsPipelineCreateInfo info = {
+	.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+	.stageCount = 2,
+	.pStages = stages,
+	.pVertexInputState = &vertex_input,
+	.pInputAssemblyState = &input_assembly,
+	.pViewportState = &viewport_state,
+	.pRasterizationState = &rasterization,
+	.pMultisampleState = &multisample,
+	.pDepthStencilState = pass == SMAA_VK_NEIGHBOR ? 0 : &depth_stencil,
+	.pColorBlendState = &color_blend,
+	.layout = swapchain->layouts[pass],
+	.renderPass = render_pass,
+	.basePipelineIndex = -1,
+    };
+    if(device->vk.CreateGraphicsPipelines(device->device, VK_NULL_HANDLE, 1, &info, 0, &pipeline) != VK_SUCCESS) {
+	pipeline = VK_NULL_HANDLE;
+    }
+
+done:
+    for(int i = 0; i < 2; i++) {
+	device->vk.DestroyShaderModule(device->device, modules[i], 0);
+    }
+    return pipeline;
+}
+
+// What the layer can't do of the configuration, like smaa_cpu_settings()
+static
+void smaa_vk_report(const SMAAConfig *config)
+{
+    if(config->edge_mode == SMAA_EDGE_DEPTH || config->predication) {
+	fprintf(stderr, "with_smaa: no depth in the Vulkan layer, using luma edge detection\n");
+    }
+    if(config->method == SMAA_METHOD_FXAA || config->sharpen > 0) {
+	fprintf(stderr, "with_smaa: no FXAA or sharpening in the Vulkan layer, using SMAA alone\n");
+    }
+    if(config->exclusion_count || config->budget > 0 || config->max_queued_frames) {
+	fprintf(stderr, "with_smaa: no exclusions, budget or max_queued_frames in the Vulkan layer, ignoring them\n");
+    }
+}
+
+static
+void smaa_vk_destroy_pipelines(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    for(int pass = 0; pass < 3; pass++) {
+	device->vk.DestroyPipeline(device->device, swapchain->pipelines[pass], 0);
+	swapchain->pipelines[pass] = VK_NULL_HANDLE;
+    }
+}
+
+// The settings of smaa_settings() in smaa.c, as specialization constants
+static
+int smaa_vk_create_pipelines(SMAAVkSwapchain *swapchain, const SMAAConfig *config)
+{
+    SMAAVkConstants constants = {
+	config->threshold,
+	config->max_search_steps,
+	config->max_search_steps_diag,
+	config->corner_rounding
+    };
+    VkSpecializationMapEntry entries[SMAA_VK_CONSTANT_COUNT] = {
+	{ SMAA_VK_CONSTANT_THRESHOLD, offsetof(SMAAVkConstants, threshold), 4 },
+	{ SMAA_VK_CONSTANT_MAX_SEARCH_STEPS, offsetof(SMAAVkConstants, max_search_steps), 4 },
+	{ SMAA_VK_CONSTANT_MAX_SEARCH_STEPS_DIAG, offsetof(SMAAVkConstants, max_search_steps_diag), 4 },
+	{ SMAA_VK_CONSTANT_CORNER_ROUNDING, offsetof(SMAAVkConstants, corner_rounding), 4 }
+    };
+    VkSpecializationInfo specialization = { SMAA_VK_CONSTANT_COUNT, entries, sizeof(constants), &constants };
+
+    int edge_fs = config->edge_mode == SMAA_EDGE_COLOR ? SMAA_VK_SHADER_COLOR_EDGE_FS : SMAA_VK_SHADER_LUMA_EDGE_FS;
+    int blend_fs = SMAA_VK_SHADER_BLEND(config->diag_detection, config->corner_detection);
+
+    swapchain->pipelines[SMAA_VK_EDGE] = smaa_vk_pipeline(swapchain, SMAA_VK_EDGE, swapchain->edge_pass,
+							  SMAA_VK_SHADER_EDGE_VS, edge_fs, &specialization);
+    swapchain->pipelines[SMAA_VK_BLEND] = smaa_vk_pipeline(swapchain, SMAA_VK_BLEND, swapchain->blend_pass,
+							   SMAA_VK_SHADER_BLEND_VS, blend_fs, &specialization);
+    swapchain->pipelines[SMAA_VK_NEIGHBOR] = smaa_vk_pipeline(swapchain, SMAA_VK_NEIGHBOR, swapchain->neighbor_pass,
+							      SMAA_VK_SHADER_NEIGHBOR_VS, SMAA_VK_SHADER_NEIGHBOR_FS,
+							      &specialization);
+    for(int pass = 0; pass < 3; pass++) {
+	if(!swapchain->pipelines[pass]) {
+	    fprintf(stderr, "with_smaa: cannot create the Vulkan pipelines\n");
+	    smaa_vk_destroy_pipelines(swapchain);
+	    return 0;
+	}
+    }
+
+    smaa_vk_report(config);
+    swapchain->config = *config;
+    return 1;
+}
+
+// Everything but what needs the queue family, see smaa_vk_initialize()
+static
+int smaa_vk_create_resources(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    uint32_t width = swapchain->extent.width, height = swapchain->extent.height;
+
+    VkFormat unorm = swapchain->format, srgb = swapchain->format;
+    for(size_t i = 0; i < sizeof(smaa_vk_srgb_formats) / sizeof(smaa_vk_srgb_formats[0]); i++) {
+	if(swapchain->format == smaa_vk_srgb_formats[i][1]) {
+	    unorm = smaa_vk_srgb_formats[i][0];
+	}
+    }
+    VkFormatFeatureFlags sampled = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+    if(!smaa_vk_format_supports(device, unorm, sampled) || !smaa_vk_format_supports(device, srgb, sampled)) {
+	fprintf(stderr, "with_smaa: cannot sample swapchain format %d, SMAA disabled\n", swapchain->format);
+	return 0;
+    }
+
+    swapchain->stencil_format = VK_FORMAT_UNDEFINED;
+    for(size_t i = 0; i < sizeof(smaa_vk_stencil_formats) / sizeof(smaa_vk_stencil_formats[0]); i++) {
+	if(smaa_vk_format_supports(device, smaa_vk_stencil_formats[i],
+				   VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT)) {
+	    swapchain->stencil_format = smaa_vk_stencil_formats[i];
+	    break;
+	}
+    }
+    if(swapchain->stencil_format == VK_FORMAT_UNDEFINED) {
+	fprintf(stderr, "with_smaa: no stencil format, SMAA disabled\n");
+	return 0;
+    }
+    VkImageAspectFlags stencil_aspect = swapchain->stencil_format == VK_FORMAT_S8_UINT
+	? VK_IMAGE_ASPECT_STENCIL_BIT : VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
+
+    VkImageUsageFlags target = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    if(!smaa_vk_image(device, &swapchain->color, unorm, srgb, width, height,
+		      VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_IMAGE_ASPECT_COLOR_BIT)
+       || !smaa_vk_image(device, &swapchain->edges, VK_FORMAT_R8G8_UNORM, VK_FORMAT_R8G8_UNORM, width, height,
+			 target, VK_IMAGE_ASPECT_COLOR_BIT)
+       || !smaa_vk_image(device, &swapchain->weights, VK_FORMAT_R8G8B8A8_UNORM, VK_FORMAT_R8G8B8A8_UNORM,
+			 width, height, target, VK_IMAGE_ASPECT_COLOR_BIT)
+       || !smaa_vk_image(device, &swapchain->stencil, swapchain->stencil_format, swapchain->stencil_format,
+			 width, height, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, stencil_aspect)
+       || !smaa_vk_create_lookup(swapchain)) {
+	fprintf(stderr, "with_smaa: cannot create the Vulkan images\n");
+	return 0;
+    }
+
+    VkSamplerCreateInfo sampler_info = {
+	.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+	.magFilter = VK_FILTER_LINEAR,
+	.minFilter = VK_FILTER_LINEAR,
+	.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+	.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+	.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+	.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+    };
+    if(device->vk.CreateSampler(device->device, &sampler_info, 0, &swapchain->sampler) != VK_SUCCESS) {
+	return 0;
+    }
+
+    VkImageLayout read = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    swapchain->edge_pass = smaa_vk_render_pass(swapchain, VK_FORMAT_R8G8_UNORM, VK_ATTACHMENT_LOAD_OP_CLEAR,
+					       read, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    swapchain->blend_pass = smaa_vk_render_pass(swapchain, VK_FORMAT_R8G8B8A8_UNORM, VK_ATTACHMENT_LOAD_OP_CLEAR,
+						read, VK_ATTACHMENT_LOAD_OP_LOAD);
+    // Every pixel is written, the frame itself was copied beforehand
+    swapchain->neighbor_pass = smaa_vk_render_pass(swapchain, swapchain->format, VK_ATTACHMENT_LOAD_OP_DONT_CARE,
+						   VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, VK_ATTACHMENT_LOAD_OP_MAX_ENUM);
+    if(!swapchain->edge_pass || !swapchain->blend_pass || !swapchain->neighbor_pass) {
+	return 0;
+    }
+
+    swapchain->edge_framebuffer = smaa_vk_framebuffer(swapchain, swapchain->edge_pass,
+						      swapchain->edges.view, swapchain->stencil.view);
+    swapchain->blend_framebuffer = smaa_vk_framebuffer(swapchain, swapchain->blend_pass,
+						       swapchain->weights.view, swapchain->stencil.view);
+    if(!swapchain->edge_framebuffer || !swapchain->blend_framebuffer) {
+	return 0;
+    }
+
+    for(uint32_t i = 0; i < swapchain->frame_count; i++) {
+	SMAAVkFrame *frame = &swapchain->frames[i];
+	VkImageViewCreateInfo view_info = {
+	    .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+	    .image = frame->image,
+	    .viewType = VK_IMAGE_VIEW_TYPE_2D,
+	    .format = swapchain->format,
+	    .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+	};
+	if(device->vk.CreateImageView(device->device, &view_info, 0, &frame->view) != VK_SUCCESS) {
+	    return 0;
+	}
+	frame->framebuffer = smaa_vk_framebuffer(swapchain, swapchain->neighbor_pass, frame->view, VK_NULL_HANDLE);
+	if(!frame->framebuffer) {
+	    return 0;
+	}
+
+	VkSemaphoreCreateInfo semaphore_info = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+	if(device->vk.CreateSemaphore(device->device, &semaphore_info, 0, &frame->done) != VK_SUCCESS) {
+	    return 0;
+	}
+    }
+
+    return smaa_vk_create_sets(swapchain);
+}
+
+static
+void smaa_vk_barrier(VkImageMemoryBarrier *barrier, VkImage image, VkImageLayout from, VkImageLayout to,
+		     VkAccessFlags src_access, VkAccessFlags dst_access)
+{
+    *barrier = (VkImageMemoryBarrier){
+	.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+	.srcAccessMask = src_access,
+	.dstAccessMask = dst_access,
+	.oldLayout = from,
+	.newLayout = to,
+	.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+	.image = image,
+	.subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 },
+    };
+}
+
+static
+int smaa_vk_record_upload(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkCommandBuffer commands = swapchain->upload;
+    VkCommandBufferBeginInfo begin = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if(device->vk.BeginCommandBuffer(commands, &begin) != VK_SUCCESS) {
+	return 0;
+    }
+
+    VkImageMemoryBarrier barriers[2];
+    smaa_vk_barrier(&barriers[0], swapchain->area.image, VK_IMAGE_LAYOUT_UNDEFINED,
+		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    smaa_vk_barrier(&barriers[1], swapchain->search.image, VK_IMAGE_LAYOUT_UNDEFINED,
+		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    device->vk.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT,
+				  0, 0, 0, 0, 0, 2, barriers);
+
+    VkBufferImageCopy area = {
+	.bufferOffset = 0,
+	.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+	.imageExtent = { AREATEX_WIDTH, AREATEX_HEIGHT, 1 },
+    };
+    VkBufferImageCopy search = {
+	.bufferOffset = AREATEX_SIZE,
+	.imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+	.imageExtent = { SEARCHTEX_WIDTH, SEARCHTEX_HEIGHT, 1 },
+    };
+    device->vk.CmdCopyBufferToImage(commands, swapchain->staging, swapchain->area.image,
+				    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &area);
+    device->vk.CmdCopyBufferToImage(commands, swapchain->staging, swapchain->search.image,
+				    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &search);
+
+    for(int i = 0; i < 2; i++) {
+	barriers[i].oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barriers[i].newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barriers[i].srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+	barriers[i].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    }
+    device->vk.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				  0, 0, 0, 0, 0, 2, barriers);
+
+    return device->vk.EndCommandBuffer(commands) == VK_SUCCESS;
+}
+
+static
+void smaa_vk_timestamp(SMAAVkSwapchain *swapchain, VkCommandBuffer commands, uint32_t index,
+		       VkPipelineStageFlagBits stage, int pass)
+{
+    if(swapchain->queries) {
+	swapchain->device->vk.CmdWriteTimestamp(commands, stage, swapchain->queries,
+						index * (SMAA_PASS_COUNT + 1) + pass);
+    }
+}
+
+static
+void smaa_vk_draw(SMAAVkSwapchain *swapchain, VkCommandBuffer commands, int pass,
+		  VkRenderPass render_pass, VkFramebuffer framebuffer)
+{
+    SMAAVkDevice *device = swapchain->device;
+    float width = swapchain->extent.width, height = swapchain->extent.height;
+    float metrics[4] = { 1.0f / width, 1.0f / height, width, height };
+    VkClearValue clear[2];
+    memset(clear, 0, sizeof(clear));
+
+    VkRenderPassBeginInfo begin = {
+	.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+	.renderPass = render_pass,
+	.framebuffer = framebuffer,
+	.renderArea = { { 0, 0 }, swapchain->extent },
+	.clearValueCount = 2,
+	.pClearValues = clear,
+    };
+    device->vk.CmdBeginRenderPass(commands, &begin, VK_SUBPASS_CONTENTS_INLINE);
+    device->vk.CmdBindPipeline(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, swapchain->pipelines[pass]);
+    device->vk.CmdBindDescriptorSets(commands, VK_PIPELINE_BIND_POINT_GRAPHICS, swapchain->layouts[pass],
+				     0, 1, &swapchain->sets[pass], 0, 0);
+    device->vk.CmdPushConstants(commands, swapchain->layouts[pass],
+				VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(metrics), metrics);
+    device->vk.CmdDraw(commands, 3, 1, 0, 0);
+    device->vk.CmdEndRenderPass(commands);
+}
+
+// The command buffer of a swapchain image: copy the frame, run the three
+// passes, the last one writing the result back into the image
+static
+int smaa_vk_record(SMAAVkSwapchain *swapchain, uint32_t index)
+{
+    SMAAVkDevice *device = swapchain->device;
+    SMAAVkFrame *frame = &swapchain->frames[index];
+    VkCommandBuffer commands = frame->commands;
+
+    // Pending submissions of other swapchain images use it too
+    VkCommandBufferBeginInfo begin = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+	.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT,
+    };
+    if(device->vk.BeginCommandBuffer(commands, &begin) != VK_SUCCESS) {
+	return 0;
+    }
+
+    if(swapchain->queries) {
+	device->vk.CmdResetQueryPool(commands, swapchain->queries, index * (SMAA_PASS_COUNT + 1), SMAA_PASS_COUNT + 1);
+    }
+    smaa_vk_timestamp(swapchain, commands, index, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0);
+
+    // The present's semaphores are waited on at the transfer stage. The
+    // previous frame's neighborhood blending may still read the copy.
+    VkImageMemoryBarrier barriers[2];
+    smaa_vk_barrier(&barriers[0], frame->image, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+		    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, 0, VK_ACCESS_TRANSFER_READ_BIT);
+    smaa_vk_barrier(&barriers[1], swapchain->color.image, VK_IMAGE_LAYOUT_UNDEFINED,
+		    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 0, VK_ACCESS_TRANSFER_WRITE_BIT);
+    device->vk.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				  VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, 0, 0, 0, 2, barriers);
+
+    VkImageCopy region = {
+	.srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+	.dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+	.extent = { swapchain->extent.width, swapchain->extent.height, 1 },
+    };
+    device->vk.CmdCopyImage(commands, frame->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			    swapchain->color.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    smaa_vk_barrier(&barriers[0], swapchain->color.image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT);
+    device->vk.CmdPipelineBarrier(commands, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+				  0, 0, 0, 0, 0, 1, barriers);
+    smaa_vk_timestamp(swapchain, commands, index, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1 + SMAA_PASS_COPY);
+
+    smaa_vk_draw(swapchain, commands, SMAA_VK_EDGE, swapchain->edge_pass, swapchain->edge_framebuffer);
+    smaa_vk_timestamp(swapchain, commands, index, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1 + SMAA_PASS_EDGE);
+    smaa_vk_draw(swapchain, commands, SMAA_VK_BLEND, swapchain->blend_pass, swapchain->blend_framebuffer);
+    smaa_vk_timestamp(swapchain, commands, index, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1 + SMAA_PASS_BLEND);
+    smaa_vk_draw(swapchain, commands, SMAA_VK_NEIGHBOR, swapchain->neighbor_pass, frame->framebuffer);
+    smaa_vk_timestamp(swapchain, commands, index, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 1 + SMAA_PASS_NEIGHBOR);
+
+    return device->vk.EndCommandBuffer(commands) == VK_SUCCESS;
+}
+
+static
+int smaa_vk_record_all(SMAAVkSwapchain *swapchain)
+{
+    for(uint32_t i = 0; i < swapchain->frame_count; i++) {
+	if(!smaa_vk_record(swapchain, i)) {
+	    return 0;
+	}
+    }
+    return 1;
+}
+
+// On the first present, once the queue family is known: the command
+// buffers and the timestamp queries
+static
+int smaa_vk_initialize(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+
+    VkCommandPoolCreateInfo pool_info = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+	.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+	.queueFamilyIndex = swapchain->family,
+    };
+    if(device->vk.CreateCommandPool(device->device, &pool_info, 0, &swapchain->pool) != VK_SUCCESS) {
+	return 0;
+    }
+
+    uint32_t count = swapchain->frame_count + 1;
+    VkCommandBuffer *commands = malloc(count * sizeof(VkCommandBuffer));
+    VkCommandBufferAllocateInfo allocate_info = {
+	.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+	.commandPool = swapchain->pool,
+	.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+	.commandBufferCount = count,
+    };
+    if(!commands || device->vk.AllocateCommandBuffers(device->device, &allocate_info, commands) != VK_SUCCESS) {
+	free(commands);
+	return 0;
+    }
+    for(uint32_t i = 0; i < count; i++) {
+	device->set_loader_data(device->device, commands[i]);
+    }
+    swapchain->upload = commands[0];
+    for(uint32_t i = 0; i < swapchain->frame_count; i++) {
+	swapchain->frames[i].commands = commands[i + 1];
+    }
+    free(commands);
+
+    uint32_t bits = swapchain->family < device->family_count
+	? device->families[swapchain->family].timestampValidBits : 0;
+    if(smaa_exporter_start()) {
+	if(!bits) {
+	    fprintf(stderr, "with_smaa: no timestamps on the present queue, telemetry disabled\n");
+	} else {
+	    VkQueryPoolCreateInfo query_info = {
+		.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+		.queryType = VK_QUERY_TYPE_TIMESTAMP,
+		.queryCount = swapchain->frame_count * (SMAA_PASS_COUNT + 1),
+	    };
+	    if(device->vk.CreateQueryPool(device->device, &query_info, 0, &swapchain->queries) != VK_SUCCESS) {
+		swapchain->queries = VK_NULL_HANDLE;
+	    }
+	    swapchain->timestamp_mask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+	}
+    }
+
+    return smaa_vk_record_upload(swapchain) && smaa_vk_record_all(swapchain);
+}
+
+// Hands the timestamps of a frame whose fence signaled to the exporter
+static
+void smaa_vk_collect(SMAAVkSwapchain *swapchain, uint32_t index)
+{
+    SMAAVkDevice *device = swapchain->device;
+    uint64_t stamps[SMAA_PASS_COUNT + 1];
+    if(device->vk.GetQueryPoolResults(device->device, swapchain->queries, index * (SMAA_PASS_COUNT + 1),
+				      SMAA_PASS_COUNT + 1, sizeof(stamps), stamps, sizeof(stamps[0]),
+				      VK_QUERY_RESULT_64_BIT) != VK_SUCCESS) {
+	smaa_exporter_drop();
+	return;
+    }
+
+    float ms[SMAA_PASS_COUNT];
+    for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	uint64_t ticks = (stamps[pass + 1] - stamps[pass]) & swapchain->timestamp_mask;
+	ms[pass] = ticks * device->timestamp_period / 1000000.0f;
+    }
+    smaa_exporter_push(ms);
+}
+
+// Looks at the fences that signaled: their frames' timestamps are read,
+// the staging buffer freed once the upload finished. Returns a signaled
+// fence nothing waits for anymore, or -1.
+static
+int smaa_vk_retire(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    int free_fence = -1;
+    for(int i = 0; i < swapchain->fence_count; i++) {
+	SMAAVkFence *fence = &swapchain->fences[i];
+	if(device->vk.GetFenceStatus(device->device, fence->fence) != VK_SUCCESS) {
+	    continue;
+	}
+	if(fence->frame >= 0) {
+	    smaa_vk_collect(swapchain, fence->frame);
+	    swapchain->frames[fence->frame].fence = -1;
+	    fence->frame = -1;
+	}
+	if(swapchain->upload_fence == i) {
+	    smaa_vk_free_staging(swapchain);
+	}
+	if(free_fence < 0) {
+	    free_fence = i;
+	}
+    }
+    return free_fence;
+}
+
+static
+int smaa_vk_fence(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    int index = smaa_vk_retire(swapchain);
+    if(index < 0) {
+	SMAAVkFence *fences = realloc(swapchain->fences, (swapchain->fence_count + 1) * sizeof(SMAAVkFence));
+	if(!fences) {
+	    return -1;
+	}
+	swapchain->fences = fences;
+
+	VkFenceCreateInfo info = { .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO };
+	if(device->vk.CreateFence(device->device, &info, 0, &fences[swapchain->fence_count].fence) != VK_SUCCESS) {
+	    return -1;
+	}
+	fences[swapchain->fence_count].frame = -1;
+	return swapchain->fence_count++;
+    }
+
+    if(device->vk.ResetFences(device->device, 1, &swapchain->fences[index].fence) != VK_SUCCESS) {
+	return -1;
+    }
+    return index;
+}
+
+// The only time the CPU waits for the GPU: before destroying anything
+// submissions in flight may still use
+static
+void smaa_vk_wait(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    for(int i = 0; i < swapchain->fence_count; i++) {
+	if(device->vk.WaitForFences(device->device, 1, &swapchain->fences[i].fence, VK_TRUE, SMAA_VK_TIMEOUT)
+	   == VK_TIMEOUT) {
+	    fprintf(stderr, "with_smaa: timeout waiting for the GPU\n");
+	    return;
+	}
+    }
+}
+
+internal
+SMAAVkSwapchain *smaa_vk_create(SMAAVkDevice *device, VkSwapchainKHR handle, const VkSwapchainCreateInfoKHR *info)
+{
+    SMAAVkSwapchain *swapchain = calloc(1, sizeof(SMAAVkSwapchain));
+    if(!swapchain) {
+	return 0;
+    }
+    swapchain->device = device;
+    swapchain->swapchain = handle;
+    swapchain->format = info->imageFormat;
+    swapchain->extent = info->imageExtent;
+    swapchain->upload_fence = -1;
+
+    uint32_t count = 0;
+    device->vk.GetSwapchainImagesKHR(device->device, handle, &count, 0);
+    VkImage *images = malloc(count * sizeof(VkImage));
+    swapchain->frames = calloc(count, sizeof(SMAAVkFrame));
+    if(!count || !images || !swapchain->frames
+       || device->vk.GetSwapchainImagesKHR(device->device, handle, &count, images) != VK_SUCCESS) {
+	free(images);
+	smaa_vk_destroy(swapchain);
+	return 0;
+    }
+    swapchain->frame_count = count;
+    for(uint32_t i = 0; i < count; i++) {
+	swapchain->frames[i].image = images[i];
+	swapchain->frames[i].fence = -1;
+    }
+    free(images);
+
+    const SMAAConfig *config = smaa_config_get(&swapchain->config_generation);
+    if(!smaa_vk_create_resources(swapchain) || !smaa_vk_create_pipelines(swapchain, config)) {
+	smaa_vk_destroy(swapchain);
+	return 0;
+    }
+
+    fprintf(stderr, "with_smaa: Vulkan swapchain %ux%u, %u images\n",
+	    swapchain->extent.width, swapchain->extent.height, swapchain->frame_count);
+    return swapchain;
+}
+
+internal
+void smaa_vk_destroy(SMAAVkSwapchain *swapchain)
+{
+    SMAAVkDevice *device = swapchain->device;
+    VkDevice handle = device->device;
+
+    smaa_vk_wait(swapchain);
+    for(int i = 0; i < swapchain->fence_count; i++) {
+	device->vk.DestroyFence(handle, swapchain->fences[i].fence, 0);
+    }
+    free(swapchain->fences);
+
+    for(uint32_t i = 0; i < swapchain->frame_count; i++) {
+	SMAAVkFrame *frame = &swapchain->frames[i];
+	device->vk.DestroySemaphore(handle, frame->done, 0);
+	device->vk.DestroyFramebuffer(handle, frame->framebuffer, 0);
+	device->vk.DestroyImageView(handle, frame->view, 0);
+    }
+    free(swapchain->frames);
+
+    // Frees the command buffers along with it
+    device->vk.DestroyCommandPool(handle, swapchain->pool, 0);
+    device->vk.DestroyQueryPool(handle, swapchain->queries, 0);
+
+    smaa_vk_destroy_pipelines(swapchain);
+    device->vk.DestroyDescriptorPool(handle, swapchain->descriptor_pool, 0);
+    for(int pass = 0; pass < 3; pass++) {
+	device->vk.DestroyPipelineLayout(handle, swapchain->layouts[pass], 0);
+	device->vk.DestroyDescriptorSetLayout(handle, swapchain->set_layouts[pass], 0);
+    }
+    device->vk.DestroyFramebuffer(handle, swapchain->edge_framebuffer, 0);
+    device->vk.DestroyFramebuffer(handle, swapchain->blend_framebuffer, 0);
+    device->vk.DestroyRenderPass(handle, swapchain->edge_pass, 0);
+    device->vk.DestroyRenderPass(handle, swapchain->blend_pass, 0);
+    device->vk.DestroyRenderPass(handle, swapchain->neighbor_pass, 0);
+    device->vk.DestroySampler(handle, swapchain->sampler, 0);
+
+    smaa_vk_free_staging(swapchain);
+    smaa_vk_destroy_image(device, &swapchain->color);
+    smaa_vk_destroy_image(device, &swapchain->edges);
+    smaa_vk_destroy_image(device, &swapchain->weights);
+    smaa_vk_destroy_image(device, &swapchain->stencil);
+    smaa_vk_destroy_image(device, &swapchain->area);
+    smaa_vk_destroy_image(device, &swapchain->search);
+
+    free(swapchain);
+}
+
+internal
+int smaa_vk_present(SMAAVkSwapchain *swapchain, VkQueue queue, uint32_t family, uint32_t index,
+		    VkCommandBuffer *commands, uint32_t *command_count, VkSemaphore *semaphore, VkFence *fence)
+{
+    if(swapchain->failed || index >= swapchain->frame_count) {
+	return 0;
+    }
+
+    // The command buffers belong to a pool of one queue family, and the
+    // submissions of one queue are ordered among each other
+    if(!swapchain->initialized) {
+	swapchain->queue = queue;
+	swapchain->family = family;
+	swapchain->initialized = 1;
+	if(!smaa_vk_initialize(swapchain)) {
+	    fprintf(stderr, "with_smaa: cannot record the Vulkan command buffers, SMAA disabled\n");
+	    swapchain->failed = 1;
+	    return 0;
+	}
+    } else if(queue != swapchain->queue) {
+	return 0;
+    }
+
+    unsigned generation;
+    const SMAAConfig *config = smaa_config_get(&generation);
+    if(generation != swapchain->config_generation) {
+	swapchain->config_generation = generation;
+	if(!smaa_config_same_shaders(config, &swapchain->config)) {
+	    smaa_vk_wait(swapchain);
+	    smaa_vk_destroy_pipelines(swapchain);
+	    if(!smaa_vk_create_pipelines(swapchain, config) || !smaa_vk_record_all(swapchain)) {
+		swapchain->failed = 1;
+		return 0;
+	    }
+	}
+    }
+
+    SMAAVkFrame *frame = &swapchain->frames[index];
+    int slot = smaa_vk_fence(swapchain);
+    if(slot < 0) {
+	return 0;
+    }
+    if(frame->fence >= 0) {
+	// Its previous timestamps are overwritten before they were read
+	swapchain->fences[frame->fence].frame = -1;
+	smaa_exporter_drop();
+    }
+    if(swapchain->queries) {
+	frame->fence = slot;
+	swapchain->fences[slot].frame = index;
+    }
+
+    if(swapchain->staging && swapchain->upload_fence < 0) {
+	commands[(*command_count)++] = swapchain->upload;
+	swapchain->upload_fence = slot;
+    }
+    commands[(*command_count)++] = frame->commands;
+    *semaphore = frame->done;
+    *fence = swapchain->fences[slot].fence;
+    return 1;
+}
@@ -0,0 +1,210 @@
+#ifndef WITH_SMAA_SMAA_VK_H
+#define WITH_SMAA_SMAA_VK_H
+
+// Include after smaa.h
+
+#include <vulkan/vulkan.h>
+#include <vulkan/vk_layer.h>
+
+// SMAA of the Vulkan layer, see layer.c for how it gets at the frames.
+// Every swapchain gets the three passes of smaa.c, as SPIR-V built from
+// the same SMAA.hlsl (see smaa_vk_sources.h). The presented image is
+// copied, anti-aliased back into itself by a command buffer recorded
+// once per swapchain image, and the present waits on its semaphore.
+// The CPU only waits for the GPU when the configuration changes or the
+// swapchain is destroyed.
+
+// The device functions the layer calls down the chain
+#define SMAA_VK_DEVICE_FUNCTIONS(F) \
+    F(DestroyDevice) \
+    F(GetDeviceQueue) \
+    F(GetDeviceQueue2) \
+    F(QueueSubmit) \
+    F(AllocateMemory) \
+    F(FreeMemory) \
+    F(MapMemory) \
+    F(UnmapMemory) \
+    F(BindBufferMemory) \
+    F(BindImageMemory) \
+    F(GetBufferMemoryRequirements) \
+    F(GetImageMemoryRequirements) \
+    F(CreateFence) \
+    F(DestroyFence) \
+    F(ResetFences) \
+    F(GetFenceStatus) \
+    F(WaitForFences) \
+    F(CreateSemaphore) \
+    F(DestroySemaphore) \
+    F(CreateQueryPool) \
+    F(DestroyQueryPool) \
+    F(GetQueryPoolResults) \
+    F(CreateBuffer) \
+    F(DestroyBuffer) \
+    F(CreateImage) \
+    F(DestroyImage) \
+    F(CreateImageView) \
+    F(DestroyImageView) \
+    F(CreateShaderModule) \
+    F(DestroyShaderModule) \
+    F(CreateGraphicsPipelines) \
+    F(DestroyPipeline) \
+    F(CreatePipelineLayout) \
+    F(DestroyPipelineLayout) \
+    F(CreateSampler) \
+    F(DestroySampler) \
+    F(CreateDescriptorSetLayout) \
+    F(DestroyDescriptorSetLayout) \
+    F(CreateDescriptorPool) \
+    F(DestroyDescriptorPool) \
+    F(AllocateDescriptorSets) \
+    F(UpdateDescriptorSets) \
+    F(CreateFramebuffer) \
+    F(DestroyFramebuffer) \
+    F(CreateRenderPass) \
+    F(DestroyRenderPass) \
+    F(CreateCommandPool) \
+    F(DestroyCommandPool) \
+    F(AllocateCommandBuffers) \
+    F(BeginCommandBuffer) \
+    F(EndCommandBuffer) \
+    F(CmdBindPipeline) \
+    F(CmdBindDescriptorSets) \
+    F(CmdDraw) \
+    F(CmdCopyImage) \
+    F(CmdCopyBufferToImage) \
+    F(CmdPipelineBarrier) \
+    F(CmdResetQueryPool) \
+    F(CmdWriteTimestamp) \
+    F(CmdPushConstants) \
+    F(CmdBeginRenderPass) \
+    F(CmdEndRenderPass) \
+    F(CreateSwapchainKHR) \
+    F(DestroySwapchainKHR) \
+    F(GetSwapchainImagesKHR) \
+    F(QueuePresentKHR)
+
+#define SMAA_VK_DECLARE(name) PFN_vk##name name;
+
+typedef struct SMAAVkDispatch {
+    SMAA_VK_DEVICE_FUNCTIONS(SMAA_VK_DECLARE)
+} SMAAVkDispatch;
+
+typedef struct SMAAVkDevice {
+    VkDevice device;
+    VkPhysicalDevice physical_device;
+    SMAAVkDispatch vk;
+    // Command buffers we allocate need the loader's dispatch table
+    PFN_vkSetDeviceLoaderData set_loader_data;
+    PFN_vkGetPhysicalDeviceFormatProperties get_format_properties;
+
+    VkPhysicalDeviceMemoryProperties memory;
+    // Nanoseconds per timestamp tick
+    float timestamp_period;
+    VkQueueFamilyProperties *families;
+    uint32_t family_count;
+} SMAAVkDevice;
+
+typedef struct SMAAVkImage {
+    VkImage image;
+    VkDeviceMemory memory;
+    VkImageView view;
+    // Decoding view of the copy of an sRGB swapchain image, else view
+    VkImageView srgb_view;
+} SMAAVkImage;
+
+// What's recorded for a swapchain image
+typedef struct SMAAVkFrame {
+    VkImage image;
+    VkImageView view;
+    VkFramebuffer framebuffer;
+    VkCommandBuffer commands;
+    // Signaled by commands, waited on by the present
+    VkSemaphore done;
+    // Of the fence pool, -1 once the timestamps were read
+    int fence;
+} SMAAVkFrame;
+
+typedef struct SMAAVkFence {
+    VkFence fence;
+    // Frame whose timestamps are read once it signals, or -1
+    int frame;
+} SMAAVkFence;
+
+typedef struct SMAAVkSwapchain {
+    SMAAVkDevice *device;
+    VkSwapchainKHR swapchain;
+    VkFormat format;
+    VkExtent2D extent;
+
+    // The queue of the first present, and its family. Presents on other
+    // queues are passed through, see smaa_vk_present().
+    VkQueue queue;
+    uint32_t family;
+    // Command buffers recorded, or recording them failed
+    int initialized;
+    int failed;
+
+    // Of the pipelines
+    SMAAConfig config;
+    unsigned config_generation;
+
+    VkCommandPool pool;
+    // Copy of the presented image, the input of every pass
+    SMAAVkImage color;
+    SMAAVkImage edges;
+    SMAAVkImage weights;
+    // Marks edge pixels for the blend pass, like stencil_rb in smaa.h
+    SMAAVkImage stencil;
+    VkFormat stencil_format;
+    SMAAVkImage area;
+    SMAAVkImage search;
+    // Lookup textures until the upload finished, see upload_fence
+    VkBuffer staging;
+    VkDeviceMemory staging_memory;
+    VkCommandBuffer upload;
+    int upload_fence;
+    VkSampler sampler;
+
+    VkRenderPass edge_pass;
+    VkRenderPass blend_pass;
+    VkRenderPass neighbor_pass;
+    VkFramebuffer edge_framebuffer;
+    VkFramebuffer blend_framebuffer;
+    VkDescriptorSetLayout set_layouts[3];
+    VkPipelineLayout layouts[3];
+    VkDescriptorPool descriptor_pool;
+    VkDescriptorSet sets[3];
+    VkPipeline pipelines[3];
+
+    // SMAA_PASS_COUNT + 1 timestamps per frame, 0 without telemetry
+    VkQueryPool queries;
+    uint64_t timestamp_mask;
+
+    // Grown as needed, so every submission has a fence to wait on
+    SMAAVkFence *fences;
+    int fence_count;
+
+    SMAAVkFrame *frames;
+    uint32_t frame_count;
+} SMAAVkSwapchain;
+
+// The usage SMAA needs of the swapchain images, to be added at creation
+#define SMAA_VK_USAGE (VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT)
+
+// Sets up SMAA for a swapchain just created, with SMAA_VK_USAGE. Returns
+// 0 if SMAA can't run on it, its frames are then presented untouched.
+internal SMAAVkSwapchain *smaa_vk_create(SMAAVkDevice *device, VkSwapchainKHR swapchain,
+					 const VkSwapchainCreateInfoKHR *info);
+
+// Waits for the swapchain's work in flight
+internal void smaa_vk_destroy(SMAAVkSwapchain *swapchain);
+
+// For the present of image index on queue: the command buffers to submit
+// before it, appended to commands, and the semaphore they signal, that
+// the present has to wait on instead of the application's. *fence is to
+// be signaled after them. Returns 0 to present the image untouched.
+internal int smaa_vk_present(SMAAVkSwapchain *swapchain, VkQueue queue, uint32_t family, uint32_t index,
+			     VkCommandBuffer *commands, uint32_t *command_count,
+			     VkSemaphore *semaphore, VkFence *fence);
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef WITH_SMAA_VK_SOURCES_H
+#define WITH_SMAA_VK_SOURCES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The shaders of the Vulkan layer, compiled to SPIR-V at build time by
+// gen_smaa_vk_shaders into the smaa_vk_shaders[] table of
+// smaa_vk_shader.h. They are SMAA.hlsl as GLSL 4 with mains of their own.
+// Thresholds, search steps and corner rounding are specialization
+// constants, SMAA_RT_METRICS a push constant; predication isn't compiled
+// in, the layer has no depth.
+
+enum {
+    SMAA_VK_SHADER_EDGE_VS,
+    SMAA_VK_SHADER_BLEND_VS,
+    SMAA_VK_SHADER_NEIGHBOR_VS,
+    SMAA_VK_SHADER_LUMA_EDGE_FS,
+    SMAA_VK_SHADER_COLOR_EDGE_FS,
+    // Followed by those without diagonal and/or corner detection, see
+    // SMAA_VK_SHADER_BLEND()
+    SMAA_VK_SHADER_BLEND_FS,
+    SMAA_VK_SHADER_NEIGHBOR_FS = SMAA_VK_SHADER_BLEND_FS + 4,
+    SMAA_VK_SHADER_COUNT
+};
+
+// Blending weights with and without diagonal and corner detection
+#define SMAA_VK_SHADER_BLEND(diag_detection, corner_detection) \
+    (SMAA_VK_SHADER_BLEND_FS + !(diag_detection) + 2 * !(corner_detection))
+
+// constant_id of the specialization constants
+enum {
+    SMAA_VK_CONSTANT_THRESHOLD,
+    SMAA_VK_CONSTANT_MAX_SEARCH_STEPS,
+    SMAA_VK_CONSTANT_MAX_SEARCH_STEPS_DIAG,
+    SMAA_VK_CONSTANT_CORNER_ROUNDING,
+    SMAA_VK_CONSTANT_COUNT
+};
+
+typedef struct SMAAVkShaderCode {
+    const uint32_t *code;
+    // In bytes
+    size_t size;
+} SMAAVkShaderCode;
+
+#endif
@@ -0,0 +1,788 @@
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "state.h"
+
+#define STATE_MAX_CONTEXTS 16
+
+typedef struct StateShadow {
+    void *context;
+    // Synced with glGet* once and no untracked call changed it since
+    int known;
+    SMAAState state;
+} StateShadow;
+
+static StateShadow state_shadows[STATE_MAX_CONTEXTS];
+static pthread_mutex_t state_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Shadow of the context current on this thread, 0 if untracked
+static __thread StateShadow *state_current;
+
+// Calls to glDeleteTextures, in any context
+static unsigned state_texture_deletions;
+
+// Set once the application got a setter that bypasses the wrappers,
+// after which no shadow can be trusted, see smaa_state_unwrapped()
+static int state_bypassed;
+
+internal
+void smaa_state_make_current(void *context)
+{
+    state_current = 0;
+    if(!context) {
+	return;
+    }
+
+    pthread_mutex_lock(&state_mutex);
+    StateShadow *free_shadow = 0;
+    for(int i = 0; i < STATE_MAX_CONTEXTS; i++) {
+	if(state_shadows[i].context == context) {
+	    state_current = &state_shadows[i];
+	    break;
+	}
+	if(!free_shadow && !state_shadows[i].context) {
+	    free_shadow = &state_shadows[i];
+	}
+    }
+    if(!state_current && free_shadow) {
+	free_shadow->context = context;
+	free_shadow->known = 0;
+	state_current = free_shadow;
+    }
+    pthread_mutex_unlock(&state_mutex);
+}
+
+internal
+unsigned smaa_state_texture_deletions(void)
+{
+    return __atomic_load_n(&state_texture_deletions, __ATOMIC_RELAXED);
+}
+
+internal
+void smaa_state_forget(void *context)
+{
+    pthread_mutex_lock(&state_mutex);
+    for(int i = 0; i < STATE_MAX_CONTEXTS; i++) {
+	if(state_shadows[i].context == context) {
+	    if(state_current == &state_shadows[i]) {
+		state_current = 0;
+	    }
+	    state_shadows[i].context = 0;
+	    state_shadows[i].known = 0;
+	}
+    }
+    pthread_mutex_unlock(&state_mutex);
+}
+
+static
+SMAAState *state_tracked()
+{
+    return state_current ? &state_current->state : 0;
+}
+
+static
+void state_lost()
+{
+    if(state_current) {
+	state_current->known = 0;
+    }
+}
+
+static
+int state_trusted(StateShadow *shadow)
+{
+    return shadow && shadow->known && !__atomic_load_n(&state_bypassed, __ATOMIC_RELAXED);
+}
+
+internal
+void smaa_state_unwrapped(const char *name)
+{
+    state_lost();
+    if(!__atomic_exchange_n(&state_bypassed, 1, __ATOMIC_RELAXED)) {
+	fprintf(stderr, "with_smaa: %s bypasses the state tracking, reading the state back"
+		" on every frame\n", name);
+    }
+}
+
+static
+GLint *state_cap(SMAAState *state, GLenum cap)
+{
+    switch(cap) {
+    case GL_DEPTH_TEST: return &state->depth;
+    case GL_BLEND: return &state->blending;
+    case GL_CULL_FACE: return &state->cull;
+    case GL_STENCIL_TEST: return &state->stencil;
+    case GL_FRAMEBUFFER_SRGB: return &state->srgb;
+    case GL_SCISSOR_TEST: return &state->scissor;
+    }
+    return 0;
+}
+
+static
+void state_stencil_faces(SMAAState *state, GLenum face, SMAAStencilFace **faces)
+{
+    faces[0] = face != GL_BACK ? &state->stencil_front : 0;
+    faces[1] = face != GL_FRONT ? &state->stencil_back : 0;
+}
+
+// Wrappers. Each forwards to the real function and updates the shadow
+// of the current context. The shim intercepts the names listed in
+// shim_hooks.list.
+
+#define STATE_REAL(name)						\
+    static __typeof__(name) *real;					\
+    if(!real) {								\
+	real = (__typeof__(name)*)shim_real_proc(#name);		\
+    }
+
+public
+void glViewport(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    STATE_REAL(glViewport);
+    real(x, y, width, height);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->viewport[0] = x;
+	state->viewport[1] = y;
+	state->viewport[2] = width;
+	state->viewport[3] = height;
+    }
+}
+
+public
+void glScissor(GLint x, GLint y, GLsizei width, GLsizei height)
+{
+    STATE_REAL(glScissor);
+    real(x, y, width, height);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->scissor_box[0] = x;
+	state->scissor_box[1] = y;
+	state->scissor_box[2] = width;
+	state->scissor_box[3] = height;
+    }
+}
+
+public
+void glBindVertexArray(GLuint array)
+{
+    STATE_REAL(glBindVertexArray);
+    real(array);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->vao = array;
+    }
+}
+
+public
+void glUseProgram(GLuint program)
+{
+    STATE_REAL(glUseProgram);
+    real(program);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->program = program;
+    }
+}
+
+public
+void glActiveTexture(GLenum texture)
+{
+    STATE_REAL(glActiveTexture);
+    real(texture);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->texture = texture;
+    }
+}
+
+public
+void glBindTexture(GLenum target, GLuint texture)
+{
+    STATE_REAL(glBindTexture);
+    real(target, texture);
+
+    SMAAState *state = state_tracked();
+    unsigned unit = state ? (unsigned)(state->texture - GL_TEXTURE0) : 0;
+    if(state && target == GL_TEXTURE_2D && unit < 3) {
+	state->textures[unit] = texture;
+    }
+}
+
+public
+void glEnable(GLenum cap)
+{
+    STATE_REAL(glEnable);
+    real(cap);
+
+    SMAAState *state = state_tracked();
+    GLint *enabled = state ? state_cap(state, cap) : 0;
+    if(enabled) {
+	*enabled = 1;
+    }
+}
+
+public
+void glDisable(GLenum cap)
+{
+    STATE_REAL(glDisable);
+    real(cap);
+
+    SMAAState *state = state_tracked();
+    GLint *enabled = state ? state_cap(state, cap) : 0;
+    if(enabled) {
+	*enabled = 0;
+    }
+}
+
+public
+void glClearColor(GLfloat red, GLfloat green, GLfloat blue, GLfloat alpha)
+{
+    STATE_REAL(glClearColor);
+    real(red, green, blue, alpha);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->clear_color[0] = red;
+	state->clear_color[1] = green;
+	state->clear_color[2] = blue;
+	state->clear_color[3] = alpha;
+    }
+}
+
+public
+void glClearStencil(GLint s)
+{
+    STATE_REAL(glClearStencil);
+    real(s);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->clear_stencil = s;
+    }
+}
+
+public
+void glStencilFuncSeparate(GLenum face, GLenum func, GLint ref, GLuint mask)
+{
+    STATE_REAL(glStencilFuncSeparate);
+    real(face, func, ref, mask);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	SMAAStencilFace *faces[2];
+	state_stencil_faces(state, face, faces);
+	for(int i = 0; i < 2; i++) {
+	    if(faces[i]) {
+		faces[i]->func = func;
+		faces[i]->ref = ref;
+		faces[i]->value_mask = mask;
+	    }
+	}
+    }
+}
+
+public
+void glStencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+    STATE_REAL(glStencilFunc);
+    real(func, ref, mask);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->stencil_front.func = state->stencil_back.func = func;
+	state->stencil_front.ref = state->stencil_back.ref = ref;
+	state->stencil_front.value_mask = state->stencil_back.value_mask = mask;
+    }
+}
+
+public
+void glStencilOpSeparate(GLenum face, GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+    STATE_REAL(glStencilOpSeparate);
+    real(face, sfail, dpfail, dppass);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	SMAAStencilFace *faces[2];
+	state_stencil_faces(state, face, faces);
+	for(int i = 0; i < 2; i++) {
+	    if(faces[i]) {
+		faces[i]->fail = sfail;
+		faces[i]->depth_fail = dpfail;
+		faces[i]->depth_pass = dppass;
+	    }
+	}
+    }
+}
+
+public
+void glStencilOp(GLenum fail, GLenum zfail, GLenum zpass)
+{
+    STATE_REAL(glStencilOp);
+    real(fail, zfail, zpass);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->stencil_front.fail = state->stencil_back.fail = fail;
+	state->stencil_front.depth_fail = state->stencil_back.depth_fail = zfail;
+	state->stencil_front.depth_pass = state->stencil_back.depth_pass = zpass;
+    }
+}
+
+public
+void glStencilMaskSeparate(GLenum face, GLuint mask)
+{
+    STATE_REAL(glStencilMaskSeparate);
+    real(face, mask);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	SMAAStencilFace *faces[2];
+	state_stencil_faces(state, face, faces);
+	for(int i = 0; i < 2; i++) {
+	    if(faces[i]) {
+		faces[i]->writemask = mask;
+	    }
+	}
+    }
+}
+
+public
+void glStencilMask(GLuint mask)
+{
+    STATE_REAL(glStencilMask);
+    real(mask);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	state->stencil_front.writemask = state->stencil_back.writemask = mask;
+    }
+}
+
+public
+void glBindFramebuffer(GLenum target, GLuint framebuffer)
+{
+    STATE_REAL(glBindFramebuffer);
+    real(target, framebuffer);
+
+    SMAAState *state = state_tracked();
+    if(state) {
+	if(target != GL_READ_FRAMEBUFFER) {
+	    state->draw_fbo = framebuffer;
+	}
+	if(target != GL_DRAW_FRAMEBUFFER) {
+	    state->read_fbo = framebuffer;
+	}
+    }
+}
+
+// Deleting a bound object binds 0 in its place
+
+static
+int state_deleted(GLint name, GLsizei n, const GLuint *names)
+{
+    for(GLsizei i = 0; i < n; i++) {
+	if(name && (GLuint)name == names[i]) {
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+public
+void glDeleteTextures(GLsizei n, const GLuint *textures)
+{
+    SMAAState *state = state_tracked();
+    if(state) {
+	for(int i = 0; i < 3; i++) {
+	    if(state_deleted(state->textures[i], n, textures)) {
+		state->textures[i] = 0;
+	    }
+	}
+    }
+    __atomic_fetch_add(&state_texture_deletions, 1, __ATOMIC_RELAXED);
+
+    STATE_REAL(glDeleteTextures);
+    real(n, textures);
+}
+
+public
+void glDeleteFramebuffers(GLsizei n, const GLuint *framebuffers)
+{
+    SMAAState *state = state_tracked();
+    if(state) {
+	if(state_deleted(state->draw_fbo, n, framebuffers)) {
+	    state->draw_fbo = 0;
+	}
+	if(state_deleted(state->read_fbo, n, framebuffers)) {
+	    state->read_fbo = 0;
+	}
+    }
+
+    STATE_REAL(glDeleteFramebuffers);
+    real(n, framebuffers);
+}
+
+public
+void glDeleteVertexArrays(GLsizei n, const GLuint *arrays)
+{
+    SMAAState *state = state_tracked();
+    if(state && state_deleted(state->vao, n, arrays)) {
+	state->vao = 0;
+    }
+
+    STATE_REAL(glDeleteVertexArrays);
+    real(n, arrays);
+}
+
+// Calls that change tracked state in ways the shadow doesn't follow. The
+// next save reads everything back.
+
+public
+void glPopAttrib(void)
+{
+    STATE_REAL(glPopAttrib);
+    real();
+    state_lost();
+}
+
+public
+void glEnablei(GLenum target, GLuint index)
+{
+    STATE_REAL(glEnablei);
+    real(target, index);
+    state_lost();
+}
+
+public
+void glDisablei(GLenum target, GLuint index)
+{
+    STATE_REAL(glDisablei);
+    real(target, index);
+    state_lost();
+}
+
+public
+void glViewportIndexedf(GLuint index, GLfloat x, GLfloat y, GLfloat w, GLfloat h)
+{
+    STATE_REAL(glViewportIndexedf);
+    real(index, x, y, w, h);
+    state_lost();
+}
+
+public
+void glViewportIndexedfv(GLuint index, const GLfloat *v)
+{
+    STATE_REAL(glViewportIndexedfv);
+    real(index, v);
+    state_lost();
+}
+
+public
+void glViewportArrayv(GLuint first, GLsizei count, const GLfloat *v)
+{
+    STATE_REAL(glViewportArrayv);
+    real(first, count, v);
+    state_lost();
+}
+
+public
+void glScissorIndexed(GLuint index, GLint left, GLint bottom, GLsizei width, GLsizei height)
+{
+    STATE_REAL(glScissorIndexed);
+    real(index, left, bottom, width, height);
+    state_lost();
+}
+
+public
+void glScissorIndexedv(GLuint index, const GLint *v)
+{
+    STATE_REAL(glScissorIndexedv);
+    real(index, v);
+    state_lost();
+}
+
+public
+void glScissorArrayv(GLuint first, GLsizei count, const GLint *v)
+{
+    STATE_REAL(glScissorArrayv);
+    real(first, count, v);
+    state_lost();
+}
+
+public
+void glBindTextures(GLuint first, GLsizei count, const GLuint *textures)
+{
+    STATE_REAL(glBindTextures);
+    real(first, count, textures);
+    state_lost();
+}
+
+public
+void glBindTextureUnit(GLuint unit, GLuint texture)
+{
+    STATE_REAL(glBindTextureUnit);
+    real(unit, texture);
+    state_lost();
+}
+
+public
+void glBindFramebufferEXT(GLenum target, GLuint framebuffer)
+{
+    STATE_REAL(glBindFramebufferEXT);
+    real(target, framebuffer);
+    state_lost();
+}
+
+public
+void glActiveTextureARB(GLenum texture)
+{
+    STATE_REAL(glActiveTextureARB);
+    real(texture);
+    state_lost();
+}
+
+public
+void glUseProgramObjectARB(GLhandleARB program)
+{
+    STATE_REAL(glUseProgramObjectARB);
+    real(program);
+    state_lost();
+}
+
+// Saving and restoring
+
+static
+void smaa_stencil_face_save(SMAAStencilFace *face, GLenum func, GLenum ref, GLenum value_mask,
+			    GLenum fail, GLenum depth_fail, GLenum depth_pass, GLenum writemask)
+{
+    glGetIntegerv(func, &face->func);
+    glGetIntegerv(ref, &face->ref);
+    glGetIntegerv(value_mask, &face->value_mask);
+    glGetIntegerv(fail, &face->fail);
+    glGetIntegerv(depth_fail, &face->depth_fail);
+    glGetIntegerv(depth_pass, &face->depth_pass);
+    glGetIntegerv(writemask, &face->writemask);
+}
+
+static
+void smaa_stencil_face_restore(SMAAStencilFace *face, GLenum which)
+{
+    glStencilFuncSeparate(which, face->func, face->ref, face->value_mask);
+    glStencilOpSeparate(which, face->fail, face->depth_fail, face->depth_pass);
+    glStencilMaskSeparate(which, face->writemask);
+}
+
+static
+int smaa_stencil_face_same(const SMAAStencilFace *a, const SMAAStencilFace *b)
+{
+    return !memcmp(a, b, sizeof(*a));
+}
+
+internal
+void smaa_state_save_compute(SMAAState *state)
+{
+    state->compute_saved = 1;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_BINDING, &state->storage_buffer);
+    glGetIntegeri_v(GL_SHADER_STORAGE_BUFFER_BINDING, 0, &state->storage_binding);
+    glGetIntegerv(GL_DISPATCH_INDIRECT_BUFFER_BINDING, &state->indirect_buffer);
+    glGetIntegeri_v(GL_IMAGE_BINDING_NAME, 0, &state->image_name);
+    glGetIntegeri_v(GL_IMAGE_BINDING_LEVEL, 0, &state->image_level);
+    glGetIntegeri_v(GL_IMAGE_BINDING_LAYERED, 0, &state->image_layered);
+    glGetIntegeri_v(GL_IMAGE_BINDING_LAYER, 0, &state->image_layer);
+    glGetIntegeri_v(GL_IMAGE_BINDING_ACCESS, 0, &state->image_access);
+    glGetIntegeri_v(GL_IMAGE_BINDING_FORMAT, 0, &state->image_format);
+}
+
+static
+void smaa_state_restore_compute(SMAAState *state)
+{
+    // Ranges bound with glBindBufferRange are restored as whole buffers
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, state->storage_binding);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, state->storage_buffer);
+    glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, state->indirect_buffer);
+    glBindImageTexture(0, state->image_name, state->image_level, state->image_layered,
+		       state->image_layer, state->image_access, state->image_format);
+}
+
+static
+void smaa_state_read(SMAAState *state)
+{
+    glGetIntegerv(GL_VIEWPORT, state->viewport);
+    glGetIntegerv(GL_SCISSOR_BOX, state->scissor_box);
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &state->vao);
+    glGetIntegerv(GL_CURRENT_PROGRAM, &state->program);
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &state->texture);
+    glGetIntegerv(GL_DEPTH_TEST, &state->depth);
+    glGetFloatv(GL_COLOR_CLEAR_VALUE, state->clear_color);
+    glGetIntegerv(GL_BLEND, &state->blending);
+    glGetIntegerv(GL_CULL_FACE, &state->cull);
+    glGetIntegerv(GL_FRAMEBUFFER_SRGB, &state->srgb);
+    glGetIntegerv(GL_STENCIL_TEST, &state->stencil);
+    glGetIntegerv(GL_SCISSOR_TEST, &state->scissor);
+    glGetIntegerv(GL_STENCIL_CLEAR_VALUE, &state->clear_stencil);
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &state->draw_fbo);
+    glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &state->read_fbo);
+
+    smaa_stencil_face_save(&state->stencil_front, GL_STENCIL_FUNC, GL_STENCIL_REF,
+			   GL_STENCIL_VALUE_MASK, GL_STENCIL_FAIL, GL_STENCIL_PASS_DEPTH_FAIL,
+			   GL_STENCIL_PASS_DEPTH_PASS, GL_STENCIL_WRITEMASK);
+    smaa_stencil_face_save(&state->stencil_back, GL_STENCIL_BACK_FUNC, GL_STENCIL_BACK_REF,
+			   GL_STENCIL_BACK_VALUE_MASK, GL_STENCIL_BACK_FAIL,
+			   GL_STENCIL_BACK_PASS_DEPTH_FAIL, GL_STENCIL_BACK_PASS_DEPTH_PASS,
+			   GL_STENCIL_BACK_WRITEMASK);
+
+    for(int i = 0; i < 3; i++) {
+	glActiveTexture(GL_TEXTURE0 + i);
+	glGetIntegerv(GL_TEXTURE_BINDING_2D, &state->textures[i]);
+    }
+
+    glActiveTexture(state->texture);
+}
+
+internal
+void smaa_state_save(SMAAState *state)
+{
+    StateShadow *shadow = state_current;
+
+    if(state_trusted(shadow)) {
+	*state = shadow->state;
+    } else {
+	smaa_state_read(state);
+	if(shadow && !__atomic_load_n(&state_bypassed, __ATOMIC_RELAXED)) {
+	    shadow->state = *state;
+	    shadow->known = 1;
+	}
+    }
+
+    state->compute_saved = 0;
+}
+
+static
+void smaa_state_set_cap(GLenum cap, GLint enabled)
+{
+    if(enabled) {
+	glEnable(cap);
+    } else {
+	glDisable(cap);
+    }
+}
+
+// Restores everything in state that differs from current
+static
+void smaa_state_restore_changed(SMAAState *state, const SMAAState *current)
+{
+    if(memcmp(state->viewport, current->viewport, sizeof(state->viewport))) {
+	glViewport(state->viewport[0], state->viewport[1], state->viewport[2], state->viewport[3]);
+    }
+    if(memcmp(state->scissor_box, current->scissor_box, sizeof(state->scissor_box))) {
+	glScissor(state->scissor_box[0], state->scissor_box[1], state->scissor_box[2], state->scissor_box[3]);
+    }
+    if(state->vao != current->vao) {
+	glBindVertexArray(state->vao);
+    }
+    if(state->program != current->program) {
+	glUseProgram(state->program);
+    }
+    if(state->draw_fbo != current->draw_fbo) {
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, state->draw_fbo);
+    }
+    if(state->read_fbo != current->read_fbo) {
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, state->read_fbo);
+    }
+    if(state->depth != current->depth) {
+	smaa_state_set_cap(GL_DEPTH_TEST, state->depth);
+    }
+    if(state->blending != current->blending) {
+	smaa_state_set_cap(GL_BLEND, state->blending);
+    }
+    if(state->cull != current->cull) {
+	smaa_state_set_cap(GL_CULL_FACE, state->cull);
+    }
+    if(state->srgb != current->srgb) {
+	smaa_state_set_cap(GL_FRAMEBUFFER_SRGB, state->srgb);
+    }
+    if(state->stencil != current->stencil) {
+	smaa_state_set_cap(GL_STENCIL_TEST, state->stencil);
+    }
+    if(state->scissor != current->scissor) {
+	smaa_state_set_cap(GL_SCISSOR_TEST, state->scissor);
+    }
+    if(memcmp(state->clear_color, current->clear_color, sizeof(state->clear_color))) {
+	glClearColor(state->clear_color[0], state->clear_color[1],
+		     state->clear_color[2], state->clear_color[3]);
+    }
+    if(state->clear_stencil != current->clear_stencil) {
+	glClearStencil(state->clear_stencil);
+    }
+    if(!smaa_stencil_face_same(&state->stencil_front, &current->stencil_front)) {
+	smaa_stencil_face_restore(&state->stencil_front, GL_FRONT);
+    }
+    if(!smaa_stencil_face_same(&state->stencil_back, &current->stencil_back)) {
+	smaa_stencil_face_restore(&state->stencil_back, GL_BACK);
+    }
+
+    for(int i = 0; i < 3; i++) {
+	if(state->textures[i] != current->textures[i]) {
+	    glActiveTexture(GL_TEXTURE0 + i);
+	    glBindTexture(GL_TEXTURE_2D, state->textures[i]);
+	}
+    }
+    if(state->texture != current->texture) {
+	glActiveTexture(state->texture);
+    }
+}
+
+static
+void smaa_state_restore_all(SMAAState *state)
+{
+    glViewport(state->viewport[0], state->viewport[1], state->viewport[2], state->viewport[3]);
+    glScissor(state->scissor_box[0], state->scissor_box[1], state->scissor_box[2], state->scissor_box[3]);
+    glBindVertexArray(state->vao);
+    glUseProgram(state->program);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, state->draw_fbo);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, state->read_fbo);
+    smaa_state_set_cap(GL_DEPTH_TEST, state->depth);
+    glClearColor(state->clear_color[0], state->clear_color[1],
+		 state->clear_color[2], state->clear_color[3]);
+    smaa_state_set_cap(GL_BLEND, state->blending);
+    smaa_state_set_cap(GL_CULL_FACE, state->cull);
+    for(int i = 0; i < 3; i++) {
+	glActiveTexture(GL_TEXTURE0 + i);
+	glBindTexture(GL_TEXTURE_2D, state->textures[i]);
+    }
+    glActiveTexture(state->texture);
+    smaa_state_set_cap(GL_FRAMEBUFFER_SRGB, state->srgb);
+    smaa_state_set_cap(GL_STENCIL_TEST, state->stencil);
+    smaa_state_set_cap(GL_SCISSOR_TEST, state->scissor);
+    glClearStencil(state->clear_stencil);
+    smaa_stencil_face_restore(&state->stencil_front, GL_FRONT);
+    smaa_stencil_face_restore(&state->stencil_back, GL_BACK);
+}
+
+internal
+void smaa_state_restore(SMAAState *state)
+{
+    StateShadow *shadow = state_current;
+
+    // SMAA's own calls went through the wrappers too, so the shadow
+    // holds the state as SMAA left it.
+    if(state_trusted(shadow)) {
+	SMAAState current = shadow->state;
+	smaa_state_restore_changed(state, &current);
+    } else {
+	smaa_state_restore_all(state);
+    }
+
+    if(state->compute_saved) {
+	smaa_state_restore_compute(state);
+    }
+}
@@ -0,0 +1,35 @@
+#ifndef WITH_SMAA_STATE_H
+#define WITH_SMAA_STATE_H
+
+#include "smaa.h"
+
+// Saving and restoring the GL state SMAA touches. The shim wraps the
+// setters of that state and keeps a shadow copy per context, so saving
+// is a copy and restoring only issues calls for what SMAA changed.
+// Contexts the shim didn't see becoming current, and contexts after a
+// call the shadow can't follow (glPopAttrib, multi-bind, ...), are
+// read back with glGet* instead.
+
+internal void smaa_state_save(SMAAState *state);
+internal void smaa_state_restore(SMAAState *state);
+
+// Adds the bindings the compute backend changes. Those aren't tracked
+// and always read back.
+internal void smaa_state_save_compute(SMAAState *state);
+
+// Called by the shim after a context was made current or destroyed
+internal void smaa_state_make_current(void *context);
+internal void smaa_state_forget(void *context);
+
+// Changes whenever textures were deleted, after which names SMAA kept of
+// the application's textures may refer to new ones
+internal unsigned smaa_state_texture_deletions(void);
+
+// Called by the shim when it hands out name without wrapping it, so the
+// wrappers miss calls to it. From then on the state is always read back.
+internal void smaa_state_unwrapped(const char *name);
+
+// The implementation a wrapper forwards to, from shim.c
+internal void *shim_real_proc(const char *name);
+
+#endif
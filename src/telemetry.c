@@ -0,0 +1,136 @@
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smaa.h"
+
+internal
+void smaa_telemetry_init(SMAATelemetry *telemetry, int timer_query)
+{
+    telemetry->timer_query = timer_query;
+    telemetry->enabled = 0;
+    telemetry->current = -1;
+    telemetry->sink = 0;
+
+    const char *target = getenv("WITH_SMAA_TELEMETRY");
+    if(!target || !target[0]) {
+	return;
+    }
+    if(!timer_query) {
+	fprintf(stderr, "with_smaa: no timer queries, telemetry disabled\n");
+	return;
+    }
+    if(!smaa_exporter_start()) {
+	return;
+    }
+
+    glGenQueries(SMAA_TELEMETRY_FRAMES * (SMAA_PASS_COUNT + 1), &telemetry->queries[0][0]);
+    memset(telemetry->in_flight, 0, sizeof(telemetry->in_flight));
+    telemetry->frame = 0;
+    telemetry->enabled = 1;
+}
+
+internal
+int smaa_telemetry_capture(SMAATelemetry *telemetry,
+			   void (*sink)(void *data, const float *ms), void *data)
+{
+    if(!telemetry->timer_query) {
+	return 0;
+    }
+
+    if(!telemetry->enabled) {
+	glGenQueries(SMAA_TELEMETRY_FRAMES * (SMAA_PASS_COUNT + 1), &telemetry->queries[0][0]);
+	memset(telemetry->in_flight, 0, sizeof(telemetry->in_flight));
+	telemetry->frame = 0;
+	telemetry->enabled = 1;
+    }
+    telemetry->sink = sink;
+    telemetry->sink_data = data;
+    return 1;
+}
+
+static
+void telemetry_collect(SMAATelemetry *telemetry, int wait)
+{
+    // Oldest frame first, sinks may care about the order
+    for(int i = 0; i < SMAA_TELEMETRY_FRAMES; i++) {
+	int slot = (telemetry->frame + i) % SMAA_TELEMETRY_FRAMES;
+	if(!telemetry->in_flight[slot]) {
+	    continue;
+	}
+
+	// The last timestamp of a frame finishes after all the others
+	GLuint *queries = telemetry->queries[slot];
+	GLuint available = wait;
+	if(!wait) {
+	    glGetQueryObjectuiv(queries[SMAA_PASS_COUNT], GL_QUERY_RESULT_AVAILABLE, &available);
+	}
+	if(!available) {
+	    continue;
+	}
+
+	GLuint64 stamps[SMAA_PASS_COUNT + 1];
+	for(int i = 0; i <= SMAA_PASS_COUNT; i++) {
+	    glGetQueryObjectui64v(queries[i], GL_QUERY_RESULT, &stamps[i]);
+	}
+
+	float ms[SMAA_PASS_COUNT];
+	for(int pass = 0; pass < SMAA_PASS_COUNT; pass++) {
+	    ms[pass] = (stamps[pass + 1] - stamps[pass]) / 1000000.0f;
+	}
+	if(telemetry->sink) {
+	    telemetry->sink(telemetry->sink_data, ms);
+	} else {
+	    smaa_exporter_push(ms);
+	}
+
+	telemetry->in_flight[slot] = 0;
+    }
+}
+
+internal
+void smaa_telemetry_flush(SMAATelemetry *telemetry)
+{
+    if(telemetry->enabled) {
+	telemetry_collect(telemetry, 1);
+    }
+}
+
+internal
+void smaa_telemetry_begin(SMAATelemetry *telemetry)
+{
+    telemetry->current = -1;
+    if(!telemetry->enabled) {
+	return;
+    }
+
+    telemetry_collect(telemetry, 0);
+
+    int slot = telemetry->frame % SMAA_TELEMETRY_FRAMES;
+    if(telemetry->in_flight[slot]) {
+	// GPU is more than SMAA_TELEMETRY_FRAMES behind, don't wait for it
+	smaa_exporter_drop();
+	return;
+    }
+
+    glQueryCounter(telemetry->queries[slot][0], GL_TIMESTAMP);
+    telemetry->current = slot;
+}
+
+internal
+void smaa_telemetry_pass(SMAATelemetry *telemetry, int pass)
+{
+    int slot = telemetry->current;
+    if(slot < 0) {
+	return;
+    }
+
+    glQueryCounter(telemetry->queries[slot][pass + 1], GL_TIMESTAMP);
+
+    if(pass == SMAA_PASS_COUNT - 1) {
+	telemetry->in_flight[slot] = 1;
+	telemetry->frame++;
+	telemetry->current = -1;
+    }
+}
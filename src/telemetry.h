@@ -0,0 +1,47 @@
+#ifndef WITH_SMAA_TELEMETRY_H
+#define WITH_SMAA_TELEMETRY_H
+
+// Include smaa.h instead, which needs SMAATelemetry itself
+
+// Per-pass GPU timings. Every frame writes GL_TIMESTAMP queries between
+// the passes, which are read back once available a few frames later and
+// handed to the exporter, see exporter.h, so the render thread never
+// blocks on the GPU.
+
+#define SMAA_TELEMETRY_FRAMES 8
+
+typedef struct SMAATelemetry {
+    int timer_query;
+    int enabled;
+
+    // Receives the timings instead of the exporter, see
+    // smaa_telemetry_capture()
+    void (*sink)(void *data, const float *ms);
+    void *sink_data;
+
+    // One timestamp before the first pass and one after every pass
+    GLuint queries[SMAA_TELEMETRY_FRAMES][SMAA_PASS_COUNT + 1];
+    int in_flight[SMAA_TELEMETRY_FRAMES];
+    int frame;
+    // Frame slot in use, -1 if this frame isn't measured
+    int current;
+} SMAATelemetry;
+
+// Call with a current context
+internal void smaa_telemetry_init(SMAATelemetry *telemetry, int timer_query);
+
+// Hands the timings of every frame to sink, in ms per SMAA_PASS_*, on
+// the render thread. Returns 0 without timer queries.
+internal int smaa_telemetry_capture(SMAATelemetry *telemetry,
+				    void (*sink)(void *data, const float *ms), void *data);
+
+// Waits for all frames in flight and passes them to the sink
+internal void smaa_telemetry_flush(SMAATelemetry *telemetry);
+
+// Once per frame, before the first pass
+internal void smaa_telemetry_begin(SMAATelemetry *telemetry);
+
+// After each pass, in the order of SMAA_PASS_*
+internal void smaa_telemetry_pass(SMAATelemetry *telemetry, int pass);
+
+#endif
@@ -0,0 +1,175 @@
+// SA_RESTART is an XSI extension
+#define _XOPEN_SOURCE 600
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "smaa.h"
+#include "trace.h"
+
+#ifdef WITH_SMAA_TRACE
+
+typedef struct TraceEvent {
+    const char *name;
+    uint64_t start;
+    uint64_t duration;
+} TraceEvent;
+
+// The events of one thread, only written by that thread
+typedef struct TraceThread {
+    struct TraceThread *next;
+    int id;
+    // Events recorded so far, the last SMAA_TRACE_EVENTS are kept
+    unsigned count;
+    TraceEvent events[SMAA_TRACE_EVENTS];
+} TraceThread;
+
+static pthread_once_t trace_once = PTHREAD_ONCE_INIT;
+static int trace_enabled = 0;
+static char trace_path[4096];
+
+// Threads are pushed without locks and never removed
+static TraceThread *trace_threads = 0;
+static int trace_thread_count = 0;
+static __thread TraceThread *trace_thread;
+
+static volatile sig_atomic_t trace_requested = 0;
+static pthread_mutex_t trace_write_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static
+uint64_t trace_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Events recorded meanwhile by other threads may be torn
+static
+void trace_write()
+{
+    pthread_mutex_lock(&trace_write_mutex);
+
+    FILE *file = fopen(trace_path, "w");
+    if(!file) {
+	perror("with_smaa: cannot write the trace");
+	pthread_mutex_unlock(&trace_write_mutex);
+	return;
+    }
+
+    int pid = getpid();
+    unsigned written = 0;
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    for(TraceThread *thread = __atomic_load_n(&trace_threads, __ATOMIC_ACQUIRE);
+	thread; thread = thread->next) {
+	fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+		"\"args\":{\"name\":\"thread %d\"}}",
+		written ? ",\n" : "", pid, thread->id, thread->id);
+	written++;
+
+	unsigned count = __atomic_load_n(&thread->count, __ATOMIC_ACQUIRE);
+	unsigned first = count > SMAA_TRACE_EVENTS ? count - SMAA_TRACE_EVENTS : 0;
+	for(unsigned i = first; i < count; i++) {
+	    const TraceEvent *event = &thread->events[i % SMAA_TRACE_EVENTS];
+	    fprintf(file, ",\n{\"name\":\"%s\",\"cat\":\"with_smaa\",\"ph\":\"X\",\"ts\":%.3f,"
+		    "\"dur\":%.3f,\"pid\":%d,\"tid\":%d}",
+		    event->name, event->start / 1000.0, event->duration / 1000.0, pid, thread->id);
+	    written++;
+	}
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+
+    fprintf(stderr, "with_smaa: wrote %u trace events to %s\n", written, trace_path);
+    pthread_mutex_unlock(&trace_write_mutex);
+}
+
+static
+void trace_signal(int signal)
+{
+    (void)signal;
+    trace_requested = 1;
+}
+
+static
+void trace_init()
+{
+    const char *path = getenv("WITH_SMAA_TRACE");
+    if(!path || !path[0]) {
+	return;
+    }
+    snprintf(trace_path, sizeof(trace_path), "%s", path);
+    atexit(trace_write);
+
+    // Unless the game handles SIGUSR2 itself
+    struct sigaction action, previous;
+    sigaction(SIGUSR2, 0, &previous);
+    if(previous.sa_handler == SIG_DFL) {
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = trace_signal;
+	sigemptyset(&action.sa_mask);
+	action.sa_flags = SA_RESTART;
+	sigaction(SIGUSR2, &action, 0);
+	fprintf(stderr, "with_smaa: tracing to %s, at exit and on SIGUSR2\n", trace_path);
+    } else {
+	fprintf(stderr, "with_smaa: tracing to %s at exit, SIGUSR2 is taken\n", trace_path);
+    }
+
+    trace_enabled = 1;
+}
+
+internal
+SMAATraceScope smaa_trace_begin(const char *name)
+{
+    pthread_once(&trace_once, trace_init);
+    if(!trace_enabled) {
+	return (SMAATraceScope){ 0, 0 };
+    }
+    return (SMAATraceScope){ name, trace_now() };
+}
+
+internal
+void smaa_trace_end(SMAATraceScope *scope)
+{
+    if(!scope->name) {
+	return;
+    }
+    uint64_t end = trace_now();
+
+    TraceThread *thread = trace_thread;
+    if(!thread) {
+	thread = calloc(1, sizeof(TraceThread));
+	if(!thread) {
+	    return;
+	}
+	thread->id = __atomic_add_fetch(&trace_thread_count, 1, __ATOMIC_RELAXED);
+	thread->next = __atomic_load_n(&trace_threads, __ATOMIC_RELAXED);
+	while(!__atomic_compare_exchange_n(&trace_threads, &thread->next, thread, 1,
+					   __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+	trace_thread = thread;
+    }
+
+    unsigned count = thread->count;
+    TraceEvent *event = &thread->events[count % SMAA_TRACE_EVENTS];
+    event->name = scope->name;
+    event->start = scope->start;
+    event->duration = end - scope->start;
+    __atomic_store_n(&thread->count, count + 1, __ATOMIC_RELEASE);
+}
+
+internal
+void smaa_trace_poll(void)
+{
+    if(trace_requested) {
+	trace_requested = 0;
+	trace_write();
+    }
+}
+
+#endif
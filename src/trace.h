@@ -0,0 +1,46 @@
+#ifndef WITH_SMAA_TRACE_H
+#define WITH_SMAA_TRACE_H
+
+#include <stdint.h>
+
+// CPU time of the phases of a swap, to tell which one a latency spike
+// comes from. Only built with -DWITH_SMAA_TRACE (cmake -DWITH_SMAA_TRACE=ON),
+// otherwise SMAA_TRACE() compiles to nothing.
+//
+// SMAA_TRACE(name) records the time until the end of the enclosing
+// block. Events go to a ring of SMAA_TRACE_EVENTS per thread, written
+// without locks. Set WITH_SMAA_TRACE to a file to enable tracing: the
+// rings are written there as a Chrome trace (JSON, for chrome://tracing
+// or Perfetto) at exit, and at the next swap after a SIGUSR2.
+
+#define SMAA_TRACE_EVENTS 16384
+
+#ifdef WITH_SMAA_TRACE
+
+typedef struct SMAATraceScope {
+    // A string literal, 0 if tracing is disabled
+    const char *name;
+    uint64_t start;
+} SMAATraceScope;
+
+internal SMAATraceScope smaa_trace_begin(const char *name);
+internal void smaa_trace_end(SMAATraceScope *scope);
+
+// Once per swap, writes the trace if SIGUSR2 was received
+internal void smaa_trace_poll(void);
+
+#define SMAA_TRACE_LABEL(line) smaa_trace_scope_##line
+#define SMAA_TRACE_SCOPE(line) SMAA_TRACE_LABEL(line)
+#define SMAA_TRACE(name) \
+    SMAATraceScope SMAA_TRACE_SCOPE(__LINE__) \
+    __attribute__ ((cleanup(smaa_trace_end))) = smaa_trace_begin(name)
+#define SMAA_TRACE_POLL() smaa_trace_poll()
+
+#else
+
+#define SMAA_TRACE(name) do {} while(0)
+#define SMAA_TRACE_POLL() do {} while(0)
+
+#endif
+
+#endif
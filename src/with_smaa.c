@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
+#include <string.h>
 #include <errno.h>
 
 int main(int argc, char **argv)
@@ -11,7 +12,17 @@ int main(int argc, char **argv)
 	return 1;
     }
 
+    // Offline, see src/smaa_batch.c
+    if(!strcmp(argv[1], "--batch")) {
+	argv[1] = "smaa_batch";
+	execvp(argv[1], &argv[1]);
+	fprintf(stderr, "with_smaa: cannot run smaa_batch: %s\n", strerror(errno));
+	return 1;
+    }
+
     setenv("LD_PRELOAD", "libwith_smaa_shim.so", 1);
+    // Vulkan games get the implicit layer instead, see src/layer.c
+    setenv("ENABLE_WITH_SMAA", "1", 1);
 
     execvp(argv[1], &argv[1]);
 